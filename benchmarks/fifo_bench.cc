@@ -0,0 +1,126 @@
+/*******************************************************************
+ *  fifo_bench.cc - Compares the throughput of the tsemfifo and the
+ *  lock-free ring fifos.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+// Usage: fifo_bench [messages [depth]]
+//
+// Passes 'messages' integers from 1, 2 and 4 producer threads to one
+// consumer thread through a queue of 'depth' entries, with blocking
+// puts and gets, and prints the throughput of each queue type: the
+// tsemfifo, the mpsc_fifo, and (for one producer only) the
+// spsc_fifo.
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "matrix/tsemfifo.h"
+#include "matrix/ring_fifo.h"
+#include "matrix/Time.h"
+
+using namespace std;
+using namespace matrix;
+
+template <typename Q>
+static void run(string label, int producers, size_t messages, size_t depth)
+{
+    Q fifo(depth);
+    vector<thread> threads;
+    size_t per_producer = messages / producers;
+    size_t total = per_producer * producers;
+    uint64_t sum = 0, v = 0;
+
+    Time::Time_t t0 = Time::getUTC();
+
+    for (int i = 0; i < producers; ++i)
+    {
+        threads.push_back(thread([&fifo, per_producer]()
+        {
+            for (size_t j = 0; j < per_producer; ++j)
+            {
+                fifo.put((uint64_t)j);
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < total; ++i)
+    {
+        fifo.get(v);
+        sum += v;
+    }
+
+    Time::Time_t elapsed = Time::getUTC() - t0;
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+
+    if (sum != producers * (per_producer * (per_producer - 1) / 2))
+    {
+        cerr << label << ": checksum mismatch" << endl;
+    }
+
+    cout << setw(10) << label
+         << setw(3) << producers << " producer(s): "
+         << setw(8) << fixed << setprecision(1)
+         << (double)elapsed / total << " ns/item, "
+         << setw(10) << setprecision(0)
+         << total * 1e9 / elapsed << " items/s" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    size_t messages = argc > 1 ? strtoul(argv[1], NULL, 10) : 4000000;
+    size_t depth = argc > 2 ? strtoul(argv[2], NULL, 10) : 1024;
+    int producers[] = {1, 2, 4};
+
+    if (messages < 4 || depth == 0)
+    {
+        cerr << "messages must be at least 4 and depth greater than 0" << endl;
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(producers) / sizeof(int); ++i)
+    {
+        int p = producers[i];
+
+        run<tsemfifo<uint64_t> >("tsemfifo", p, messages, depth);
+        run<mpsc_fifo<uint64_t> >("mpsc_fifo", p, messages, depth);
+
+        if (p == 1)
+        {
+            run<spsc_fifo<uint64_t> >("spsc_fifo", p, messages, depth);
+        }
+    }
+
+    return 0;
+}
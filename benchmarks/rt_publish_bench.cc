@@ -0,0 +1,202 @@
+/*******************************************************************
+ *  rt_publish_bench.cc - Measures rtinproc publish latency while
+ *  other threads subscribe and unsubscribe.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+// Usage: rt_publish_bench [messages [churn_threads]]
+//
+// Publishes 'messages' doubles over an rtinproc DataSource to a
+// DataSink, timing each publish() call. This is done twice: once
+// with no other activity, and once while 'churn_threads' threads
+// repeatedly subscribe and unsubscribe RTTransportClients to the same
+// RTTransportServer. The min, median, 99th percentile and max
+// latencies of each run are printed.
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <yaml-cpp/yaml.h>
+
+#include "matrix/Keymaster.h"
+#include "matrix/DataInterface.h"
+#include "matrix/RTTransportClient.h"
+#include "matrix/Thread.h"
+#include "matrix/TCondition.h"
+#include "matrix/Time.h"
+
+using namespace std;
+using namespace matrix;
+
+static string km_urn("inproc://rt_publish_bench.keymaster");
+
+static string yaml_configuration =
+    "Keymaster:\n"\
+    "  URLS:\n"\
+    "    Initial:\n"\
+    "      - inproc://rt_publish_bench.keymaster\n"\
+    "\n"\
+    "components:\n"\
+    "  bench:\n"\
+    "    Transports:\n"\
+    "      A:\n"\
+    "        Specified: [rtinproc]\n"\
+    "    Sources:\n"\
+    "      data: A\n"\
+    "      churn: A\n";
+
+/**
+ * \class Churner
+ *
+ * Subscribes and unsubscribes an RTTransportClient to the
+ * benchmark's RTTransportServer as fast as it can, until told to
+ * stop. Each cycle forces the server to install a new subscriber
+ * table.
+ *
+ */
+
+class Churner
+{
+public:
+
+    Churner(string urn)
+        : _urn(urn),
+          _cycles(0),
+          _done(false),
+          _cb(this, &Churner::_data_handler),
+          _thread(this, &Churner::_churn_task)
+    {
+    }
+
+    void start()
+    {
+        _thread.start();
+    }
+
+    size_t stop()
+    {
+        _done.set_value(true);
+        _thread.stop_without_cancel();
+        return _cycles;
+    }
+
+private:
+
+    void _data_handler(string, void *, size_t)
+    {
+    }
+
+    void _churn_task()
+    {
+        bool done = false;
+
+        while (!done)
+        {
+            unique_ptr<RTTransportClient> tc(new RTTransportClient(_urn));
+            tc->connect(_urn);
+            tc->subscribe("bench.churn", &_cb);
+            tc.reset();
+            ++_cycles;
+            _done.get_value(done);
+        }
+    }
+
+    string _urn;
+    size_t _cycles;
+    TCondition<bool> _done;
+    DataMemberCB<Churner> _cb;
+    Thread<Churner> _thread;
+};
+
+static void report(string label, vector<Time::Time_t> &lat, size_t cycles)
+{
+    sort(lat.begin(), lat.end());
+    cout << label
+         << ": min " << lat.front()
+         << " ns, median " << lat[lat.size() / 2]
+         << " ns, p99 " << lat[(lat.size() * 99) / 100]
+         << " ns, max " << lat.back()
+         << " ns, subscribe/unsubscribe cycles " << cycles
+         << endl;
+}
+
+static void run(DataSource<double> &source, string urn,
+                size_t messages, int churn_threads, string label)
+{
+    vector<shared_ptr<Churner> > churners;
+    vector<Time::Time_t> lat(messages);
+    size_t cycles = 0;
+
+    for (int i = 0; i < churn_threads; ++i)
+    {
+        churners.push_back(shared_ptr<Churner>(new Churner(urn)));
+        churners.back()->start();
+    }
+
+    for (size_t i = 0; i < messages; ++i)
+    {
+        double d = (double)i;
+        Time::Time_t t0 = Time::getUTC();
+        source.publish(d);
+        lat[i] = Time::getUTC() - t0;
+    }
+
+    for (size_t i = 0; i < churners.size(); ++i)
+    {
+        cycles += churners[i]->stop();
+    }
+
+    report(label, lat, cycles);
+}
+
+int main(int argc, char **argv)
+{
+    size_t messages = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    int churn_threads = argc > 2 ? atoi(argv[2]) : 2;
+
+    if (messages == 0)
+    {
+        cerr << "messages must be greater than 0" << endl;
+        return 1;
+    }
+
+    YAML::Node config = YAML::Load(yaml_configuration);
+    KeymasterServer kms(config);
+    kms.run();
+
+    DataSource<double> source(km_urn, "bench", "data");
+    DataSink<double, select_only> sink(km_urn, 1000);
+    sink.connect("bench", "data");
+    string urn = sink.current_source_urn();
+
+    run(source, urn, messages, 0, "no churn");
+    run(source, urn, messages, churn_threads, "with churn");
+
+    sink.disconnect();
+    return 0;
+}
@@ -0,0 +1,600 @@
+/*******************************************************************
+ *  CaptureFile.cc - Writes and reads capture files, which record
+ *  a stream's messages with their arrival times.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#include "CaptureFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace matrix;
+using namespace capture;
+
+// Padding, written after anything not a multiple of ALIGN bytes long.
+static char const zeros[ALIGN] = {0};
+
+static FileRecorder::options without_rotation(FileRecorder::options opts)
+{
+    opts.rotate_bytes = 0;
+    opts.rotate_interval = 0;
+    return opts;
+}
+
+/**
+ * Constructor.
+ *
+ * @param filename: The capture file.
+ *
+ * @param opts: The options for the FileRecorder that writes it.
+ *
+ * @param index_interval: Every 'index_interval'th message is entered
+ * in the seek index.
+ *
+ */
+
+CaptureWriter::CaptureWriter(string filename, FileRecorder::options const &opts,
+                             size_t index_interval)
+    : _recorder(filename, without_rotation(opts)),
+      _index_interval(max((size_t)1, index_interval)),
+      _open(false),
+      _offset(0)
+{
+    memset(&_trailer, 0, sizeof _trailer);
+}
+
+/**
+ * Creates the file and writes its header.
+ *
+ * @param description: The stream's data description, as YAML text. May
+ * be empty.
+ *
+ * @return true on success. On failure `error()` says why.
+ *
+ */
+
+bool CaptureWriter::open(string description)
+{
+    file_header h = {MAGIC, VERSION, Time::getUTC(), description.size()};
+    struct iovec iov[3] =
+    {
+        {&h, sizeof h},
+        {(void *)description.data(), description.size()},
+        {(void *)zeros, aligned(description.size()) - description.size()}
+    };
+
+    if (!_recorder.open())
+    {
+        return false;
+    }
+
+    memset(&_trailer, 0, sizeof _trailer);
+    _keys.clear();
+    _index.clear();
+    _pending.clear();
+    _offset = sizeof h + aligned(description.size());
+    _open = true;
+    return _recorder.write(iov, 3);
+}
+
+void CaptureWriter::_queue(uint32_t type, Time::Time_t t, topic_id_t topic,
+                           void const *data, size_t size)
+{
+    pending p = {{type, 0, t, topic, size}, data};
+
+    _pending.push_back(p);
+    _offset += sizeof(record_header) + aligned(size);
+}
+
+/**
+ * Queues a message. The message is not written until `flush()`, and
+ * 'data' must remain valid until then.
+ *
+ * @param t: The message's arrival time.
+ *
+ * @param key: The message's key, "component.data".
+ *
+ * @param data: The message.
+ *
+ * @param size: The size of the message, in bytes.
+ *
+ */
+
+void CaptureWriter::add(Time::Time_t t, string const &key, void const *data, size_t size)
+{
+    topic_id_t topic = TopicRegistry::hash(key);
+    map<topic_id_t, string>::iterator k = _keys.find(topic);
+
+    if (k == _keys.end())
+    {
+        k = _keys.insert(make_pair(topic, key)).first;
+        _queue(KEY, t, topic, k->second.data(), k->second.size());
+    }
+
+    if (_trailer.num_messages % _index_interval == 0)
+    {
+        index_entry e = {t, _offset};
+        _index.push_back(e);
+    }
+
+    if (_trailer.num_messages++ == 0)
+    {
+        _trailer.first_time = t;
+    }
+
+    _trailer.last_time = t;
+    _queue(DATA, t, topic, data, size);
+}
+
+/**
+ * Writes everything queued by `add()`, with one write.
+ *
+ * @return true on success. On failure `error()` says why.
+ *
+ */
+
+bool CaptureWriter::flush()
+{
+    if (_pending.empty())
+    {
+        return true;
+    }
+
+    _iov.clear();
+
+    for (vector<pending>::iterator p = _pending.begin(); p != _pending.end(); ++p)
+    {
+        size_t size = p->header.size;
+        struct iovec h = {&p->header, sizeof(record_header)};
+        struct iovec d = {(void *)p->data, size};
+        struct iovec z = {(void *)zeros, aligned(size) - size};
+
+        _iov.push_back(h);
+
+        if (size)
+        {
+            _iov.push_back(d);
+        }
+
+        if (z.iov_len)
+        {
+            _iov.push_back(z);
+        }
+    }
+
+    bool rval = _recorder.write(_iov.data(), _iov.size());
+    _pending.clear();
+    return rval;
+}
+
+/**
+ * Writes any queued messages, then the keys, the seek index and the
+ * trailer, and closes the file.
+ *
+ * @return true on success. On failure `error()` says why.
+ *
+ */
+
+bool CaptureWriter::close()
+{
+    if (!_open)
+    {
+        return true;
+    }
+
+    _open = false;
+
+    if (!flush())
+    {
+        _recorder.close();
+        return false;
+    }
+
+    vector<key_entry> entries;
+
+    entries.reserve(_keys.size());
+    _iov.clear();
+    _trailer.keys_offset = _offset;
+    _trailer.num_keys = _keys.size();
+
+    for (map<topic_id_t, string>::iterator k = _keys.begin(); k != _keys.end(); ++k)
+    {
+        key_entry e = {k->first, k->second.size()};
+        entries.push_back(e);
+
+        struct iovec i[3] =
+        {
+            {&entries.back(), sizeof(key_entry)},
+            {(void *)k->second.data(), k->second.size()},
+            {(void *)zeros, aligned(k->second.size()) - k->second.size()}
+        };
+
+        _iov.insert(_iov.end(), i, i + 3);
+        _offset += sizeof(key_entry) + aligned(k->second.size());
+    }
+
+    _trailer.index_offset = _offset;
+    _trailer.num_index = _index.size();
+    _trailer.magic = TRAILER_MAGIC;
+    _trailer.version = VERSION;
+
+    struct iovec i[2] =
+    {
+        {_index.data(), _index.size() * sizeof(index_entry)},
+        {&_trailer, sizeof _trailer}
+    };
+
+    _iov.insert(_iov.end(), i, i + 2);
+
+    bool rval = _recorder.write(_iov.data(), _iov.size());
+    return _recorder.close() && rval;
+}
+
+/**
+ * Constructor. Nothing is read until `open()`.
+ *
+ * @param filename: The capture file.
+ *
+ */
+
+CaptureReader::CaptureReader(string filename)
+    : _filename(filename),
+      _fd(-1),
+      _base(nullptr),
+      _length(0),
+      _first(0),
+      _end(0),
+      _pos(0),
+      _indexed(false)
+{
+    memset(&_trailer, 0, sizeof _trailer);
+}
+
+CaptureReader::~CaptureReader()
+{
+    close();
+}
+
+bool CaptureReader::_fail(string what)
+{
+    _error = what + " " + _filename + (errno ? string(": ") + strerror(errno) : "");
+    close();
+    return false;
+}
+
+/**
+ * Maps the file and reads its header, keys and seek index. If the
+ * file has no valid trailer the index is rebuilt from the records.
+ *
+ * @return true on success. On failure `error()` says why.
+ *
+ */
+
+bool CaptureReader::open()
+{
+    struct stat st;
+
+    close();
+    _error.clear();
+
+    if ((_fd = ::open(_filename.c_str(), O_RDONLY | O_CLOEXEC)) == -1
+        || fstat(_fd, &st) == -1)
+    {
+        return _fail("opening");
+    }
+
+    _length = st.st_size;
+    errno = 0;
+
+    if (_length < sizeof(file_header))
+    {
+        return _fail("not a capture file:");
+    }
+
+    if ((_base = (unsigned char *)mmap(nullptr, _length, PROT_READ, MAP_SHARED,
+                                       _fd, 0)) == MAP_FAILED)
+    {
+        _base = nullptr;
+        return _fail("mapping");
+    }
+
+    madvise(_base, _length, MADV_SEQUENTIAL);
+
+    file_header const *h = (file_header const *)_base;
+
+    if (h->magic != MAGIC || h->version != VERSION
+        || h->description_size > _length - sizeof(file_header))
+    {
+        return _fail("not a capture file:");
+    }
+
+    _description.assign((char const *)(h + 1), h->description_size);
+    _first = sizeof(file_header) + aligned(h->description_size);
+
+    if (!_read_trailer())
+    {
+        _scan();
+    }
+
+    rewind();
+    return true;
+}
+
+/**
+ * Unmaps and closes the file.
+ *
+ */
+
+void CaptureReader::close()
+{
+    if (_base)
+    {
+        munmap(_base, _length);
+        _base = nullptr;
+    }
+
+    if (_fd != -1)
+    {
+        ::close(_fd);
+        _fd = -1;
+    }
+
+    _first = _end = _pos = 0;
+    _indexed = false;
+    _keys.clear();
+    _index.clear();
+    memset(&_trailer, 0, sizeof _trailer);
+}
+
+bool CaptureReader::_read_trailer()
+{
+    if (_length < _first + sizeof(trailer))
+    {
+        return false;
+    }
+
+    uint64_t end = _length - sizeof(trailer);
+    trailer const *t = (trailer const *)(_base + end);
+
+    if (t->magic != TRAILER_MAGIC || t->version != VERSION
+        || t->keys_offset < _first || t->keys_offset > t->index_offset
+        || t->index_offset > end
+        || t->num_index > (end - t->index_offset) / sizeof(index_entry))
+    {
+        return false;
+    }
+
+    uint64_t p = t->keys_offset;
+
+    for (uint64_t i = 0; i < t->num_keys; ++i)
+    {
+        key_entry const *k = (key_entry const *)(_base + p);
+
+        if (p + sizeof(key_entry) > t->index_offset
+            || k->size > t->index_offset - p - sizeof(key_entry))
+        {
+            _keys.clear();
+            return false;
+        }
+
+        _keys[k->topic].assign((char const *)(k + 1), k->size);
+        p += sizeof(key_entry) + aligned(k->size);
+    }
+
+    index_entry const *ix = (index_entry const *)(_base + t->index_offset);
+
+    for (uint64_t i = 0; i < t->num_index; ++i)
+    {
+        // seek() starts reading records at these.
+        if (ix[i].offset < _first || ix[i].offset >= t->keys_offset)
+        {
+            _keys.clear();
+            return false;
+        }
+    }
+
+    _index.assign(ix, ix + t->num_index);
+    _trailer = *t;
+    _end = t->keys_offset;
+    _indexed = true;
+    return true;
+}
+
+/**
+ * Walks the records to rebuild the keys and seek index of a file that
+ * has no trailer. Stops at the first incomplete record, or at the
+ * first that is no record at all: zeros, with a type of 0, where the
+ * recorder stopped writing.
+ *
+ */
+
+void CaptureReader::_scan()
+{
+    _end = _first;
+
+    while (_end + sizeof(record_header) <= _length)
+    {
+        record_header const *h = _record(_end);
+
+        if ((h->type != DATA && h->type != KEY)
+            || h->size > _length - _end - sizeof(record_header))
+        {
+            break;
+        }
+
+        if (h->type == KEY)
+        {
+            _keys[h->topic].assign((char const *)(h + 1), h->size);
+        }
+        else
+        {
+            if (_trailer.num_messages % INDEX_INTERVAL == 0)
+            {
+                index_entry e = {h->time, _end};
+                _index.push_back(e);
+            }
+
+            if (_trailer.num_messages++ == 0)
+            {
+                _trailer.first_time = h->time;
+            }
+
+            _trailer.last_time = h->time;
+        }
+
+        _end = min(_length, _end + sizeof(record_header) + aligned(h->size));
+    }
+}
+
+record_header const *CaptureReader::_record(uint64_t offset) const
+{
+    return (record_header const *)(_base + offset);
+}
+
+/**
+ * Returns the record at 'offset', or NULL if it runs past the end of
+ * the records, as in a corrupt file. `error()` then says where.
+ *
+ */
+
+record_header const *CaptureReader::_checked_record(uint64_t offset)
+{
+    record_header const *h = _record(offset);
+
+    if (offset + sizeof(record_header) > _end
+        || h->size > _end - offset - sizeof(record_header))
+    {
+        _error = "record at offset " + to_string(offset)
+            + " runs past the end of the data in " + _filename;
+        return nullptr;
+    }
+
+    return h;
+}
+
+/**
+ * Positions the reader at the first message.
+ *
+ */
+
+void CaptureReader::rewind()
+{
+    _pos = _first;
+}
+
+/**
+ * Positions the reader at the first message that arrived at or after
+ * 't', using the seek index to skip most of the file.
+ *
+ * @param t: The time to seek to.
+ *
+ */
+
+void CaptureReader::seek(Time::Time_t t)
+{
+    vector<index_entry>::iterator i =
+        upper_bound(_index.begin(), _index.end(), t,
+                    [](Time::Time_t t, index_entry const &e) { return t < e.time; });
+
+    _pos = i == _index.begin() ? _first : (i - 1)->offset;
+
+    while (_pos < _end)
+    {
+        record_header const *h = _checked_record(_pos);
+
+        if (h == nullptr)
+        {
+            _pos = _end;
+            break;
+        }
+
+        if (h->type == DATA && h->time >= t)
+        {
+            break;
+        }
+
+        _pos += sizeof(record_header) + aligned(h->size);
+    }
+}
+
+/**
+ * Returns the next message. The message's data points into the
+ * mapped file, and is valid until the reader is closed.
+ *
+ * @param m: Set to the next message.
+ *
+ * @return true if there was a message, false at the end of the file,
+ * or at a record that runs past it (see `error()`).
+ *
+ */
+
+bool CaptureReader::next(message &m)
+{
+    while (_pos < _end)
+    {
+        record_header const *h = _checked_record(_pos);
+
+        if (h == nullptr)
+        {
+            _pos = _end;
+            return false;
+        }
+
+        _pos += sizeof(record_header) + aligned(h->size);
+
+        if (h->type == DATA)
+        {
+            m.time = h->time;
+            m.topic = h->topic;
+            m.data = h + 1;
+            m.size = h->size;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Returns the key of a topic recorded in the file.
+ *
+ * @param topic: The topic ID.
+ *
+ * @return The key, or an empty string if there is no such topic.
+ *
+ */
+
+string CaptureReader::key(topic_id_t topic) const
+{
+    map<topic_id_t, string>::const_iterator k = _keys.find(topic);
+    return k == _keys.end() ? string() : k->second;
+}
@@ -0,0 +1,253 @@
+/*******************************************************************
+ *  CaptureFile.h - Declares the capture file format, and its
+ *  writer and reader.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#ifndef CaptureFile_h
+#define CaptureFile_h
+
+#include "matrix/Time.h"
+#include "matrix/TopicRegistry.h"
+#include "FileRecorder.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * The capture file format, used to record a stream with its timing so
+ * that it may be replayed faithfully.
+ *
+ * A capture file is a `file_header`, followed by the stream's
+ * `data_description` as YAML text (which may be empty), followed by
+ * records. Every record is a `record_header` followed by the payload,
+ * padded out to a multiple of `ALIGN` bytes. A record is either:
+ *
+ *   * `DATA`: one message. `time` is its arrival time, `topic` the
+ *     topic ID (see TopicRegistry) of its key.
+ *
+ *   * `KEY`: the key of `topic`, as the payload. Written once, before
+ *     the first message of that topic.
+ *
+ * No record type is 0, so that zeroed space, such as space reserved
+ * for the file but never written, is not mistaken for records.
+ *
+ * When the file is closed the keys and a sparse seek index are
+ * appended, followed by a fixed size `trailer` at the very end of the
+ * file. The index holds the time and file offset of every
+ * `index_interval`th message. A file without a valid trailer, as left
+ * by a recorder that did not exit cleanly, can still be read; the
+ * reader then rebuilds the index by scanning the records.
+ *
+ * All fields are in host byte order.
+ *
+ */
+
+namespace capture
+{
+    enum
+    {
+        MAGIC = 0x4643584d,         // "MXCF"
+        TRAILER_MAGIC = 0x4943584d, // "MXCI"
+        VERSION = 1,
+        ALIGN = 8,
+        // the default interval of the seek index, in messages, and the
+        // one used when an index is rebuilt.
+        INDEX_INTERVAL = 256
+    };
+
+    enum record_types
+    {
+        DATA = 1,
+        KEY = 2
+    };
+
+    struct file_header
+    {
+        uint32_t magic;
+        uint32_t version;
+        Time::Time_t created;
+        uint64_t description_size;
+    };
+
+    struct record_header
+    {
+        uint32_t type;
+        uint32_t reserved;
+        Time::Time_t time;
+        matrix::topic_id_t topic;
+        uint64_t size;              // the payload, without padding
+    };
+
+    struct index_entry
+    {
+        Time::Time_t time;
+        uint64_t offset;
+    };
+
+    // Each key is stored as a key_entry followed by the key, padded.
+    struct key_entry
+    {
+        matrix::topic_id_t topic;
+        uint64_t size;
+    };
+
+    struct trailer
+    {
+        uint64_t keys_offset;
+        uint64_t num_keys;
+        uint64_t index_offset;
+        uint64_t num_index;
+        uint64_t num_messages;
+        Time::Time_t first_time;
+        Time::Time_t last_time;
+        uint32_t magic;
+        uint32_t version;
+    };
+
+    inline uint64_t aligned(uint64_t n)
+    {
+        return (n + ALIGN - 1) & ~((uint64_t)ALIGN - 1);
+    }
+}
+
+/**
+ * \class CaptureWriter
+ *
+ * Writes a capture file through a FileRecorder. Messages are added
+ * with `add()`, which only queues them; `flush()` writes everything
+ * queued with one call. The data must remain valid until then.
+ * Rotation is turned off, as a capture is a single file.
+ *
+ */
+
+class CaptureWriter
+{
+public:
+
+    CaptureWriter(std::string filename,
+                  FileRecorder::options const &opts = FileRecorder::options(),
+                  size_t index_interval = capture::INDEX_INTERVAL);
+
+    bool open(std::string description = std::string());
+    void add(Time::Time_t t, std::string const &key, void const *data, size_t size);
+    bool flush();
+    bool close();
+
+    size_t num_messages() const { return _trailer.num_messages; }
+    std::string error() const { return _recorder.error(); }
+
+private:
+
+    void _queue(uint32_t type, Time::Time_t t, matrix::topic_id_t topic,
+                void const *data, size_t size);
+
+    FileRecorder _recorder;
+    size_t _index_interval;
+    bool _open;
+
+    capture::trailer _trailer;
+    std::map<matrix::topic_id_t, std::string> _keys;
+    std::vector<capture::index_entry> _index;
+
+    struct pending
+    {
+        capture::record_header header;
+        void const *data;
+    };
+
+    // the records add() has queued, and the offset the next will have.
+    std::vector<pending> _pending;
+    std::vector<struct iovec> _iov;
+    uint64_t _offset;
+};
+
+/**
+ * \class CaptureReader
+ *
+ * Reads a capture file. The file is memory mapped, and `next()`
+ * returns each message in place, without copying it.
+ *
+ */
+
+class CaptureReader
+{
+public:
+
+    struct message
+    {
+        Time::Time_t time;
+        matrix::topic_id_t topic;
+        void const *data;
+        size_t size;
+    };
+
+    CaptureReader(std::string filename);
+    ~CaptureReader();
+
+    bool open();
+    void close();
+
+    void rewind();
+    void seek(Time::Time_t t);
+    bool next(message &m);
+
+    std::string key(matrix::topic_id_t topic) const;
+    std::string description() const { return _description; }
+    Time::Time_t first_time() const { return _trailer.first_time; }
+    Time::Time_t last_time() const { return _trailer.last_time; }
+    size_t num_messages() const { return _trailer.num_messages; }
+    bool indexed() const { return _indexed; }
+    std::string error() const { return _error; }
+
+private:
+
+    bool _fail(std::string what);
+    bool _read_trailer();
+    void _scan();
+    capture::record_header const *_record(uint64_t offset) const;
+    capture::record_header const *_checked_record(uint64_t offset);
+
+    std::string _filename;
+    std::string _error;
+    int _fd;
+    unsigned char *_base;
+    uint64_t _length;
+
+    // the records lie in [_first, _end).
+    uint64_t _first;
+    uint64_t _end;
+    uint64_t _pos;
+
+    bool _indexed;
+    std::string _description;
+    capture::trailer _trailer;
+    std::map<matrix::topic_id_t, std::string> _keys;
+    std::vector<capture::index_entry> _index;
+};
+
+#endif
@@ -0,0 +1,247 @@
+/*******************************************************************
+ *  CapturePlayer.cc - Implementation of a Component which replays
+ *  a capture file with its recorded timing.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#include "CapturePlayer.h"
+#include "CaptureFile.h"
+
+#include "matrix/yaml_util.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace Time;
+using namespace mxutils;
+using namespace matrix;
+
+matrix::Component * CapturePlayer::factory(string name, string km_url)
+{
+    return new CapturePlayer(name, km_url);
+}
+
+CapturePlayer::CapturePlayer(string name, string km_url) :
+    FileDataSource(name, km_url),
+    speed(1.0),
+    start_offset(0),
+    key()
+{
+
+}
+
+CapturePlayer::~CapturePlayer()
+{
+}
+
+/**
+ * Sleeps until 'deadline', on the monotonic clock. Long waits are
+ * spent waiting on `_run`, so that a stop is not held up by a gap in
+ * the capture; the final stretch is slept precisely.
+ *
+ * @param deadline: The time to wake, from `getUTC(CLOCK_MONOTONIC)`.
+ *
+ * @return false if the component was stopped while waiting.
+ *
+ */
+
+bool CapturePlayer::_wait_until(Time_t deadline)
+{
+    Time_t now;
+
+    while ((now = getUTC(CLOCK_MONOTONIC)) + 2000000 < deadline)
+    {
+        // leave the last millisecond to clock_nanosleep().
+        Time_t usecs = min((deadline - now - 1000000) / 1000, (Time_t)1000000);
+
+        if (_run.wait(false, (int)usecs))
+        {
+            return false;
+        }
+    }
+
+    timespec ts;
+    time2timespec(deadline, ts);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+    return true;
+}
+
+void CapturePlayer::_reader_thread()
+{
+    CaptureReader reader(filename);
+
+    if (!reader.open())
+    {
+        cout << __PRETTY_FUNCTION__ << " " << reader.error() << endl;
+        disconnect();
+        _read_thread_started.signal(false);
+        return;
+    }
+
+    _read_thread_started.signal(true);
+
+    topic_id_t only = TopicRegistry::hash(key);
+    Time_t start = reader.first_time() + start_offset;
+    size_t published = 0;
+    size_t loop = 0;
+    bool run = true;
+
+    while (run)
+    {
+        CaptureReader::message m;
+        Time_t origin = getUTC(CLOCK_MONOTONIC);
+        size_t before = published;
+
+        reader.seek(start);
+
+        while (run && reader.next(m))
+        {
+            if (!key.empty() && m.topic != only)
+            {
+                continue;
+            }
+
+            if (!max_speed && m.time > start
+                && !_wait_until(origin + (Time_t)((m.time - start) / speed)))
+            {
+                break;
+            }
+
+            try
+            {
+                data_source.publish_bytes(m.data, m.size);
+                ++published;
+            }
+            catch (MatrixException e)
+            {
+                cout << __PRETTY_FUNCTION__ << e.what() << endl;
+                stop();
+                run = false;
+            }
+
+            if (run && (!max_speed || (published & 0xff) == 0))
+            {
+                _run.get_value(run);
+            }
+        }
+
+        _run.get_value(run);
+
+        // Nothing matched 'key' at or after 'start_seconds', and no
+        // pass ever will; looping would only spin.
+        if (run && published == before)
+        {
+            cout << __PRETTY_FUNCTION__ << " nothing to play from " << filename
+                 << " for the given key and start_seconds" << endl;
+            stop();
+            run = false;
+        }
+
+        if (run && loops && ++loop == loops)
+        {
+            cout << __PRETTY_FUNCTION__ << " published " << published
+                 << " messages from " << filename << endl;
+            stop();
+            run = false;
+        }
+    }
+}
+
+bool CapturePlayer::connect()
+{
+    yaml_result yr;
+
+    if (keymaster->get(my_full_instance_name + ".filename", yr))
+    {
+        filename = yr.node.as<string>();
+    }
+    else
+    {
+        cout << __PRETTY_FUNCTION__ << " Invalid configuration "
+        << " filename attribute is not present in config file" << endl;
+        return false;
+    }
+
+    speed = 1.0;
+    max_speed = false;
+    start_offset = 0;
+    loops = 1;
+    key.clear();
+
+    if (keymaster->get(my_full_instance_name + ".speed", yr))
+    {
+        speed = yr.node.as<double>();
+
+        if (speed <= 0.0)
+        {
+            cout << __PRETTY_FUNCTION__ << " Invalid configuration "
+                 << " speed must be greater than 0" << endl;
+            return false;
+        }
+    }
+
+    if (keymaster->get(my_full_instance_name + ".max_speed", yr))
+    {
+        max_speed = yr.node.as<bool>();
+    }
+
+    if (keymaster->get(my_full_instance_name + ".start_seconds", yr))
+    {
+        start_offset = (Time_t)(yr.node.as<double>() * TM_ONE_SEC);
+    }
+
+    if (keymaster->get(my_full_instance_name + ".loops", yr))
+    {
+        loops = yr.node.as<size_t>();
+    }
+
+    if (keymaster->get(my_full_instance_name + ".key", yr))
+    {
+        key = yr.node.as<string>();
+    }
+
+    CaptureReader reader(filename);
+
+    if (!reader.open())
+    {
+        cout << __PRETTY_FUNCTION__ << " " << reader.error() << endl;
+        return false;
+    }
+
+    if (reader.num_messages() == 0)
+    {
+        cout << __PRETTY_FUNCTION__ << " " << filename
+             << " contains no messages" << endl;
+        return false;
+    }
+
+    if (!reader.indexed())
+    {
+        cout << __PRETTY_FUNCTION__ << " " << filename
+             << " was not closed cleanly; its index was rebuilt" << endl;
+    }
+
+    return true;
+}
@@ -0,0 +1,73 @@
+/*******************************************************************
+ *  CapturePlayer.h - A FileDataSource which replays a capture
+ *  file with its recorded timing.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#ifndef CapturePlayer_h
+#define CapturePlayer_h
+
+#include "FileDataSource.h"
+
+/**
+ * \class CapturePlayer
+ *
+ * A FileDataSource that replays a capture file (see CaptureFile.h),
+ * publishing each message with the timing it was recorded with. The
+ * configuration is:
+ *
+ *     player:
+ *       filename: /data/capture.mxc
+ *       speed: 1.0          # 2.0 plays twice as fast as recorded
+ *       max_speed: false    # if true, ignore the timing altogether
+ *       start_seconds: 0    # start this far into the capture
+ *       loops: 1            # passes over the capture, 0 for no limit
+ *       key: comp.data      # only replay this key (default: all)
+ *
+ * Only 'filename' is required.
+ *
+ */
+
+class CapturePlayer : public FileDataSource
+{
+public:
+
+    static matrix::Component *factory(std::string, std::string);
+    virtual ~CapturePlayer();
+
+protected:
+    CapturePlayer(std::string name, std::string km_url);
+
+    virtual void _reader_thread();
+    virtual bool connect();
+
+    bool _wait_until(Time::Time_t deadline);
+
+    double speed;
+    Time::Time_t start_offset;
+    std::string key;
+};
+
+#endif
@@ -0,0 +1,146 @@
+/*******************************************************************
+ *  CaptureRecorder.cc - Implementation of a Component which records
+ *  a stream, with its timing, to a capture file.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#include "CaptureRecorder.h"
+#include "CaptureFile.h"
+
+#include "matrix/yaml_util.h"
+#include "matrix/ResourceLock.h"
+
+using namespace std;
+using namespace Time;
+using namespace mxutils;
+using namespace matrix;
+
+matrix::Component * CaptureRecorder::factory(string name, string km_url)
+{
+    return new CaptureRecorder(name, km_url);
+}
+
+CaptureRecorder::CaptureRecorder(string name, string km_url) :
+    FileDataSink(name, km_url),
+    key(),
+    description()
+{
+
+}
+
+CaptureRecorder::~CaptureRecorder()
+{
+}
+
+void CaptureRecorder::_writer_thread()
+{
+    CaptureWriter writer(filename, recorder_options);
+
+    _write_thread_started.signal(true);
+
+    if (!writer.open(description))
+    {
+        cout << __PRETTY_FUNCTION__ << " " << writer.error() << endl;
+        stop();
+        return;
+    }
+
+    ResourceLock fd_holder([&writer]()
+                           {
+                               if (!writer.close())
+                               {
+                                   cout << __PRETTY_FUNCTION__ << " "
+                                        << writer.error() << endl;
+                               }
+
+                               cout << "closed capture file, "
+                                    << writer.num_messages() << " messages" << endl;
+                           } );
+
+    bool run = true;
+    buffers.resize(BATCH_SIZE);
+
+    while (run)
+    {
+        try
+        {
+            size_t n = data_sink.get_batch(buffers.begin(), buffers.size(),
+                                           100000000);
+            Time_t now = getUTC();
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                writer.add(now, key, buffers[i].data(), buffers[i].size());
+            }
+
+            if (!writer.flush())
+            {
+                cout << __PRETTY_FUNCTION__ << " " << writer.error() << endl;
+                stop();
+                break;
+            }
+        }
+        catch (MatrixException e)
+        {
+            cout << __PRETTY_FUNCTION__ << e.what() << endl;
+            stop();
+        }
+        _run.get_value(run);
+    }
+}
+
+bool CaptureRecorder::connect()
+{
+    if (!FileDataSink::connect())
+    {
+        return false;
+    }
+
+    yaml_result yr;
+    ConnectionKey q(current_mode, my_instance_name, "data_sink");
+
+    if (find_data_connection(q))
+    {
+        key = std::get<0>(q) + "." + std::get<1>(q);
+    }
+
+    description.clear();
+
+    if (keymaster->get(my_full_instance_name + ".description", yr))
+    {
+        string path = "stream_descriptions." + yr.node.as<string>();
+
+        if (!keymaster->get(path, yr))
+        {
+            cout << __PRETTY_FUNCTION__ << " Invalid configuration "
+                 << path << " is not present in config file" << endl;
+            return false;
+        }
+
+        description = YAML::Dump(yr.node);
+    }
+
+    return true;
+}
@@ -0,0 +1,73 @@
+/*******************************************************************
+ *  CaptureRecorder.h - A FileDataSink which records a stream, with
+ *  its timing, to a capture file.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#ifndef CaptureRecorder_h
+#define CaptureRecorder_h
+
+#include "FileDataSink.h"
+
+/**
+ * \class CaptureRecorder
+ *
+ * A FileDataSink that records its input stream as a capture file (see
+ * CaptureFile.h): every message is framed with its arrival time and
+ * key, and a seek index is written when recording stops. It is
+ * configured as a FileDataSink, plus an optional 'description', the
+ * name of the stream's entry under 'stream_descriptions', which is
+ * then embedded in the file:
+ *
+ *     recorder:
+ *       filename: /data/capture.mxc
+ *       description: spectrometer_data
+ *       recorder:
+ *         direct: true
+ *
+ * The arrival time of a message is the time the recorder took it from
+ * its sink. Messages that arrive while the recorder is busy writing
+ * are taken together, and share a time.
+ *
+ */
+
+class CaptureRecorder : public FileDataSink
+{
+public:
+
+    static matrix::Component *factory(std::string, std::string);
+    virtual ~CaptureRecorder();
+
+protected:
+    CaptureRecorder(std::string name, std::string km_url);
+
+    virtual void _writer_thread();
+    virtual bool connect();
+
+    std::string key;
+    std::string description;
+};
+
+#endif
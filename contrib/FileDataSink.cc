@@ -84,39 +84,53 @@ FileDataSink::~FileDataSink()
 
 void FileDataSink::_writer_thread()
 {
-    FILE *fout;
+    FileRecorder recorder(filename, recorder_options);
 
     _write_thread_started.signal(true);
 
-    fout = fopen(filename.c_str(), "w+");
-    if (!fout)
+    if (!recorder.open())
     {
-        cout << __PRETTY_FUNCTION__ << " unable to open file " << filename << endl;
+        cout << __PRETTY_FUNCTION__ << " " << recorder.error() << endl;
         stop();
+        return;
     }
 
-    ResourceLock fd_holder([&fout]()
+    ResourceLock fd_holder([&recorder]()
                            {
+                               if (!recorder.close())
+                               {
+                                   cout << __PRETTY_FUNCTION__ << " "
+                                        << recorder.error() << endl;
+                               }
+
                                cout << "closed FileWriter file" << endl;
-                               fclose(fout);
-                               fout = nullptr;
                            } );
 
     bool run = true;
-    int nbytes;
-    buffer.reset( new matrix::GenericBuffer() );
-    // buffer->resize(blocksize);
-    
+    struct iovec iov[BATCH_SIZE];
+    buffers.resize(BATCH_SIZE);
+
     while (run)
     {
         try
         {
-            data_sink.get(*buffer);
-            nbytes = fwrite(buffer->data(), buffer->size(), 1, fout);
-            if (nbytes != buffer->size())
+            // Take everything that is waiting, up to BATCH_SIZE
+            // buffers, waiting at most 100 mS so that _run is checked.
+            size_t n = data_sink.get_batch(buffers.begin(), buffers.size(),
+                                           100000000);
+
+            for (size_t i = 0; i < n; ++i)
+            {
+                iov[i].iov_base = buffers[i].data();
+                iov[i].iov_len = buffers[i].size();
+            }
+
+            // The whole batch is written with one call.
+            if (n && !recorder.write(iov, n))
             {
-                cout << __PRETTY_FUNCTION__ << " wrote " << nbytes
-                << " needed to write " << buffer->size() << endl;
+                cout << __PRETTY_FUNCTION__ << " " << recorder.error() << endl;
+                stop();
+                break;
             }
         }
         catch (MatrixException e)
@@ -144,6 +158,14 @@ bool FileDataSink::connect()
         return false;
     }
 
+    // The recorder options are optional.
+    recorder_options = FileRecorder::options();
+
+    if (keymaster->get(my_full_instance_name + ".recorder", yr))
+    {
+        recorder_options = FileRecorder::options(yr.node);
+    }
+
     try
     {
         if (!connect_sink(data_sink, "data_sink"))
@@ -33,6 +33,7 @@
 #include "matrix/DataInterface.h"
 #include "matrix/DataSource.h"
 #include "matrix/DataSink.h"
+#include "FileRecorder.h"
 
 /**
  * \class FileDataSink
@@ -41,6 +42,12 @@
  * factor (i.e how much data per publish). There is no limit on file
  * size.
  *
+ * The data is written by a FileRecorder, a batch of buffers at a
+ * time. The recorder is configured by the optional 'recorder' map
+ * under the component's configuration (see
+ * `FileRecorder::options`), which allows direct I/O, preallocation,
+ * file rotation and periodic syncs to be turned on.
+ *
  */
 
 class FileDataSink : public matrix::Component
@@ -53,15 +60,15 @@ public:
 protected:
     FileDataSink(std::string name, std::string km_url);
 
-    // Run file reader
-    void _writer_thread();
+    // Run file writer
+    virtual void _writer_thread();
 
     // override various base class methods
     virtual bool _do_start();
     virtual bool _do_stop();
     virtual bool _stop();
 
-    bool connect();
+    virtual bool connect();
     bool disconnect();
 
     matrix::DataSink<matrix::GenericBuffer> data_sink;
@@ -70,10 +77,14 @@ protected:
     matrix::TCondition<bool> _write_thread_started;
     matrix::TCondition<bool> _run;
 
-    std::unique_ptr<matrix::GenericBuffer> buffer;
+    // The most buffers taken from the sink, and written, at once.
+    enum { BATCH_SIZE = 64 };
+
+    std::vector<matrix::GenericBuffer> buffers;
 
     size_t blocksize;
     std::string filename;
+    FileRecorder::options recorder_options;
 
 };
 
@@ -39,6 +39,8 @@
 #include <sched.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "matrix/yaml_util.h"
@@ -72,7 +74,9 @@ FileDataSource::FileDataSource(string name, string km_url) :
     _run(true),
     blocksize(0),
     filename(),
-    repeat_continuously(true)
+    loops(0),
+    max_speed(false),
+    period(1000000.0)
 {
 
 }
@@ -83,59 +87,117 @@ FileDataSource::~FileDataSource()
 {
 }
 
+/**
+ * Adds 'ns' nanoseconds to a timespec.
+ *
+ */
+
+static void add_ns(timespec &ts, long long ns)
+{
+    ns += ts.tv_nsec;
+    ts.tv_sec += ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+}
+
 void FileDataSource::_reader_thread()
 {
-    FILE *fin;
-    fin = fopen(filename.c_str(), "r");
-    if (!fin)
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    unsigned char *base;
+
+    if (fd == -1 || fstat(fd, &st) == -1
+        || (base = (unsigned char *)mmap(nullptr, st.st_size, PROT_READ,
+                                         MAP_SHARED, fd, 0)) == MAP_FAILED)
     {
-        cout << __PRETTY_FUNCTION__ << " unable to open file " << filename << endl;
+        cout << __PRETTY_FUNCTION__ << " unable to map file " << filename << endl;
         cout << strerror(errno) << endl;
+
+        if (fd != -1)
+        {
+            close(fd);
+        }
+
         disconnect();
         _read_thread_started.signal(false);
         return; // TODO: not sure what to do here
     }
-    ResourceLock fd_holder([&fin]()
+
+    size_t length = st.st_size;
+    ResourceLock fd_holder([fd, base, length]()
                            {
                                cout << "closed FileReader file" << endl;
-                               fclose(fin);
-                               fin = nullptr;
+                               munmap(base, length);
+                               close(fd);
                            } );
     _read_thread_started.signal(true);
 
+    madvise(base, length, MADV_SEQUENTIAL);
+
+    size_t blocks = length / blocksize;
+    size_t published = 0;
+    size_t advised = 0;
+    size_t loop = 0;
     bool run = true;
-    int nbytes;
 
-    buffer.reset( new matrix::GenericBuffer() );
-    buffer->resize(blocksize);
+    // Messages are paced against absolute deadlines, so that time
+    // spent publishing does not accumulate as drift.
+    timespec next;
+    double owed = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &next);
 
-    timespec delay = {5, 0}; // 1 msec
     while (run)
     {
-        clock_nanosleep(CLOCK_REALTIME, 0, &delay, nullptr);
-        nbytes = fread(buffer->data(), blocksize, 1, fin);
-        if (nbytes > 0)
+        for (size_t i = 0; i < blocks && run; ++i)
         {
+            size_t offset = i * blocksize;
+
+            // Keep a window ahead of the block being published
+            // requested, so it is read in before it is needed.
+            while (advised < length && offset + blocksize + READAHEAD > advised)
+            {
+                madvise(base + advised, min((size_t)READAHEAD, length - advised),
+                        MADV_WILLNEED);
+                advised += READAHEAD;
+            }
+
+            if (!max_speed)
+            {
+                owed += period;
+                add_ns(next, (long long)owed);
+                owed -= (long long)owed;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+            }
+
             try
             {
-                data_source.publish(*buffer);
+                data_source.publish_bytes(base + offset, blocksize);
+                ++published;
             }
             catch (MatrixException e)
             {
                 cout << __PRETTY_FUNCTION__ << e.what() << endl;
                 stop();
+                run = false;
+            }
+
+            // At full speed the condition's mutex is only taken every
+            // so often.
+            if (run && (!max_speed || (published & 0xff) == 0))
+            {
+                _run.get_value(run);
             }
         }
-        else if (feof(fin) && repeat_continuously)
-        {
-            rewind(fin);
-        }
-        else
+
+        advised = 0;
+
+        if (run && loops && ++loop == loops)
         {
-            cout << __PRETTY_FUNCTION__ << " error on input file (too small perhaps?)" << endl;
+            cout << __PRETTY_FUNCTION__ << " published " << published
+                 << " messages in " << loops << " passes over "
+                 << filename << endl;
             stop();
+            run = false;
         }
-        _run.get_value(run);
     }
 }
 
@@ -183,6 +245,34 @@ bool FileDataSource::connect()
         cout << __PRETTY_FUNCTION__ << " file size is not multiple of blocksize -- some data will be skipped"
              << endl;
     }
+
+    // Replay options. With no rate given the default is 1000
+    // messages per second.
+    loops = 0;
+    max_speed = false;
+    period = 1000000.0;
+
+    if (keymaster->get(my_full_instance_name + ".loops", yr))
+    {
+        loops = yr.node.as<size_t>();
+    }
+
+    if (keymaster->get(my_full_instance_name + ".max_speed", yr))
+    {
+        max_speed = yr.node.as<bool>();
+    }
+
+    if (keymaster->get(my_full_instance_name + ".messages_per_second", yr)
+        && yr.node.as<double>() > 0.0)
+    {
+        period = 1e9 / yr.node.as<double>();
+    }
+    else if (keymaster->get(my_full_instance_name + ".bytes_per_second", yr)
+             && yr.node.as<double>() > 0.0)
+    {
+        period = 1e9 * blocksize / yr.node.as<double>();
+    }
+
     return true;
 }
 
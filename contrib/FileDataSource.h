@@ -43,6 +43,17 @@
  * size is not an exact muliple of the blocking factor, some data
  * will be ignored at the end of the file.
  *
+ * The file is memory mapped, and each block is published straight
+ * from the mapping. Besides 'filename' and 'message_size' the
+ * component's configuration may give:
+ *
+ *     messages_per_second: 1000   # publish rate, or
+ *     bytes_per_second: 1.0e9     # publish rate in bytes
+ *     max_speed: false            # if true, publish as fast as possible
+ *     loops: 0                    # passes over the file, 0 for no limit
+ *
+ * The default is 1000 messages per second, repeated continuously.
+ *
  */
 
 class FileDataSource : public matrix::Component
@@ -56,14 +67,14 @@ protected:
     FileDataSource(std::string name, std::string km_url);
 
     // Run file reader
-    void _reader_thread();
+    virtual void _reader_thread();
 
     // override various base class methods
     virtual bool _do_start();
     virtual bool _do_stop();
     virtual bool _stop();
 
-    bool connect();
+    virtual bool connect();
     bool disconnect();
 
     matrix::DataSource<matrix::GenericBuffer> data_source;
@@ -72,11 +83,15 @@ protected:
     matrix::TCondition<bool> _read_thread_started;
     matrix::TCondition<bool> _run;
 
-    std::unique_ptr<matrix::GenericBuffer> buffer;
+    // The readahead window requested ahead of the block being published.
+    enum { READAHEAD = 16 << 20 };
 
     size_t blocksize;
     std::string filename;
-    bool repeat_continuously;
+    size_t loops;
+    bool max_speed;
+    // The time between messages, in nanoseconds.
+    double period;
 
 };
 
@@ -0,0 +1,574 @@
+/*******************************************************************
+ *  FileRecorder.cc - Writes blocks of data to disk with large,
+ *  batched, optionally direct writes.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#include "FileRecorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * The default options: buffered writes, 8 MB staging (only used with
+ * `direct`), 1 GB preallocation, one file, no forced syncs.
+ *
+ */
+
+FileRecorder::options::options()
+    : direct(false),
+      staging_bytes(8 << 20),
+      preallocate_bytes(1 << 30),
+      rotate_bytes(0),
+      rotate_interval(0),
+      sync_bytes(0),
+      sync_interval(0)
+{
+}
+
+/**
+ * Reads the options from a YAML map, for example a component's
+ * 'recorder' configuration:
+ *
+ *      recorder:
+ *        direct: true
+ *        staging_bytes: 16777216
+ *        preallocate_bytes: 4294967296
+ *        rotate_bytes: 0
+ *        rotate_seconds: 600
+ *        sync_bytes: 1073741824
+ *        sync_seconds: 0
+ *
+ * Any option not given keeps its default.
+ *
+ * @param n: The YAML map.
+ *
+ */
+
+FileRecorder::options::options(YAML::Node n)
+    : options()
+{
+    if (!n.IsMap())
+    {
+        return;
+    }
+
+    if (n["direct"])
+    {
+        direct = n["direct"].as<bool>();
+    }
+
+    if (n["staging_bytes"])
+    {
+        staging_bytes = n["staging_bytes"].as<size_t>();
+    }
+
+    if (n["preallocate_bytes"])
+    {
+        preallocate_bytes = n["preallocate_bytes"].as<size_t>();
+    }
+
+    if (n["rotate_bytes"])
+    {
+        rotate_bytes = n["rotate_bytes"].as<size_t>();
+    }
+
+    if (n["rotate_seconds"])
+    {
+        rotate_interval = (Time::Time_t)(n["rotate_seconds"].as<double>() * Time::TM_ONE_SEC);
+    }
+
+    if (n["sync_bytes"])
+    {
+        sync_bytes = n["sync_bytes"].as<size_t>();
+    }
+
+    if (n["sync_seconds"])
+    {
+        sync_interval = (Time::Time_t)(n["sync_seconds"].as<double>() * Time::TM_ONE_SEC);
+    }
+}
+
+/**
+ * Constructor. Nothing is opened until `open()`.
+ *
+ * @param filename: The file to write, or the base name of the files if
+ * they are rotated.
+ *
+ * @param opts: The recorder options.
+ *
+ */
+
+FileRecorder::FileRecorder(string filename, options const &opts)
+    : _filename(filename),
+      _opts(opts),
+      _fd(-1),
+      _file_number(0),
+      _staging(nullptr),
+      _staged(0),
+      _in_file(0),
+      _allocated(0),
+      _unsynced(0),
+      _total(0),
+      _opened(0),
+      _synced(0)
+{
+    if (_opts.direct)
+    {
+        // whole pages, at least one.
+        _opts.staging_bytes = max((size_t)ALIGNMENT,
+                                  _opts.staging_bytes / ALIGNMENT * ALIGNMENT);
+    }
+}
+
+FileRecorder::~FileRecorder()
+{
+    close();
+    free(_staging);
+}
+
+bool FileRecorder::_fail(string what)
+{
+    _error = what + " " + _current + ": " + strerror(errno);
+    return false;
+}
+
+/**
+ * Opens the first file.
+ *
+ * @return true on success. On failure `error()` says why.
+ *
+ */
+
+bool FileRecorder::open()
+{
+    if (_opts.direct && !_staging
+        && posix_memalign((void **)&_staging, ALIGNMENT, _opts.staging_bytes) != 0)
+    {
+        _staging = nullptr;
+        return _fail("allocating staging buffer for");
+    }
+
+    _file_number = 0;
+    return _open_next();
+}
+
+bool FileRecorder::_open_next()
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    if (_opts.direct)
+    {
+        flags |= O_DIRECT;
+    }
+
+    _current = _filename;
+
+    if (_opts.rotate_bytes || _opts.rotate_interval)
+    {
+        _current += "." + to_string(_file_number);
+    }
+
+    ++_file_number;
+
+    if ((_fd = ::open(_current.c_str(), flags, 0644)) == -1)
+    {
+        return _fail("opening");
+    }
+
+    _staged = 0;
+    _in_file = 0;
+    _allocated = 0;
+    _unsynced = 0;
+    _opened = _synced = Time::getUTC();
+    return true;
+}
+
+/**
+ * Writes out any staged data and closes the current file. Space
+ * reserved beyond the data is given back to the file system.
+ *
+ * @return true on success.
+ *
+ */
+
+bool FileRecorder::close()
+{
+    bool rval = true;
+
+    if (_fd == -1)
+    {
+        return true;
+    }
+
+    if (_staged)
+    {
+        // the tail is not a whole number of pages, so it is written
+        // through the page cache.
+        int flags = fcntl(_fd, F_GETFL);
+        fcntl(_fd, F_SETFL, flags & ~O_DIRECT);
+        size_t n = _staged;
+        _staged = 0;
+        rval = _write_fully(_staging, n);
+    }
+
+    if (_allocated > _in_file)
+    {
+        // Truncating to the size the file already has frees the
+        // blocks beyond it. (Punching a hole there would not: ext4,
+        // for one, ignores holes past the end of the file.) Best
+        // effort; the data is unaffected either way.
+        if (ftruncate(_fd, _in_file) == -1)
+        {
+            cerr << "FileRecorder: cannot release the space reserved for "
+                 << _current << ": " << strerror(errno) << endl;
+        }
+
+        _allocated = 0;
+    }
+
+    if (::close(_fd) == -1 && rval)
+    {
+        rval = _fail("closing");
+    }
+
+    _fd = -1;
+    return rval;
+}
+
+/**
+ * Forces the data written so far to the device, including, with
+ * `direct`, what is still in the staging buffer.
+ *
+ * @return true on success.
+ *
+ */
+
+bool FileRecorder::sync()
+{
+    _unsynced = 0;
+    _synced = Time::getUTC();
+
+    if (_fd == -1)
+    {
+        return true;
+    }
+
+    if (_staged && !_sync_staged())
+    {
+        return false;
+    }
+
+    if (fdatasync(_fd) == -1)
+    {
+        return _fail("syncing");
+    }
+
+    return true;
+}
+
+/**
+ * Writes the partly filled staging buffer where it will go once it
+ * fills, padded out to whole pages, and cuts the file back to the
+ * data, as `close()` does. The buffer stays staged: the next full
+ * write of it overwrites the padding. Only used with `direct`.
+ *
+ */
+
+bool FileRecorder::_sync_staged()
+{
+    size_t padded = (_staged + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    off_t at = _in_file - _staged;
+
+    memset(_staging + _staged, 0, padded - _staged);
+
+    for (size_t done = 0; done < padded;)
+    {
+        ssize_t w = pwrite(_fd, _staging + done, padded - done, at + done);
+
+        if (w == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return _fail("writing");
+        }
+
+        done += w;
+    }
+
+    if (ftruncate(_fd, _in_file) == -1)
+    {
+        return _fail("truncating");
+    }
+
+    // truncating released what was reserved beyond the data.
+    _allocated = min(_allocated, _in_file);
+    return true;
+}
+
+/**
+ * Makes sure space is allocated for 'n' more bytes, reserving it a
+ * `preallocate_bytes` chunk at a time. A file system that cannot
+ * preallocate simply allocates as the data is written.
+ *
+ */
+
+bool FileRecorder::_reserve(size_t n)
+{
+    if (_opts.preallocate_bytes == 0 || _in_file + n <= _allocated)
+    {
+        return true;
+    }
+
+    size_t len = max(_opts.preallocate_bytes, _in_file + n - _allocated);
+
+    if (fallocate(_fd, FALLOC_FL_KEEP_SIZE, _allocated, len) == 0)
+    {
+        _allocated += len;
+    }
+    else
+    {
+        // not supported here; don't try again.
+        _opts.preallocate_bytes = 0;
+    }
+
+    return true;
+}
+
+bool FileRecorder::_write_fully(char const *data, size_t n)
+{
+    while (n)
+    {
+        ssize_t w = ::write(_fd, data, n);
+
+        if (w == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return _fail("writing");
+        }
+
+        data += w;
+        n -= w;
+    }
+
+    return true;
+}
+
+/**
+ * Calls `writev()` until all 'n' bytes described by 'iov' are
+ * written. 'iov' is modified.
+ *
+ */
+
+bool FileRecorder::_writev_fully(struct iovec *iov, int iovcnt, size_t n)
+{
+    while (n)
+    {
+        ssize_t w = ::writev(_fd, iov, min(iovcnt, IOV_MAX));
+
+        if (w == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return _fail("writing");
+        }
+
+        n -= w;
+
+        // skip what was written.
+        while (iovcnt && (size_t)w >= iov->iov_len)
+        {
+            w -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+
+        if (iovcnt)
+        {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Copies data into the staging buffer, writing the buffer out each
+ * time it fills. Only used with `direct`.
+ *
+ */
+
+bool FileRecorder::_stage(char const *data, size_t n)
+{
+    while (n)
+    {
+        size_t c = min(n, _opts.staging_bytes - _staged);
+
+        memcpy(_staging + _staged, data, c);
+        _staged += c;
+        data += c;
+        n -= c;
+
+        if (_staged == _opts.staging_bytes)
+        {
+            _staged = 0;
+
+            if (!_write_fully(_staging, _opts.staging_bytes))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool FileRecorder::_maybe_sync_or_rotate()
+{
+    Time::Time_t now = 0;
+
+    if (_opts.sync_interval || _opts.rotate_interval)
+    {
+        now = Time::getUTC();
+    }
+
+    if ((_opts.rotate_bytes && _in_file >= _opts.rotate_bytes)
+        || (_opts.rotate_interval && now - _opened >= _opts.rotate_interval))
+    {
+        return close() && _open_next();
+    }
+
+    if ((_opts.sync_bytes && _unsynced >= _opts.sync_bytes)
+        || (_opts.sync_interval && now - _synced >= _opts.sync_interval))
+    {
+        return sync();
+    }
+
+    return true;
+}
+
+/**
+ * Writes a batch of blocks. The batch always goes to one file; if the
+ * file is then due to be rotated or synced, that is done before
+ * returning.
+ *
+ * @param iov: The blocks.
+ * @param iovcnt: The number of blocks.
+ *
+ * @return true on success. On failure `error()` says why.
+ *
+ */
+
+bool FileRecorder::write(struct iovec const *iov, size_t iovcnt)
+{
+    size_t n = 0;
+    bool rval;
+
+    if (_fd == -1)
+    {
+        errno = EBADF;
+        return _fail("writing");
+    }
+
+    for (size_t i = 0; i < iovcnt; ++i)
+    {
+        n += iov[i].iov_len;
+    }
+
+    _reserve(n);
+
+    if (_opts.direct)
+    {
+        rval = true;
+
+        for (size_t i = 0; i < iovcnt && rval; ++i)
+        {
+            rval = _stage((char const *)iov[i].iov_base, iov[i].iov_len);
+        }
+    }
+    else
+    {
+        struct iovec local[IOV_MAX];
+        size_t done = 0;
+
+        rval = true;
+
+        // writev() takes at most IOV_MAX blocks at a time.
+        while (done < iovcnt && rval)
+        {
+            int c = (int)min(iovcnt - done, (size_t)IOV_MAX);
+            size_t bytes = 0;
+
+            for (int i = 0; i < c; ++i)
+            {
+                local[i] = iov[done + i];
+                bytes += local[i].iov_len;
+            }
+
+            rval = _writev_fully(local, c, bytes);
+            done += c;
+        }
+    }
+
+    if (!rval)
+    {
+        return false;
+    }
+
+    _in_file += n;
+    _unsynced += n;
+    _total += n;
+    return _maybe_sync_or_rotate();
+}
+
+/**
+ * Writes a single block.
+ *
+ */
+
+bool FileRecorder::write(void const *data, size_t n)
+{
+    struct iovec iov = {(void *)data, n};
+    return write(&iov, 1);
+}
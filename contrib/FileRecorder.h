@@ -0,0 +1,141 @@
+/*******************************************************************
+ *  FileRecorder.h - Declares FileRecorder, which writes blocks of
+ *  data to disk at high rates.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#ifndef FileRecorder_h
+#define FileRecorder_h
+
+#include "matrix/Time.h"
+
+#include <string>
+#include <sys/uio.h>
+#include <yaml-cpp/yaml.h>
+
+/**
+ * \class FileRecorder
+ *
+ * Writes a stream of data blocks to disk at high rates. Blocks are
+ * handed over in batches, as an iovec array, and written with as few
+ * and as large system calls as possible:
+ *
+ *   * Normally a batch is written with one `writev()`, straight from
+ *     the caller's buffers.
+ *
+ *   * With `direct` set the file is opened O_DIRECT, bypassing the
+ *     page cache. Data is copied into an aligned staging buffer, which
+ *     is written whenever it fills. The unaligned remainder is written
+ *     when the file is closed.
+ *
+ * Space is reserved with `fallocate()` ahead of the data, in
+ * `preallocate_bytes` chunks, so that the file system can lay the
+ * file out contiguously. The file size only ever reflects the data
+ * written, and what is reserved beyond it is released again when the
+ * file is closed.
+ *
+ * The recorder can move on to a new file once the current one holds
+ * `rotate_bytes` bytes or is `rotate_interval` old, always between
+ * batches. Rotated files are named `<filename>.<n>`, n counting from 0.
+ * Without rotation the file is just `<filename>`. Data may be forced
+ * to the device with `fdatasync()` every `sync_bytes` bytes or
+ * `sync_interval` nanoseconds; with `direct` the staged remainder is
+ * written out, page padded, for this, and the file cut back to the
+ * data.
+ *
+ * All sizes are in bytes and all intervals in nanoseconds. A 0 turns
+ * the feature off.
+ *
+ */
+
+class FileRecorder
+{
+public:
+
+    struct options
+    {
+        options();
+        options(YAML::Node n);
+
+        bool direct;
+        size_t staging_bytes;
+        size_t preallocate_bytes;
+        size_t rotate_bytes;
+        Time::Time_t rotate_interval;
+        size_t sync_bytes;
+        Time::Time_t sync_interval;
+    };
+
+    enum
+    {
+        ALIGNMENT = 4096
+    };
+
+    FileRecorder(std::string filename, options const &opts = options());
+    virtual ~FileRecorder();
+
+    bool open();
+    bool write(struct iovec const *iov, size_t iovcnt);
+    bool write(void const *data, size_t n);
+    bool sync();
+    bool close();
+
+    /// the file being written.
+    std::string current_file() const { return _current; }
+    /// bytes written to all files so far.
+    size_t bytes_written() const { return _total; }
+    /// the error that caused the last failure.
+    std::string error() const { return _error; }
+
+protected:
+
+    bool _open_next();
+    bool _fail(std::string what);
+    bool _write_fully(char const *data, size_t n);
+    bool _writev_fully(struct iovec *iov, int iovcnt, size_t n);
+    bool _stage(char const *data, size_t n);
+    bool _sync_staged();
+    bool _reserve(size_t n);
+    bool _maybe_sync_or_rotate();
+
+    std::string _filename;
+    std::string _current;
+    std::string _error;
+    options _opts;
+    int _fd;
+    size_t _file_number;
+
+    char *_staging;
+    size_t _staged;
+
+    size_t _in_file;
+    size_t _allocated;
+    size_t _unsynced;
+    size_t _total;
+    Time::Time_t _opened;
+    Time::Time_t _synced;
+};
+
+#endif
@@ -28,6 +28,7 @@
 #include <math.h>
 #include <cstdio>
 #include <exception>
+#include <algorithm>
 #include <cmath>
 #include "matrix/yaml_util.h"
 
@@ -92,18 +93,42 @@ void ExAccumulator::poll()
 {
     int ctr = 0;
     poll_thread_started.signal(true);
-    double avg, sum, sample;
-    int i;
+    double avg, sum;
+    vector<double> samples;
+    vector<double> averages;
+    size_t i, have = 0, used, decimate;
     while (1)
     {
-        sum = 0.0;
-        for (i=0; i<decimate_factor; ++i)
+        // Read as many samples as have arrived, up to
+        // AVERAGES_PER_BATCH averages' worth, and publish all the
+        // averages they make together. Samples left over are kept for
+        // the next pass.
+        decimate = decimate_factor;
+        samples.resize(decimate * AVERAGES_PER_BATCH);
+        if (have > samples.size())
         {
-            input_signal_sink.get(sample);
-            sum += sample;
+            have = 0;
         }
-        avg = sum/decimate_factor;
-        output_signal_source.publish(avg);
+        have += input_signal_sink.get_batch(samples.data() + have,
+                                            samples.size() - have, 1000000000);
+        used = have - have % decimate;
+        averages.clear();
+        for (i = 0; i < used; i += decimate)
+        {
+            sum = 0.0;
+            for (size_t j = i; j < i + decimate; ++j)
+            {
+                sum += samples[j];
+            }
+            avg = sum/decimate;
+            averages.push_back(avg);
+        }
+        if (!averages.empty())
+        {
+            output_signal_source.publish_batch(averages.data(), averages.size());
+        }
+        copy(samples.begin() + used, samples.begin() + have, samples.begin());
+        have -= used;
     }        
 }
 
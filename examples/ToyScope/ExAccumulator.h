@@ -71,6 +71,7 @@ protected:
     matrix::Thread<ExAccumulator>       poll_thread;
     matrix::TCondition<bool>            poll_thread_started;
     int decimate_factor;
+    enum { AVERAGES_PER_BATCH = 16 };
      
     
 };
@@ -118,8 +118,9 @@ void ExFFT::poll()
 {
     int ctr = 0;
     poll_thread_started.signal(true);
-    double data;
-    int i;
+    int i, n;
+    vector<double> datain(N);
+    vector<double> dataout(N);
     fftw_complex *in, *out;
     fftw_plan p;
     
@@ -131,12 +132,14 @@ void ExFFT::poll()
     while (1)
     {
         // spin until N values have been read
+        for (n=0; n<N; )
+        {
+            n += input_signal_sink.get_batch(datain.data() + n, N - n, 1000000000);
+        }
         for (i=0; i<N; ++i)
         {
-            double datain;
-            input_signal_sink.get(datain);
             // should probably generate both I/Q values ...
-            in[i][0] = datain;
+            in[i][0] = datain[i];
             in[i][1] = 0.0;
         }
         // perform the complex-complex FFT
@@ -144,9 +147,9 @@ void ExFFT::poll()
         for (i=0; i<N; ++i)
         {
             // calculate the power:
-            double dataout = out[i][0]*out[i][0] + out[i][1]*out[i][1];
-            output_signal_source.publish(dataout);
+            dataout[i] = out[i][0]*out[i][0] + out[i][1]*out[i][1];
         }
+        output_signal_source.publish_batch(dataout.data(), N);
         printf("fftcycle\n");            
     }
     
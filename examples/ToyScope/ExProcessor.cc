@@ -107,22 +107,33 @@ void ExProcessor::poll()
 {
     int ctr = 0;
     poll_thread_started.signal(true);
-    double data;
+    double data[BATCH_SIZE];
+    size_t i, n;
     
     while (1)
     {
+        // Take everything that has arrived, up to BATCH_SIZE samples,
+        // and pass it on as one message.
+        n = input_signal_sink.get_batch(data, BATCH_SIZE, 1000000000);
+
+        if (n == 0)
+        {
+            continue;
+        }
+
         switch (operation)
         {
             case NONE:
-                input_signal_sink.get(data);
-                output_signal_source.publish(data);
             break;
             case SQUARE:
-                input_signal_sink.get(data);
-                data = data*data;
-                output_signal_source.publish(data);
+                for (i = 0; i < n; ++i)
+                {
+                    data[i] = data[i]*data[i];
+                }
             break;
         }
+
+        output_signal_source.publish_batch(data, n);
     }
 }
 
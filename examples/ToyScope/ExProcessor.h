@@ -78,6 +78,7 @@ protected:
     matrix::TCondition<bool>            poll_thread_started;
     int operation;
     enum Operation { NONE, SQUARE }; 
+    enum { BATCH_SIZE = 1024 };
     
 };
 
@@ -113,47 +113,56 @@ ExSignalGenerator::~ExSignalGenerator()
 {
 }
 
-/// Reads 'decimation_factor samples, averages them, and outputs the average
-/// to a linux fifo. An external application reads and displays the result.
+/// Generates samples at 'rate' samples per second. The samples are
+/// published in blocks, about BLOCKS_PER_SEC of them per second, so
+/// that a high rate does not mean a high message rate.
 void ExSignalGenerator::poll()
 {
     int ctr = 0;
     poll_thread_started.signal(true);
-    double avg, sum, sample;
+    double sample;
     int i;
     double n;
     double s_per_c;
     float grc_sample;
+    vector<double> block;
     n = 0;
     while (1)
     {
-        Time_t delay = 1000000000 / static_cast<Time_t>(rate_factor);
+        int block_size = rate_factor > BLOCKS_PER_SEC ? rate_factor / BLOCKS_PER_SEC : 1;
+        Time_t delay = (1000000000 * static_cast<Time_t>(block_size))
+                       / static_cast<Time_t>(rate_factor);
         Time::thread_delay(delay);
         s_per_c = rate_factor / frequency;
-        switch (waveform_type)
+        block.resize(block_size);
+        for (i = 0; i < block_size; ++i)
         {
-            case TONE:
-                sample = amplitude * cos(n / s_per_c * M_PI);
-                n = n + 1.0;
-                break;
-            case NOISE:
-                sample = amplitude * static_cast<double>(rand()) / RAND_MAX;
-                break;
-            case DC:
-                sample = amplitude;
-                break;
-            default:
-                printf("unknown waveform?\n");
-                break;
+            switch (waveform_type)
+            {
+                case TONE:
+                    sample = amplitude * cos(n / s_per_c * M_PI);
+                    n = n + 1.0;
+                    break;
+                case NOISE:
+                    sample = amplitude * static_cast<double>(rand()) / RAND_MAX;
+                    break;
+                case DC:
+                    sample = amplitude;
+                    break;
+                default:
+                    printf("unknown waveform?\n");
+                    break;
+            }
+            block[i] = sample;
+
+            grc_sample = (float)sample;
+            grc_src.publish(grc_sample);
+
+            if (ctr++ % 512 == 0)
+                printf("SG: %f\n", sample);
         }
 
-        output_signal_source.publish(sample);
-
-        grc_sample = (float)sample;
-        grc_src.publish(grc_sample);
-
-        if (ctr++ % 512 == 0)
-            printf("SG: %f\n", sample);
+        output_signal_source.publish_batch(block.data(), block.size());
     }
 }
 
@@ -45,7 +45,7 @@
 ///
 /// Data Sinks (Inputs) - None
 /// Data Sources (Outputs):
-/// *  "wavedata" - a single double value
+/// *  "wavedata" - blocks of double values, published with publish_batch()
 ///
 class ExSignalGenerator : public matrix::Component
 {
@@ -83,6 +83,7 @@ protected:
     int rate_factor;
     
     enum WaveType {TONE, NOISE, DC};
+    enum { BLOCKS_PER_SEC = 100 };
      
     
 };
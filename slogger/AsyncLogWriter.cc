@@ -0,0 +1,284 @@
+
+#include "AsyncLogWriter.h"
+#include <iostream>
+#include "matrix/ThreadLock.h"
+
+using namespace std;
+using namespace matrix;
+
+/// how long the threads wait for work before checking whether to stop.
+static const Time::Time_t poll_interval = Time::TM_ONE_SEC / 10;
+
+AsyncLogWriter::AsyncLogWriter(YAML::Node dd, string hdr, string dir,
+                               size_t maxrows, size_t queue_size,
+                               int debug) :
+    ddyaml(dd),
+    header(hdr),
+    directory(dir),
+    max_rows_per_file(maxrows),
+    debuglevel(debug),
+    started(false),
+    threaded(false),
+    retry_at(0),
+    rows(BATCH_SIZE),
+    rows_in_file(0),
+    queue(queue_size),
+    retired(4),
+    max_queue_depth(0),
+    rows_written(0),
+    rows_dropped(0),
+    files(0),
+    sync_opens(0),
+    batches(0),
+    last_write_latency(0),
+    total_write_latency(0),
+    max_write_latency(0),
+    running(false),
+    writer(this, &AsyncLogWriter::writer_task),
+    opener(this, &AsyncLogWriter::opener_task)
+{
+    // throws if the description is bad.
+    current = make_logger();
+    datasize = current->log_datasize();
+}
+
+AsyncLogWriter::~AsyncLogWriter()
+{
+    stop();
+}
+
+shared_ptr<FITSLogger> AsyncLogWriter::make_logger()
+{
+    shared_ptr<FITSLogger> log(new FITSLogger(ddyaml, header, debuglevel));
+    log->set_directory(directory);
+    return log;
+}
+
+bool AsyncLogWriter::start(bool threads)
+{
+    if (started)
+    {
+        return true;
+    }
+
+    if (!current->is_log_open() && !current->open_log())
+    {
+        return false;
+    }
+
+    ++files;
+    rows_in_file = 0;
+    started = true;
+    threaded = threads;
+
+    if (threaded)
+    {
+        running.set_value(true);
+        writer.start("log_writer");
+        opener.start("log_opener");
+    }
+
+    return true;
+}
+
+void AsyncLogWriter::stop()
+{
+    shared_ptr<FITSLogger> old;
+
+    if (!started)
+    {
+        return;
+    }
+
+    started = false;
+
+    if (threaded)
+    {
+        running.set_value(false);
+        writer.stop_without_cancel();
+        opener.stop_without_cancel();
+    }
+    else
+    {
+        while (write_pending(0))
+        {
+        }
+    }
+
+    while (retired.try_get(old))
+    {
+        old->close();
+    }
+
+    if (next_log)
+    {
+        next_log->discard();
+        next_log.reset();
+    }
+
+    current->close();
+}
+
+size_t AsyncLogWriter::put(GenericBuffer const *rows, size_t n)
+{
+    size_t dropped = n - queue.try_put_n(rows, n);
+    size_t depth = queue.size();
+    size_t max = max_queue_depth;
+
+    while (depth > max && !max_queue_depth.compare_exchange_weak(max, depth))
+    {
+    }
+
+    rows_dropped += dropped;
+    return dropped;
+}
+
+AsyncLogWriter::metrics AsyncLogWriter::get_metrics()
+{
+    metrics m;
+    size_t b = batches;
+
+    m.queue_depth = queue.size();
+    m.max_queue_depth = max_queue_depth;
+    m.queue_capacity = queue.capacity();
+    m.rows_written = rows_written;
+    m.rows_dropped = rows_dropped;
+    m.files = files;
+    m.sync_opens = sync_opens;
+    m.last_write_latency = last_write_latency;
+    m.mean_write_latency = b ? total_write_latency / b : 0;
+    m.max_write_latency = max_write_latency;
+    return m;
+}
+
+/// Switches the writer to the next file. Called by the writer thread.
+void AsyncLogWriter::rotate()
+{
+    shared_ptr<FITSLogger> next;
+    ThreadLock<Mutex> l(next_mutex);
+
+    l.lock();
+    next.swap(next_log);
+    l.unlock();
+
+    if (!next || !next->activate_log())
+    {
+        // the opener has fallen behind, or failed: open one here.
+        if (next)
+        {
+            next->discard();
+        }
+
+        ++sync_opens;
+        next = make_logger();
+
+        if (!next->open_log())
+        {
+            cout << header << " could not open a new file, continuing with "
+                 << "the current one" << endl;
+            rows_in_file = 0;
+            return;
+        }
+    }
+
+    cout << header << " opening new file" << endl;
+    // the opener closes the old file. If it has several waiting
+    // already, the oldest is closed here instead, as it is dropped.
+    retired.put_no_block(std::move(current));
+    current = next;
+    rows_in_file = 0;
+    ++files;
+}
+
+size_t AsyncLogWriter::write_pending(Time::Time_t time_out)
+{
+    size_t n = queue.get_n(rows.begin(), rows.size(), time_out);
+
+    if (n == 0)
+    {
+        // quiet: don't leave rows in the logger's buffer.
+        current->flush();
+        return 0;
+    }
+
+    Time::Time_t t0 = Time::getUTC();
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        current->log_data(rows[i]);
+
+        if (++rows_in_file >= max_rows_per_file)
+        {
+            rotate();
+        }
+    }
+
+    Time::Time_t dt = Time::getUTC() - t0;
+    Time::Time_t max = max_write_latency;
+
+    while (dt > max && !max_write_latency.compare_exchange_weak(max, dt))
+    {
+    }
+
+    last_write_latency = dt;
+    total_write_latency += dt;
+    rows_written += n;
+    ++batches;
+    return n;
+}
+
+void AsyncLogWriter::service_files(Time::Time_t time_out)
+{
+    shared_ptr<FITSLogger> old;
+    bool need;
+    ThreadLock<Mutex> l(next_mutex);
+
+    l.lock();
+    need = !next_log;
+    l.unlock();
+
+    if (need && Time::getUTC() >= retry_at)
+    {
+        shared_ptr<FITSLogger> log = make_logger();
+
+        if (log->prepare_log())
+        {
+            l.lock();
+            next_log = log;
+            l.unlock();
+        }
+        else
+        {
+            // try again later; rotate() will open one if it must.
+            retry_at = Time::getUTC() + Time::TM_ONE_SEC;
+        }
+    }
+
+    if (retired.timed_get(old, time_out))
+    {
+        old->close();
+    }
+}
+
+void AsyncLogWriter::writer_task()
+{
+    bool run = true;
+
+    // stop only once the queue has been drained.
+    while (write_pending(poll_interval) || run)
+    {
+        running.get_value(run);
+    }
+}
+
+/// Closes retired files, and keeps the next file open and ready.
+void AsyncLogWriter::opener_task()
+{
+    bool run = true;
+
+    while (run)
+    {
+        service_files(poll_interval);
+        running.get_value(run);
+    }
+}
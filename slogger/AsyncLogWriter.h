@@ -0,0 +1,124 @@
+#ifndef AsyncLogWriter_h
+#define AsyncLogWriter_h
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "matrix/Mutex.h"
+#include "matrix/Thread.h"
+#include "matrix/TCondition.h"
+#include "matrix/Time.h"
+#include "matrix/tsemfifo.h"
+#include "FITSLogger.h"
+
+/// Logs rows to a series of FITS files from a writer thread of its own,
+/// fed by a bounded queue, so that a slow disk or a change of file never
+/// holds up the thread that drains the DataSink. If the queue is full
+/// the incoming rows are dropped and counted.
+///
+/// A second, background thread opens the next file (header and all)
+/// ahead of time, under a temporary name. When the current file reaches
+/// 'max_rows_per_file' rows the writer switches to the waiting file
+/// between two rows, renaming it to its time-based name, and hands the
+/// old file back to the background thread to be closed.
+///
+/// Alternatively, start(false) starts no threads, and the work is done
+/// by calling write_pending() and service_files() from a thread of the
+/// caller's. This is how one thread pool serves many streams (see
+/// MultiStreamLogger). Those calls must not be made by two threads at
+/// once.
+class AsyncLogWriter
+{
+public:
+
+    struct metrics
+    {
+        size_t queue_depth;                // rows waiting now
+        size_t max_queue_depth;            // most rows ever waiting
+        size_t queue_capacity;
+        size_t rows_written;
+        size_t rows_dropped;               // because the queue was full
+        size_t files;                      // files started
+        size_t sync_opens;                 // files the writer had to open itself
+        Time::Time_t last_write_latency;   // ns to write the last batch of rows
+        Time::Time_t mean_write_latency;
+        Time::Time_t max_write_latency;
+    };
+
+    AsyncLogWriter(YAML::Node ddyaml, std::string header, std::string directory,
+                   size_t max_rows_per_file, size_t queue_size = 4096,
+                   int debuglevel = 0);
+
+    /// stops the threads and closes the files.
+    virtual ~AsyncLogWriter();
+
+    /// opens the first file and, if 'threads', starts the threads.
+    bool start(bool threads = true);
+
+    /// writes out the queued rows, then stops the threads and closes the files.
+    void stop();
+
+    /// writes a batch of queued rows, waiting up to 'time_out' ns for
+    /// some. Returns the number written.
+    size_t write_pending(Time::Time_t time_out);
+
+    /// closes a retired file, waiting up to 'time_out' ns for one, and
+    /// opens the next file if it is not open yet.
+    void service_files(Time::Time_t time_out);
+
+    /// queues 'n' rows without blocking. Returns the number dropped.
+    size_t put(matrix::GenericBuffer const *rows, size_t n);
+
+    /// returns the size of a row. Buffers given to put() should be this size.
+    size_t log_datasize() { return datasize; }
+
+    metrics get_metrics();
+
+private:
+
+    enum { BATCH_SIZE = 64 };
+
+    std::shared_ptr<FITSLogger> make_logger();
+    void rotate();
+    void writer_task();
+    void opener_task();
+
+    YAML::Node ddyaml;
+    std::string header;
+    std::string directory;
+    size_t max_rows_per_file;
+    int debuglevel;
+    size_t datasize;
+    bool started;
+    bool threaded;
+    Time::Time_t retry_at;      // when to next try to open the next file
+    std::vector<matrix::GenericBuffer> rows;
+
+    // only touched by the writer thread once started.
+    std::shared_ptr<FITSLogger> current;
+    size_t rows_in_file;
+
+    // the pre-opened next file, if the opener has made it yet.
+    std::shared_ptr<FITSLogger> next_log;
+    matrix::Mutex next_mutex;
+
+    matrix::tsemfifo<matrix::GenericBuffer> queue;
+    matrix::tsemfifo<std::shared_ptr<FITSLogger> > retired;
+
+    std::atomic<size_t> max_queue_depth;
+    std::atomic<size_t> rows_written;
+    std::atomic<size_t> rows_dropped;
+    std::atomic<size_t> files;
+    std::atomic<size_t> sync_opens;
+    std::atomic<size_t> batches;
+    std::atomic<Time::Time_t> last_write_latency;
+    std::atomic<Time::Time_t> total_write_latency;
+    std::atomic<Time::Time_t> max_write_latency;
+
+    matrix::TCondition<bool> running;
+    matrix::Thread<AsyncLogWriter> writer;
+    matrix::Thread<AsyncLogWriter> opener;
+};
+
+#endif
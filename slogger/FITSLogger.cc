@@ -5,6 +5,7 @@
 #include <sstream>
 #include <iostream>
 #include <sys/stat.h>
+#include <unistd.h>
 #include "matrix/make_path.h"
 #include <string.h>
 #include "matrix/Time.h"
@@ -23,8 +24,11 @@ union TimeBits
     double dmjd;
 };
 
-FITSLogger::FITSLogger(YAML::Node ystr, string hdr, int debuglevel) :
+FITSLogger::FITSLogger(YAML::Node ystr, string hdr, int debuglevel,
+                       size_t flushrows, Time::Time_t flushinterval) :
     ddesc(ystr),
+    buffered_rows(0),
+    first_buffered(0),
     mtx(),
     status(0),
     header(hdr),
@@ -32,7 +36,19 @@ FITSLogger::FITSLogger(YAML::Node ystr, string hdr, int debuglevel) :
     fout(nullptr)
 {
     debug = debuglevel;
-    (void)ddesc.size();
+    set_flush_threshold(flushrows, flushinterval);
+}
+
+/// Buffered rows are written once there are 'rows' of them, or the
+/// oldest has waited 'interval' nanoseconds. Any rows already buffered
+/// are written first.
+void FITSLogger::set_flush_threshold(size_t rows, Time::Time_t interval)
+{
+    flush();
+    flush_rows = rows > 0 ? rows : 1;
+    flush_interval = interval;
+    row_buf.resize(flush_rows * ddesc.size());
+    column_buf.resize(flush_rows);
 }
 
 FITSLogger::~FITSLogger()
@@ -125,6 +141,20 @@ static string get_type_code(data_description::types t, size_t n = 1)
     return tstr;
 }
 
+/// Formats time 't' for the DATE-OBS style keywords, and as a DMJD.
+static void time_keys(Time::Time_t t, char *dateobs, double &dmjd)
+{
+    uint32_t mjd;
+    int yr, month, day, hour, minute;
+    double sec;
+
+    Time::time2TimeStamp(t, mjd, dmjd);
+    dmjd = dmjd/86400000. + static_cast<double>(mjd);
+    Time::calendarDate(t, yr, month, day, hour, minute, sec);
+    sprintf(dateobs, "%d-%02d-%02dT%02d:%02d:%02d",
+            yr, month, day, hour, minute, (int) sec);
+}
+
 bool FITSLogger::create_header()
 {
     char keyname[10];
@@ -132,24 +162,15 @@ bool FITSLogger::create_header()
     char value[64];
     char dateobs[64];
     bool rtn = true;
-    uint32_t mjd;
     double theTime;
-    int yr, month, day, hour, minute;
-    double sec;
     long lzero = 0;
-    Time::Time_t t;
 
     // create a primary header
     fits_create_img(fout, 8, 0, 0, &status);
 
     // Write an M&C sampler style primary header.
 
-    t = Time::getUTC();
-    Time::time2TimeStamp(t, mjd, theTime);
-    theTime = theTime/86400000. + static_cast<double>(mjd);
-    Time::calendarDate(t, yr, month, day, hour, minute, sec);
-    sprintf(dateobs, "%d-%02d-%02dT%02d:%02d:%02d",
-            yr, month, day, hour, minute, (int) sec);
+    time_keys(Time::getUTC(), dateobs, theTime);
 
     strcpy(keyname, "ORIGIN");
     strcpy(comment, "");
@@ -215,7 +236,7 @@ bool FITSLogger::create_header()
     fits_update_key_dbl(fout, keyname, theTime, -15, comment, &status);
 
     // now create the binary table
-    int ncols = ddesc.fields.size();
+    int ncols = ddesc.num_fields();
     int extnum = 2;
     long nrows = 0;
     char **tnames, **tform, **tunit;
@@ -233,7 +254,7 @@ bool FITSLogger::create_header()
         memset(tunit[i], 0, 80);
     }
     int fits_cols = 0;
-    for (auto dd = ddesc.fields.begin(); dd != ddesc.fields.end(); ++dd)
+    for (auto dd = ddesc.fields().begin(); dd != ddesc.fields().end(); ++dd)
     {
         // omit any skipped fields
         if (dd->skip)
@@ -277,18 +298,102 @@ bool FITSLogger::is_log_open()
     return fout != nullptr;
 }
 
+/// The time-based name of a file started at 't' in 'dir', with a
+/// suffix if a file of that name exists already: files may change more
+/// often than once a second, and a stream may be restarted within one.
+static string free_log_name(string dir, Time::Time_t t)
+{
+    string base, name;
+
+    generate_log_filename(t, base);
+    name = base;
+
+    for (int i = 1; access((dir + "/" + name + ".fits").c_str(), F_OK) == 0; ++i)
+    {
+        name = base + "_" + to_string(i);
+    }
+
+    return name + ".fits";
+}
+
 bool FITSLogger::open_log()
 {
-    string name;
+    return set_file(free_log_name(directory_name, Time::getUTC()));
+}
+
+/// Creates the next log file, header and all, under a temporary name,
+/// so that the slow part of opening a file may be done ahead of time
+/// and on another thread. activate_log() then gives it its real name.
+bool FITSLogger::prepare_log()
+{
+    // the stream and the pid keep writers sharing the directory from
+    // taking each other's file. A leftover from a previous run would
+    // make the create fail.
+    string next_file = "." + header + "." + to_string(getpid()) + ".next.fits";
+
+    unlink((directory_name + "/" + next_file).c_str());
+    return set_file(next_file);
+}
+
+/// Renames a file made by prepare_log() to the usual time-based name,
+/// and sets the time keywords to now, when it starts being used.
+bool FITSLogger::activate_log()
+{
+    char keyname[10];
+    char comment[64];
+    char dateobs[64];
+    double dmjd;
     Time::Time_t now = Time::getUTC();
-    generate_log_filename(now, name);
-    return set_file(name + ".fits");
+    ThreadLock<Mutex> lck(mtx);
+
+    lck.lock();
+    string name = free_log_name(directory_name, now);
+
+    if (fout == nullptr
+        || rename((directory_name + "/" + file_name).c_str(),
+                  (directory_name + "/" + name).c_str()) != 0)
+    {
+        return false;
+    }
+
+    file_name = name;
+    time_keys(now, dateobs, dmjd);
+    fits_movabs_hdu(fout, 1, nullptr, &status);
+
+    strcpy(keyname, "DATEBLD");
+    strcpy(comment, "time at start of log file");
+    fits_update_key_str(fout, keyname, dateobs, comment, &status);
+
+    strcpy(keyname, "DATE-OBS");
+    fits_update_key_str(fout, keyname, dateobs, comment, &status);
+
+    strcpy(keyname, "UTSTART");
+    strcpy(comment, "DMJD of slogger start");
+    fits_update_key_dbl(fout, keyname, dmjd, -15, comment, &status);
+
+    fits_movabs_hdu(fout, 2, nullptr, &status);
+    return status == 0;
+}
+
+/// Closes and deletes the current file, e.g. one made by prepare_log()
+/// that was never used.
+void FITSLogger::discard()
+{
+    if (fout)
+    {
+        ThreadLock<Mutex> lck(mtx);
+        lck.lock();
+        buffered_rows = 0;
+        fits_delete_file(fout, &status);
+        fout = nullptr;
+    }
 }
 
 void FITSLogger::close()
 {
     if (fout)
     {
+        flush();
         ThreadLock<Mutex> lck(mtx);
         lck.lock();
         fits_close_file(fout, &status);
@@ -298,7 +403,7 @@ void FITSLogger::close()
 }
 
 
-/// Log a row of data
+/// Buffer a row of data, writing out the buffered rows when due
 bool FITSLogger::log_data(GenericBuffer &data)
 {
     // if the file isn't open, silently ignore the data.
@@ -307,111 +412,114 @@ bool FITSLogger::log_data(GenericBuffer &data)
         return false;
     }
 
+    size_t row_size = ddesc.size();
+    Time::Time_t now = Time::getUTC();
+
+    if (buffered_rows == 0)
+    {
+        first_buffered = now;
+    }
+
+    memcpy(row_buf.data() + buffered_rows * row_size, data.data(),
+           min(row_size, data.size()));
+    ++buffered_rows;
+
+    if (buffered_rows >= flush_rows || now - first_buffered >= flush_interval)
+    {
+        return flush();
+    }
+
+    return true;
+}
+
+/// Transposes column 'id' of the 'n' buffered rows into column_buf and
+/// writes it as 'n' rows of FITS column 'column', in one call.
+template <typename T>
+void FITSLogger::write_column(int fits_type, int column, size_t id, size_t n)
+{
+    T *p = (T *)column_buf.data();
+
+    ddesc.extract(id, row_buf.data(), n, p);
+    fits_write_col(fout, fits_type, column, (LONGLONG)cur_row + 1, 1LL,
+                   (LONGLONG)n, p, &status);
+}
+
+/// Write the buffered rows, a column at a time
+bool FITSLogger::flush()
+{
+    size_t n = buffered_rows;
+
+    if (fout == nullptr || n == 0)
+    {
+        return false;
+    }
+
     int columnNum = 1;
 
-    fits_insert_rows(fout, cur_row, 1, &status);
-    ++cur_row;
+    fits_insert_rows(fout, cur_row, n, &status);
 
-    for (auto z=ddesc.fields.begin(); z!=ddesc.fields.end(); )
+    for (size_t id = 0; id < ddesc.num_fields(); ++id)
     {
+        compiled_description::field const &z = ddesc[id];
+
         // skip over unused fields
-        if (z->skip)
+        if (z.skip)
         {
-            ++z;
             continue;
         }
-        switch (z->type)
+
+        switch (z.type)
         {
             case data_description::TIME_T:
             {
-                double dmjd;
-                Time::Time_t t;
+                // converted in place, each Time_t to its DMJD.
+                TimeBits *tb = (TimeBits *)column_buf.data();
 
-                t = get_data_buffer_value<Time::Time_t>(data.data(), z->offset);
-                dmjd = Time::DMJD(t);
-                fits_write_col_dbl(fout, columnNum, (LONGLONG)cur_row, 1LL, 1LL, &dmjd, &status);
-                dbprintf("%lu %.15f ", t, dmjd);
+                ddesc.extract(id, row_buf.data(), n, (Time::Time_t *)tb);
+
+                for (size_t i = 0; i < n; ++i)
+                {
+                    tb[i].dmjd = Time::DMJD(tb[i].dmjd_bits);
+                }
+
+                fits_write_col(fout, TDOUBLE, columnNum, (LONGLONG)cur_row + 1,
+                               1LL, (LONGLONG)n, tb, &status);
                 break;
             }
-
             case data_description::DOUBLE:
-            {
-                double d = get_data_buffer_value<double>(data.data(), z->offset);
-                dbprintf("%f ", d);
-                fits_write_col_dbl(fout, columnNum, (LONGLONG)cur_row, 1LL, 1LL, &d, &status);
+                write_column<double>(TDOUBLE, columnNum, id, n);
                 break;
-            }
             case data_description::FLOAT:
-            {
-                float d = get_data_buffer_value<float>(data.data(), z->offset);
-                dbprintf("%f ", d);
-                fits_write_col_flt(fout, columnNum, cur_row, 1, 1, &d, &status);
+                write_column<float>(TFLOAT, columnNum, id, n);
                 break;
-            }
             case data_description::INT64_T:
             case data_description::LONG:
-            {
-                int64_t d = get_data_buffer_value<int64_t>(data.data(), z->offset);
-                dbprintf("%ld ", d);
-                fits_write_col_lnglng(fout, columnNum, cur_row, 1, 1, (LONGLONG*)&d, &status);
+            case data_description::UINT64_T:
+            case data_description::UNSIGNED_LONG:
+                write_column<LONGLONG>(TLONGLONG, columnNum, id, n);
                 break;
-            }
             case data_description::INT32_T:
             case data_description::INT:
-            {
-                int32_t d = get_data_buffer_value<int32_t>(data.data(), z->offset);
-                dbprintf("%d ", d);
-                fits_write_col_int(fout, columnNum, cur_row, 1, 1, &d, &status);
+                write_column<int>(TINT, columnNum, id, n);
                 break;
-            }
             case data_description::INT16_T:
             case data_description::SHORT:
-            {
-                int16_t d = get_data_buffer_value<int16_t>(data.data(), z->offset);
-                dbprintf("%d ", d);
-                fits_write_col_sht(fout, columnNum, cur_row, 1, 1, (short *)&d, &status);
+                write_column<short>(TSHORT, columnNum, id, n);
                 break;
-            }
             case data_description::INT8_T:
             case data_description::CHAR:
-            {
-                int8_t d = get_data_buffer_value<int8_t>(data.data(), z->offset);
-                dbprintf("%c ", d);
-                fits_write_col_byt(fout, columnNum, cur_row, 1, 1, (unsigned char *)&d, &status);
-                break;
-            }
-            case data_description::UINT64_T:
-            case data_description::UNSIGNED_LONG:
-            {
-                uint64_t d = get_data_buffer_value<uint64_t>(data.data(), z->offset);
-                dbprintf("%lu ", d);
-                fits_write_col_lnglng(fout, columnNum, cur_row, 1, 1, (LONGLONG*)&d, &status);
+            case data_description::UINT8_T:
+            case data_description::UNSIGNED_CHAR:
+                write_column<unsigned char>(TBYTE, columnNum, id, n);
                 break;
-            }
             case data_description::UINT32_T:
             case data_description::UNSIGNED_INT:
-            {
-                uint32_t d = get_data_buffer_value<uint32_t>(data.data(), z->offset);
-                dbprintf("%u ", d);
-                fits_write_col_uint(fout, columnNum, cur_row, 1, 1, (unsigned int *)&d, &status);
+                write_column<unsigned int>(TUINT, columnNum, id, n);
                 break;
-            }
             case data_description::UINT16_T:
             case data_description::UNSIGNED_SHORT:
-            {
-                uint16_t d = get_data_buffer_value<uint16_t>(data.data(), z->offset);
-                dbprintf("%u ", d);
-                fits_write_col_usht(fout, columnNum, cur_row, 1, 1, (unsigned short *)&d, &status);
-                break;
-            }
-            case data_description::UINT8_T:
-            case data_description::UNSIGNED_CHAR:
-            {
-                uint8_t d = get_data_buffer_value<uint8_t>(data.data(), z->offset);
-                dbprintf("%u ", d);
-                fits_write_col_byt(fout, columnNum, cur_row, 1, 1, (unsigned char *)&d, &status);
+                write_column<unsigned short>(TUSHORT, columnNum, id, n);
                 break;
-            }
             case data_description::LONG_DOUBLE:
             {
                 // I'm not sure FITS knows this type?
@@ -420,7 +528,7 @@ bool FITSLogger::log_data(GenericBuffer &data)
             }
 
             default:
-                printf("%s type %d not supported\n", __PRETTY_FUNCTION__, z->type);
+                printf("%s type %d not supported\n", __PRETTY_FUNCTION__, z.type);
                 break;
         }
 
@@ -429,20 +537,14 @@ bool FITSLogger::log_data(GenericBuffer &data)
             printf("Error %d\n", status);
             last_reported_status = status;
         }
-        ++z;
 
-        // if there are more entries, otherwise flush
-        if (z!=ddesc.fields.end())
-        {
-            dbprintf(", ");
-            ++columnNum;
-        }
+        ++columnNum;
     }
-    dbprintf("\n");
+
+    dbprintf("wrote %lu rows\n", n);
+    cur_row += n;
+    buffered_rows = 0;
     fits_flush_file(fout, &status);
 
     return true;
 }
-
-
-
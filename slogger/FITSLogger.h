@@ -9,6 +9,7 @@
 #include "matrix/Mutex.h"
 #include "matrix/ThreadLock.h"
 #include "matrix/DataInterface.h"
+#include "matrix/Time.h"
 #include <fitsio.h>
 
 /// A general log data writer which works with the matrix GenericBuffer.
@@ -16,7 +17,9 @@ class FITSLogger
 {
 public:
 
-    FITSLogger(YAML::Node ddyaml, std::string header, int debuglevel=0);
+    FITSLogger(YAML::Node ddyaml, std::string header, int debuglevel=0,
+               size_t flush_rows=1024,
+               Time::Time_t flush_interval=Time::TM_ONE_SEC);
 
     /// cleaup and close file
     virtual ~FITSLogger();
@@ -27,6 +30,16 @@ public:
     /// open a time-named log file:
     bool open_log();
 
+    /// open the next log file ahead of time, under a temporary name
+    /// ('.<header>.<pid>.next.fits'):
+    bool prepare_log();
+
+    /// give a file opened by prepare_log() its time-based name:
+    bool activate_log();
+
+    /// close and delete the current file.
+    void discard();
+
     /// safe check on status of file
     bool is_log_open();
 
@@ -36,11 +49,19 @@ public:
     /// creates the Binary table header
     bool create_header();
 
-    /// writes the data to the log file in the calling context (possibly blocking)
+    /// buffers a row of data, and writes the buffered rows to the log
+    /// file in the calling context (possibly blocking) once there are
+    /// 'flush_rows' of them or the oldest is 'flush_interval' old.
     /// Should only be used from soft-rt context.
     bool log_data(matrix::GenericBuffer &);
 
-    /// closes the current file.
+    /// writes any buffered rows to the log file now.
+    bool flush();
+
+    /// sets the row count and age at which buffered rows are written.
+    void set_flush_threshold(size_t rows, Time::Time_t interval);
+
+    /// writes any buffered rows and closes the current file.
     void close();
 
     /// returns the specified size of the data. The GenericBuffer should be
@@ -50,11 +71,23 @@ public:
 
 
 protected:
+    template <typename T>
+    void write_column(int fits_type, int column, size_t id, size_t n);
+
     std::string directory_name;
     std::string file_name;
     std::string header;
     size_t log_size;
-    matrix::data_description ddesc;
+    matrix::compiled_description ddesc;
+
+    // rows not yet written, back to back, and one column of them
+    // transposed for writing.
+    std::vector<unsigned char> row_buf;
+    std::vector<uint64_t> column_buf;
+    size_t buffered_rows;
+    size_t flush_rows;
+    Time::Time_t flush_interval;
+    Time::Time_t first_buffered;
 
     matrix::Mutex mtx;
     int status;
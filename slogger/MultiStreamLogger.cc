@@ -0,0 +1,422 @@
+
+#include "MultiStreamLogger.h"
+#include <algorithm>
+#include <fnmatch.h>
+#include <iostream>
+#include <boost/algorithm/string.hpp>
+#include "matrix/ThreadLock.h"
+
+using namespace std;
+using namespace matrix;
+
+/// how long the threads wait for work before checking whether to stop.
+static const int poll_usecs = 100000;
+/// how often streams that could not be started are tried again.
+static const Time::Time_t reconcile_interval = 10 * Time::TM_ONE_SEC;
+/// how often the writers' figures are printed.
+static const Time::Time_t report_interval = 60 * Time::TM_ONE_SEC;
+
+LogWorker::LogWorker() :
+    changed(false),
+    work(false),
+    running(false),
+    thread(this, &LogWorker::task)
+{
+}
+
+LogWorker::~LogWorker()
+{
+    stop();
+}
+
+void LogWorker::start(string name)
+{
+    running.set_value(true);
+    thread.start(name);
+}
+
+void LogWorker::stop()
+{
+    if (thread.running())
+    {
+        running.set_value(false);
+        wake();
+        thread.stop_without_cancel();
+    }
+
+    // any writers left are stopped here, as they are released.
+    ThreadLock<Mutex> l(mtx);
+    l.lock();
+    writers.clear();
+    failures.clear();
+}
+
+void LogWorker::add(shared_ptr<AsyncLogWriter> w)
+{
+    ThreadLock<Mutex> l(mtx);
+    l.lock();
+    writers.push_back(w);
+    changed = true;
+}
+
+void LogWorker::remove(shared_ptr<AsyncLogWriter> w)
+{
+    ThreadLock<Mutex> l(mtx);
+    l.lock();
+    writers.erase(std::remove(writers.begin(), writers.end(), w), writers.end());
+    failures.erase(std::remove(failures.begin(), failures.end(), w), failures.end());
+    changed = true;
+}
+
+size_t LogWorker::size()
+{
+    ThreadLock<Mutex> l(mtx);
+    l.lock();
+    return writers.size();
+}
+
+bool LogWorker::failed(shared_ptr<AsyncLogWriter> w)
+{
+    ThreadLock<Mutex> l(mtx);
+    l.lock();
+    return std::find(failures.begin(), failures.end(), w) != failures.end();
+}
+
+void LogWorker::task()
+{
+    vector<shared_ptr<AsyncLogWriter> > mine;
+    ThreadLock<Mutex> l(mtx);
+    bool run = true;
+
+    while (run)
+    {
+        size_t n = 0;
+
+        // cleared before looking, so that a wake() while busy is not
+        // missed.
+        work.set_value(false);
+
+        l.lock();
+
+        if (changed)
+        {
+            mine = writers;
+            changed = false;
+        }
+
+        l.unlock();
+
+        for (size_t i = 0; i < mine.size();)
+        {
+            // opens the first file of a writer just added; after
+            // that, does nothing.
+            if (!mine[i]->start(false))
+            {
+                l.lock();
+                writers.erase(std::remove(writers.begin(), writers.end(), mine[i]),
+                              writers.end());
+                failures.push_back(mine[i]);
+                l.unlock();
+                mine.erase(mine.begin() + i);
+                continue;
+            }
+
+            n += mine[i]->write_pending(0);
+            mine[i]->service_files(0);
+            ++i;
+        }
+
+        if (n == 0)
+        {
+            work.wait(true, poll_usecs);
+        }
+
+        running.get_value(run);
+    }
+}
+
+MultiStreamLogger::MultiStreamLogger(string km_url, string pats, string dir,
+                                     size_t maxrows, size_t writer_threads,
+                                     int debug) :
+    keymaster_url(km_url),
+    log_dir(dir),
+    max_rows_per_file(maxrows),
+    debuglevel(debug),
+    keymaster(km_url),
+    streams_cb(this, &MultiStreamLogger::streams_changed),
+    changed(false),
+    running(false)
+{
+    boost::split(patterns, pats, boost::is_any_of(","));
+
+    for (size_t i = 0; i < max(writer_threads, (size_t)1); ++i)
+    {
+        workers.push_back(shared_ptr<LogWorker>(new LogWorker()));
+        workers.back()->start("log_worker_" + to_string(i));
+    }
+}
+
+MultiStreamLogger::~MultiStreamLogger()
+{
+    stop();
+
+    while (!streams.empty())
+    {
+        remove_stream(streams.begin());
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i]->stop();
+    }
+}
+
+bool MultiStreamLogger::matches(string alias)
+{
+    for (size_t i = 0; i < patterns.size(); ++i)
+    {
+        if (fnmatch(patterns[i].c_str(), alias.c_str(), 0) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// Keymaster callback for changes to the 'streams' table. The reactor
+/// picks the change up.
+void MultiStreamLogger::streams_changed(string, YAML::Node n)
+{
+    ThreadLock<Mutex> l(wanted_mtx);
+    l.lock();
+    wanted = n;
+    changed = true;
+}
+
+/// Makes the set of streams logged match the 'streams' table: streams
+/// no longer in it, whose entry has changed, or whose first file could
+/// not be opened, are removed, and matching streams not yet logged are
+/// added. Returns true if the set changed.
+bool MultiStreamLogger::reconcile()
+{
+    ThreadLock<Mutex> l(wanted_mtx);
+    map<string, YAML::Node> want;
+    size_t before = streams.size();
+    bool removed = false;
+
+    l.lock();
+    changed = false;
+
+    if (wanted.IsMap())
+    {
+        for (YAML::const_iterator i = wanted.begin(); i != wanted.end(); ++i)
+        {
+            string alias = i->first.as<string>();
+
+            if (matches(alias))
+            {
+                want[alias] = YAML::Clone(i->second);
+            }
+        }
+    }
+
+    l.unlock();
+
+    for (streams_t::iterator i = streams.begin(); i != streams.end();)
+    {
+        map<string, YAML::Node>::iterator w = want.find(i->first);
+
+        if (workers[i->second->worker]->failed(i->second->writer))
+        {
+            // added again below, to try again.
+            cout << i->first << ": error opening log file" << endl;
+            remove_stream(i++);
+            removed = true;
+        }
+        else if (w == want.end() || YAML::Dump(w->second) != YAML::Dump(i->second->config))
+        {
+            cout << "removing stream " << i->first << endl;
+            remove_stream(i++);
+            removed = true;
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    for (map<string, YAML::Node>::iterator w = want.begin(); w != want.end(); ++w)
+    {
+        if (streams.find(w->first) == streams.end())
+        {
+            add_stream(w->first, w->second);
+        }
+    }
+
+    return removed || streams.size() != before;
+}
+
+void MultiStreamLogger::add_stream(string alias, YAML::Node config)
+{
+    shared_ptr<stream> s(new stream());
+    size_t w = 0;
+
+    s->alias = alias;
+    s->config = config;
+
+    try
+    {
+        if (!config.IsSequence() || config.size() < 3)
+        {
+            cout << alias << ": unexpected stream_description format| "
+                 << config << endl;
+            return;
+        }
+
+        YAML::Node dd = keymaster.get(string("stream_descriptions.")
+                                      + config[2].as<string>() + ".fields");
+        // the file is opened by the worker, once the sink is
+        // connected: see LogWorker::task().
+        s->writer.reset(new AsyncLogWriter(dd, alias, log_dir + "/" + alias + "/",
+                                           max_rows_per_file, 4096, debuglevel));
+        s->sink.reset(new DataSink<GenericBuffer>(keymaster_url, 256));
+        s->sink->connect(config[0].as<string>(), config[1].as<string>(), "");
+    }
+    catch (KeymasterException &e)
+    {
+        cout << alias << ": " << e.what() << endl;
+        return;
+    }
+    catch (MatrixException &e)
+    {
+        cout << alias << ": " << e.what() << endl;
+        return;
+    }
+    catch (YAML::Exception &e)
+    {
+        cout << alias << ": " << e.what() << endl;
+        return;
+    }
+
+    // to the least busy worker.
+    for (size_t i = 1; i < workers.size(); ++i)
+    {
+        if (workers[i]->size() < workers[w]->size())
+        {
+            w = i;
+        }
+    }
+
+    s->worker = w;
+    workers[w]->add(s->writer);
+    streams[alias] = s;
+    cout << "added stream " << alias << endl;
+}
+
+void MultiStreamLogger::remove_stream(streams_t::iterator s)
+{
+    s->second->sink->disconnect();
+    workers[s->second->worker]->remove(s->second->writer);
+    streams.erase(s);
+}
+
+void MultiStreamLogger::report()
+{
+    size_t rows = 0, dropped = 0, max_depth = 0;
+    Time::Time_t max_latency = 0;
+    string deepest, slowest;
+
+    for (streams_t::iterator i = streams.begin(); i != streams.end(); ++i)
+    {
+        AsyncLogWriter::metrics m = i->second->writer->get_metrics();
+
+        rows += m.rows_written;
+        dropped += m.rows_dropped;
+
+        if (m.max_queue_depth >= max_depth)
+        {
+            max_depth = m.max_queue_depth;
+            deepest = i->first;
+        }
+
+        if (m.max_write_latency >= max_latency)
+        {
+            max_latency = m.max_write_latency;
+            slowest = i->first;
+        }
+    }
+
+    cout << streams.size() << " streams"
+         << ", rows " << rows
+         << ", dropped " << dropped
+         << ", max queue " << max_depth << " (" << deepest << ")"
+         << ", max write latency " << max_latency / 1000 << " us ("
+         << slowest << ")" << endl;
+}
+
+void MultiStreamLogger::run()
+{
+    vector<GenericBuffer> rows(BATCH_SIZE);
+    vector<shared_ptr<stream> > inputs;
+    vector<size_t> ready;
+    unique_ptr<poller> p(new poller());
+    Time::Time_t next_reconcile = 0;
+    Time::Time_t next_report = Time::getUTC() + report_interval;
+    bool run = true;
+
+    streams_changed("streams", keymaster.get("streams"));
+    keymaster.subscribe("streams", &streams_cb);
+    running.set_value(true);
+
+    while (run)
+    {
+        Time::Time_t now = Time::getUTC();
+
+        if (changed || now >= next_reconcile)
+        {
+            if (reconcile())
+            {
+                inputs.clear();
+                p.reset(new poller());
+
+                for (streams_t::iterator i = streams.begin(); i != streams.end(); ++i)
+                {
+                    p->push_back(i->second->sink.get());
+                    inputs.push_back(i->second);
+                }
+            }
+
+            next_reconcile = now + reconcile_interval;
+        }
+
+        p->wait(ready, poll_usecs);
+
+        for (size_t i = 0; i < ready.size(); ++i)
+        {
+            stream &s = *inputs[ready[i]];
+            size_t n = s.sink->get_batch(rows.begin(), rows.size(), 0);
+
+            if (n)
+            {
+                s.writer->put(rows.data(), n);
+                workers[s.worker]->wake();
+            }
+        }
+
+        if (now >= next_report)
+        {
+            report();
+            next_report = now + report_interval;
+        }
+
+        running.get_value(run);
+    }
+
+    keymaster.unsubscribe("streams");
+}
+
+void MultiStreamLogger::stop()
+{
+    running.set_value(false);
+}
@@ -0,0 +1,129 @@
+#ifndef MultiStreamLogger_h
+#define MultiStreamLogger_h
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "matrix/DataSink.h"
+#include "matrix/Keymaster.h"
+#include "matrix/Mutex.h"
+#include "matrix/TCondition.h"
+#include "matrix/Thread.h"
+#include "matrix/Time.h"
+#include "AsyncLogWriter.h"
+
+/// One of the writer threads of a MultiStreamLogger. It serves the
+/// AsyncLogWriters given to it, so each stream's files are only ever
+/// written by one thread. The worker also opens a writer's first file,
+/// so that the caller of add() is not held up by it. A writer removed
+/// from the worker is stopped, and its files closed, once the worker
+/// lets go of it.
+class LogWorker
+{
+public:
+
+    LogWorker();
+    virtual ~LogWorker();
+
+    void start(std::string name);
+    void stop();
+
+    void add(std::shared_ptr<AsyncLogWriter>);
+    void remove(std::shared_ptr<AsyncLogWriter>);
+
+    /// the number of writers served.
+    size_t size();
+
+    /// true if the worker could not open the writer's first file. The
+    /// worker no longer serves it.
+    bool failed(std::shared_ptr<AsyncLogWriter>);
+
+    /// tells the worker there are rows to write.
+    void wake() { work.signal(true); }
+
+private:
+
+    void task();
+
+    matrix::Mutex mtx;
+    std::vector<std::shared_ptr<AsyncLogWriter> > writers;
+    std::vector<std::shared_ptr<AsyncLogWriter> > failures;
+    bool changed;
+    matrix::TCondition<bool> work;
+    matrix::TCondition<bool> running;
+    matrix::Thread<LogWorker> thread;
+};
+
+class SloggerTest;
+
+/// Logs many streams from one process. The streams are the entries of
+/// the Keymaster's 'streams' table whose aliases match any of a list of
+/// patterns (shell wildcards, see fnmatch(3)), each to its own series
+/// of files as a single-stream slogger would.
+///
+/// The DataSinks of all the streams are drained by one reactor thread,
+/// the caller of run(), which waits on all of them at once with a
+/// matrix::poller. Their rows are written by a fixed pool of LogWorker
+/// threads, each serving a share of the streams. Streams are added and
+/// removed as the 'streams' table changes.
+class MultiStreamLogger
+{
+public:
+
+    MultiStreamLogger(std::string keymaster_url, std::string patterns,
+                      std::string log_dir, size_t max_rows_per_file,
+                      size_t writer_threads, int debuglevel = 0);
+    virtual ~MultiStreamLogger();
+
+    /// runs the reactor in the calling thread, until stop().
+    void run();
+    void stop();
+
+private:
+
+    friend class ::SloggerTest;
+
+    enum { BATCH_SIZE = 64 };
+
+    struct stream
+    {
+        std::string alias;
+        YAML::Node config;      // [component, source, description]
+        std::shared_ptr<matrix::DataSink<matrix::GenericBuffer> > sink;
+        std::shared_ptr<AsyncLogWriter> writer;
+        size_t worker;
+    };
+
+    typedef std::map<std::string, std::shared_ptr<stream> > streams_t;
+
+    bool matches(std::string alias);
+    void streams_changed(std::string key, YAML::Node streams);
+    bool reconcile();
+    void add_stream(std::string alias, YAML::Node config);
+    void remove_stream(streams_t::iterator s);
+    void report();
+
+    std::string keymaster_url;
+    std::vector<std::string> patterns;
+    std::string log_dir;
+    size_t max_rows_per_file;
+    int debuglevel;
+
+    matrix::Keymaster keymaster;
+    matrix::KeymasterMemberCB<MultiStreamLogger> streams_cb;
+
+    // the latest 'streams' table, from the Keymaster subscription.
+    matrix::Mutex wanted_mtx;
+    YAML::Node wanted;
+    std::atomic<bool> changed;
+
+    // only touched by the reactor thread.
+    streams_t streams;
+    std::vector<std::shared_ptr<LogWorker> > workers;
+
+    matrix::TCondition<bool> running;
+};
+
+#endif
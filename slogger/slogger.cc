@@ -5,6 +5,8 @@
 #include <vector>
 #include <memory>
 #include "FITSLogger.h"
+#include "AsyncLogWriter.h"
+#include "MultiStreamLogger.h"
 #include "matrix/ThreadLock.h"
 
 using namespace std;
@@ -14,15 +16,22 @@ const char helpstr[] =
 "Slogger, a DataSink to fits logger program.                                                   \n"
 "usage: slogger -str stream_alias [ -debug ]  [ -url keymaster_url ] [ -ldir path ]            \n"
 "       [ -data_timeout seconds ] [ -maxrows nrows ] [ -ls ]                                   \n"
+"       slogger -streams pattern[,pattern...] [ -writers nthreads ] [ ... ]                    \n"
 "The environment variable MATRIXLOGDIR can be used to specify where log files                  \n"
 "will be written. Alternatively this can be specified using the -ldir option.                  \n"
 "                                                                                              \n"
 "If the -ls option is given, slogger will list the available streams and exit                  \n"
 "                                                                                              \n"
+"With -streams, one slogger logs every stream whose alias matches one of the patterns          \n"
+"(shell wildcards, e.g. -streams '*' or -streams 'az_*,el_encoder'), each into its own         \n"
+"subdirectory, using a pool of -writers threads. Streams are added and removed as the          \n"
+"streams table in the keymaster changes.                                                       \n"
+"                                                                                              \n"
 "Option defaults are:                                                                          \n"
 "    -url tcp://localhost:42000                                                                \n"
 "    -data_timeout 2                                                                           \n"
 "    -maxrows 262144                                                                           \n"
+"    -writers 4                                                                                \n"
 "    -ldir $MATRIXLOGDIR or /tmp if not set                                                    \n"
 "                                                                                              \n"
 "                                                                                              \n"
@@ -53,6 +62,9 @@ const char helpstr[] =
 
 string keymaster_url = "tcp://localhost:42000";
 
+// how often the writer's queue and latency figures are printed.
+const Time::Time_t STATS_INTERVAL = 60 * Time::TM_ONE_SEC;
+
 
 
 int main(int argc, char **argv)
@@ -70,7 +82,9 @@ int main(int argc, char **argv)
     // defaults
     int debuglevel = 0;
     size_t max_rows_per_file = 256*1024; // 262144 rows default
+    size_t writer_threads = 4;
     string stream_arg;
+    string stream_patterns;
 
     const char *log_base = getenv("MATRIXLOGDIR");
 
@@ -128,14 +142,23 @@ int main(int argc, char **argv)
             arg = argv[i];
             double tmo = std::strtod(arg.c_str(), nullptr);
             time_out = static_cast<Time::Time_t>(tmo * Time::TM_ONE_SEC);
-            return -1;
         }
         else if (arg == "-maxrows")
         {
             ++i;
             arg = argv[i];
             max_rows_per_file = std::strtol(arg.c_str(), nullptr, 0);
-            return -1;
+        }
+        else if (arg == "-streams")
+        {
+            ++i;
+            stream_patterns = argv[i];
+        }
+        else if (arg == "-writers")
+        {
+            ++i;
+            arg = argv[i];
+            writer_threads = std::strtol(arg.c_str(), nullptr, 0);
         }
         else
         {
@@ -148,8 +171,8 @@ int main(int argc, char **argv)
     YAML::Node dd_node;
     string stream_dd_path;
     Keymaster keymaster(keymaster_url);
-    DataSink<GenericBuffer> sink(keymaster_url);
-    unique_ptr<FITSLogger> log;
+    DataSink<GenericBuffer> sink(keymaster_url, 256);
+    unique_ptr<AsyncLogWriter> log;
 
     // list available stream aliases
     if (stream_arg == "-ls")
@@ -168,6 +191,15 @@ int main(int argc, char **argv)
         cout << "logging path not set - using /tmp" << endl;
         log_dir = "/tmp";
     }
+
+    if (!stream_patterns.empty())
+    {
+        MultiStreamLogger msl(keymaster_url, stream_patterns, log_dir,
+                              max_rows_per_file, writer_threads, debuglevel);
+        msl.run();
+        return 0;
+    }
+
     log_dir = log_dir + "/" + stream_arg;
     try
     {
@@ -205,7 +237,8 @@ int main(int argc, char **argv)
     }
     try
     {
-        log.reset( new FITSLogger(stream_dd, stream_arg, debuglevel));
+        log.reset(new AsyncLogWriter(stream_dd, stream_arg, log_dir + "/",
+                                     max_rows_per_file, 4096, debuglevel));
     }
     catch(MatrixException e)
     {
@@ -215,9 +248,7 @@ int main(int argc, char **argv)
         return -1;
     }
 
-    log->set_directory(log_dir + "/");
-
-    if (!log->open_log())
+    if (!log->start())
     {
         cout << "Error opening log file: "
              <<  strerror(errno) << endl;
@@ -233,12 +264,18 @@ int main(int argc, char **argv)
         return -1;
     }
 
-    int nrows = 0;
+    // Rows are taken from the sink up to this many at a time, so that
+    // after a stall the logger catches up instead of falling further
+    // behind.
+    vector<GenericBuffer> gbuffers(64);
 
-    GenericBuffer gbuffer;
-    gbuffer.resize(log->log_datasize());
+    for (size_t i = 0; i < gbuffers.size(); ++i)
+    {
+        gbuffers[i].resize(log->log_datasize());
+    }
 
     Time::Time_t last_stamp = Time::getUTC();
+    Time::Time_t last_report = last_stamp;
 
     while (1)
     {
@@ -251,27 +288,38 @@ int main(int argc, char **argv)
 
         if (now - last_stamp < time_out * 5)
         {
-            if (sink.timed_get(gbuffer, time_out))
+            size_t n = sink.get_batch(gbuffers.begin(), gbuffers.size(), time_out);
+
+            if (n)
             {
                 // cout << "got data" << endl;
                 last_stamp = Time::getUTC();
-                log->log_data(gbuffer);
-
-                if (++nrows > max_rows_per_file)
-                {
-                    cout << stream_alias << " opening new file" << endl;
-                    log->close();
-                    if (!log->open_log())
-                    {
-                        return (-1);
-                    }
-                    nrows = 0;
-                }
             }
-            else
+
+            // the writer thread writes the rows and changes files;
+            // this never blocks.
+            log->put(gbuffers.data(), n);
+
+            if (n == 0)
             {
                 cout << "data time out" << endl;
             }
+
+            if (now - last_report >= STATS_INTERVAL)
+            {
+                AsyncLogWriter::metrics m = log->get_metrics();
+                cout << stream_arg
+                     << ": queue " << m.queue_depth << "/" << m.queue_capacity
+                     << " (max " << m.max_queue_depth << ")"
+                     << ", rows " << m.rows_written
+                     << ", dropped " << m.rows_dropped
+                     << ", files " << m.files
+                     << ", write latency last/mean/max "
+                     << m.last_write_latency / 1000 << "/"
+                     << m.mean_write_latency / 1000 << "/"
+                     << m.max_write_latency / 1000 << " us" << endl;
+                last_report = now;
+            }
         }
         else
         {
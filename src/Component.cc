@@ -106,12 +106,34 @@ namespace matrix
 
                         if (dst_comp == my_instance_name)
                         {
-                            const string protocol = n.size() == 5 ? n[3].as<string>() : "";
+                            // The optional fifth element is either the
+                            // transport, or a map of connection options
+                            // which may include the transport.
+                            string protocol;
+                            YAML::Node options;
+
+                            if (n.size() == 5)
+                            {
+                                if (n[4].IsMap())
+                                {
+                                    options = n[4];
+
+                                    if (options["transport"])
+                                    {
+                                        protocol = options["transport"].as<string>();
+                                    }
+                                }
+                                else
+                                {
+                                    protocol = n[4].as<string>();
+                                }
+                            }
 
                             ConnectionKey ck(mode,
                                              dst_comp,
                                              sink_name);
                             connections[ck] = ConnectionKey(src_comp, src_name, protocol);
+                            connection_options[ck] = options;
                         }
                     }
                 }
@@ -139,6 +161,18 @@ namespace matrix
         }
     }
 
+    YAML::Node Component::find_connection_options(ConnectionKey const &c)
+    {
+        auto opts = connection_options.find(c);
+
+        if (opts == connection_options.end())
+        {
+            return YAML::Node();
+        }
+
+        return opts->second;
+    }
+
     bool Component::create_data_connections()
     {
         return _create_data_connections();
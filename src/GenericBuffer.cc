@@ -256,4 +256,94 @@ namespace matrix
 
         return s_elem_size * s_elems;
     }
+
+    /**
+     * Constructs an empty compiled_description, with no fields.
+     *
+     */
+
+    compiled_description::compiled_description()
+        : _size(0)
+    {
+    }
+
+    /**
+     * Compiles a data_description.
+     *
+     * @param dd: The description. It is taken by value because
+     * computing its offsets modifies it.
+     *
+     */
+
+    compiled_description::compiled_description(data_description dd)
+        : _size(0)
+    {
+        _compile(dd);
+    }
+
+    /**
+     * Compiles a data description straight from its YAML
+     * representation: either the fields themselves, as accepted by
+     * `data_description(YAML::Node)`, or a map with a 'fields' key.
+     *
+     * @param dd: The YAML description.
+     *
+     */
+
+    compiled_description::compiled_description(YAML::Node dd)
+        : _size(0)
+    {
+        data_description d(dd.IsMap() && dd["fields"] ? dd["fields"] : dd);
+        _compile(d);
+    }
+
+    void compiled_description::_compile(data_description &dd)
+    {
+        if (dd.fields.empty())
+        {
+            return;
+        }
+
+        _size = dd.size();
+        _fields.reserve(dd.fields.size());
+
+        for (list<data_description::data_field>::iterator i = dd.fields.begin();
+             i != dd.fields.end(); ++i)
+        {
+            field f;
+
+            f.name = i->name;
+            f.type = i->type;
+            f.offset = i->offset;
+            f.elements = i->elements;
+            f.width = data_description::type_info[i->type];
+            f.skip = i->skip;
+            _ids[f.name] = _fields.size();
+            _by_type[f.type].push_back(_fields.size());
+            _fields.push_back(f);
+        }
+    }
+
+    /**
+     * Looks up a field's ID. This is meant to be done once, not per
+     * sample.
+     *
+     * @param name: The field name.
+     *
+     * @return The field ID, the index of the field in `fields()`.
+     *
+     */
+
+    size_t compiled_description::field_id(string const &name) const
+    {
+        map<string, size_t>::const_iterator i = _ids.find(name);
+
+        if (i == _ids.end())
+        {
+            throw MatrixException("compiled_description::field_id()",
+                                  "no field named '" + name + "'");
+        }
+
+        return i->second;
+    }
 }
@@ -80,30 +80,36 @@ namespace matrix
     {
         bool run(true);
         Keymaster km(keymaster_url);
-        GenericBuffer data;
-        YAML::Node dd;
+        vector<GenericBuffer> data(BATCH_SIZE);
+        compiled_description dd;
 
         try
         {
-            dd = km.get(my_full_instance_name + ".data_description");
+            dd = compiled_description(km.get(my_full_instance_name + ".data_description"));
         }
         catch (KeymasterException &e)
         {
             cerr << e.what() << endl;
             throw_value_error(my_full_instance_name + ".data_description", e.what());
         }
+        catch (MatrixException &e)
+        {
+            cerr << e.what() << endl;
+            throw_value_error(my_full_instance_name + ".data_description", e.what());
+        }
 
         _thread_started.signal(true);
 
         while (run)
         {
-            // try to get with a time-out of 5 mS
-            if (_sink.timed_get(data, 5000000))
+            // try to get with a time-out of 5 mS. If the handler has
+            // fallen behind, this takes everything that is waiting in
+            // one go.
+            size_t n = _sink.get_batch(data.begin(), data.size(), 5000000);
+
+            for (size_t i = 0; i < n && _handler; ++i)
             {
-                if (_handler)
-                {
-                    _handler->exec(dd, data);
-                }
+                _handler->exec(dd, data[i]);
             }
 
             // continue until _run is false and no heaps were read.
@@ -29,12 +29,14 @@
 #include "matrix/ZMQContext.h"
 #include "matrix/ThreadLock.h"
 #include "matrix/tsemfifo.h"
+#include "matrix/event_notifier.h"
 #include "matrix/Thread.h"
 #include "matrix/ThreadLock.h"
 #include "matrix/zmq_util.h"
 #include "matrix/netUtils.h"
 #include "matrix/matrix_util.h"
 #include "matrix/yaml_util.h"
+#include "matrix/yaml_msgpack.h"
 #include "matrix/Time.h"
 #include "matrix/ResourceLock.h"
 
@@ -42,6 +44,7 @@
 #include <cstring>
 #include <sstream>
 #include <map>
+#include <set>
 #include <vector>
 #include <list>
 #include <iostream>
@@ -68,6 +71,160 @@ using namespace matrix;
 #define QUIT        3
 #define KM_TIMEOUT  5000
 
+/**
+ * The topic on which the deltas for 'keychain' are published:
+ * "#<keychain>#". No keychain publication can begin with '#', which
+ * cannot begin an unquoted YAML key; and the closing '#' keeps a
+ * subscription to the deltas of "foo" from also matching those of
+ * "foobar" or "foo.bar".
+ *
+ * @param keychain: The keychain; "" for the root.
+ *
+ * @return The topic.
+ *
+ */
+
+static string delta_topic(string const &keychain)
+{
+    return "#" + keychain + "#";
+}
+
+/**
+ * The inverse of `delta_topic()`.
+ *
+ * @param topic: A publication or subscription topic.
+ *
+ * @param keychain: Set to the keychain if 'topic' is a delta topic.
+ *
+ * @return true if 'topic' is a delta topic, false otherwise.
+ *
+ */
+
+static bool delta_keychain(string const &topic, string &keychain)
+{
+    if (topic.size() < 2 || topic[0] != '#' || topic[topic.size() - 1] != '#')
+    {
+        return false;
+    }
+
+    keychain = topic.substr(1, topic.size() - 2);
+    return true;
+}
+
+// The encodings the keymaster publishes in. A subscriber chooses one
+// by putting its topic prefix before the topic it subscribes to.
+enum
+{
+    YAML_ENCODING,
+    MSGPACK_ENCODING,
+    ENCODINGS
+};
+
+static string const topic_prefix[ENCODINGS] = {"", "!"};
+
+/**
+ * Removes the encoding's prefix from a publication or subscription
+ * topic.
+ *
+ * @param topic: The topic, which is left without its prefix.
+ *
+ * @return The topic's encoding.
+ *
+ */
+
+static int topic_encoding(string &topic)
+{
+    for (int e = ENCODINGS - 1; e > YAML_ENCODING; --e)
+    {
+        if (topic.compare(0, topic_prefix[e].size(), topic_prefix[e]) == 0)
+        {
+            topic.erase(0, topic_prefix[e].size());
+            return e;
+        }
+    }
+
+    return YAML_ENCODING;
+}
+
+/**
+ * Encodes a subtree for publication.
+ *
+ * @param n: The subtree.
+ *
+ * @param encoding: The encoding.
+ *
+ * @return The encoded subtree.
+ *
+ */
+
+static string encode(YAML::Node const &n, int encoding)
+{
+    if (encoding == MSGPACK_ENCODING)
+    {
+        return yaml_to_msgpack(n);
+    }
+
+    ostringstream yr;
+    yr << n;
+    return yr.str();
+}
+
+/**
+ * Encodes a delta for publication (see `KmImpl::deltas()`).
+ *
+ * @param seq: The delta's sequence number.
+ *
+ * @param key: The keychain that changed.
+ *
+ * @param r: The keychain's lookup, which succeeded for a put and
+ * failed for a delete.
+ *
+ * @param encoding: The encoding.
+ *
+ * @return The encoded delta.
+ *
+ */
+
+static string encode_delta(uint64_t seq, string const &key, yaml_result const &r, int encoding)
+{
+    if (encoding == MSGPACK_ENCODING)
+    {
+        msgpack::sbuffer buf;
+        msgpack::packer<msgpack::sbuffer> pk(&buf);
+
+        pk.pack_map(r.result ? 4 : 3);
+        pk.pack(string("seq"));
+        pk.pack(seq);
+        pk.pack(string("key"));
+        pk.pack(key);
+        pk.pack(string("op"));
+        pk.pack(string(r.result ? "put" : "del"));
+
+        if (r.result)
+        {
+            pk.pack(string("value"));
+            pack_yaml(pk, r.node);
+        }
+
+        return string(buf.data(), buf.size());
+    }
+
+    YAML::Emitter e;
+
+    e << YAML::BeginMap
+      << YAML::Key << "seq" << YAML::Value << seq
+      << YAML::Key << "key" << YAML::Value << key
+      << YAML::Key << "op" << YAML::Value << (r.result ? "put" : "del");
+
+    if (r.result)
+    {
+        e << YAML::Key << "value" << YAML::Value << r.node;
+    }
+
+    e << YAML::EndMap;
+    return e.c_str();
+}
+
 struct substring_p
 {
     substring_p(string subs)
@@ -126,6 +283,12 @@ struct KeymasterServer::KmImpl
     void heartbeat_task();
     bool load_config_file(string filename);
     bool publish(std::string key, bool block = false);
+    void subscription(zmq::message_t &msg);
+    bool has_subscriber(std::string key);
+    void invalidate(std::string const &key);
+    void reply(zmq::socket_t &sock, yaml_result const &r, bool packed);
+    uint64_t delta_stream(std::string const &keychain);
+    void deltas(std::string const &key, std::vector<data_package> &packages);
     void run();
     void terminate();
 
@@ -143,6 +306,7 @@ struct KeymasterServer::KmImpl
     int _pub_port_used;
     bool _state_manager_done;
     tsemfifo<data_package> _data_queue;
+    std::shared_ptr<event_notifier> _data_ready;
     Mutex _cache_lock;
     std::string _state_task_url;
     std::string _hostname;
@@ -157,6 +321,23 @@ struct KeymasterServer::KmImpl
     std::vector<std::string> _publish_service_urls;
 
     list<YAML::Node> _root_node;    //<? THE keymaster node
+    yaml_index _index;              //<? keychain index into _root_node
+
+    // The prefixes subscribed to on the XPUB socket, and the
+    // serialized subtrees last published, by topic. Until the
+    // publisher has first read the XPUB socket `_subscriptions` is
+    // not to be trusted, and `_publisher_ready`, guarded by the same
+    // lock, is false.
+    Protected<std::set<std::string> > _subscriptions;
+    bool _publisher_ready;
+    Protected<std::map<std::string, std::string> > _serialized;
+
+    // The delta streams, by keychain, with the sequence number last
+    // published on each. `_delta_clock` is the greatest sequence
+    // number ever issued, on any stream, and is guarded by the same
+    // lock.
+    Protected<std::map<std::string, uint64_t> > _delta_streams;
+    uint64_t _delta_clock;
 };
 
 /**
@@ -185,12 +366,17 @@ KeymasterServer::KmImpl::KmImpl(YAML::Node config)
     _server_thread_ready(false),
     _state_manager_thread_ready(false),
     _data_queue(1000),
+    _data_ready(new event_notifier()),
     _state_task_url(string("inproc://") + gen_random_string(20)),
     _state_task_quit(true),
     _running(true),
-    _clone_interval(0)
+    _clone_interval(0),
+    _publisher_ready(false),
+    _delta_clock(0)
 {
+    _data_queue.set_notifier(_data_ready);
     _root_node.push_front(YAML::Clone(config));
+    _index.reset(_root_node.front());
     setup_urls();
 
     if (using_tcp() && !getCanonicalHostname(_hostname))
@@ -286,9 +472,6 @@ void KeymasterServer::KmImpl::run()
                       string("KeymasterServer: unable to start the heartbeat thread")));
         }
     }
-    // Now that we're running, publish everything, so that any clients
-    // already subscribed may be updated.
-    publish("Root", true);
 }
 
 /**
@@ -311,6 +494,8 @@ void KeymasterServer::KmImpl::terminate()
 
     if (_server_thread.running())
     {
+        // wake the publisher, which then sees _running is false.
+        _data_queue.try_put(data_package());
         _data_queue.release();
         _server_thread.stop_without_cancel();
     }
@@ -456,13 +641,17 @@ void KeymasterServer::KmImpl::bind_server(zmq::socket_t &server_sock, vector<str
  * for something to be published until it gets a "QUIT" message.  This
  * consists of releasing the state queue.
  *
+ * The publisher is an XPUB socket, so that the task also receives the
+ * subscribers' subscriptions. These are kept in `_subscriptions`, for
+ * `publish()` to consult.
+ *
  */
 
 void KeymasterServer::KmImpl::server_task()
 
 {
     data_package dp;
-    zmq::socket_t data_publisher(ZMQContext::Instance()->get_context(), ZMQ_PUB);
+    zmq::socket_t data_publisher(ZMQContext::Instance()->get_context(), ZMQ_XPUB);
     string tcp_url;
 
     try
@@ -486,12 +675,57 @@ void KeymasterServer::KmImpl::server_task()
     // allow more secure recovery.
     Time::thread_delay(2000000000);
 
-    while (_data_queue.get(dp))
+    // Meanwhile the subscriptions have queued up on the XPUB
+    // socket. Read them before `has_subscriber()` starts relying on
+    // them; until then, everything is published.
+    zmq::message_t sub;
+
+    while (data_publisher.recv(&sub, ZMQ_DONTWAIT))
+    {
+        subscription(sub);
+    }
+
+    ThreadLock<decltype(_subscriptions)> sl(_subscriptions);
+    sl.lock();
+    _publisher_ready = true;
+    sl.unlock();
+
+    zmq::pollitem_t items [] =
+        {
+#if ZMQ_VERSION_MAJOR > 3
+            { (void *)data_publisher, 0, ZMQ_POLLIN, 0 },
+#else
+            { data_publisher, 0, ZMQ_POLLIN, 0 },
+#endif
+            { NULL, _data_ready->fd(), ZMQ_POLLIN, 0 }
+        };
+
+    while (_running)
     {
         try
         {
-            z_send(data_publisher, dp.key, ZMQ_SNDMORE);
-            z_send(data_publisher, dp.val, 0);
+            zmq::poll(&items [0], 2, -1);
+
+            if (items[0].revents & ZMQ_POLLIN)
+            {
+                zmq::message_t msg;
+
+                while (data_publisher.recv(&msg, ZMQ_DONTWAIT))
+                {
+                    subscription(msg);
+                }
+            }
+
+            if (items[1].revents & ZMQ_POLLIN)
+            {
+                _data_ready->rearm();
+
+                while (_running && _data_queue.try_get(dp))
+                {
+                    z_send(data_publisher, dp.key, ZMQ_SNDMORE);
+                    z_send(data_publisher, dp.val, 0);
+                }
+            }
         }
         catch (zmq::error_t &e)
         {
@@ -541,8 +775,7 @@ void KeymasterServer::KmImpl::state_manager_task()
     {
         // bind to all state server URLs
         bind_server(state_sock, _state_service_urls);
-        put_yaml_val(
-            _root_node.front(), "KeymasterServer.URLS", _state_service_urls, true);
+        _index.put("KeymasterServer.URLS", YAML::Node(_state_service_urls), true);
         publish("KeymasterServer.URLS");
     }
     catch (zmq::error_t &e)
@@ -558,12 +791,10 @@ void KeymasterServer::KmImpl::state_manager_task()
     }
 
 
-    yaml_result rs = put_yaml_val(
-        _root_node.front(),
-        "Keymaster.URLS.AsConfigured.State", _state_service_urls, true);
-    yaml_result rp = put_yaml_val(
-        _root_node.front(),
-        "Keymaster.URLS.AsConfigured.Pub", _publish_service_urls, true);
+    yaml_result rs = _index.put(
+        "Keymaster.URLS.AsConfigured.State", YAML::Node(_state_service_urls), true);
+    yaml_result rp = _index.put(
+        "Keymaster.URLS.AsConfigured.Pub", YAML::Node(_publish_service_urls), true);
     ostringstream state;
     ostringstream pub;
     mxutils::output_vector(_state_service_urls, state);
@@ -590,6 +821,11 @@ void KeymasterServer::KmImpl::state_manager_task()
 #endif
         };
 
+    // Now that we're running, publish everything, so that any clients
+    // already subscribed may be updated. This is done here, not in
+    // 'run()', as 'publish()' reads the index this thread modifies.
+    publish("Root", true);
+
     _state_manager_thread_ready.signal(true); // allow 'run()' to move
                                               // on.
 
@@ -621,6 +857,17 @@ void KeymasterServer::KmImpl::state_manager_task()
 
                 z_recv(state_sock, key);
 
+                // A client that has negotiated msgpack (see
+                // "ENCODING", below) marks each request with a
+                // leading "msgpack" frame. Its PUT values, and the
+                // replies to it, are then msgpack rather than YAML.
+                bool packed = key == "msgpack";
+
+                if (packed)
+                {
+                    z_recv(state_sock, key);
+                }
+
                 // Determine the request.  Currently requests may
                 // be either a "ping" (just to see if the service
                 // is alive); a "LIST" to get information on all
@@ -636,6 +883,22 @@ void KeymasterServer::KmImpl::state_manager_task()
                     // reply with something
                     z_send(state_sock, "I'm not dead yet!", 0);
                 }
+                /////////////////// E N C O D I N G ///////////////////
+                // The client lists the encodings it can use; the
+                // reply is the one to use, which is "yaml" if none of
+                // them is known.
+                else if (key.size() == 8 && key == "ENCODING")
+                {
+                    z_recv_multipart(state_sock, frame);
+                    string encoding("yaml");
+
+                    if (find(frame.begin(), frame.end(), "msgpack") != frame.end())
+                    {
+                        encoding = "msgpack";
+                    }
+
+                    z_send(state_sock, encoding, 0);
+                }
                 /////////////////// G E T ///////////////////
                 else if (key.size() == 3 && key == "GET")
                 {
@@ -644,16 +907,43 @@ void KeymasterServer::KmImpl::state_manager_task()
                     if (!frame.empty())
                     {
                         string keychain = frame[0];
-                        ostringstream rval;
 
                         if (keychain == "Root")
                         {
                             keychain = "";
                         }
 
-                        yaml_result r = get_yaml_node(_root_node.front(), keychain);
-                        rval << r;
-                        z_send(state_sock, rval.str(), 0);
+                        yaml_result r = _index.get(keychain);
+                        reply(state_sock, r, packed);
+                    }
+                    else
+                    {
+                        string msg("ERROR: Keychain expected, but not received!");
+                        z_send(state_sock, msg, 0);
+                    }
+                }
+                /////////////////// S Y N C ///////////////////
+                // Starts (or joins) the delta stream for a keychain,
+                // replying with the subtree and the stream's current
+                // sequence number, from which deltas continue.
+                else if (key.size() == 4 && key == "SYNC")
+                {
+                    z_recv_multipart(state_sock, frame);
+
+                    if (!frame.empty())
+                    {
+                        string keychain = frame[0];
+
+                        if (keychain == "Root")
+                        {
+                            keychain = "";
+                        }
+
+                        yaml_result r = _index.get(keychain);
+                        YAML::Node n;
+                        n["seq"] = delta_stream(keychain);
+                        n["value"] = r.result ? YAML::Clone(r.node) : YAML::Node();
+                        reply(state_sock, yaml_result(true, n, keychain, r.err), packed);
                     }
                     else
                     {
@@ -675,7 +965,7 @@ void KeymasterServer::KmImpl::state_manager_task()
                             keychain = "";
                         }
 
-                        string yaml_string = frame[1];
+                        string const &val = frame[1];
                         bool create = false;
 
                         if (frame.size() > 2 && frame[2] == "create")
@@ -684,18 +974,25 @@ void KeymasterServer::KmImpl::state_manager_task()
                         }
 
                         yaml_result r;
-                        ostringstream rval;
-                        YAML::Node n = YAML::Load(yaml_string);
+                        YAML::Node n;
 
-                        r = put_yaml_node(_root_node.front(), keychain, n, create);
+                        try
+                        {
+                            n = packed ? msgpack_to_yaml(val.data(), val.size()) : YAML::Load(val);
+                            r = _index.put(keychain, n, create);
+                        }
+                        catch (std::exception &e)
+                        {
+                            r = yaml_result(false, YAML::Node(), "",
+                                            string("Unable to decode value: ") + e.what());
+                        }
 
                         if (r.result)
                         {
                             publish(keychain);
                         }
 
-                        rval << r;
-                        z_send(state_sock, rval.str(), 0);
+                        reply(state_sock, r, packed);
 
                         // What follows is here to prevent undue
                         // memory usage. yaml-cpp has an unbounded
@@ -712,6 +1009,7 @@ void KeymasterServer::KmImpl::state_manager_task()
                         {
                             _root_node.push_front(YAML::Clone(_root_node.front()));
                             _root_node.pop_back();
+                            _index.reset(_root_node.front());
                         }
                     }
                     else
@@ -728,10 +1026,8 @@ void KeymasterServer::KmImpl::state_manager_task()
                     if (!frame.empty())
                     {
                         string keychain = frame[0];
-                        yaml_result r = delete_yaml_node(_root_node.front(), keychain);
-                        ostringstream rval;
-                        rval << r;
-                        z_send(state_sock, rval.str(), 0);
+                        yaml_result r = _index.del(keychain);
+                        reply(state_sock, r, packed);
 
                         if (r.result)
                         {
@@ -816,6 +1112,306 @@ void KeymasterServer::KmImpl::heartbeat_task()
     }
 }
 
+/**
+ * Replies to a request on the state socket with a `yaml_result`.
+ *
+ * @param sock: The state socket.
+ *
+ * @param r: The result.
+ *
+ * @param packed: If true the request was made in msgpack, and the
+ * reply is too. Otherwise it is YAML.
+ *
+ */
+
+void KeymasterServer::KmImpl::reply(zmq::socket_t &sock, yaml_result const &r, bool packed)
+{
+    if (packed)
+    {
+        z_send(sock, yaml_result_to_msgpack(r), 0);
+    }
+    else
+    {
+        ostringstream rval;
+        rval << r;
+        z_send(sock, rval.str(), 0);
+    }
+}
+
+/**
+ * Records a subscription or unsubscription received on the XPUB
+ * socket. The first byte of the message is 1 for a subscription and 0
+ * for an unsubscription; the rest is the prefix.
+ *
+ * @param msg: The message received on the XPUB socket.
+ *
+ */
+
+void KeymasterServer::KmImpl::subscription(zmq::message_t &msg)
+{
+    char const *data = (char const *)msg.data();
+
+    if (msg.size() == 0 || data[0] > 1)
+    {
+        return;
+    }
+
+    ThreadLock<decltype(_subscriptions)> l(_subscriptions);
+    string prefix(data + 1, msg.size() - 1);
+    string topic(prefix), keychain;
+    bool subscribed = false;
+
+    l.lock();
+
+    if (data[0] == 1)
+    {
+        _subscriptions.insert(prefix);
+    }
+    else
+    {
+        _subscriptions.erase(prefix);
+    }
+
+    topic_encoding(topic);
+
+    if (!delta_keychain(topic, keychain))
+    {
+        return;
+    }
+
+    for (int e = 0; e < ENCODINGS; ++e)
+    {
+        subscribed = subscribed || _subscriptions.count(topic_prefix[e] + topic);
+    }
+
+    l.unlock();
+
+    // A delta stream lives while anyone is subscribed to it, in any
+    // encoding. It is created by the subscriber's SYNC, but also
+    // here, in case the unsubscription of an earlier subscriber
+    // arrived after that SYNC; the new stream's sequence numbers then
+    // tell the new subscriber to SYNC again.
+    if (data[0] == 1)
+    {
+        delta_stream(keychain);
+    }
+    else if (!subscribed)
+    {
+        ThreadLock<decltype(_delta_streams)> dl(_delta_streams);
+        dl.lock();
+        _delta_streams.erase(keychain);
+    }
+}
+
+/**
+ * Returns the current sequence number of the delta stream for
+ * 'keychain', creating the stream if there is none. A new stream
+ * starts past every sequence number yet issued, so that a subscriber
+ * holding the number of an earlier stream for 'keychain' sees a gap
+ * rather than taking new deltas for old ones.
+ *
+ * @param keychain: The keychain of the stream; "" for the root.
+ *
+ * @return The sequence number of the stream's last delta. The next
+ * delta will carry this plus one.
+ *
+ */
+
+uint64_t KeymasterServer::KmImpl::delta_stream(string const &keychain)
+{
+    ThreadLock<decltype(_delta_streams)> l(_delta_streams);
+    map<string, uint64_t>::iterator i;
+
+    l.lock();
+
+    if ((i = _delta_streams.find(keychain)) == _delta_streams.end())
+    {
+        i = _delta_streams.insert(make_pair(keychain, ++_delta_clock)).first;
+    }
+
+    return i->second;
+}
+
+/**
+ * Builds the delta notifications for a change to 'key'. Each delta
+ * is a small YAML map: the stream's next sequence number `seq`, the
+ * changed keychain `key`, the operation `op` ("put" or "del") and,
+ * for a put, the new `value`.
+ *
+ * The stream of every prefix of 'key', and of 'key' itself, gets a
+ * delta for 'key'. The streams of keychains beneath 'key' are
+ * replaced along with it, and each gets a delta for its own keychain.
+ * Each delta is encoded in every encoding its stream is subscribed
+ * to in.
+ *
+ * @param key: The keychain that changed; "" for the root.
+ *
+ * @param packages: The deltas are appended to this.
+ *
+ */
+
+void KeymasterServer::KmImpl::deltas(string const &key, vector<data_package> &packages)
+{
+    ThreadLock<decltype(_delta_streams)> l(_delta_streams);
+    vector<pair<string, string> > targets; // stream, changed keychain
+    map<string, uint64_t>::iterator i;
+
+    l.lock();
+
+    if (_delta_streams.empty())
+    {
+        return;
+    }
+
+    if (key.empty())
+    {
+        for (i = _delta_streams.begin(); i != _delta_streams.end(); ++i)
+        {
+            targets.push_back(make_pair(i->first, i->first));
+        }
+    }
+    else
+    {
+        if (_delta_streams.count(""))
+        {
+            targets.push_back(make_pair(string(), key));
+        }
+
+        for (size_t end = 0; end != string::npos;)
+        {
+            end = key.find('.', end + 1);
+            string prefix = key.substr(0, end);
+
+            if (_delta_streams.count(prefix))
+            {
+                targets.push_back(make_pair(prefix, key));
+            }
+        }
+
+        // Beneath 'key' is the range ["key.", "key/"), '/' following '.'.
+        for (i = _delta_streams.lower_bound(key + ".");
+             i != _delta_streams.lower_bound(key + "/"); ++i)
+        {
+            targets.push_back(make_pair(i->first, i->first));
+        }
+    }
+
+    for (size_t k = 0; k < targets.size(); ++k)
+    {
+        uint64_t seq = ++_delta_streams[targets[k].first];
+        yaml_result r = _index.lookup(targets[k].second);
+
+        _delta_clock = max(_delta_clock, seq);
+
+        for (int e = 0; e < ENCODINGS; ++e)
+        {
+            string topic = topic_prefix[e] + delta_topic(targets[k].first);
+
+            if (has_subscriber(topic))
+            {
+                data_package dp = {topic, encode_delta(seq, targets[k].second, r, e)};
+                packages.push_back(dp);
+            }
+        }
+    }
+}
+
+/**
+ * Determines whether anyone would receive a publication of 'key':
+ * ZMQ subscriptions are prefixes, so a subscriber receives 'key' if
+ * any subscribed prefix is a prefix of 'key'.
+ *
+ * The subscriptions are ordered, so the candidate is the greatest
+ * subscription not greater than 'key'. If it is not a prefix of
+ * 'key', any subscription that is must also be a prefix of what the
+ * candidate and 'key' have in common, and the search continues with
+ * that. Each step shortens the key.
+ *
+ * Before the publisher is ready the subscriptions are incomplete:
+ * clients that reconnect after a restart of the server subscribe
+ * during its startup delay. Everything is then assumed to have a
+ * subscriber, and left to ZMQ to filter.
+ *
+ * @param key: The data key.
+ *
+ * @return true if a subscriber would receive 'key'.
+ *
+ */
+
+bool KeymasterServer::KmImpl::has_subscriber(string key)
+{
+    ThreadLock<decltype(_subscriptions)> l(_subscriptions);
+
+    l.lock();
+
+    if (!_publisher_ready)
+    {
+        return true;
+    }
+
+    while (true)
+    {
+        set<string>::iterator i = _subscriptions.upper_bound(key);
+
+        if (i == _subscriptions.begin())
+        {
+            return false;
+        }
+
+        --i;
+
+        if (key.compare(0, i->size(), *i) == 0)
+        {
+            return true;
+        }
+
+        size_t n = 0;
+
+        while (n < i->size() && (*i)[n] == key[n])
+        {
+            ++n;
+        }
+
+        key.resize(n);
+    }
+}
+
+/**
+ * Drops the cached serializations that a change to 'key' makes
+ * stale: those of 'key', of everything beneath it, and of every
+ * prefix of it, in every encoding. The caller must hold the
+ * `_serialized` lock.
+ *
+ * @param key: The data key that changed. If empty, everything is
+ * dropped.
+ *
+ */
+
+void KeymasterServer::KmImpl::invalidate(string const &key)
+{
+    if (key.empty())
+    {
+        _serialized.clear();
+        return;
+    }
+
+    for (int e = 0; e < ENCODINGS; ++e)
+    {
+        string topic = topic_prefix[e] + key;
+
+        // Beneath 'topic' is the range ["topic.", "topic/"), '/'
+        // following '.'.
+        _serialized.erase(_serialized.lower_bound(topic + "."),
+                          _serialized.lower_bound(topic + "/"));
+
+        for (size_t end = 0; end != string::npos;)
+        {
+            end = topic.find('.', end + 1);
+            _serialized.erase(topic.substr(0, end));
+        }
+    }
+}
+
 /**
  * Publish data. Whenever a node is modified, we need to of
  * course publish that node. But we also need to publish
@@ -824,6 +1420,17 @@ void KeymasterServer::KmImpl::heartbeat_task()
  * keys. So if the node is "foo.bar.baz", we publish "foo",
  * "foo.bar", and "foo.bar.baz"
  *
+ * Only the keys someone is subscribed to are serialized and
+ * published, and only in the encodings they are subscribed to in.
+ * Serialized subtrees are cached, by topic, until something beneath
+ * them changes. If the node's new value serializes to what was last
+ * published for it, as when a status is PUT again unchanged, nothing
+ * beneath any of its prefixes has changed either, and their cached
+ * serializations are published as they are.
+ *
+ * The deltas for any delta streams the change affects (see
+ * `deltas()`) are published as well.
+ *
  * @param key: the data key
  *
  * @return true if the data was succesfuly placed in the publication
@@ -834,46 +1441,101 @@ void KeymasterServer::KmImpl::heartbeat_task()
 bool KeymasterServer::KmImpl::publish(std::string key, bool block)
 {
     bool rval = true;
+    vector<data_package> packages;
 
-    // Publish "Root" if there is no key
     try
     {
-        data_package dp = {key, ""};
-        YAML::Node node = _root_node.front();
+        ThreadLock<decltype(_serialized)> l(_serialized);
 
-        if (dp.key.empty())
+        deltas(key, packages);
+
+        // Publish "Root" if there is no key
+        if (key.empty())
         {
-            ostringstream yr;
-            yr << node;
-            dp.key = "Root";
-            dp.val = yr.str();
+            l.lock();
+            invalidate(key);
+            l.unlock();
+
+            for (int e = 0; e < ENCODINGS; ++e)
+            {
+                string topic = topic_prefix[e] + "Root";
+
+                if (has_subscriber(topic))
+                {
+                    data_package dp = {topic, encode(_index.root(), e)};
+                    packages.push_back(dp);
+                }
+            }
         }
         else
         {
-            vector<string> keys;
-            boost::split(keys, dp.key, boost::is_any_of("."));
+            vector<string> topics[ENCODINGS];
+            int first = ENCODINGS; // the first encoding anyone wants
+
+            for (size_t end = 0; end != string::npos;)
+            {
+                end = key.find('.', end + 1);
+                string prefix = key.substr(0, end);
+
+                for (int e = 0; e < ENCODINGS; ++e)
+                {
+                    if (has_subscriber(topic_prefix[e] + prefix))
+                    {
+                        topics[e].push_back(topic_prefix[e] + prefix);
+                        first = min(first, e);
+                    }
+                }
+            }
+
+            l.lock();
 
-            // Publish with keys
-            for (size_t i = 1; i < keys.size() + 1; ++i)
+            if (first == ENCODINGS)
             {
-                string key = boost::algorithm::join(vector<string>(keys.begin(), keys.begin() + i), ".");
-                yaml_result r = get_yaml_node(node, key);
+                invalidate(key);
+            }
+            else
+            {
+                yaml_result r = _index.lookup(key);
+                string topic = topic_prefix[first] + key;
+                map<string, string>::iterator i = _serialized.find(topic);
+                string val;
 
-                if (r.result == true)
+                if (r.result)
                 {
-                    ostringstream yr;
-                    // we just need the node that goes with the key.
-                    yr << r.node;
-                    dp.key = key;
-                    dp.val = yr.str();
+                    val = encode(r.node, first);
+                }
 
-                    if (block)
+                if (!r.result || i == _serialized.end() || i->second != val)
+                {
+                    invalidate(key);
+
+                    if (r.result)
                     {
-                        _data_queue.put(dp);
+                        _serialized[topic] = val;
                     }
-                    else
+                }
+
+                // Publish with keys
+                for (int e = 0; e < ENCODINGS; ++e)
+                {
+                    for (size_t k = 0; k < topics[e].size(); ++k)
                     {
-                        rval = rval and _data_queue.try_put(dp);
+                        if ((i = _serialized.find(topics[e][k])) == _serialized.end())
+                        {
+                            string prefix = topics[e][k].substr(topic_prefix[e].size());
+                            yaml_result r = _index.lookup(prefix);
+
+                            if (r.result != true)
+                            {
+                                continue;
+                            }
+
+                            // we just need the node that goes with the key.
+                            i = _serialized.insert(make_pair(topics[e][k], encode(r.node, e))).first;
+                        }
+
+                        data_package dp = {i->first, i->second};
+                        packages.push_back(dp);
                     }
                 }
             }
@@ -886,6 +1548,18 @@ bool KeymasterServer::KmImpl::publish(std::string key, bool block)
         return false;
     }
 
+    for (size_t k = 0; k < packages.size(); ++k)
+    {
+        if (block)
+        {
+            _data_queue.put(packages[k]);
+        }
+        else
+        {
+            rval = rval and _data_queue.try_put(packages[k]);
+        }
+    }
+
     return rval;
 }
 
@@ -1015,12 +1689,20 @@ void KeymasterServer::terminate()
  *
  * @param keymaster_url: The url for the keymaster service
  *
+ * @param msgpack: If true, requests, replies and subscribed data are
+ * exchanged with the keymaster in msgpack, if it supports it, rather
+ * than in YAML text. Encoding and parsing msgpack is much cheaper
+ * for both ends. The choice is invisible to the caller, who deals in
+ * YAML::Nodes either way. Defaults to false.
+ *
  */
 
-Keymaster::Keymaster(string keymaster_url, bool /* shared */)
+Keymaster::Keymaster(string keymaster_url, bool /* shared */, bool msgpack)
     :
     _km_url(keymaster_url),
     _pipe_url(string("inproc://") + gen_random_string(20)),
+    _use_msgpack(msgpack),
+    _msgpack(false),
     _subscriber_thread(this, &Keymaster::_subscriber_task),
     _subscriber_thread_ready(false),
     _put_thread(this, &Keymaster::_put_task),
@@ -1073,7 +1755,9 @@ Keymaster::~Keymaster()
  * @param key: A key to a YAML node. In form "key1.key2.key3" which
  * represents a hierarchy of YAML nodes on the Keymaster.
  *
- * @param val: A new value for the node pointet to by 'key'.
+ * @param val: A new value for the node pointet to by 'key', or NULL
+ * if the command takes none. It is sent in the encoding negotiated by
+ * `_keymaster_socket()`, as is the whole request.
  *
  * @param flag: A flag regulating the operation of PUT: if 'create'
  * PUT will create a new node at the specified key if one doesn't
@@ -1081,7 +1765,7 @@ Keymaster::~Keymaster()
  *
  */
 
-yaml_result Keymaster::_call_keymaster(string cmd, string key, string val, string flag)
+yaml_result Keymaster::_call_keymaster(string cmd, string key, YAML::Node const *val, string flag)
 {
     string response;
     yaml_result yr;
@@ -1099,14 +1783,28 @@ yaml_result Keymaster::_call_keymaster(string cmd, string key, string val, strin
 
         lck.lock();
         shared_ptr<zmq::socket_t> km = _keymaster_socket();
+
+        if (_msgpack)
+        {
+            z_send(*km, string("msgpack"), ZMQ_SNDMORE, KM_TIMEOUT);
+        }
+
         // always send a command
         z_send(*km, cmd, ZMQ_SNDMORE, KM_TIMEOUT);
         // always send a key
-        z_send(*km, key, val.empty() ? 0: ZMQ_SNDMORE, KM_TIMEOUT);
+        z_send(*km, key, val ? ZMQ_SNDMORE : 0, KM_TIMEOUT);
 
-        if (!val.empty())
+        if (val)
         {
-            z_send(*km, val, flag.empty() ? 0 : ZMQ_SNDMORE, KM_TIMEOUT);
+            ostringstream yaml_val;
+
+            if (!_msgpack)
+            {
+                yaml_val << *val;
+            }
+
+            z_send(*km, _msgpack ? yaml_to_msgpack(*val) : yaml_val.str(),
+                   flag.empty() ? 0 : ZMQ_SNDMORE, KM_TIMEOUT);
         }
 
         if (!flag.empty())
@@ -1117,7 +1815,14 @@ yaml_result Keymaster::_call_keymaster(string cmd, string key, string val, strin
         // use a reasonable time-out, in case Keymaster is gone.
         z_recv(*km, response, KM_TIMEOUT);
 
-        yr.from_yaml_node(YAML::Load(response));
+        if (_msgpack)
+        {
+            msgpack_to_yaml_result(response.data(), response.size(), yr);
+        }
+        else
+        {
+            yr.from_yaml_node(YAML::Load(response));
+        }
         _r = yr;
         return yr;
     }
@@ -1189,6 +1894,11 @@ void Keymaster::_handle_keymaster_server_exception()
  * and reset, this will construct a new one and attempt to reconnect
  * it.
  *
+ * A new socket also negotiates the encoding of requests and replies
+ * with the server: msgpack if both ends want it, otherwise YAML. A
+ * server that predates msgpack replies to the negotiation as to any
+ * unknown request, which also means YAML.
+ *
  * @return std::shared_ptr<zmq::socket_t>, which will point to a
  * socket connected to the Keymaster server.
  *
@@ -1203,6 +1913,18 @@ shared_ptr<zmq::socket_t> Keymaster::_keymaster_socket()
 
     _km_.reset(new zmq::socket_t(ZMQContext::Instance()->get_context(), ZMQ_REQ));
     _km_->connect(_km_url.c_str());
+    _msgpack = false;
+
+    if (_use_msgpack)
+    {
+        string encoding;
+
+        z_send(*_km_, string("ENCODING"), ZMQ_SNDMORE, KM_TIMEOUT);
+        z_send(*_km_, string("msgpack"), 0, KM_TIMEOUT);
+        z_recv(*_km_, encoding, KM_TIMEOUT);
+        _msgpack = encoding == "msgpack";
+    }
+
     return _km_;
 }
 
@@ -1317,10 +2039,8 @@ bool Keymaster::put(std::string key, YAML::Node n, bool create)
 {
     string cmd("PUT"), create_flag("create");
     yaml_result yr;
-    ostringstream val;
 
-    val << n;
-    yr = _call_keymaster(cmd, key, val.str(), create ? create_flag : "");
+    yr = _call_keymaster(cmd, key, &n, create ? create_flag : "");
     n.reset();
     return yr.result;
 }
@@ -1379,6 +2099,14 @@ bool Keymaster::del(std::string key)
  * keymaster. NOTE: The function does not assume ownership of this
  * object! This should be managed by the thread calling this function.
  *
+ * @param delta: If true, subscribe to deltas rather than to the whole
+ * subtree. The keymaster then publishes only what changed beneath
+ * 'key', with a sequence number, and the subscriber thread merges
+ * this into a cached copy of the subtree, which it fetches again if
+ * it ever misses a delta. 'f' is still called with the whole
+ * (merged) subtree. This is much cheaper for large subtrees that
+ * change a little at a time, such as the root.
+ *
  * @return: true if all went well. false means that the subscription
  * failed, which could happen if the keymaster is not running, so the
  * subscription thread could not be started (the subscription thread
@@ -1386,7 +2114,7 @@ bool Keymaster::del(std::string key)
  *
  */
 
-bool Keymaster::subscribe(string key, KeymasterCallbackBase *f)
+bool Keymaster::subscribe(string key, KeymasterCallbackBase *f, bool delta)
 {
     // first start the subscriber thread. If it's already running this
     // won't do anything.
@@ -1411,7 +2139,8 @@ bool Keymaster::subscribe(string key, KeymasterCallbackBase *f)
     pipe.connect(_pipe_url.c_str());
     z_send(pipe, SUBSCRIBE, ZMQ_SNDMORE);
     z_send(pipe, key, ZMQ_SNDMORE);
-    z_send(pipe, f, 0);
+    z_send(pipe, f, ZMQ_SNDMORE);
+    z_send(pipe, delta, 0);
     int rval;
     z_recv(pipe, rval);
     return rval ? true : false;
@@ -1622,18 +2351,48 @@ void Keymaster::_subscriber_task()
                 {
                     string key;
                     KeymasterCallbackBase *f_ptr;
+                    bool delta;
                     z_recv(pipe, key);
                     z_recv(pipe, f_ptr);
+                    z_recv(pipe, delta);
+
+                    // Subscribe in msgpack if that is what the
+                    // keymaster speaks.
+                    ThreadLock<Mutex> lck(_shared_lock);
+                    lck.lock();
+                    string prefix = topic_prefix[_msgpack ? MSGPACK_ENCODING : YAML_ENCODING];
+                    lck.unlock();
+
+                    // Subscribe to the deltas before fetching the
+                    // subtree they apply to, so that none are missed
+                    // in between.
+                    if (delta)
+                    {
+                        if (key == "Root")
+                        {
+                            key = "";
+                        }
 
-                    // Publisher publishes this as 'Root'. A
-                    // subscription with an empty key subscribes to all keys.
-                    if (key.empty())
+                        string topic = prefix + delta_topic(key);
+                        _callbacks[topic] = f_ptr;
+                        sub_sock.setsockopt(ZMQ_SUBSCRIBE, topic.c_str(), topic.length());
+                        _sync(key, _deltas[key]);
+                    }
+                    else
                     {
-                        key = "Root";
+                        // Publisher publishes this as 'Root'. A
+                        // subscription with an empty key subscribes
+                        // to all keys.
+                        if (key.empty())
+                        {
+                            key = "Root";
+                        }
+
+                        string topic = prefix + key;
+                        _callbacks[topic] = f_ptr;
+                        sub_sock.setsockopt(ZMQ_SUBSCRIBE, topic.c_str(), topic.length());
                     }
 
-                    _callbacks[key] = f_ptr;
-                    sub_sock.setsockopt(ZMQ_SUBSCRIBE, key.c_str(), key.length());
                     z_send(pipe, 1, 0);
                 }
                 else if (msg == UNSUBSCRIBE)
@@ -1646,11 +2405,25 @@ void Keymaster::_subscriber_task()
                         key = "Root";
                     }
 
-                    sub_sock.setsockopt(ZMQ_UNSUBSCRIBE, key.c_str(), key.length());
+                    string keychain = key == "Root" ? "" : key;
+                    bool delta = _deltas.erase(keychain);
 
-                    if (_callbacks.find(key) != _callbacks.end())
+                    // in whichever encoding it was subscribed to
+                    for (int e = 0; e < ENCODINGS; ++e)
                     {
-                        _callbacks.erase(key);
+                        string topic = topic_prefix[e] + key;
+
+                        if (_callbacks.erase(topic))
+                        {
+                            sub_sock.setsockopt(ZMQ_UNSUBSCRIBE, topic.c_str(), topic.length());
+                        }
+
+                        topic = topic_prefix[e] + delta_topic(keychain);
+
+                        if (delta && _callbacks.erase(topic))
+                        {
+                            sub_sock.setsockopt(ZMQ_UNSUBSCRIBE, topic.c_str(), topic.length());
+                        }
                     }
 
                     z_send(pipe, 1, 0);
@@ -1673,12 +2446,29 @@ void Keymaster::_subscriber_task()
                 if (!val.empty())
                 {
                     map<string, KeymasterCallbackBase *>::const_iterator mci;
+                    map<string, delta_cache>::iterator dci;
+                    string topic(key), keychain;
+                    int encoding = topic_encoding(topic);
                     mci = _callbacks.find(key);
 
                     if (mci != _callbacks.end())
                     {
-                        YAML::Node n = YAML::Load(val[0]);
-                        mci->second->exec(mci->first, n);
+                        YAML::Node n = encoding == MSGPACK_ENCODING
+                            ? msgpack_to_yaml(val[0].data(), val[0].size())
+                            : YAML::Load(val[0]);
+
+                        if (!delta_keychain(topic, keychain))
+                        {
+                            mci->second->exec(topic, n);
+                        }
+                        else if ((dci = _deltas.find(keychain)) != _deltas.end()
+                                 && _merge_delta(keychain, dci->second, n))
+                        {
+                            // The callback gets a copy, so that it
+                            // may keep or modify it.
+                            mci->second->exec(keychain.empty() ? "Root" : keychain,
+                                              YAML::Clone(dci->second.tree));
+                        }
                     }
                 }
             }
@@ -1694,6 +2484,11 @@ void Keymaster::_subscriber_task()
             cerr << Time::isoDateTime(Time::getUTC())
                  << " -- Keymaster subscriber task: " << e.what() << endl;
         }
+        catch (std::exception &e) // msgpack decoding
+        {
+            cerr << Time::isoDateTime(Time::getUTC())
+                 << " -- Keymaster subscriber task: " << e.what() << endl;
+        }
     }
 
     int zero = 0;
@@ -1704,6 +2499,109 @@ void Keymaster::_subscriber_task()
     sub_sock.close();
 }
 
+/**
+ * Fetches the subtree of a delta subscription, along with the
+ * sequence number of the last delta it includes. Called by the
+ * subscriber thread when it subscribes, and again whenever it finds
+ * it has missed a delta.
+ *
+ * @param keychain: The subscription's keychain; "" for the root.
+ *
+ * @param dc: The subscription's cache, which is replaced.
+ *
+ * @return true if the cache is now in sync, false if the keymaster
+ * could not be reached. In that case the next delta will try again.
+ *
+ */
+
+bool Keymaster::_sync(string const &keychain, delta_cache &dc)
+{
+    yaml_result yr = _call_keymaster("SYNC", keychain.empty() ? "Root" : keychain);
+
+    dc.synced = yr.result && yr.node.IsMap() && yr.node["seq"];
+
+    if (dc.synced)
+    {
+        dc.seq = yr.node["seq"].as<uint64_t>();
+        dc.tree.reset(YAML::Clone(yr.node["value"]));
+    }
+    else
+    {
+        cerr << Time::isoDateTime(Time::getUTC())
+             << " -- Keymaster: unable to sync deltas for '" << keychain
+             << "': " << yr.err << endl;
+    }
+
+    return dc.synced;
+}
+
+/**
+ * Merges a delta into the cached subtree of a delta subscription.
+ * A delta that is already in the cache is ignored. If one or more
+ * deltas were missed, the cache is refreshed with `_sync()`.
+ *
+ * @param keychain: The subscription's keychain; "" for the root.
+ *
+ * @param dc: The subscription's cache.
+ *
+ * @param delta: The delta, as published by the keymaster: a map of
+ * `seq`, `key`, `op` and, for a "put", `value`.
+ *
+ * @return true if the cache changed, false otherwise.
+ *
+ */
+
+bool Keymaster::_merge_delta(string const &keychain, delta_cache &dc, YAML::Node delta)
+{
+    uint64_t seq = delta["seq"].as<uint64_t>();
+
+    if (dc.synced && seq <= dc.seq)
+    {
+        return false;
+    }
+
+    if (!dc.synced || seq != dc.seq + 1)
+    {
+        return _sync(keychain, dc);
+    }
+
+    // the changed keychain, relative to the subscription's
+    string key = delta["key"].as<string>();
+    key = key.size() > keychain.size() ? key.substr(keychain.empty() ? 0 : keychain.size() + 1) : "";
+
+    if (delta["op"].as<string>() == "put")
+    {
+        if (key.empty())
+        {
+            dc.tree.reset(delta["value"]);
+        }
+        else
+        {
+            // the subtree may have been deleted, or never existed
+            if (!dc.tree || dc.tree.IsNull())
+            {
+                dc.tree.reset(YAML::Node(YAML::NodeType::Map));
+            }
+
+            put_yaml_node(dc.tree, key, delta["value"], true);
+        }
+    }
+    else
+    {
+        if (key.empty())
+        {
+            dc.tree.reset(YAML::Node());
+        }
+        else
+        {
+            delete_yaml_node(dc.tree, key);
+        }
+    }
+
+    dc.seq = seq;
+    return true;
+}
+
 /**
  * Starts the deferred put thread, if it is not already running.
  *
@@ -33,6 +33,10 @@
 #include "matrix/Keymaster.h"
 
 #include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <sched.h>
 
 using namespace std;
 using namespace mxutils;
@@ -77,20 +81,75 @@ namespace matrix
 
         bool publish(string key, string data);
         bool publish(string key, void const *data, size_t sze);
+        bool publish(topic_id_t topic, void const *data, size_t sze);
+        bool publish(topic_id_t topic, SharedBuffer const &buf);
         string get_urn();
         bool subscribe(string key, DataCallbackBase *cb);
         bool unsubscribe(string key, DataCallbackBase *cb);
 
         // This is how the server knows who its subscribers are. The
-        // first template arg is a key, which is in the form
-        // "component.data". So if component 'cat' emits data 'meow', the
-        // key would be "cat.meow". This class needs some way to
-        // populate this map. This is done via the 'subscribe' method.
-        Mutex _client_mutex;
-        multimap<string, DataCallbackBase *> _clients;
+        // table is keyed by the topic ID of the data key, which is in
+        // the form "component.data". So if component 'cat' emits data
+        // 'meow', the key would be "cat.meow". This class needs some
+        // way to populate this map. This is done via the 'subscribe'
+        // method.
+        //
+        // The table is never modified in place. Publishers take a
+        // snapshot of it with 'std::atomic_load()' and use it without
+        // any locking; 'subscribe()' and 'unsubscribe()' build a new
+        // table from a copy of the current one and swap it in with
+        // 'std::atomic_store()'. '_writer_mutex' serializes the
+        // writers only.
+        typedef vector<DataCallbackBase *> callback_list_t;
+        typedef map<topic_id_t, callback_list_t> client_table_t;
+
+        // A publish in progress on this thread. A callback may
+        // unsubscribe, and the unsubscribe cannot wait for the publish
+        // that called it; it finds that publish here instead, and
+        // marks it 'stale' if it was for the topic removed.
+        struct publish_frame
+        {
+            publish_frame(Impl *i, topic_id_t t, client_table_t const *tbl)
+                : impl(i), topic(t), table(tbl), stale(false), prev(top)
+            {
+                top = this;
+            }
+
+            ~publish_frame()
+            {
+                top = prev;
+            }
+
+            Impl *impl;
+            topic_id_t topic;
+            client_table_t const *table;
+            bool stale;
+            publish_frame *prev;
+
+            static thread_local publish_frame *top;
+        };
+
+        // A table that has been replaced, but that a publisher may
+        // still be using.
+        struct retired_table
+        {
+            client_table_t const *table;
+            weak_ptr<const client_table_t> ref;
+        };
+
+        shared_ptr<const client_table_t> _snapshot();
+        void _replace(shared_ptr<const client_table_t> new_table, bool wait_for_readers);
+        bool _deliver(topic_id_t topic, void const *data, size_t sze, SharedBuffer const *buf);
+
+        Mutex _writer_mutex;
+        shared_ptr<const client_table_t> _clients;
+        vector<retired_table> _retired;
         string _urn;
     };
 
+    thread_local RTTransportServer::Impl::publish_frame *
+    RTTransportServer::Impl::publish_frame::top = NULL;
+
     /**
      * Constructs an RTTransportServer implementation.
      *
@@ -99,6 +158,7 @@ namespace matrix
      */
 
     RTTransportServer::Impl::Impl(string urn)
+        : _clients(new client_table_t())
     {
         _urn = urn + "://" + gen_random_string(20);
     }
@@ -112,6 +172,125 @@ namespace matrix
     {
     }
 
+    /**
+     * Returns the current subscriber table. The returned table is
+     * immutable, and remains valid for as long as the caller holds the
+     * shared_ptr, even if a subscriber is added or removed in the
+     * meantime.
+     *
+     * @return A shared_ptr to the current subscriber table.
+     *
+     */
+
+    shared_ptr<const RTTransportServer::Impl::client_table_t>
+    RTTransportServer::Impl::_snapshot()
+    {
+        return atomic_load(&_clients);
+    }
+
+    /**
+     * Installs a new subscriber table. Must be called with
+     * '_writer_mutex' held.
+     *
+     * @param new_table: The table that replaces the current one.
+     *
+     * @param wait_for_readers: If `true`, does not return until every
+     * publisher on another thread that was using an earlier table has
+     * finished with it. This is needed when removing subscribers, as
+     * the caller may destroy the callback as soon as this returns.
+     * Publishes on this thread, which called the caller, are not waited
+     * for; `unsubscribe()` marks them instead.
+     *
+     */
+
+    void RTTransportServer::Impl::_replace(shared_ptr<const client_table_t> new_table,
+                                           bool wait_for_readers)
+    {
+        shared_ptr<const client_table_t> old_table = atomic_load(&_clients);
+        retired_table r = {old_table.get(), old_table};
+
+        atomic_store(&_clients, new_table);
+        old_table.reset();
+        _retired.push_back(r);
+
+        if (wait_for_readers)
+        {
+            // Publishers hold a copy of the table they use for the
+            // duration of a publish. Once the only copies left of a
+            // retired table are held by publishes further up this
+            // thread's stack, no publisher can call a callback from it.
+            for (vector<retired_table>::iterator i = _retired.begin(); i != _retired.end(); ++i)
+            {
+                long ours = 0;
+
+                for (publish_frame *f = publish_frame::top; f; f = f->prev)
+                {
+                    if (f->impl == this && f->table == i->table)
+                    {
+                        ++ours;
+                    }
+                }
+
+                while (i->ref.use_count() > ours)
+                {
+                    sched_yield();
+                }
+            }
+        }
+
+        for (vector<retired_table>::iterator i = _retired.begin(); i != _retired.end();)
+        {
+            i = i->ref.expired() ? _retired.erase(i) : i + 1;
+        }
+    }
+
+    /**
+     * Calls every callback subscribed to a topic, stopping early if one
+     * of them unsubscribes the topic.
+     *
+     * @param topic: The data's topic ID
+     *
+     * @param data: A pointer to the data, if 'buf' is NULL.
+     *
+     * @param sze: The size of the data buffer pointed to by 'data'
+     *
+     * @param buf: The buffer to publish, or NULL.
+     *
+     * @return true if there was a subscriber, false otherwise.
+     *
+     */
+
+    bool RTTransportServer::Impl::_deliver(topic_id_t topic, void const *data, size_t sze,
+                                           SharedBuffer const *buf)
+    {
+        shared_ptr<const client_table_t> clients = _snapshot();
+        client_table_t::const_iterator client = clients->find(topic);
+
+        if (client == clients->end())
+        {
+            return false;
+        }
+
+        publish_frame frame(this, topic, clients.get());
+
+        // Call all clients subscribed to the data represented by 'key'
+        // with the data.
+        for (callback_list_t::const_iterator cb = client->second.begin();
+             cb != client->second.end() && !frame.stale; ++cb)
+        {
+            if (buf)
+            {
+                (*cb)->exec(topic, *buf);
+            }
+            else
+            {
+                (*cb)->exec(topic, (void *)data, sze);
+            }
+        }
+
+        return !client->second.empty();
+    }
+
     /**
      * Published data by key, as a std::string.
      *
@@ -123,17 +302,12 @@ namespace matrix
 
     bool RTTransportServer::Impl::publish(string key, string data)
     {
-        return publish(key, data.data(), data.size());
+        return publish(TopicRegistry::intern(key), data.data(), data.size());
     }
 
     /**
-     * Publishes data by key, void * and size. Data from DataSinks are
-     * published with a key that corresponds to the source component and
-     * data, with the format 'source.data', where 'source' is the source
-     * component's name, and 'data' is the named data stream. Each data
-     * stream 'source.data' may have multiple clients. RTTransportServer,
-     * like ZMQ based transports, may publish the same data to multiple
-     * clients.
+     * Publishes data by key, void * and size. The key is interned on
+     * every call; DataSources avoid this by publishing by topic ID.
      *
      * @param key: The data key
      *
@@ -141,29 +315,56 @@ namespace matrix
      *
      * @param sze: The size of the data buffer pointed to by 'data'
      *
-     * @return true if publish succeeded, false otherwise. The call will
-     * fail if there is no subscriber.
+     * @return true if publish succeeded, false otherwise.
      *
      */
 
     bool RTTransportServer::Impl::publish(string key, void const *data, size_t sze)
     {
-        bool rval = false;
-        multimap<string, DataCallbackBase *>::iterator client;
-        ThreadLock<Mutex> l(_client_mutex);
+        return publish(TopicRegistry::intern(key), data, sze);
+    }
 
-        l.lock();
+    /**
+     * Publishes data by topic ID, void * and size. Data from DataSinks
+     * are published with the topic ID of a key that corresponds to the
+     * source component and data, with the format 'source.data', where
+     * 'source' is the source component's name, and 'data' is the named
+     * data stream. Each data stream 'source.data' may have multiple
+     * clients. RTTransportServer, like ZMQ based transports, may publish
+     * the same data to multiple clients.
+     *
+     * @param topic: The data's topic ID
+     *
+     * @param data: A pointer to the data
+     *
+     * @param sze: The size of the data buffer pointed to by 'data'
+     *
+     * @return true if publish succeeded, false otherwise. The call will
+     * fail if there is no subscriber.
+     *
+     */
 
-        // Find all clients subscribed to the data represented by 'key'.
-        for (client = _clients.equal_range(key).first;
-             client != _clients.equal_range(key).second; ++client)
-        {
-            // call their callbacks with the data.
-            client->second->exec(key, (void *)data, sze);
-            rval = true;
-        }
+    bool RTTransportServer::Impl::publish(topic_id_t topic, void const *data, size_t sze)
+    {
+        return _deliver(topic, data, sze, NULL);
+    }
+
+    /**
+     * Publishes a SharedBuffer by topic ID. Every subscriber receives a
+     * reference to the same buffer; the data is not copied.
+     *
+     * @param topic: The data's topic ID
+     *
+     * @param buf: The buffer to publish.
+     *
+     * @return true if publish succeeded, false otherwise. The call will
+     * fail if there is no subscriber.
+     *
+     */
 
-        return rval;
+    bool RTTransportServer::Impl::publish(topic_id_t topic, SharedBuffer const &buf)
+    {
+        return _deliver(topic, NULL, 0, &buf);
     }
 
     /**
@@ -200,10 +401,12 @@ namespace matrix
 
     bool RTTransportServer::Impl::subscribe(string key, DataCallbackBase *cb)
     {
-        ThreadLock<Mutex> l(_client_mutex);
+        ThreadLock<Mutex> l(_writer_mutex);
 
         l.lock();
-        _clients.insert(make_pair(key, cb));
+        shared_ptr<client_table_t> new_table(new client_table_t(*_snapshot()));
+        (*new_table)[TopicRegistry::intern(key)].push_back(cb);
+        _replace(new_table, false);
         return true;
     }
 
@@ -213,6 +416,11 @@ namespace matrix
      * class provides the public subscribe interface, and forwards the
      * request to this class.
      *
+     * Does not return until any publish in progress on another thread
+     * that might still call the removed callbacks has completed. A
+     * callback may unsubscribe from within a publish; that publish
+     * calls none of the removed callbacks after it returns.
+     *
      * @param key: The data key.
      *
      * @param cb: The callback functor pointer. This should match the one
@@ -225,25 +433,37 @@ namespace matrix
 
     bool RTTransportServer::Impl::unsubscribe(string key, DataCallbackBase *)
     {
-        bool rval = false;
-        multimap<string, DataCallbackBase *>::iterator client;
-        ThreadLock<Mutex> l(_client_mutex);
+        ThreadLock<Mutex> l(_writer_mutex);
+
+        topic_id_t topic = TopicRegistry::intern(key);
 
         l.lock();
+        shared_ptr<const client_table_t> clients = _snapshot();
+
+        if (clients->find(topic) == clients->end())
+        {
+            return false;
+        }
 
         // Many clients may be registered for this data under
-        // 'key'. Look for an exact match of key, cb:
+        // 'key'.
         // Note: We delete all clients for a given key with the rtproc
         // transport because the unsubscribe call here only is
         // called once due to reference counting on the TC. -- JJB
-        for (client = _clients.equal_range(key).first;
-             client != _clients.equal_range(key).second; ++client)
+        shared_ptr<client_table_t> new_table(new client_table_t(*clients));
+        new_table->erase(topic);
+        clients.reset();
+
+        for (publish_frame *f = publish_frame::top; f; f = f->prev)
         {
-            _clients.erase(client);
-            rval = true;
+            if (f->impl == this && f->topic == topic)
+            {
+                f->stale = true;
+            }
         }
 
-        return rval;
+        _replace(new_table, true);
+        return true;
     }
 
     /**
@@ -356,4 +576,43 @@ namespace matrix
         return _impl->publish(key, data);
     }
 
+
+    /**
+     * This private function provides the TransportServer 'publish()'
+     * functionality for DataSources, which publish by topic ID.
+     *
+     * @param topic: The data's topic ID.
+     *
+     * @param data: A pointer to the data buffer to publish
+     *
+     * @param size_of_data: The size of the 'data' buffer in bytes.
+     *
+     * @return true on success, false otherwise. Failure simply indicates
+     * that there is no client subscribed for this data.
+     *
+     */
+
+    bool RTTransportServer::_publish(topic_id_t topic, const void *data, size_t size_of_data)
+    {
+        return _impl->publish(topic, data, size_of_data);
+    }
+
+    /**
+     * This private function provides the TransportServer 'publish()'
+     * functionality for DataSource<SharedBuffer>. The buffer is handed
+     * to the subscribers by reference.
+     *
+     * @param topic: The data's topic ID.
+     *
+     * @param buf: The buffer to publish.
+     *
+     * @return true on success, false otherwise. Failure simply indicates
+     * that there is no client subscribed for this data.
+     *
+     */
+
+    bool RTTransportServer::_publish(topic_id_t topic, SharedBuffer const &buf)
+    {
+        return _impl->publish(topic, buf);
+    }
 }
@@ -0,0 +1,428 @@
+/*******************************************************************
+ *  ShmTransportClient.cc - Implementation of the shared memory
+ *  transport client.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#include "matrix/ShmTransportClient.h"
+#include "matrix/DataCallback.h"
+#include "matrix/shm_ring.h"
+#include "matrix/Mutex.h"
+#include "matrix/ThreadLock.h"
+#include "matrix/Thread.h"
+#include "matrix/Time.h"
+
+#include <iostream>
+#include <map>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace matrix
+{
+    TransportClient *ShmTransportClient::factory(string urn)
+    {
+        return new ShmTransportClient(urn);
+    }
+
+    struct ShmTransportClient::Impl
+    {
+        Impl() :
+            _segment_size(0),
+            _hdr(NULL),
+            _data(NULL),
+            _slot(-1),
+            _lost(0),
+            _running(false),
+            _connected(false),
+            _reader_thread(this, &ShmTransportClient::Impl::reader_task)
+        {}
+
+        ~Impl()
+        {
+            disconnect();
+        }
+
+        bool connect(string urn);
+        bool disconnect();
+        bool subscribe(string key, DataCallbackBase *cb);
+        bool unsubscribe(string key);
+
+        void reader_task();
+        void _report_loss();
+
+        bool _map(string urn);
+        void _unmap();
+
+        size_t _segment_size;
+        shm::ring_header *_hdr;
+        unsigned char *_data;
+        int _slot;
+        uint64_t _lost;
+        std::string _urn;
+        std::atomic<bool> _running;
+        bool _connected;
+        Thread<ShmTransportClient::Impl> _reader_thread;
+        Mutex _subscribers_mutex;
+        map<topic_id_t, DataCallbackBase *> _subscribers;
+    };
+
+    /**
+     * Maps the server's shared memory object and checks that it is a
+     * ring this client understands.
+     *
+     * @param urn: The server's URN, 'shm://<shared memory object name>'.
+     *
+     * @return true if the ring was mapped, false otherwise.
+     *
+     */
+
+    bool ShmTransportClient::Impl::_map(string urn)
+    {
+        string now = Time::isoDateTime(Time::getUTC()) + " -- ShmTransportClient for URN " + urn;
+        string prefix = "shm://";
+
+        if (urn.compare(0, prefix.size(), prefix) != 0)
+        {
+            cerr << now << ": not an shm URN." << endl;
+            return false;
+        }
+
+        string name = urn.substr(prefix.size());
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        struct stat st;
+
+        if (fd == -1)
+        {
+            cerr << now << ": shm_open: " << strerror(errno) << endl;
+            return false;
+        }
+
+        if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(shm::ring_header))
+        {
+            cerr << now << ": shared memory object is too small." << endl;
+            close(fd);
+            return false;
+        }
+
+        void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (p == MAP_FAILED)
+        {
+            cerr << now << ": mmap: " << strerror(errno) << endl;
+            return false;
+        }
+
+        _hdr = (shm::ring_header *)p;
+        _segment_size = st.st_size;
+
+        if (_hdr->magic != shm::MAGIC || _hdr->version != shm::VERSION
+            || shm::segment_size(_hdr->capacity) > _segment_size)
+        {
+            cerr << now << ": not a compatible matrix shared memory ring." << endl;
+            _unmap();
+            return false;
+        }
+
+        _data = shm::data_area(_hdr);
+        return true;
+    }
+
+    void ShmTransportClient::Impl::_unmap()
+    {
+        if (_hdr)
+        {
+            munmap(_hdr, _segment_size);
+            _hdr = NULL;
+            _data = NULL;
+        }
+    }
+
+    /**
+     * Maps the ring, registers as one of its readers, and starts the
+     * reader thread. Reading starts with the next message published.
+     *
+     * @param urn: The server's URN.
+     *
+     * @return true on success, false otherwise.
+     *
+     */
+
+    bool ShmTransportClient::Impl::connect(string urn)
+    {
+        if (_connected)
+        {
+            return false;
+        }
+
+        if (!_map(urn))
+        {
+            return false;
+        }
+
+        for (int i = 0; i < shm::MAX_READERS && _slot == -1; ++i)
+        {
+            pid_t free_slot = 0;
+
+            if (_hdr->readers[i].pid.compare_exchange_strong(free_slot, getpid()))
+            {
+                _hdr->readers[i].busy.store(shm::IDLE);
+                _hdr->readers[i].lost.store(0);
+                _hdr->readers[i].tail.store(_hdr->head.load(std::memory_order_acquire),
+                                            std::memory_order_release);
+                _slot = i;
+            }
+        }
+
+        if (_slot == -1)
+        {
+            cerr << Time::isoDateTime(Time::getUTC())
+                 << " -- ShmTransportClient for URN " << urn
+                 << ": all " << shm::MAX_READERS << " reader slots are in use." << endl;
+            _unmap();
+            return false;
+        }
+
+        _lost = 0;
+        _urn = urn;
+        _running = true;
+
+        if (_reader_thread.start() != 0)
+        {
+            cerr << Time::isoDateTime(Time::getUTC())
+                 << " -- ShmTransportClient for URN " << urn
+                 << ": failure to start reader thread." << endl;
+            _running = false;
+            _hdr->readers[_slot].pid.store(0);
+            _slot = -1;
+            _unmap();
+            return false;
+        }
+
+        _connected = true;
+        return true;
+    }
+
+    /**
+     * Stops the reader thread, gives up the reader slot and unmaps the
+     * ring.
+     *
+     * @return true if it was connected, false otherwise.
+     *
+     */
+
+    bool ShmTransportClient::Impl::disconnect()
+    {
+        if (_connected)
+        {
+            _running = false;
+            shm::futex_wake_all(&_hdr->futex);
+            _reader_thread.stop_without_cancel();
+            _hdr->readers[_slot].pid.store(0, std::memory_order_release);
+            _slot = -1;
+            _unmap();
+            _connected = false;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool ShmTransportClient::Impl::subscribe(string key, DataCallbackBase *cb)
+    {
+        ThreadLock<Mutex> l(_subscribers_mutex);
+
+        if (key.empty())
+        {
+            return false;
+        }
+
+        l.lock();
+        _subscribers[TopicRegistry::intern(key)] = cb;
+        return true;
+    }
+
+    bool ShmTransportClient::Impl::unsubscribe(string key)
+    {
+        ThreadLock<Mutex> l(_subscribers_mutex);
+
+        l.lock();
+        return _subscribers.erase(TopicRegistry::intern(key)) > 0;
+    }
+
+    /**
+     * Waits for records in the ring and hands them to the subscribers'
+     * callbacks in place. The tail is advanced past a record only after
+     * its callbacks return, so the server will not overwrite a record
+     * while it is being read.
+     *
+     * If the reader falls so far behind that the server evicts it, the
+     * server moves its tail up to the head. The record being read, if
+     * any, is announced in the slot's 'busy' position, which the server
+     * steps around instead. The reader reports the loss and carries on
+     * from the new tail.
+     *
+     */
+
+    void ShmTransportClient::Impl::reader_task()
+    {
+        shm::reader_slot &slot = _hdr->readers[_slot];
+        uint64_t capacity = _hdr->capacity;
+        uint64_t tail = slot.tail.load(std::memory_order_acquire);
+
+        while (_running)
+        {
+            uint64_t head = _hdr->head.load(std::memory_order_acquire);
+
+            if (tail == head)
+            {
+                // Register as a waiter before checking the head a
+                // second time, so that either the publisher sees us
+                // waiting or we see its new head.
+                uint32_t f = _hdr->futex.load(std::memory_order_acquire);
+                _hdr->waiters.fetch_add(1);
+
+                if (_hdr->head.load(std::memory_order_acquire) == tail)
+                {
+                    shm::futex_wait(&_hdr->futex, f, 100000);
+                }
+
+                _hdr->waiters.fetch_sub(1);
+                continue;
+            }
+
+            ThreadLock<Mutex> l(_subscribers_mutex);
+            l.lock();
+
+            while (tail != head)
+            {
+                // The header is copied while the tail still holds the
+                // record, as the server may pad over it once it evicts
+                // us. Then the record is announced in 'busy' and the
+                // tail checked again. These, like the server's move of
+                // the tail and its load of 'busy', are sequentially
+                // consistent, so either we see the eviction or the
+                // server sees 'busy'.
+                shm::record_header *rec = (shm::record_header *)(_data + tail % capacity);
+                shm::record_header h = *rec;
+                uint64_t next = tail + h.length;
+                bool evicted = slot.tail.load() != tail;
+
+                if (!evicted)
+                {
+                    slot.busy_end.store(next);
+                    slot.busy.store(tail);
+                    evicted = slot.tail.load() != tail;
+                }
+
+                if (evicted)
+                {
+                    slot.busy.store(shm::IDLE);
+                    tail = slot.tail.load();
+                    _report_loss();
+                    break;
+                }
+
+                if (h.flags == shm::DATA)
+                {
+                    map<topic_id_t, DataCallbackBase *>::const_iterator i =
+                        _subscribers.find(h.topic);
+
+                    if (i != _subscribers.end())
+                    {
+                        i->second->exec(h.topic, (void *)(rec + 1), h.size);
+                    }
+                }
+
+                // 'tail' becomes the evicted position if this fails.
+                evicted = !slot.tail.compare_exchange_strong(tail, next);
+                slot.busy.store(shm::IDLE);
+
+                if (evicted)
+                {
+                    _report_loss();
+                    break;
+                }
+
+                tail = next;
+            }
+        }
+    }
+
+    /**
+     * Reports the messages the server skipped when it evicted this
+     * reader.
+     *
+     */
+
+    void ShmTransportClient::Impl::_report_loss()
+    {
+        uint64_t lost = _hdr->readers[_slot].lost.load();
+
+        if (lost != _lost)
+        {
+            cerr << Time::isoDateTime(Time::getUTC())
+                 << " -- ShmTransportClient for URN " << _urn
+                 << ": fell behind, " << lost - _lost << " messages lost." << endl;
+            _lost = lost;
+        }
+    }
+
+    ShmTransportClient::ShmTransportClient(string urn)
+        : TransportClient(urn),
+          _impl(new Impl())
+    {
+    }
+
+    ShmTransportClient::~ShmTransportClient()
+    {
+        _impl->disconnect();
+    }
+
+    bool ShmTransportClient::_connect()
+    {
+        return _impl->connect(_urn);
+    }
+
+    bool ShmTransportClient::_disconnect()
+    {
+        return _impl->disconnect();
+    }
+
+    bool ShmTransportClient::_subscribe(string key, DataCallbackBase *cb)
+    {
+        return _impl->subscribe(key, cb);
+    }
+
+    bool ShmTransportClient::_unsubscribe(string key)
+    {
+        return _impl->unsubscribe(key);
+    }
+}
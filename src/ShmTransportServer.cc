@@ -0,0 +1,568 @@
+/*******************************************************************
+ *  ShmTransportServer.cc - Implementation of the shared memory
+ *  transport server.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#include "matrix/ShmTransportServer.h"
+#include "matrix/shm_ring.h"
+#include "matrix/Keymaster.h"
+#include "matrix/Mutex.h"
+#include "matrix/ThreadLock.h"
+#include "matrix/Time.h"
+#include "matrix/zmq_util.h"
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace mxutils;
+
+namespace matrix
+{
+    /**
+     * Creates a ShmTransportServer, returning a TransportServer pointer
+     * to it. This is a static function that can be used by
+     * TransportServer::create() to create this type of object based
+     * solely on the transports provided to create().
+     *
+     * @param km_urn: the URN to the keymaster.
+     *
+     * @param key: The key to query the keymaster for the transport's
+     * configuration.
+     *
+     * @return A TransportServer * pointing to the created ShmTransportServer.
+     *
+     */
+
+    TransportServer *ShmTransportServer::factory(string km_url, string key)
+    {
+        TransportServer *ds = new ShmTransportServer(km_url, key);
+        return ds;
+    }
+
+    /**
+     * \class Impl is the private implementation of the ShmTransportServer class.
+     *
+     */
+
+    struct ShmTransportServer::Impl
+    {
+        Impl(uint64_t capacity, mode_t mode);
+        ~Impl();
+
+        bool publish(topic_id_t topic, void const *data, size_t sze);
+        string get_urn();
+
+        struct held_record
+        {
+            uint64_t begin;
+            uint64_t end;
+        };
+
+        uint64_t _min_tail();
+        void _reclaim_dead_readers();
+        void _evict_lagging_readers(uint64_t end);
+        uint64_t _count_records(uint64_t from, uint64_t to);
+        int _held_records(held_record *held);
+        uint64_t _place(uint64_t pos, uint64_t length,
+                        held_record const *held, int n, bool write);
+
+        string _name;
+        size_t _segment_size;
+        shm::ring_header *_hdr;
+        unsigned char *_data;
+        Mutex _publish_mutex;
+    };
+
+    /**
+     * Creates and maps the shared memory object, and initializes the
+     * ring header.
+     *
+     * @param capacity: The size of the data ring, in bytes.
+     *
+     * @param mode: The permissions of the shared memory object.
+     *
+     */
+
+    ShmTransportServer::Impl::Impl(uint64_t capacity, mode_t mode)
+        : _name("/matrix." + gen_random_string(20)),
+          _segment_size(shm::segment_size(shm::aligned(capacity))),
+          _hdr(NULL),
+          _data(NULL)
+    {
+        int fd = shm_open(_name.c_str(), O_RDWR | O_CREAT | O_EXCL, mode);
+
+        if (fd == -1)
+        {
+            throw CreationError(string("shm_open: ") + strerror(errno));
+        }
+
+        // shm_open() applies the umask; the mode asked for is the mode
+        // wanted.
+        fchmod(fd, mode);
+
+        if (ftruncate(fd, _segment_size) == -1)
+        {
+            string err = strerror(errno);
+            close(fd);
+            shm_unlink(_name.c_str());
+            throw CreationError("ftruncate: " + err);
+        }
+
+        void *p = mmap(NULL, _segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (p == MAP_FAILED)
+        {
+            string err = strerror(errno);
+            shm_unlink(_name.c_str());
+            throw CreationError("mmap: " + err);
+        }
+
+        _hdr = new (p) shm::ring_header();
+        _hdr->capacity = shm::aligned(capacity);
+        _hdr->head.store(0);
+        _hdr->futex.store(0);
+        _hdr->waiters.store(0);
+
+        for (int i = 0; i < shm::MAX_READERS; ++i)
+        {
+            _hdr->readers[i].pid.store(0);
+            _hdr->readers[i].tail.store(0);
+            _hdr->readers[i].busy.store(shm::IDLE);
+            _hdr->readers[i].busy_end.store(0);
+            _hdr->readers[i].lost.store(0);
+        }
+
+        _hdr->version = shm::VERSION;
+        _hdr->magic = shm::MAGIC;
+        _data = shm::data_area(_hdr);
+    }
+
+    /**
+     * Unlinks and unmaps the shared memory object. Clients that still
+     * have it mapped keep their mappings until they disconnect.
+     *
+     */
+
+    ShmTransportServer::Impl::~Impl()
+    {
+        shm_unlink(_name.c_str());
+        munmap(_hdr, _segment_size);
+    }
+
+    string ShmTransportServer::Impl::get_urn()
+    {
+        return "shm://" + _name;
+    }
+
+    /**
+     * Returns the position of the slowest registered reader, or the
+     * head if there are none.
+     *
+     */
+
+    uint64_t ShmTransportServer::Impl::_min_tail()
+    {
+        uint64_t head = _hdr->head.load(std::memory_order_relaxed);
+        uint64_t min_tail = head;
+
+        for (int i = 0; i < shm::MAX_READERS; ++i)
+        {
+            if (_hdr->readers[i].pid.load(std::memory_order_acquire))
+            {
+                uint64_t tail = _hdr->readers[i].tail.load(std::memory_order_acquire);
+
+                if (tail < min_tail)
+                {
+                    min_tail = tail;
+                }
+            }
+        }
+
+        return min_tail;
+    }
+
+    /**
+     * Frees the slots of readers whose processes no longer exist, so
+     * that a client that crashed does not block the ring forever.
+     *
+     */
+
+    void ShmTransportServer::Impl::_reclaim_dead_readers()
+    {
+        for (int i = 0; i < shm::MAX_READERS; ++i)
+        {
+            pid_t pid = _hdr->readers[i].pid.load();
+
+            if (pid && kill(pid, 0) == -1 && errno == ESRCH)
+            {
+                _hdr->readers[i].pid.compare_exchange_strong(pid, 0);
+            }
+        }
+    }
+
+    /**
+     * Moves the tail of every reader that keeps the ring from holding
+     * data up to 'end' up to the head, so that one slow reader does not
+     * stall the others. The records each one skips are added to its
+     * slot's 'lost' count, for the reader to report.
+     *
+     * @param end: The position the ring must be able to reach.
+     *
+     */
+
+    void ShmTransportServer::Impl::_evict_lagging_readers(uint64_t end)
+    {
+        uint64_t capacity = _hdr->capacity;
+        uint64_t head = _hdr->head.load(std::memory_order_relaxed);
+
+        for (int i = 0; i < shm::MAX_READERS; ++i)
+        {
+            shm::reader_slot &slot = _hdr->readers[i];
+            uint64_t tail = slot.tail.load();
+            uint64_t lost = 0;
+
+            if (!slot.pid.load() || end - tail <= capacity)
+            {
+                continue;
+            }
+
+            // A tail more than a ring behind belongs to a reader still
+            // claiming the slot; there is nothing to count. Otherwise
+            // the count goes in before the tail moves, so that it is
+            // complete when the reader sees the move.
+            if (head - tail <= capacity)
+            {
+                lost = _count_records(tail, head);
+                slot.lost.fetch_add(lost);
+            }
+
+            if (!slot.tail.compare_exchange_strong(tail, head))
+            {
+                // The reader moved on; try again on the next publish.
+                slot.lost.fetch_sub(lost);
+            }
+        }
+    }
+
+    /**
+     * Counts the data records between two record boundaries.
+     *
+     */
+
+    uint64_t ShmTransportServer::Impl::_count_records(uint64_t from, uint64_t to)
+    {
+        uint64_t capacity = _hdr->capacity;
+        uint64_t n = 0;
+
+        while (from < to)
+        {
+            shm::record_header *rec = (shm::record_header *)(_data + from % capacity);
+
+            if (rec->length == 0)
+            {
+                break;
+            }
+
+            if (rec->flags == shm::DATA)
+            {
+                ++n;
+            }
+
+            from += rec->length;
+        }
+
+        return n;
+    }
+
+    /**
+     * Collects the records that evicted readers are still using. Called
+     * after any eviction: the writer moves a tail and then reads 'busy',
+     * the reader stores 'busy' and then checks its tail, all with
+     * sequential consistency, so either the reader sees that it was
+     * evicted or the record it holds is found here.
+     *
+     * @param held: An array of `shm::MAX_READERS` records to fill in.
+     *
+     * @return The number of records filled in.
+     *
+     */
+
+    int ShmTransportServer::Impl::_held_records(held_record *held)
+    {
+        int n = 0;
+
+        for (int i = 0; i < shm::MAX_READERS; ++i)
+        {
+            shm::reader_slot &slot = _hdr->readers[i];
+            uint64_t busy = slot.busy.load();
+
+            // A reader that has not been evicted holds its record
+            // through its tail.
+            if (!slot.pid.load() || busy == shm::IDLE || busy >= slot.tail.load())
+            {
+                continue;
+            }
+
+            held[n].begin = busy;
+            held[n].end = slot.busy_end.load();
+
+            // The reader stores 'busy_end' before 'busy', so if 'busy'
+            // did not change the end is the one that goes with it.
+            if (slot.busy.load() == busy)
+            {
+                ++n;
+            }
+        }
+
+        return n;
+    }
+
+    /**
+     * Finds the position at which a record will go, after padding out
+     * the end of the ring and the places held records occupy. A record
+     * may be held for many passes through the ring, so it is stepped
+     * around on every one.
+     *
+     * @param pos: The head.
+     *
+     * @param length: The length of the record.
+     *
+     * @param held: The held records.
+     *
+     * @param n: The number of held records.
+     *
+     * @param write: If true, write the `PAD` records, else only find the
+     * position.
+     *
+     * @return The position of the record.
+     *
+     */
+
+    uint64_t ShmTransportServer::Impl::_place(uint64_t pos, uint64_t length,
+                                              held_record const *held, int n, bool write)
+    {
+        uint64_t capacity = _hdr->capacity;
+
+        for (;;)
+        {
+            uint64_t offset = pos % capacity;
+            uint64_t end = offset + length > capacity ? pos + capacity - offset : pos;
+
+            for (int i = 0; i < n; ++i)
+            {
+                uint64_t begin = held[i].begin % capacity;
+                uint64_t held_end = begin + held[i].end - held[i].begin;
+
+                if (offset < held_end && offset + length > begin
+                    && pos + held_end - offset > end)
+                {
+                    // The pad's header may overwrite the held record's
+                    // header, which the reader has already copied.
+                    end = pos + held_end - offset;
+                }
+            }
+
+            if (end == pos)
+            {
+                return pos;
+            }
+
+            if (write)
+            {
+                shm::record_header *p = (shm::record_header *)(_data + offset);
+                p->length = end - pos;
+                p->size = 0;
+                p->topic = 0;
+                p->flags = shm::PAD;
+            }
+
+            pos = end;
+        }
+    }
+
+    /**
+     * Copies a message into the ring and wakes any waiting clients.
+     * Readers too far behind for it to fit are evicted first.
+     *
+     * @param topic: The topic ID of the data's key.
+     *
+     * @param data: A pointer to the data.
+     *
+     * @param sze: The size of the data, in bytes.
+     *
+     * @return true if the message was placed in the ring, false if
+     * there was no room for it even after evicting the readers in the
+     * way.
+     *
+     */
+
+    bool ShmTransportServer::Impl::publish(topic_id_t topic, void const *data, size_t sze)
+    {
+        ThreadLock<Mutex> l(_publish_mutex);
+        uint64_t capacity = _hdr->capacity;
+        uint64_t length = shm::aligned(sizeof(shm::record_header) + sze);
+        held_record held[shm::MAX_READERS];
+        uint64_t head, start;
+        int n;
+
+        l.lock();
+        head = _hdr->head.load(std::memory_order_relaxed);
+        n = _held_records(held);
+
+        if (_place(head, length, held, 0, false) + length - head > capacity)
+        {
+            cerr << Time::isoDateTime(Time::getUTC())
+                 << " -- ShmTransportServer: message of " << sze
+                 << " bytes does not fit in the " << capacity
+                 << " byte ring for " << _name << endl;
+            return false;
+        }
+
+        start = _place(head, length, held, n, false);
+
+        if (start + length - _min_tail() > capacity)
+        {
+            _reclaim_dead_readers();
+            _evict_lagging_readers(start + length);
+            n = _held_records(held);
+            start = _place(head, length, held, n, false);
+
+            if (start + length - _min_tail() > capacity)
+            {
+                return false;
+            }
+        }
+
+        _place(head, length, held, n, true);
+        shm::record_header *rec = (shm::record_header *)(_data + start % capacity);
+        rec->length = length;
+        rec->size = sze;
+        rec->topic = topic;
+        rec->flags = shm::DATA;
+        memcpy(rec + 1, data, sze);
+
+        _hdr->head.store(start + length, std::memory_order_release);
+        _hdr->futex.fetch_add(1, std::memory_order_release);
+
+        if (_hdr->waiters.load(std::memory_order_acquire))
+        {
+            shm::futex_wake_all(&_hdr->futex);
+        }
+
+        return true;
+    }
+
+    /**
+     * Constructs the ShmTransportServer, creating the shared memory ring
+     * and registering its URN with the Keymaster.
+     *
+     * @param keymaster_url: The keymaster URN.
+     *
+     * @param key: The data transport key that specifies the transport
+     * configuration.
+     *
+     */
+
+    ShmTransportServer::ShmTransportServer(string keymaster_url, string key)
+        : TransportServer(keymaster_url, key)
+    {
+        try
+        {
+            Keymaster km(_km_url);
+            uint64_t capacity = 16 * 1024 * 1024;
+            mode_t mode = 0600;
+
+            try
+            {
+                capacity = km.get_as<uint64_t>(_transport_key + ".BufferSize");
+            }
+            catch (KeymasterException &e)
+            {
+                // not given, use the default.
+            }
+
+            try
+            {
+                // an octal string, e.g. "0660", as for chmod.
+                string m = km.get_as<string>(_transport_key + ".Mode");
+                mode = strtoul(m.c_str(), NULL, 8) & 0777;
+            }
+            catch (KeymasterException &e)
+            {
+                // not given, use the default.
+            }
+
+            // will throw CreationError if it fails.
+            _impl.reset(new Impl(capacity, mode));
+
+            vector<string> urns;
+            urns.push_back(_impl->get_urn());
+            km.put(_transport_key + ".AsConfigured", urns, true);
+        }
+        catch (KeymasterException &e)
+        {
+            throw CreationError(e.what());
+        }
+    }
+
+    ShmTransportServer::~ShmTransportServer()
+    {
+        _impl.reset();
+
+        try
+        {
+            Keymaster km(_km_url);
+            km.del(_transport_key + ".AsConfigured");
+        }
+        catch (KeymasterException &e)
+        {
+            // The Keymaster may already be gone.
+        }
+    }
+
+    bool ShmTransportServer::_publish(string key, const void *data, size_t size_of_data)
+    {
+        return _impl->publish(TopicRegistry::intern(key), data, size_of_data);
+    }
+
+    bool ShmTransportServer::_publish(string key, string data)
+    {
+        return _impl->publish(TopicRegistry::intern(key), data.data(), data.size());
+    }
+
+    bool ShmTransportServer::_publish(topic_id_t topic, const void *data, size_t size_of_data)
+    {
+        return _impl->publish(topic, data, size_of_data);
+    }
+}
@@ -397,68 +397,62 @@ namespace matrix
     GenericBuffer TestDataGenerator::_create_generic_buffer(vector<string> &init_vals, data_description dd)
     {
         GenericBuffer gb;
+        compiled_description cd(dd);
 
-        // size() computes the size and also the offsets of the
-        // data. The latter are stored as the 'offset' field in the
-        // data_field element type of 'fields'. See above.
-        gb.resize(dd.size());
+        gb.resize(cd.size());
 
-        // for each element in 'fields', create the appropriate
-        // pointer and store the initial value in the proper place in
-        // the buffer.
+        // for each field store the initial value in the proper place
+        // in the buffer.
 
-        int k = 0;
-
-        for (std::list<data_description::data_field>::iterator i = dd.fields.begin();
-             i != dd.fields.end(); ++i, ++k)
+        for (size_t k = 0; k < cd.num_fields(); ++k)
         {
             string v = init_vals[k];
-            data_description::types ft = i->type;
-            size_t o = i->offset;
+            data_description::types ft = cd[k].type;
+            unsigned char *b = gb.data();
 
             if (ft == data_description::INT8_T || ft == data_description::CHAR)
             {
-                set_data_buffer_value(gb.data(), o, convert<int8_t>(v));
+                cd.set(b, k, convert<int8_t>(v));
             }
             else if (ft == data_description::UINT8_T || ft == data_description::UNSIGNED_CHAR)
             {
-                set_data_buffer_value(gb.data(), o, convert<uint8_t>(v));
+                cd.set(b, k, convert<uint8_t>(v));
             }
             else if (ft == data_description::INT16_T || ft == data_description::SHORT)
             {
-                set_data_buffer_value(gb.data(), o, convert<int16_t>(v));
+                cd.set(b, k, convert<int16_t>(v));
             }
             else if (ft == data_description::UINT16_T || ft == data_description::UNSIGNED_SHORT)
             {
-                set_data_buffer_value(gb.data(), o, convert<uint16_t>(v));
+                cd.set(b, k, convert<uint16_t>(v));
             }
             else if (ft == data_description::INT32_T || ft == data_description::INT)
             {
-                set_data_buffer_value(gb.data(), o, convert<int32_t>(v));
+                cd.set(b, k, convert<int32_t>(v));
             }
             else if (ft == data_description::UINT32_T || ft == data_description::UNSIGNED_INT)
             {
-                set_data_buffer_value(gb.data(), o, convert<uint32_t>(v));
+                cd.set(b, k, convert<uint32_t>(v));
             }
             else if (ft == data_description::INT64_T || ft == data_description::LONG)
             {
-                set_data_buffer_value(gb.data(), o, convert<int64_t>(v));
+                cd.set(b, k, convert<int64_t>(v));
             }
             else if (ft == data_description::UINT64_T || ft == data_description::UNSIGNED_LONG)
             {
-                set_data_buffer_value(gb.data(), o, convert<uint64_t>(v));
+                cd.set(b, k, convert<uint64_t>(v));
             }
             else if (ft == data_description::BOOL)
             {
-                set_data_buffer_value(gb.data(),o,convert<bool>(v));
+                cd.set(b, k, convert<bool>(v));
             }
             else if (ft == data_description::FLOAT)
             {
-                set_data_buffer_value(gb.data(), o, convert<float>(v));
+                cd.set(b, k, convert<float>(v));
             }
             else if (ft == data_description::DOUBLE)
             {
-                set_data_buffer_value(gb.data(), o, convert<double>(v));
+                cd.set(b, k, convert<double>(v));
             }
         }
 
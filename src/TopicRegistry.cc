@@ -0,0 +1,141 @@
+/*******************************************************************
+ *  TopicRegistry.cc - Implements the data key to topic ID registry.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#include "matrix/TopicRegistry.h"
+#include "matrix/Mutex.h"
+#include "matrix/ThreadLock.h"
+#include "matrix/matrix_util.h"
+
+#include <map>
+
+using namespace std;
+
+namespace matrix
+{
+    // The reverse (ID to key) mapping of every key interned so far.
+    static Protected<map<topic_id_t, string> > topics;
+
+    /**
+     * Computes the topic ID of a key without registering it.
+     *
+     * @param key: The data key, "component.data".
+     *
+     * @return The 64-bit FNV-1a hash of 'key'.
+     *
+     */
+
+    topic_id_t TopicRegistry::hash(string const &key)
+    {
+        topic_id_t h = 14695981039346656037ULL;
+
+        for (string::const_iterator c = key.begin(); c != key.end(); ++c)
+        {
+            h ^= (unsigned char)*c;
+            h *= 1099511628211ULL;
+        }
+
+        return h;
+    }
+
+    /**
+     * Returns the topic ID for a key, registering the key if it has not
+     * been seen before. This is meant to be called once, when a
+     * DataSource is constructed or a DataSink connects, not per
+     * message.
+     *
+     * @param key: The data key, "component.data".
+     *
+     * @return The key's topic ID.
+     *
+     */
+
+    topic_id_t TopicRegistry::intern(string const &key)
+    {
+        ThreadLock<decltype(topics)> l(topics);
+        topic_id_t topic = hash(key);
+        map<topic_id_t, string>::iterator i;
+
+        l.lock();
+
+        if ((i = topics.find(topic)) == topics.end())
+        {
+            topics[topic] = key;
+        }
+        else if (i->second != key)
+        {
+            throw MatrixException("TopicRegistry",
+                                  "topic ID collision between '" + i->second
+                                  + "' and '" + key + "'");
+        }
+
+        return topic;
+    }
+
+    /**
+     * Finds the key for a topic ID.
+     *
+     * @param topic: The topic ID.
+     *
+     * @param key: Set to the key if 'topic' is known.
+     *
+     * @return true if 'topic' has been interned, false otherwise.
+     *
+     */
+
+    bool TopicRegistry::lookup(topic_id_t topic, string &key)
+    {
+        ThreadLock<decltype(topics)> l(topics);
+        map<topic_id_t, string>::iterator i;
+
+        l.lock();
+
+        if ((i = topics.find(topic)) == topics.end())
+        {
+            return false;
+        }
+
+        key = i->second;
+        return true;
+    }
+
+    /**
+     * Returns the key for a topic ID.
+     *
+     * @param topic: The topic ID.
+     *
+     * @return The key, or an empty string if 'topic' has not been
+     * interned.
+     *
+     */
+
+    string TopicRegistry::key(topic_id_t topic)
+    {
+        string k;
+        lookup(topic, k);
+        return k;
+    }
+}
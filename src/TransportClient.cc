@@ -173,4 +173,8 @@ namespace matrix
     {
         return false;
     }
+
+    void TransportClient::_set_options(YAML::Node )
+    {
+    }
 };
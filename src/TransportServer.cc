@@ -262,4 +262,28 @@ namespace matrix
         cerr << "abstract method " << __func__ << " called" << endl;
         return false;
     }
+
+    // Transports that do not dispatch by topic ID get the key instead.
+    bool TransportServer::_publish(topic_id_t topic, const void *data, size_t size_of_data)
+    {
+        return _publish(TopicRegistry::key(topic), data, size_of_data);
+    }
+
+    // Transports that cannot pass the buffer itself along send its contents.
+    bool TransportServer::_publish(topic_id_t topic, SharedBuffer const &buf)
+    {
+        return _publish(topic, (const void *)buf.data(), buf.size());
+    }
+
+    // Transports that send immediately have nothing queued, and drop
+    // nothing for lack of queue space.
+    size_t TransportServer::_queue_depth()
+    {
+        return 0;
+    }
+
+    size_t TransportServer::_dropped()
+    {
+        return 0;
+    }
 }
@@ -31,6 +31,9 @@
 
 #include "matrix/ZMQContext.h"
 #include "matrix/ThreadLock.h"
+#include "matrix/Keymaster.h"
+
+#include <iostream>
 
 using namespace matrix;
 
@@ -38,6 +41,8 @@ namespace matrix
 {
     std::shared_ptr<ZMQContext> ZMQContext::_instance;
     Mutex ZMQContext::_instance_lock;
+    std::shared_ptr<ZMQContext> ZMQContext::_transport_instance;
+    Mutex ZMQContext::_transport_lock;
 
 /********************************************************************
  * ZMQContext::ZMQContext
@@ -95,10 +100,63 @@ namespace matrix
         return _instance;
     }
 
+/********************************************************************
+ * ZMQContext::TransportInstance(std::string keymaster_url)
+ *
+ * Returns the context of the ZMQ data transports, ZMQTransportServer
+ * and ZMQTransportClient, creating it if it doesn't yet exist. It is
+ * kept apart from `Instance()`, which every Keymaster client uses, so
+ * that it has no sockets yet when it is created, and the I/O thread
+ * settings given by the 'ZMQContext' key of the configuration (see
+ * `configure()`) can still take effect in any process.
+ *
+ * @param keymaster_url: The Keymaster to read the 'ZMQContext' key
+ * from, when the context is created. If empty, or the key is not
+ * there, the ZMQ defaults are used.
+ *
+ * @return A std::shared_ptr to the transports' ZMQContext object.
+ *
+ *******************************************************************/
+
+    std::shared_ptr<ZMQContext> ZMQContext::TransportInstance(std::string keymaster_url)
+    {
+        ThreadLock<Mutex> l(_transport_lock);
+
+        l.lock();
+
+        if (_transport_instance == NULL)
+        {
+            _transport_instance.reset(new ZMQContext());
+
+            if (!keymaster_url.empty())
+            {
+                try
+                {
+                    Keymaster km(keymaster_url);
+                    YAML::Node zc = km.get("ZMQContext");
+
+                    _transport_instance->configure(
+                        zc["IOThreads"] ? zc["IOThreads"].as<int>() : 0,
+                        zc["ThreadAffinity"] ? zc["ThreadAffinity"].as<std::vector<int> >()
+                        : std::vector<int>());
+                }
+                catch (KeymasterException &e)
+                {
+                    // not configured, keep the ZMQ defaults.
+                }
+            }
+        }
+
+        l.unlock();
+
+        return _transport_instance;
+    }
+
 /********************************************************************
  * ZMQContext::RemoveInstance()
  *
- * This static function forcibly destroys this instance.
+ * This static function forcibly destroys this instance, and that of
+ * the transports.
  *
  *******************************************************************/
 
@@ -108,6 +166,11 @@ namespace matrix
         l.lock();
         _instance.reset();
         l.unlock();
+
+        ThreadLock<Mutex> tl(_transport_lock);
+        tl.lock();
+        _transport_instance.reset();
+        tl.unlock();
     }
 
 /********************************************************************
@@ -123,4 +186,61 @@ namespace matrix
     {
         return _context;
     }
+
+/********************************************************************
+ * ZMQContext::configure(int io_threads, std::vector<int> const &cpus)
+ *
+ * Sets the number of ZMQ I/O threads, and the CPUs they may run
+ * on. ZMQ starts the I/O threads when the first socket is created, so
+ * this only has an effect if called before that. It is normally
+ * called by `TransportInstance()`, from the top-level 'ZMQContext' key
+ * of the configuration:
+ *
+ *     ZMQContext:
+ *       IOThreads: 2
+ *       ThreadAffinity: [2, 3]
+ *
+ * @param io_threads: The number of I/O threads. If 0, the default
+ * (1) is kept.
+ *
+ * @param cpus: The CPUs the I/O threads are confined to. If empty,
+ * they may run on any CPU.
+ *
+ * @return true if the settings were accepted, false otherwise.
+ *
+ *******************************************************************/
+
+    bool ZMQContext::configure(int io_threads, std::vector<int> const &cpus)
+    {
+        void *ctx = (void *)_context;
+        bool rval = true;
+
+        if (io_threads > 0 && zmq_ctx_set(ctx, ZMQ_IO_THREADS, io_threads) != 0)
+        {
+            std::cerr << "ZMQContext: cannot set I/O threads to "
+                      << io_threads << std::endl;
+            rval = false;
+        }
+
+#if defined(ZMQ_THREAD_AFFINITY_CPU_ADD)
+        for (std::vector<int>::const_iterator i = cpus.begin(); i != cpus.end(); ++i)
+        {
+            if (zmq_ctx_set(ctx, ZMQ_THREAD_AFFINITY_CPU_ADD, *i) != 0)
+            {
+                std::cerr << "ZMQContext: cannot add CPU " << *i
+                          << " to the I/O thread affinity" << std::endl;
+                rval = false;
+            }
+        }
+#else
+        if (!cpus.empty())
+        {
+            std::cerr << "ZMQContext: I/O thread affinity needs ZMQ 4.3 or later"
+                      << std::endl;
+            rval = false;
+        }
+#endif
+
+        return rval;
+    }
 };
\ No newline at end of file
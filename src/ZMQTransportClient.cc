@@ -28,10 +28,14 @@
 
 #include "matrix/ZMQTransportClient.h"
 #include "matrix/RTTransportClient.h"
+#include "matrix/ShmTransportClient.h"
 #include "matrix/ZMQContext.h"
 #include "matrix/zmq_util.h"
+#include "matrix/TopicRegistry.h"
+#include "matrix/SharedBuffer.h"
 
 #include <iostream>
+#include <cstring>
 
 #define SUBSCRIBE   1
 #define UNSUBSCRIBE 2
@@ -83,7 +87,8 @@ namespace matrix
         {"tcp",      &ZMQTransportClient::factory},
         {"ipc",      &ZMQTransportClient::factory},
         {"inproc",   &ZMQTransportClient::factory},
-        {"rtinproc", &RTTransportClient::factory}
+        {"rtinproc", &RTTransportClient::factory},
+        {"shm",      &ShmTransportClient::factory}
     };
 
 
@@ -92,7 +97,7 @@ namespace matrix
     {
         Impl() :
             _pipe_urn("inproc://" + gen_random_string(20)),
-            _ctx(ZMQContext::Instance()->get_context()),
+            _ctx(ZMQContext::TransportInstance()->get_context()),
             _connected(false),
             _sub_thread(this, &ZMQTransportClient::Impl::sub_task),
             _task_ready(false)
@@ -112,11 +117,12 @@ namespace matrix
 
         std::string _pipe_urn;
         std::string _data_urn;
+        YAML::Node _socket_options;
         zmq::context_t &_ctx;
         bool _connected;
         Thread<ZMQTransportClient::Impl> _sub_thread;
         TCondition<bool> _task_ready;
-        std::map<std::string, DataCallbackBase *> _subscribers;
+        std::map<topic_id_t, DataCallbackBase *> _subscribers;
     };
 
     bool ZMQTransportClient::Impl::connect(string urn)
@@ -207,7 +213,13 @@ namespace matrix
         zmq::socket_t pipe(_ctx, ZMQ_REP);
         vector<string>::const_iterator cvi;
         bool invalid_context = false;
+        // Data frames are received straight into a message that the
+        // subscribers get as a SharedBuffer. If a subscriber keeps a
+        // reference (a DataSink<SharedBuffer> does) a new message is
+        // used for the next frame; otherwise this one is reused.
+        shared_ptr<zmq::message_t> msg(new zmq::message_t());
 
+        set_socket_options(sub_sock, _socket_options, false);
         sub_sock.connect(_data_urn.c_str());
         pipe.bind(_pipe_urn.c_str());
 
@@ -250,8 +262,11 @@ namespace matrix
                         }
                         else
                         {
-                            _subscribers[key] = f_ptr;
-                            sub_sock.setsockopt(ZMQ_SUBSCRIBE, key.c_str(), key.length());
+                            // publishers lead with a wire_header, whose
+                            // first field is the topic ID, so filter on that.
+                            topic_id_t topic = TopicRegistry::intern(key);
+                            _subscribers[topic] = f_ptr;
+                            sub_sock.setsockopt(ZMQ_SUBSCRIBE, &topic, sizeof topic);
                             z_send(pipe, 1, 0);
                         }
                     }
@@ -266,11 +281,12 @@ namespace matrix
                         }
                         else
                         {
-                            sub_sock.setsockopt(ZMQ_UNSUBSCRIBE, key.c_str(), key.length());
+                            topic_id_t topic = TopicRegistry::intern(key);
+                            sub_sock.setsockopt(ZMQ_UNSUBSCRIBE, &topic, sizeof topic);
 
-                            if (_subscribers.find(key) != _subscribers.end())
+                            if (_subscribers.find(topic) != _subscribers.end())
                             {
-                                _subscribers.erase(key);
+                                _subscribers.erase(topic);
                             }
 
                             z_send(pipe, 1, 0);
@@ -286,21 +302,44 @@ namespace matrix
                 // The subscribed data is handled here
                 if (items[1].revents & ZMQ_POLLIN)
                 {
-                    string key;
-                    zmq::message_t msg; // the data
+                    wire_header hdr;
                     int more;
                     size_t more_size = sizeof(more);
-                    map<string, DataCallbackBase *>::const_iterator mci;
+                    map<topic_id_t, DataCallbackBase *>::const_iterator mci;
                     DataCallbackBase *f = NULL;
 
-                    // get the key
-                    z_recv(sub_sock, key);
-                    mci = _subscribers.find(key);
+                    if (!msg.unique())
+                    {
+                        msg.reset(new zmq::message_t());
+                    }
+
+                    // get the header. Anything that isn't one is
+                    // drained below without a callback.
+                    sub_sock.recv(msg.get());
 
-                    // get callback registered to this key
-                    if (mci != _subscribers.end())
+                    if (msg->size() >= sizeof hdr)
                     {
-                        f = mci->second;
+                        memcpy(&hdr, msg->data(), sizeof hdr);
+
+                        // get callback registered to this topic
+                        if (hdr.version == wire_header::VERSION
+                            && (mci = _subscribers.find(hdr.topic)) != _subscribers.end())
+                        {
+                            f = mci->second;
+                        }
+
+                        // a single frame message: the data follows the
+                        // header (see wire_header).
+                        if (f && (hdr.flags & wire_header::INLINE))
+                        {
+                            f->exec(hdr.topic, SharedBuffer(msg, (char *)msg->data() + sizeof hdr,
+                                                            msg->size() - sizeof hdr));
+                            f = NULL;
+                        }
+                        else if (msg->size() != sizeof hdr)
+                        {
+                            f = NULL;
+                        }
                     }
 
                     // repeat for every possible frame containing
@@ -313,12 +352,17 @@ namespace matrix
 
                     while (more)
                     {
-                        sub_sock.recv(&msg);
+                        if (!msg.unique())
+                        {
+                            msg.reset(new zmq::message_t());
+                        }
+
+                        sub_sock.recv(msg.get());
 
                         // execute only if we found a callback.
                         if (f)
                         {
-                            f->exec(key, msg.data(), msg.size());
+                            f->exec(hdr.topic, SharedBuffer(msg, msg->data(), msg->size()));
                         }
 
                         sub_sock.getsockopt(ZMQ_RCVMORE, &more, &more_size);
@@ -385,4 +429,14 @@ namespace matrix
         return _impl->unsubscribe(key);
     }
 
+    // The options are applied to the subscriber socket when it is
+    // created, on connect; later changes have no effect.
+    void ZMQTransportClient::_set_options(YAML::Node options)
+    {
+        if (!_impl->_connected)
+        {
+            _impl->_socket_options = options;
+        }
+    }
+
 }
@@ -28,12 +28,18 @@
 
 #include "matrix/ZMQTransportServer.h"
 #include "matrix/RTTransportServer.h"
+#include "matrix/ShmTransportServer.h"
 #include "matrix/ZMQContext.h"
 #include "matrix/zmq_util.h"
+#include "matrix/TopicRegistry.h"
 #include "matrix/matrix_util.h"
 #include "matrix/netUtils.h"
 #include "matrix/Time.h"
 #include "matrix/Keymaster.h"
+#include "matrix/Thread.h"
+#include "matrix/mpsc_ring.h"
+#include <atomic>
+#include <semaphore.h>
 #include <boost/regex.hpp>
 
 using namespace std;
@@ -81,28 +87,74 @@ namespace matrix
         {"tcp",      &ZMQTransportServer::factory},
         {"ipc",      &ZMQTransportServer::factory},
         {"inproc",   &ZMQTransportServer::factory},
-        {"rtinproc", &RTTransportServer::factory}
+        {"rtinproc", &RTTransportServer::factory},
+        {"shm",      &ShmTransportServer::factory}
     };
 
 /**
  * \class PubImpl is the private implementation of the ZMQTransportServer class.
  *
+ * A ZMQTransportServer is shared by all the DataSources of a component
+ * that name the same transport, and ZMQ sockets are not thread
+ * safe. If the DataSources publish from different threads, the
+ * transport should be given a send queue:
+ *
+ *     Transports:
+ *       A:
+ *         Specified: [tcp]
+ *         SendQueue: 1024
+ *
+ * With a send queue, `publish()` only places the message on a lock
+ * free MPSC queue (see mpsc_ring) and returns; a sender thread owned
+ * by the transport is then the only thread to use the socket. A
+ * publisher never blocks, and if the queue is full the message is
+ * dropped and counted. Without a send queue (the default), messages
+ * are sent on the socket from the publishing thread.
+ *
+ * Socket options may also be given for the transport, in a
+ * 'SocketOptions' map (see `set_socket_options()`). If CONFLATE is
+ * set, each message is sent as a single frame, with the data inline
+ * after the `wire_header`.
+ *
  */
 
     struct ZMQTransportServer::PubImpl
     {
-        PubImpl(vector<string> urls);
+        PubImpl(vector<string> urls, size_t send_queue, YAML::Node socket_options,
+                string km_url);
         ~PubImpl();
 
         bool publish(string key, string data);
         bool publish(string key, void const *data, size_t sze);
+        bool publish(topic_id_t topic, void const *data, size_t sze);
+        bool publish(topic_id_t topic, SharedBuffer const &buf);
         vector<string> get_urls();
+        size_t queue_depth();
+        size_t dropped();
+
+        bool _send(topic_id_t topic, void const *data, size_t sze);
+        bool _send(topic_id_t topic, SharedBuffer const &buf);
+        bool _enqueue(topic_id_t topic, SharedBuffer const &buf);
+        void _sender_task();
 
         string _hostname;
         vector<string> _publish_service_urls;
 
         zmq::context_t &_ctx;
         zmq::socket_t _pub_skt;
+        bool _single_frame;
+
+        struct pending
+        {
+            topic_id_t topic;
+            SharedBuffer buf;
+        };
+
+        std::unique_ptr<mpsc_ring<pending> > _queue;
+        sem_t _queue_sem;
+        std::atomic<bool> _sender_done;
+        std::atomic<size_t> _dropped;
+        Thread<PubImpl> _sender_thread;
     };
 
 /**
@@ -113,14 +165,25 @@ namespace matrix
  * @param urns: The desired URNs, as a vector of strings. If
  * only the transport is given, ephemeral URLs will be generated.
  *
+ * @param km_url: The Keymaster, from which the transports' ZMQ
+ * context is configured if this is the first to use it (see
+ * `ZMQContext::TransportInstance()`).
+ *
  */
 
-    ZMQTransportServer::PubImpl::PubImpl(vector<string> urns)
+    ZMQTransportServer::PubImpl::PubImpl(vector<string> urns, size_t send_queue,
+                                         YAML::Node socket_options, string km_url)
         :
-        _ctx(ZMQContext::Instance()->get_context()),
-        _pub_skt(_ctx, ZMQ_PUB)
+        _ctx(ZMQContext::TransportInstance(km_url)->get_context()),
+        _pub_skt(_ctx, ZMQ_PUB),
+        _single_frame(socket_option_set(socket_options, "CONFLATE")),
+        _sender_done(false),
+        _dropped(0),
+        _sender_thread(this, &ZMQTransportServer::PubImpl::_sender_task)
 
     {
+        sem_init(&_queue_sem, 0, 0);
+        set_socket_options(_pub_skt, socket_options, true);
 
         // process the urns.
         _publish_service_urls.clear();
@@ -196,6 +259,11 @@ namespace matrix
             return;
         }
 
+        if (send_queue)
+        {
+            _queue.reset(new mpsc_ring<pending>(send_queue));
+            _sender_thread.start("zmq_sender");
+        }
     }
 
 /**
@@ -207,6 +275,15 @@ namespace matrix
     ZMQTransportServer::PubImpl::~PubImpl()
 
     {
+        if (_sender_thread.running())
+        {
+            _sender_done.store(true);
+            sem_post(&_queue_sem);
+            _sender_thread.stop_without_cancel();
+        }
+
+        sem_destroy(&_queue_sem);
+
         int zero = 0;
         _pub_skt.setsockopt(ZMQ_LINGER, &zero, sizeof zero);
         _pub_skt.close();
@@ -236,7 +313,7 @@ namespace matrix
 
     bool ZMQTransportServer::PubImpl::publish(string key, string data)
     {
-        return publish(key, data.data(), data.size());
+        return publish(TopicRegistry::intern(key), data.data(), data.size());
     }
 
 /**
@@ -251,13 +328,95 @@ namespace matrix
  */
 
     bool ZMQTransportServer::PubImpl::publish(string key, void const *data, size_t sze)
+    {
+        return publish(TopicRegistry::intern(key), data, sze);
+    }
+
+/**
+ * Publishes the data, provided as a void * with a size parameter. If
+ * there is a send queue the data is copied and queued for the sender
+ * thread, otherwise it is sent right away.
+ *
+ * @param topic: The topic ID of the data's key.
+ *
+ * @param data: A void pointer to the buffer containing the data
+ *
+ * @param sze: The size of the data buffer
+ *
+ * @return true if the data was sent or queued, false otherwise.
+ *
+ */
+
+    bool ZMQTransportServer::PubImpl::publish(topic_id_t topic, void const *data, size_t sze)
+    {
+        if (_queue)
+        {
+            return _enqueue(topic, SharedBuffer(data, sze));
+        }
+
+        return _send(topic, data, sze);
+    }
+
+/**
+ * Publishes a SharedBuffer. If there is a send queue a reference to the
+ * buffer is queued for the sender thread, otherwise the buffer is sent
+ * right away. Either way the data is not copied.
+ *
+ * @param topic: The topic ID of the data's key.
+ *
+ * @param buf: The buffer to publish.
+ *
+ * @return true if the data was sent or queued, false otherwise.
+ *
+ */
+
+    bool ZMQTransportServer::PubImpl::publish(topic_id_t topic, SharedBuffer const &buf)
+    {
+        if (_queue)
+        {
+            return _enqueue(topic, buf);
+        }
+
+        return _send(topic, buf);
+    }
+
+/**
+ * Sends the data, provided as a void * with a size parameter. The
+ * first frame is a `wire_header` carrying the topic ID, the second
+ * the data.
+ *
+ * @param topic: The topic ID of the data's key.
+ *
+ * @param data: A void pointer to the buffer containing the data
+ *
+ * @param sze: The size of the data buffer
+ *
+ */
+
+    bool ZMQTransportServer::PubImpl::_send(topic_id_t topic, void const *data, size_t sze)
     {
         bool rval = true;
+        wire_header hdr;
+
+        hdr.topic = topic;
+        hdr.version = wire_header::VERSION;
+        hdr.flags = 0;
 
         try
         {
-            z_send(_pub_skt, key, ZMQ_SNDMORE, 0);
-            z_send(_pub_skt, (const char *)data, sze, 0, 0);
+            if (_single_frame)
+            {
+                zmq::message_t msg(sizeof hdr + sze);
+                hdr.flags = wire_header::INLINE;
+                memcpy(msg.data(), &hdr, sizeof hdr);
+                memcpy((char *)msg.data() + sizeof hdr, data, sze);
+                _pub_skt.send(msg, 0);
+            }
+            else
+            {
+                z_send(_pub_skt, hdr, ZMQ_SNDMORE, 0);
+                z_send(_pub_skt, (const char *)data, sze, 0, 0);
+            }
         }
         catch (zmq::error_t &e)
         {
@@ -271,6 +430,164 @@ namespace matrix
     }
 
 
+/**
+ * Called by ZMQ when it is done with a message sent by the SharedBuffer
+ * overload of _send(). This may be in one of ZMQ's I/O threads.
+ *
+ * @param hint: The heap allocated SharedBuffer reference that kept the
+ * data alive while ZMQ had it.
+ *
+ */
+
+    static void release_shared_buffer(void *, void *hint)
+    {
+        delete (SharedBuffer *)hint;
+    }
+
+/**
+ * Sends a SharedBuffer without copying it. The message handed to
+ * ZMQ points at the buffer's own data, and holds a reference to the
+ * buffer until ZMQ releases the message. If the buffer came from a
+ * BufferPool it returns to the pool at that point.
+ *
+ * @param topic: The topic ID of the data's key.
+ *
+ * @param buf: The buffer to send.
+ *
+ */
+
+    bool ZMQTransportServer::PubImpl::_send(topic_id_t topic, SharedBuffer const &buf)
+    {
+        bool rval = true;
+        wire_header hdr;
+
+        // a single frame means copying the data in behind the header.
+        if (_single_frame)
+        {
+            return _send(topic, buf.data(), buf.size());
+        }
+
+        hdr.topic = topic;
+        hdr.version = wire_header::VERSION;
+        hdr.flags = 0;
+
+        try
+        {
+            SharedBuffer *ref = new SharedBuffer(buf);
+            zmq::message_t msg;
+
+            try
+            {
+                msg.rebuild((void *)ref->data(), ref->size(), &release_shared_buffer, ref);
+            }
+            catch (zmq::error_t &e)
+            {
+                // ZMQ never took the reference.
+                delete ref;
+                throw;
+            }
+
+            z_send(_pub_skt, hdr, ZMQ_SNDMORE, 0);
+            _pub_skt.send(msg, 0);
+        }
+        catch (zmq::error_t &e)
+        {
+            cerr << Time::isoDateTime(Time::getUTC())
+                 << " -- ZMQ exception in publisher: "
+                 << e.what() << endl;
+            rval = false;
+        }
+
+        return rval;
+    }
+
+/**
+ * Places a message on the send queue and wakes the sender thread. Safe
+ * to call from any number of threads at once. Never blocks.
+ *
+ * @param topic: The topic ID of the data's key.
+ *
+ * @param buf: The data to send.
+ *
+ * @return true if the message was queued, false if the queue was full
+ * and the message was dropped.
+ *
+ */
+
+    bool ZMQTransportServer::PubImpl::_enqueue(topic_id_t topic, SharedBuffer const &buf)
+    {
+        pending p = {topic, buf};
+
+        if (!_queue->try_put(std::move(p)))
+        {
+            ++_dropped;
+            return false;
+        }
+
+        sem_post(&_queue_sem);
+        return true;
+    }
+
+/**
+ * The sender thread. Sends everything on the send queue each time it
+ * is woken, and exits once told to and the queue is empty. This is the
+ * only thread that uses the socket when there is a send queue.
+ *
+ */
+
+    void ZMQTransportServer::PubImpl::_sender_task()
+    {
+        pending p;
+
+        for (;;)
+        {
+            if (sem_wait(&_queue_sem) == -1 && errno == EINTR)
+            {
+                continue;
+            }
+
+            // Drain the queue rather than taking one message per
+            // wake-up: a message whose producer has not finished
+            // putting it blocks those behind it, and the wake-ups for
+            // those may already have been used.
+            while (_queue->try_get(p))
+            {
+                _send(p.topic, p.buf);
+                p.buf.reset();
+            }
+
+            if (_sender_done.load())
+            {
+                break;
+            }
+        }
+    }
+
+/**
+ * Returns the number of messages waiting on the send queue.
+ *
+ * @return The queue depth, always 0 if there is no send queue.
+ *
+ */
+
+    size_t ZMQTransportServer::PubImpl::queue_depth()
+    {
+        return _queue ? _queue->size() : 0;
+    }
+
+/**
+ * Returns the number of messages dropped because the send queue was
+ * full.
+ *
+ * @return The count of dropped messages.
+ *
+ */
+
+    size_t ZMQTransportServer::PubImpl::dropped()
+    {
+        return _dropped.load();
+    }
+
     ZMQTransportServer::ZMQTransportServer(string keymaster_url, string key)
         : TransportServer(keymaster_url, key)
     {
@@ -278,10 +595,30 @@ namespace matrix
         {
             Keymaster km(_km_url);
             vector<string> urns;
+            size_t send_queue = 0;
+            YAML::Node socket_options;
             urns = km.get_as<vector<string> >(_transport_key + ".Specified");
 
+            try
+            {
+                send_queue = km.get_as<size_t>(_transport_key + ".SendQueue");
+            }
+            catch (KeymasterException &e)
+            {
+                // not given, send from the publishing thread.
+            }
+
+            try
+            {
+                socket_options = km.get(_transport_key + ".SocketOptions");
+            }
+            catch (KeymasterException &e)
+            {
+                // not given, use the ZMQ defaults.
+            }
+
             // will throw CreationError if it fails.
-            _impl.reset(new PubImpl(urns));
+            _impl.reset(new PubImpl(urns, send_queue, socket_options, _km_url));
 
             // register the AsConfigured urns:
             urns = _impl->get_urls();
@@ -320,4 +657,24 @@ namespace matrix
     {
         return _impl->publish(key, data);
     }
+
+    bool ZMQTransportServer::_publish(topic_id_t topic, const void *data, size_t size_of_data)
+    {
+        return _impl->publish(topic, data, size_of_data);
+    }
+
+    bool ZMQTransportServer::_publish(topic_id_t topic, SharedBuffer const &buf)
+    {
+        return _impl->publish(topic, buf);
+    }
+
+    size_t ZMQTransportServer::_queue_depth()
+    {
+        return _impl->queue_depth();
+    }
+
+    size_t ZMQTransportServer::_dropped()
+    {
+        return _impl->dropped();
+    }
 }
@@ -167,6 +167,9 @@ namespace matrix
         /// Query for a connection
         bool find_data_connection(ConnectionKey &);
 
+        /// Query for the options of a connection
+        YAML::Node find_connection_options(ConnectionKey const &);
+
         bool parse_data_connections();
 
         template<typename J>
@@ -260,6 +263,9 @@ namespace matrix
         /// A thingy which has all the connection info for the current mode.
         /// Maps a key of <mode,component,sink> to the corresponding <component,source,transport>
         ConnectionMap connections;
+        /// The options map given for a connection, if any, with the
+        /// same key as 'connections'.
+        std::map<ConnectionKey, YAML::Node> connection_options;
         std::string current_mode;
         bool done;
         matrix::Thread<Component> cmd_thread;
@@ -275,6 +281,21 @@ namespace matrix
         ConnectionKey q(current_mode, my_instance_name, sinkname);
         if (find_data_connection(q))
         {
+            YAML::Node opts = find_connection_options(
+                ConnectionKey(current_mode, my_instance_name, sinkname));
+
+            if (opts["overflow"])
+            {
+                Time::Time_t timeout = opts["timeout_ms"] ?
+                    opts["timeout_ms"].as<Time::Time_t>() * 1000000 : 0;
+                sink.set_overflow_policy(opts["overflow"].as<std::string>(), timeout);
+            }
+            else
+            {
+                // not one left over from another mode's connection.
+                sink.reset_overflow_policy();
+            }
+
             sink.connect(std::get<0>(q), std::get<1>(q), std::get<2>(q));
         }
         return true;
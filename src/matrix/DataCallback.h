@@ -35,6 +35,9 @@
 #if !defined(_DATA_CALLBACK_H_)
 #define _DATA_CALLBACK_H_
 
+#include "matrix/TopicRegistry.h"
+#include "matrix/SharedBuffer.h"
+
 #include <string>
 #include <yaml-cpp/yaml.h>
 
@@ -53,14 +56,34 @@ namespace matrix
      * published, it is received by the Keymaster client object, which then
      * calls the provided pointer to an object of this type.
      *
+     * Transports deliver data by topic ID (see TopicRegistry). A
+     * callback that only overrides the string `_call()` still works:
+     * the default `_call_topic()` recovers the key from the registry and
+     * forwards to it, at the cost of a lookup per message.
+     *
+     * Transports that hold the data in a SharedBuffer (rtinproc passes
+     * the published one along, ZMQ clients wrap the received message)
+     * call the SharedBuffer `exec()`. By default this hands the callback
+     * the buffer's contents, as for any other data.
+     *
      */
 
     struct DataCallbackBase
     {
         void operator()(std::string key, void *val, size_t sze) {_call(key, val, sze);}
         void exec(std::string key, void *val, size_t sze)       {_call(key, val, sze);}
+        void exec(topic_id_t topic, void *val, size_t sze)      {_call_topic(topic, val, sze);}
+        void exec(topic_id_t topic, SharedBuffer const &buf)    {_call_shared(topic, buf);}
     private:
         virtual void _call(std::string key, void *val, size_t szed) = 0;
+        virtual void _call_topic(topic_id_t topic, void *val, size_t sze)
+        {
+            _call(TopicRegistry::key(topic), val, sze);
+        }
+        virtual void _call_shared(topic_id_t topic, SharedBuffer const &buf)
+        {
+            _call_topic(topic, (void *)buf.data(), buf.size());
+        }
     };
 
     /**
@@ -90,6 +113,12 @@ namespace matrix
      *         ds->subscribe("Data", &my_cb); // assumes a data source named "Data"
      *     }
      *
+     * The member function may instead take a `topic_id_t` in place of
+     * the std::string key, in which case it is called with the topic ID
+     * and no key string is ever constructed. A second member function,
+     * taking a topic ID and a `SharedBuffer const &`, may be given to
+     * receive SharedBuffers without their being copied.
+     *
      */
 
     template <typename T>
@@ -97,10 +126,22 @@ namespace matrix
     {
     public:
         typedef void (T::*ActionMethod)(std::string, void *, size_t);
+        typedef void (T::*TopicActionMethod)(topic_id_t, void *, size_t);
+        typedef void (T::*SharedActionMethod)(topic_id_t, SharedBuffer const &);
 
         DataMemberCB(T *obj, ActionMethod cb) :
             _object(obj),
-            _faction(cb)
+            _faction(cb),
+            _ftaction(NULL),
+            _fsaction(NULL)
+        {
+        }
+
+        DataMemberCB(T *obj, TopicActionMethod cb, SharedActionMethod scb = NULL) :
+            _object(obj),
+            _faction(NULL),
+            _ftaction(cb),
+            _fsaction(scb)
         {
         }
 
@@ -114,10 +155,40 @@ namespace matrix
             {
                 (_object->*_faction)(key, buf, len);
             }
+            else if (_object && _ftaction)
+            {
+                (_object->*_ftaction)(TopicRegistry::intern(key), buf, len);
+            }
+        }
+
+        void _call_topic(topic_id_t topic, void *buf, size_t len)
+        {
+            if (_object && _ftaction)
+            {
+                (_object->*_ftaction)(topic, buf, len);
+            }
+            else if (_object && _faction)
+            {
+                (_object->*_faction)(TopicRegistry::key(topic), buf, len);
+            }
+        }
+
+        void _call_shared(topic_id_t topic, SharedBuffer const &buf)
+        {
+            if (_object && _fsaction)
+            {
+                (_object->*_fsaction)(topic, buf);
+            }
+            else
+            {
+                _call_topic(topic, (void *)buf.data(), buf.size());
+            }
         }
 
         T  *_object;
         ActionMethod _faction;
+        TopicActionMethod _ftaction;
+        SharedActionMethod _fsaction;
     };
 
 }
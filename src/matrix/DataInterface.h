@@ -45,6 +45,7 @@
 #define DataInterface_h
 
 #include "matrix/GenericBuffer.h"
+#include "matrix/SharedBuffer.h"
 #include "matrix/DataCallback.h"
 #include "matrix/TransportServer.h"
 #include "matrix/TransportClient.h"
@@ -29,11 +29,22 @@
 #define _DATA_SINK_H_
 
 #include "matrix/Time.h"
+#include "matrix/Mutex.h"
+#include "matrix/ThreadLock.h"
 #include "matrix/tsemfifo.h"
+#include "matrix/ring_fifo.h"
+#include "matrix/event_notifier.h"
 #include "matrix/DataInterface.h"
+#include "matrix/ZMQContext.h"
 
+#include <algorithm>
+#include <atomic>
+#include <numeric>
 #include <sstream>
 #include <msgpack.hpp>
+#include <zmq.hpp>
+#include <unistd.h>
+#include <sys/epoll.h>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcomment"
@@ -76,6 +87,21 @@
  *    with copy semantics (no memory allocation) and a fixed buffer
  *    size, use a DataSink<fixed_buffer<size> >.
  *
+ *  * A DataSink<T> of a simple type also accepts messages that hold
+ *    several T back to back, as published by
+ *    `DataSource<T>::publish_batch()`. Each T becomes a separate
+ *    entry in the queue, all of them put under a single lock, and
+ *    `get_batch()` drains many entries under a single lock:
+ *
+ *          double vals[256];
+ *          size_t n = ds.get_batch(vals, 256, 1000000000);
+ *
+ *  * For a DataSink that receives blocks of data without copying
+ *    them, use a DataSink<SharedBuffer>. Over rtinproc the sink gets
+ *    a reference to the buffer the DataSource published; over ZMQ
+ *    transports, a read-only view of the received ZMQ message. The
+ *    only copy is the one made by ZMQ on receipt.
+ *
  *  * For a DataSink that is flexible as to the messages being
  *    received, but still not associated with any concrete type--for
  *    example, if only exchanging ASCII strings--at the cost of using
@@ -92,6 +118,22 @@
  * buffer. DataSink may then 'get()' or 'try_get()' the data at the
  * tsemfifo head.
  *
+ * What happens when data arrives faster than it is consumed is set
+ * by the sink's overflow policy (see `overflow_policy`). By default
+ * the oldest queued entry is dropped; a status display might instead
+ * want only the latest value:
+ *
+ *          ds.set_overflow_policy(overflow_policy::CONFLATE);
+ *
+ * The receive queue is a tsemfifo<T> by default. The third template
+ * parameter selects another queue with the same interface: most sinks
+ * are fed by exactly one transport thread, and for these an
+ * `spsc_fifo` avoids the tsemfifo's mutex and semaphores altogether
+ * (see ring_fifo.h, and note that these queues can not drop their
+ * oldest entries):
+ *
+ *          DataSink<double, select_specified, spsc_fifo> ds(keymaster_urn, 1024);
+ *
  * A DataSink may disconnect and reconnect to a different data
  * source as many times as desired. To reconnect it just needs a new
  * component name and  data name. Note that the DataSink in question
@@ -233,7 +275,7 @@ namespace matrix
  * Base class for the DataSink types. Needed for poller class. Since
  * every DataSink<T> is potentially a different type (depending on T),
  * the poller needs some way to manipulate them. It only needs the
- * items() and set_notifier() interface to do so.
+ * items(), event_fd() and clear_event() interface to do so.
  *
  */
 
@@ -245,6 +287,8 @@ namespace matrix
 
         virtual size_t items() = 0;
         virtual void set_notifier(std::shared_ptr<matrix::fifo_notifier> n) = 0;
+        virtual int event_fd() = 0;
+        virtual void clear_event() = 0;
         virtual std::string current_source_urn() = 0;
         virtual std::string current_source_key() = 0;
         virtual void disconnect() = 0;
@@ -257,72 +301,157 @@ namespace matrix
 /**
  * \class poller
  *
- * Allows a thread to be notified when any or all of given DataSinks
- * is/are ready to be read.
+ * Allows a thread to wait until any or all of a set of DataSinks and
+ * ZMQ sockets are ready to be read, so that one thread may service
+ * many inputs.
+ *
+ * The wait is an epoll wait. Each DataSink contributes its eventfd
+ * (see `DataSinkBase::event_fd()`), which it only signals when data
+ * arrives at an empty queue; each ZMQ socket its ZMQ_FD. A wake-up
+ * therefore costs work only for the inputs that actually became
+ * ready, however many there are. Inputs that were ready at the last
+ * `wait()` are checked again at the next, as neither kind of
+ * descriptor is signalled again while there is data left unread.
  *
  * example:
  *
  *      DataSink<int> x(...);
  *      DataSink<double> y(...);
+ *      zmq::socket_t s(...);
  *      poller p;
+ *      std::vector<size_t> ready;
  *      int x_in;
  *      double y_in;
  *
  *      ...
- *      p.push_back(&x);
- *      p.push_back(&y);
+ *      size_t xi = p.push_back(&x);
+ *      size_t yi = p.push_back(&y);
+ *      size_t si = p.push_back(s);
  *
  *      while (run)
  *      {
- *          // returns true if any of the DataSinks are ready to read,
- *          // false if the time-out (in us) expired. Time-out here is
- *          // 5 mS. (there is also an all_of() function)
+ *          // fills 'ready' with the indices of the inputs that may be
+ *          // read without blocking, returning how many there are. 0
+ *          // if the time-out (in us) expired. Time-out here is 5 mS.
+ *
+ *          p.wait(ready, 5000);
  *
- *          if (p.any_of(5000))
+ *          for (auto i : ready)
  *          {
- *              if (x.items())
+ *              if (i == xi)
  *              {
- *                  x.try_get(x_in);
- *                  // do something with x_in
+ *                  while (x.try_get(x_in))
+ *                  {
+ *                      // do something with x_in
+ *                  }
  *              }
- *
- *              if (y.items())
+ *              else if (i == yi)
  *              {
- *                  y.try_get(y_in);
- *                  // do something with y_in
+ *                  ...
+ *              }
+ *              else if (i == si)
+ *              {
+ *                  // s.recv(...) with ZMQ_DONTWAIT until it would block
  *              }
  *          }
  *      }
  *
+ * `any_of()` and `all_of()` just return true once one or all of the
+ * inputs are ready.
+ *
  */
 #pragma GCC diagnostic pop
 
     class poller
     {
-        struct notifier : public matrix::fifo_notifier
+        enum
+        {
+            MAX_EVENTS = 64
+        };
+
+        struct input
         {
-            notifier(TCondition<bool> &n)
-                : item_placed(n)
+            DataSinkBase *sink;
+            zmq::socket_t *socket;
+        };
+
+        int _epoll_fd;
+        std::vector<input> _inputs;
+        std::vector<size_t> _pending;
+
+        poller(poller const &);
+        poller &operator=(poller const &);
+
+/**
+ * Adds a descriptor to the epoll set, tagged with the index of its
+ * input, and marks the input to be checked at the next `wait()`, in
+ * case it is ready already.
+ *
+ */
+
+        size_t _add(input in, int fd)
+        {
+            epoll_event ev;
+            size_t i = _inputs.size();
+
+            ev.events = EPOLLIN;
+            ev.data.u64 = i;
+
+            if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
             {
+                throw MatrixException("poller::push_back()", strerror(errno));
             }
 
-            virtual void _call(int)
+            _inputs.push_back(in);
+            _pending.push_back(i);
+            return i;
+        }
+
+/**
+ * Checks whether an input is ready. A DataSink's notification is
+ * cleared before its queue is looked at, so that nothing that arrives
+ * in between is missed. This is skipped for a sink that has not been
+ * signalled and still has data, which saves a system call per wait;
+ * such a sink will be checked again next time.
+ *
+ * @param i: The index of the input.
+ *
+ * @param signalled: true if the input's descriptor was readable.
+ *
+ */
+
+        bool _ready(size_t i, bool signalled)
+        {
+            input &in = _inputs[i];
+
+            if (in.sink)
             {
-                item_placed.signal(true);
-            }
+                if (!signalled && in.sink->items() > 0)
+                {
+                    return true;
+                }
 
-            matrix::TCondition<bool> &item_placed;
-        };
+                in.sink->clear_event();
+                return in.sink->items() > 0;
+            }
 
-        matrix::TCondition<bool> _item_placed;
-        std::shared_ptr<matrix::fifo_notifier> _notifier;
-        std::vector<matrix::DataSinkBase *> _queues;
+            // reading ZMQ_EVENTS is what clears ZMQ_FD.
+            return in.socket->getsockopt<int>(ZMQ_EVENTS) & ZMQ_POLLIN;
+        }
 
     public:
         poller()
-            : _item_placed(false),
-              _notifier(new poller::notifier(_item_placed))
+            : _epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+        {
+            if (_epoll_fd == -1)
+            {
+                throw MatrixException("poller", strerror(errno));
+            }
+        }
+
+        ~poller()
         {
+            close(_epoll_fd);
         }
 
 /**
@@ -332,71 +461,173 @@ namespace matrix
  *
  * @param ds: Address of the DataSink.
  *
+ * @return The index of the DataSink in the poller, as returned by
+ * `wait()`. Inputs are numbered from 0 in the order they are added.
+ *
+ */
+
+        size_t push_back(matrix::DataSinkBase *ds)
+        {
+            input in = {ds, NULL};
+            return _add(in, ds->event_fd());
+        }
+
+/**
+ * Adds a ZMQ socket to the poller.
+ *
+ * @param skt: The socket, which must outlive the poller.
+ *
+ * @return The index of the socket in the poller, as returned by
+ * `wait()`.
+ *
+ */
+
+        size_t push_back(zmq::socket_t &skt)
+        {
+            input in = {NULL, &skt};
+            return _add(in, skt.getsockopt<int>(ZMQ_FD));
+        }
+
+/**
+ * Waits for up to `usecs` microseconds for any of the inputs to
+ * become ready to read, and returns those that are.
+ *
+ * @param ready: Filled with the indices of the inputs that are
+ * ready, in ascending order.
+ *
+ * @param usecs: the time to wait, in microseconds; -1 to wait
+ * indefinitely.
+ *
+ * @return The number of ready inputs, 0 if the time-out expired (or,
+ * rarely, on a spurious wake-up).
+ *
+ */
+
+        size_t wait(std::vector<size_t> &ready, int usecs)
+        {
+            return _wait(ready, usecs, false);
+        }
+
+    private:
+
+/**
+ * Implements `wait()`. If 'block' is false and some inputs are ready
+ * already, only collects the others without waiting; otherwise waits
+ * for more inputs to become ready, as `all_of()` needs.
+ *
  */
 
-        void push_back(matrix::DataSinkBase *ds)
+        size_t _wait(std::vector<size_t> &ready, int usecs, bool block)
         {
-            ds->set_notifier(_notifier);
-            _queues.push_back(ds);
+            epoll_event events[MAX_EVENTS];
+            int n;
+
+            ready.clear();
+
+            for (auto i : _pending)
+            {
+                if (_ready(i, false))
+                {
+                    ready.push_back(i);
+                }
+            }
+
+            int timeout = usecs < 0 ? -1 : (usecs + 999) / 1000;
+
+            if (!ready.empty() && (!block || ready.size() == _inputs.size()))
+            {
+                timeout = 0;
+            }
+
+            do
+            {
+                n = epoll_wait(_epoll_fd, events, MAX_EVENTS, timeout);
+            }
+            while (n == -1 && errno == EINTR);
+
+            for (int e = 0; e < n; ++e)
+            {
+                size_t i = events[e].data.u64;
+
+                if (std::find(ready.begin(), ready.end(), i) != ready.end())
+                {
+                    // known to be ready; just clear the notification so
+                    // that it does not cut the next wait short.
+                    if (_inputs[i].sink)
+                    {
+                        _inputs[i].sink->clear_event();
+                    }
+                }
+                else if (_ready(i, true))
+                {
+                    ready.push_back(i);
+                }
+            }
+
+            std::sort(ready.begin(), ready.end());
+            _pending = ready;
+            return ready.size();
         }
 
+    public:
+
 /**
- * Blocks for `usecs` microseconds or until any of the added DataSinks
+ * Blocks for `usecs` microseconds or until any of the added inputs
  * becomes readable.
  *
  * @param usecs: the time to wait, in microseconds.
  *
- * @return true if one of the DataSinks became ready to read, false if
+ * @return true if one of the inputs became ready to read, false if
  * it times out.
  *
  */
 
         bool any_of(int usecs)
         {
-            matrix::ThreadLock<decltype(_item_placed)> l(_item_placed);
+            std::vector<size_t> ready;
             Time::Time_t time_to_quit = Time::getUTC() + ((Time::Time_t)usecs) * 1000L;
-            l.lock();
 
-            while (!std::any_of(_queues.begin(), _queues.end(),
-                    [](DataSinkBase *i) {return i->items() > 0;}))
+            while (!wait(ready, usecs))
             {
-                _item_placed.wait_locked_with_timeout(usecs);
+                Time::Time_t now = Time::getUTC();
 
-                if (Time::getUTC() >= time_to_quit)
+                if (now >= time_to_quit)
                 {
                     return false;
                 }
+
+                usecs = (time_to_quit - now) / 1000L;
             }
 
             return true;
         }
 
 /**
- * blocks for `usecs` microseconds, or until all DataSinks in the
+ * blocks for `usecs` microseconds, or until all inputs in the
  * poller become readable.
  *
  * @param usecs: the time to wait, in microseconds.
  *
- * @return true if all of the DataSinks became ready to read, false if
+ * @return true if all of the inputs became ready to read, false if
  * it times out.
  *
  */
 
         bool all_of(int usecs)
         {
-            ThreadLock<decltype(_item_placed)> l(_item_placed);
+            std::vector<size_t> ready;
             Time::Time_t time_to_quit = Time::getUTC() + ((Time::Time_t)usecs) * 1000L;
-            l.lock();
 
-            while (!std::all_of(_queues.begin(), _queues.end(),
-                    [](DataSinkBase *i) {return i->items() > 0;}))
+            while (_wait(ready, usecs, true) < _inputs.size())
             {
-                _item_placed.wait_locked_with_timeout(usecs);
+                Time::Time_t now = Time::getUTC();
 
-                if (Time::getUTC() >= time_to_quit)
+                if (now >= time_to_quit)
                 {
                     return false;
                 }
+
+                usecs = (time_to_quit - now) / 1000L;
             }
 
             return true;
@@ -470,26 +701,193 @@ namespace matrix
  *
  */
 #pragma GCC diagnostic pop
-    /**
-     * General implementation for all types T. This is used by the
-     * transport to provide the data to the tsemfifo belonging to a
-     * specific DataSink.
-     *
-     * @param data: The data buffer
-     * @param sze: The size in bytes of the buffer
-     * @param ringbuf: the ringbuf to place the string into.
-     *
-     * @return The number of the oldest entries flushed from the
-     * buffer to make room for this one. Ideally this is 0.
-     *
-     */
+
+/**
+ * \struct overflow_policy
+ *
+ * What a DataSink does with incoming data when its queue is full, or,
+ * for CONFLATE, whenever there is anything in it at all:
+ *
+ *  * DROP_OLDEST: The oldest entry is discarded to make room. The
+ *    default, and the behavior of DataSinks before there was a
+ *    choice. Good for a consumer that wants the most recent history.
+ *
+ *  * DROP_NEWEST: The incoming data is discarded. The queue keeps the
+ *    oldest history.
+ *
+ *  * CONFLATE: Everything already in the queue is discarded, so that
+ *    the queue only ever holds the latest value. Good for status or
+ *    display consumers, which only care about the current state.
+ *
+ *  * BLOCK: Waits for room. Nothing is lost, but the transport's
+ *    receive thread stalls, and with it every other sink on the same
+ *    TransportClient, until the consumer catches up.
+ *
+ *  * BLOCK_TIMEOUT: Waits for room for up to `timeout` nano seconds,
+ *    then discards the incoming data.
+ *
+ * The data that is discarded is counted against the policy in effect
+ * (see `DataSink::lost_items()`).
+ *
+ */
+
+    struct overflow_policy
+    {
+        enum kind
+        {
+            DROP_OLDEST,
+            DROP_NEWEST,
+            CONFLATE,
+            BLOCK,
+            BLOCK_TIMEOUT,
+            N_POLICIES
+        };
+
+        overflow_policy(kind k = DROP_OLDEST, Time::Time_t t = 0)
+            : policy(k),
+              timeout(t)
+        {
+        }
+
+        static overflow_policy parse(std::string name, Time::Time_t t = 0);
+
+        kind policy;
+        Time::Time_t timeout;
+    };
+
+/**
+ * Converts a policy name, as it would appear in a configuration, to
+ * an overflow_policy.
+ *
+ * @param name: One of "drop_oldest", "drop_newest", "conflate",
+ * "block" or "block_timeout".
+ *
+ * @param t: The timeout, in nano seconds, for "block_timeout".
+ *
+ * @return The overflow_policy. Throws a MatrixException if 'name' is
+ * not a policy.
+ *
+ */
+
+    inline overflow_policy overflow_policy::parse(std::string name, Time::Time_t t)
+    {
+        if (name == "drop_oldest")
+        {
+            return overflow_policy(DROP_OLDEST);
+        }
+        else if (name == "drop_newest")
+        {
+            return overflow_policy(DROP_NEWEST);
+        }
+        else if (name == "conflate")
+        {
+            return overflow_policy(CONFLATE);
+        }
+        else if (name == "block")
+        {
+            return overflow_policy(BLOCK);
+        }
+        else if (name == "block_timeout")
+        {
+            return overflow_policy(BLOCK_TIMEOUT, t);
+        }
+
+        throw MatrixException("overflow_policy::parse()",
+                              "unknown overflow policy '" + name + "'");
+    }
 
     namespace dspub
     {
-        template <typename T>
-        int _data_handler(void *data, size_t sze, tsemfifo<T> &ringbuf, bool blocking)
+        /**
+         * Puts one entry into a DataSink's queue according to the
+         * sink's overflow policy.
+         *
+         * @param ringbuf: The queue.
+         * @param obj: The entry, which is moved into the queue.
+         * @param policy: What to do if the queue is full.
+         *
+         * @return The number of entries discarded, the incoming one
+         * or ones already in the queue. Ideally this is 0.
+         *
+         */
+
+        template <typename Q, typename T>
+        int _put(Q &ringbuf, T &&obj, overflow_policy const &policy)
         {
-            if (sizeof(T) != sze)
+            switch (policy.policy)
+            {
+            case overflow_policy::BLOCK:
+                return ringbuf.put(std::forward<T>(obj)) ? 0 : 1;
+            case overflow_policy::BLOCK_TIMEOUT:
+                return ringbuf.timed_put(std::forward<T>(obj), policy.timeout) ? 0 : 1;
+            case overflow_policy::DROP_NEWEST:
+                return ringbuf.try_put(std::forward<T>(obj)) ? 0 : 1;
+            case overflow_policy::CONFLATE:
+                return ringbuf.put_latest(std::forward<T>(obj));
+            default:
+                return ringbuf.put_no_block(std::forward<T>(obj));
+            }
+        }
+
+        /**
+         * The batch counterpart of `_put()`. Puts 'n' entries, all
+         * under one lock where the policy allows it. CONFLATE keeps
+         * only the last of them.
+         *
+         * @param ringbuf: The queue.
+         * @param objs: The entries, which are copied into the queue.
+         * @param n: The number of entries.
+         * @param policy: What to do if the queue is full.
+         *
+         * @return The number of entries discarded.
+         *
+         */
+
+        template <typename Q, typename T>
+        int _put_n(Q &ringbuf, T const *objs, size_t n,
+                   overflow_policy const &policy)
+        {
+            switch (policy.policy)
+            {
+            case overflow_policy::BLOCK:
+                return n - ringbuf.put_n(objs, n);
+            case overflow_policy::BLOCK_TIMEOUT:
+                return n - ringbuf.timed_put_n(objs, n, policy.timeout);
+            case overflow_policy::DROP_NEWEST:
+                return n - ringbuf.try_put_n(objs, n);
+            case overflow_policy::CONFLATE:
+                return ringbuf.put_latest(objs[n - 1]) + n - 1;
+            default:
+                return ringbuf.put_n_no_block(objs, n);
+            }
+        }
+
+        /**
+         * General implementation for all types T. This is used by the
+         * transport to provide the data to the tsemfifo belonging to a
+         * specific DataSink. The buffer may hold one T, or several back
+         * to back (see `DataSource<T>::publish_batch()`), in which case
+         * they are all put into the tsemfifo at once.
+         *
+         * @param data: The data buffer
+         * @param sze: The size in bytes of the buffer, a multiple of sizeof(T)
+         * @param ringbuf: the ringbuf to place the string into.
+         * @param spare: The sink's spare entry. Unused for plain types;
+         * see the std::string overload.
+         * @param policy: What to do if the ringbuf is full.
+         *
+         * @return The number of entries discarded because the buffer
+         * was full. Ideally this is 0.
+         *
+         */
+
+        template <template <typename> class Q, typename T>
+        int _data_handler(void *data, size_t sze, Q<T> &ringbuf, T &,
+                          overflow_policy const &policy)
+        {
+            size_t n = sze / sizeof(T);
+
+            if (n == 0 || n * sizeof(T) != sze)
             {
                 std::ostringstream msg;
                 msg << "size mismatch error. sizeof(T) == " << sizeof(T)
@@ -497,14 +895,12 @@ namespace matrix
                 throw matrix::MatrixException("DataSink::_data_handler()", msg.str());
             }
 
-            if (blocking)
+            if (n > 1)
             {
-                return ringbuf.put(*(T*)data);
-            }
-            else
-            {
-                return ringbuf.put_no_block(*(T *) data);
+                return _put_n(ringbuf, (T const *)data, n, policy);
             }
+
+            return _put(ringbuf, T(*(T *)data), policy);
         }
 
         /**
@@ -514,64 +910,54 @@ namespace matrix
          * @param sze: The size, in bytes, of the incoming data
          * @param ringuf: The rinbuf into which to put the data, after
          * converting it to the proper type
-         * @param blocking: If true, blocks until there is space in the
-         * fifo. If not, drops the data and returns immediately.
+         * @param spare: The sink's spare vector, filled and swapped into
+         * the ringbuf as for std::string.
+         * @param policy: What to do if the ringbuf is full.
          *
-         * @return int, the boolean value of the ringbuf put operation.
+         * @return The number of entries discarded.
          *
          */
 
-        template <typename T>
+        template <template <typename> class Q, typename T>
         int _data_handler(void *data, size_t sze,
-                          matrix::tsemfifo<std::vector<T>> &ringbuf, bool blocking)
+                          Q<std::vector<T>> &ringbuf,
+                          std::vector<T> &spare,
+                          overflow_policy const &policy)
         {
-            auto elems = sze / sizeof(T);
-            std::vector<T> incoming(elems);
-            std::memmove(incoming.data(), data, sze);
-
-            if (blocking)
-            {
-                return ringbuf.put(incoming);
-            }
-            else
-            {
-                return ringbuf.put_no_block(incoming);
-            }
+            spare.resize(sze / sizeof(T));
+            std::memmove(spare.data(), data, sze);
+            return _put(ringbuf, std::move(spare), policy);
         }
 
         /**
          * std::string specialization for _data_handler, wich is used by
          * the transport to provide the data to the DataSink's
-         * tsemfifo. Using std::strings has some implications: When the
-         * string is placed into the fifo, it's operator=() will be used
-         * to transfer the data. This means whatever previous buffer the
-         * string inside the fifo was using will be deleted, and a pointer
-         * to a new buffer given to it (by std::string, in this
-         * function). This means memory allocation and deallocation.
+         * tsemfifo. The data is copied into the sink's spare string,
+         * which is then swapped into the fifo (see `recyclable`). The
+         * spare is left holding the buffer of the slot it went into,
+         * which in turn was left there by the consumer's get(). Once
+         * these buffers have grown to the size of the messages no
+         * memory is allocated or freed per message.
          *
          * @param data: The data buffer
          * @param sze: The size in bytes of the buffer
          * @param ringbuf: the ringbuf to place the string into.
+         * @param spare: The sink's spare string.
+         * @param policy: What to do if the ringbuf is full.
          *
-         * @return The number of the oldest entries flushed from the
-         * buffer to make room for this one. Ideally this is 0.
+         * @return The number of entries discarded because the buffer
+         * was full. Ideally this is 0.
          *
          */
 
-        inline int _data_handler(void *data, size_t sze,
-                matrix::tsemfifo<std::string> &ringbuf, bool blocking)
+        template <template <typename> class Q>
+        int _data_handler(void *data, size_t sze,
+                Q<std::string> &ringbuf, std::string &spare,
+                overflow_policy const &policy)
         {
-            std::string val(sze, 0);
-            std::memmove((char *)val.data(), data, sze);
-
-            if (blocking)
-            {
-                return ringbuf.put(val);
-            }
-            else
-            {
-                return ringbuf.put_no_block(val);
-            }
+            spare.resize(sze);
+            std::memmove((char *)spare.data(), data, sze);
+            return _put(ringbuf, std::move(spare), policy);
         }
 
         /**
@@ -581,49 +967,104 @@ namespace matrix
          * resizable buffer. In a DataSource, it is useful for matching
          * the expected size of a DataSink, and when used in a DataSync,
          * useful for matching the incoming size from a
-         * DataSource. GenericBuffers will only resize themselves when the
-         * incoming data size does not match the previously allocated
-         * size. In that case a new buffer of the right size will be
-         * allocated. Otherwise data is copied to the buffers without any
-         * allocation or deallocation or transfer of buffer, as with
-         * std::string.
+         * DataSource. As with std::string, the data is copied into the
+         * sink's spare buffer, which is swapped into the fifo, so that
+         * buffers circulate between the transport and the consumer and
+         * are only reallocated if the message size grows.
          *
          * @param data: The data buffer
          * @param sze: The size in bytes of the buffer
          * @param ringbuf: the ringbuf to place the string into.
+         * @param spare: The sink's spare buffer.
+         * @param policy: What to do if the ringbuf is full.
          *
-         * @return The number of the oldest entries flushed from the
-         * buffer to make room for this one. Ideally this is 0.
+         * @return The number of entries discarded because the buffer
+         * was full. Ideally this is 0.
          *
          */
 
-        inline int _data_handler(void *data, size_t sze,
-                matrix::tsemfifo<matrix::GenericBuffer> &ringbuf, bool blocking)
+        template <template <typename> class Q>
+        int _data_handler(void *data, size_t sze,
+                Q<matrix::GenericBuffer> &ringbuf,
+                matrix::GenericBuffer &spare,
+                overflow_policy const &policy)
         {
-            matrix::GenericBuffer buf;
-
-            if (buf.size() != sze)
+            if (spare.size() != sze)
             {
-                buf.resize(sze);
+                spare.resize(sze);
             }
 
-            // TBF? A copy could be eliminated here if tsemfifo had a
-            // 'get_next_no_block()' and a 'put()' (with empty parameter list),
-            // wich would handle the semaphores properly to mark it as put,
-            // to get the next available slot and copy it directly to this.
-            std::memmove((unsigned char *)buf.data(), data, sze);
-            if (blocking)
-            {
-                return ringbuf.put(buf);
-            }
-            else
-            {
-                return ringbuf.put_no_block(buf);
-            }
+            std::memmove((unsigned char *)spare.data(), data, sze);
+            return _put(ringbuf, std::move(spare), policy);
+        }
+
+        /**
+         * matrix::SharedBuffer specialization for _data_handler, used
+         * when a DataSink<SharedBuffer> receives its data from a
+         * transport that delivers bytes. The bytes are copied once, into
+         * a new SharedBuffer.
+         *
+         * @param data: The data buffer
+         * @param sze: The size in bytes of the buffer
+         * @param ringbuf: the ringbuf to place the buffer into.
+         * @param spare: Unused; SharedBuffers are not recycled.
+         * @param policy: What to do if the ringbuf is full.
+         *
+         * @return The number of entries discarded because the buffer
+         * was full. Ideally this is 0.
+         *
+         */
+
+        template <template <typename> class Q>
+        int _data_handler(void *data, size_t sze,
+                Q<matrix::SharedBuffer> &ringbuf, matrix::SharedBuffer &,
+                overflow_policy const &policy)
+        {
+            return _put(ringbuf, matrix::SharedBuffer(data, sze), policy);
+        }
+
+        /**
+         * Handles a SharedBuffer published over a transport that passes
+         * it along by reference (rtinproc). In general the contents are
+         * converted to a T as if they had arrived as bytes.
+         *
+         * @param buf: The published buffer
+         * @param ringbuf: the ringbuf to place the data into.
+         * @param spare: The sink's spare entry (see `_data_handler()`).
+         * @param policy: What to do if the ringbuf is full.
+         *
+         * @return The number of entries discarded because the buffer
+         * was full. Ideally this is 0.
+         *
+         */
+
+        template <template <typename> class Q, typename T>
+        int _shared_data_handler(matrix::SharedBuffer const &buf,
+                                 Q<T> &ringbuf, T &spare,
+                                 overflow_policy const &policy)
+        {
+            return _data_handler((void *)buf.data(), buf.size(), ringbuf,
+                                 spare, policy);
+        }
+
+        /**
+         * Overload for a DataSink<SharedBuffer>: the sink's queue takes
+         * another reference to the published buffer. Nothing is
+         * allocated or copied.
+         *
+         */
+
+        template <template <typename> class Q>
+        int _shared_data_handler(matrix::SharedBuffer const &buf,
+                Q<matrix::SharedBuffer> &ringbuf, matrix::SharedBuffer &,
+                overflow_policy const &policy)
+        {
+            return _put(ringbuf, matrix::SharedBuffer(buf), policy);
         }
     }
 
-    template <typename T, typename U = select_specified>
+    template <typename T, typename U = select_specified,
+              template <typename> class Q = tsemfifo>
     class DataSink : public matrix::DataSinkBase
     {
     public:
@@ -633,10 +1074,18 @@ namespace matrix
         void get(T &);
         bool try_get(T &);
         bool timed_get(T &, Time::Time_t);
+        template <typename OutputIt>
+        size_t get_batch(OutputIt, size_t, Time::Time_t);
         size_t items();
         size_t lost_items();
+        size_t lost_items(overflow_policy::kind policy);
+        void set_overflow_policy(overflow_policy policy);
+        void set_overflow_policy(std::string name, Time::Time_t timeout = 0);
+        void reset_overflow_policy();
         size_t flush(int items);
         void set_notifier(std::shared_ptr<matrix::fifo_notifier> n);
+        int event_fd();
+        void clear_event();
 
         void connect(std::string component_name, std::string data_name,
                      std::string transport = "");
@@ -651,14 +1100,18 @@ namespace matrix
         void _reconnect(std::string component_name, std::string data_name,
                         std::string transport = "");
         void _disconnect();
-        void _data_handler(std::string key, void *data, size_t sze);
+        void _data_handler(topic_id_t topic, void *data, size_t sze);
+        overflow_policy _get_overflow_policy();
+        void _shared_data_handler(topic_id_t topic, matrix::SharedBuffer const &buf);
         std::string _get_as_configured_key(std::string component_name,
                 std::string data_name);
+        YAML::Node _get_socket_options();
 
         bool _connected;
-        size_t _lost_data;
+        std::atomic<size_t> _lost_data[overflow_policy::N_POLICIES];
         std::string _km_urn;
         std::string _key;
+        topic_id_t _topic;
         std::string _asconf_key;
         std::string _pipe_url;
         std::string _urn;
@@ -667,9 +1120,21 @@ namespace matrix
         std::string _transport;
 
         std::shared_ptr<matrix::TransportClient> _tc;
-        matrix::tsemfifo<T> _ringbuf;
+        Q<T> _ringbuf;
+        // Filled by the transport and swapped into _ringbuf; holds
+        // the buffer recycled from the slot it went into. A source
+        // may publish from several threads (e.g. over rtinproc), so
+        // it is only touched under _spare_mutex.
+        T _spare;
+        matrix::Mutex _spare_mutex;
         matrix::DataMemberCB<DataSink> _cb;
-        bool _blocking;
+        // May be changed while connected, so the transport thread
+        // copies it under _policy_mutex. A separate lock, as a BLOCK
+        // put waits with _spare_mutex held.
+        overflow_policy _policy;
+        overflow_policy _default_policy;
+        matrix::Mutex _policy_mutex;
+        std::shared_ptr<matrix::event_notifier> _event;
     };
 
 /**
@@ -677,16 +1142,29 @@ namespace matrix
  *
  * @param km_urn: Access to the keymaster.
  *
+ * @param ringbuf_size: The depth of the receive queue.
+ *
+ * @param blocking: If true, the sink starts out with the BLOCK
+ * overflow policy, otherwise with DROP_OLDEST. See
+ * `set_overflow_policy()` for the others.
+ *
  */
 
-    template <typename T, typename U>
-    DataSink<T, U>::DataSink(std::string km_urn, size_t ringbuf_size, bool blocking)
+    template <typename T, typename U, template <typename> class Q>
+    DataSink<T, U, Q>::DataSink(std::string km_urn, size_t ringbuf_size, bool blocking)
         : _connected(false),
           _km_urn(km_urn),
+          _topic(0),
           _ringbuf(ringbuf_size),
-          _cb(this, &DataSink::_data_handler),
-          _blocking(blocking)
+          _spare(),
+          _cb(this, &DataSink::_data_handler, &DataSink::_shared_data_handler),
+          _policy(blocking ? overflow_policy::BLOCK : overflow_policy::DROP_OLDEST),
+          _default_policy(_policy),
+          _event(new matrix::event_notifier())
     {
+        std::fill(_lost_data, _lost_data + overflow_policy::N_POLICIES, 0);
+        // installed now, before any transport thread can put.
+        _ringbuf.set_notifier(_event);
     }
 
 /**
@@ -694,8 +1172,8 @@ namespace matrix
  *
  */
 
-    template <typename T, typename U>
-    DataSink<T, U>::~DataSink() throw()
+    template <typename T, typename U, template <typename> class Q>
+    DataSink<T, U, Q>::~DataSink() throw()
     {
         std::string now = Time::isoDateTime(Time::getUTC()) + " -- ";
 
@@ -723,8 +1201,8 @@ namespace matrix
  *
  */
 
-    template <typename T, typename U>
-    void DataSink<T, U>::_check_connected()
+    template <typename T, typename U, template <typename> class Q>
+    void DataSink<T, U, Q>::_check_connected()
     {
         if (!_connected)
         {
@@ -735,18 +1213,42 @@ namespace matrix
 /**
  * This handler handles the actual data coming from the DataSource.
  *
- * @param key: The key to the data source
+ * @param topic: The topic ID of the key to the data source
  * @param data: The data blob from the source
  * @param sze: The size, in bytes, of this blob.
  *
  */
 
-    template <typename T, typename U>
-    void DataSink<T, U>::_data_handler(std::string key, void *data, size_t sze)
+    template <typename T, typename U, template <typename> class Q>
+    void DataSink<T, U, Q>::_data_handler(topic_id_t topic, void *data, size_t sze)
+    {
+        if (topic == _topic)
+        {
+            overflow_policy policy = _get_overflow_policy();
+            matrix::ThreadLock<matrix::Mutex> l(_spare_mutex);
+            l.lock();
+            _lost_data[policy.policy] += dspub::_data_handler(data, sze, _ringbuf, _spare, policy);
+        }
+    }
+
+/**
+ * This handler handles a SharedBuffer passed along by reference from
+ * the DataSource.
+ *
+ * @param topic: The topic ID of the key to the data source
+ * @param buf: The published buffer
+ *
+ */
+
+    template <typename T, typename U, template <typename> class Q>
+    void DataSink<T, U, Q>::_shared_data_handler(topic_id_t topic, matrix::SharedBuffer const &buf)
     {
-        if (key == _key)
+        if (topic == _topic)
         {
-            _lost_data += dspub::_data_handler(data, sze, _ringbuf, _blocking);
+            overflow_policy policy = _get_overflow_policy();
+            matrix::ThreadLock<matrix::Mutex> l(_spare_mutex);
+            l.lock();
+            _lost_data[policy.policy] += dspub::_shared_data_handler(buf, _ringbuf, _spare, policy);
         }
     }
 
@@ -758,8 +1260,8 @@ namespace matrix
  *
  */
 
-    template <typename T, typename U>
-    void DataSink<T, U>::get(T &val)
+    template <typename T, typename U, template <typename> class Q>
+    void DataSink<T, U, Q>::get(T &val)
     {
         _check_connected();
         _ringbuf.get(val);
@@ -778,8 +1280,8 @@ namespace matrix
  *
  */
 
-    template <typename T, typename U>
-    bool DataSink<T, U>::try_get(T &val)
+    template <typename T, typename U, template <typename> class Q>
+    bool DataSink<T, U, Q>::try_get(T &val)
     {
         _check_connected();
         return _ringbuf.try_get(val);
@@ -795,13 +1297,40 @@ namespace matrix
  *
  */
 
-    template <typename T, typename U>
-    bool DataSink<T, U>::timed_get(T &val, Time::Time_t time_out)
+    template <typename T, typename U, template <typename> class Q>
+    bool DataSink<T, U, Q>::timed_get(T &val, Time::Time_t time_out)
     {
         _check_connected();
         return _ringbuf.timed_get(val, time_out);
     }
 
+/**
+ * Gets up to 'max' values from the data source at once. Waits up to
+ * 'time_out' for the first value, then drains whatever else is
+ * already queued, up to 'max', under a single lock. This is much
+ * cheaper per value than repeated calls to `get()` when the source
+ * produces values faster than one at a time can be consumed.
+ *
+ * @param out: An output iterator the values are moved to: an array
+ * or std::vector with room for at least 'max' values, or a
+ * std::back_inserter().
+ *
+ * @param max: The most values to get.
+ *
+ * @param time_out: the time-out, in nanoseconds (relative)
+ *
+ * @return The number of values written to 'out', 0 on time-out.
+ *
+ */
+
+    template <typename T, typename U, template <typename> class Q>
+    template <typename OutputIt>
+    size_t DataSink<T, U, Q>::get_batch(OutputIt out, size_t max, Time::Time_t time_out)
+    {
+        _check_connected();
+        return _ringbuf.get_n(out, max, time_out);
+    }
+
 /**
  * Connects to a data source. DataSink does this by obtaining a
  * pointer to a TransportClient and subscribing to the desired key,
@@ -833,8 +1362,8 @@ namespace matrix
  *
  */
 
-    template <typename T, typename U>
-    void DataSink<T, U>::connect(std::string component_name,
+    template <typename T, typename U, template <typename> class Q>
+    void DataSink<T, U, Q>::connect(std::string component_name,
                                  std::string data_name, std::string transport)
     {
         U tss(_km_urn, transport);
@@ -849,14 +1378,45 @@ namespace matrix
         _transport = transport;
         _urn = tss(component_name, data_name);
         _key = component_name + "." + data_name;
+        _topic = TopicRegistry::intern(_key);
         _asconf_key = _get_as_configured_key(component_name, data_name);
-        _lost_data = 0L;
+        std::fill(_lost_data, _lost_data + overflow_policy::N_POLICIES, 0);
+        // so that the ZMQ transports' context is configured from the
+        // Keymaster, should this be the first of them in the process.
+        ZMQContext::TransportInstance(_km_urn);
         _tc = TransportClient::get_transport(_urn);
+        _tc->set_options(_get_socket_options());
         _tc->connect(_urn);
         _tc->subscribe(_key, &_cb);
         _connected = true;
     }
 
+/**
+ * Fetches the 'SocketOptions' map of the transport used by the data
+ * source, which the TransportClient applies to its socket(s) when it
+ * first connects. Must be called after `_asconf_key` is set.
+ *
+ * @return The options, or a null node if the transport has none.
+ *
+ */
+
+    template <typename T, typename U, template <typename> class Q>
+    YAML::Node DataSink<T, U, Q>::_get_socket_options()
+    {
+        // _asconf_key is 'components.<component>.Transports.<transport>.AsConfigured'
+        std::string key = _asconf_key.substr(0, _asconf_key.rfind('.')) + ".SocketOptions";
+
+        try
+        {
+            Keymaster km(_km_urn);
+            return km.get(key);
+        }
+        catch (KeymasterException &e)
+        {
+            return YAML::Node();
+        }
+    }
+
 /**
  * Creates and returns an 'AsConfigured' key for the
  * transport. This will be used to subscribe to the Keymaster to
@@ -870,8 +1430,8 @@ namespace matrix
  *
  */
 
-    template <typename T, typename U>
-    std::string DataSink<T, U>::_get_as_configured_key(std::string component_name,
+    template <typename T, typename U, template <typename> class Q>
+    std::string DataSink<T, U, Q>::_get_as_configured_key(std::string component_name,
             std::string data_name)
     {
         Keymaster km(_km_urn);
@@ -894,13 +1454,14 @@ namespace matrix
  *
  */
 
-    template <typename T, typename U>
-    void DataSink<T, U>::disconnect()
+    template <typename T, typename U, template <typename> class Q>
+    void DataSink<T, U, Q>::disconnect()
     {
         if (_connected)
         {
             _tc->unsubscribe(_key);
             _key.clear();
+            _topic = 0;
             _tc.reset();
             TransportClient::release_transport(_urn);
             _connected = false;
@@ -915,8 +1476,8 @@ namespace matrix
  *
  */
 
-    template <typename T, typename U>
-    size_t DataSink<T, U>::items()
+    template <typename T, typename U, template <typename> class Q>
+    size_t DataSink<T, U, Q>::items()
     {
         return (size_t)_ringbuf.size();
     }
@@ -933,10 +1494,90 @@ namespace matrix
  *
  */
 
-    template <typename T, typename U>
-    size_t DataSink<T, U>::lost_items()
+    template <typename T, typename U, template <typename> class Q>
+    size_t DataSink<T, U, Q>::lost_items()
+    {
+        return std::accumulate(_lost_data, _lost_data + overflow_policy::N_POLICIES,
+                               (size_t)0);
+    }
+
+/**
+ * Returns the number of items lost while a particular overflow policy
+ * was in effect. What "lost" means depends on the policy: for
+ * DROP_OLDEST and CONFLATE it is entries discarded from the queue,
+ * for the others incoming data that was never queued.
+ *
+ * @param policy: The overflow policy of interest.
+ *
+ * @return The number of items lost under 'policy' during this
+ * connection.
+ *
+ */
+
+    template <typename T, typename U, template <typename> class Q>
+    size_t DataSink<T, U, Q>::lost_items(overflow_policy::kind policy)
+    {
+        return _lost_data[policy];
+    }
+
+/**
+ * Sets what the DataSink does with incoming data when its queue is
+ * full (see `overflow_policy`). This may be done while connected:
+ * the transport's thread uses the new policy from the next message
+ * on.
+ *
+ * @param policy: The new overflow policy.
+ *
+ */
+
+    template <typename T, typename U, template <typename> class Q>
+    void DataSink<T, U, Q>::set_overflow_policy(overflow_policy policy)
+    {
+        matrix::ThreadLock<matrix::Mutex> l(_policy_mutex);
+        l.lock();
+        _policy = policy;
+    }
+
+/**
+ * Returns a copy of the overflow policy, for the transport's thread.
+ *
+ */
+
+    template <typename T, typename U, template <typename> class Q>
+    overflow_policy DataSink<T, U, Q>::_get_overflow_policy()
+    {
+        matrix::ThreadLock<matrix::Mutex> l(_policy_mutex);
+        l.lock();
+        return _policy;
+    }
+
+/**
+ * Sets the overflow policy by name, as given in a configuration.
+ *
+ * @param name: "drop_oldest", "drop_newest", "conflate", "block" or
+ * "block_timeout". Throws a MatrixException if it is none of these.
+ *
+ * @param timeout: For "block_timeout", how long to wait for room in
+ * the queue, in nano seconds.
+ *
+ */
+
+    template <typename T, typename U, template <typename> class Q>
+    void DataSink<T, U, Q>::set_overflow_policy(std::string name, Time::Time_t timeout)
+    {
+        set_overflow_policy(overflow_policy::parse(name, timeout));
+    }
+
+/**
+ * Restores the overflow policy the DataSink was constructed with:
+ * BLOCK if it was made blocking, otherwise DROP_OLDEST.
+ *
+ */
+
+    template <typename T, typename U, template <typename> class Q>
+    void DataSink<T, U, Q>::reset_overflow_policy()
     {
-        return _lost_data;
+        set_overflow_policy(_default_policy);
     }
 
 /**
@@ -952,8 +1593,8 @@ namespace matrix
  *
  */
 
-    template <typename T, typename U>
-    size_t DataSink<T, U>::flush(int items)
+    template <typename T, typename U, template <typename> class Q>
+    size_t DataSink<T, U, Q>::flush(int items)
     {
         return (size_t)_ringbuf.flush(items);
     }
@@ -961,19 +1602,54 @@ namespace matrix
 /**
  * Passes a notifier functor to the ring buffer. The notifier is
  * called when data is placed into the ring buffer, allowing the
- * poller (or other code) to be notified when data is available.
+ * poller (or other code) to be notified when data is available. It
+ * replaces the notifier behind `event_fd()`, which then no longer
+ * becomes readable, and should be given before `connect()`.
  *
  * @param n: a shared_ptr<fifo_notifier>. fifo_notifier is the base
  * class for the notifier functors.
  *
  */
 
-    template <typename T, typename U>
-    void DataSink<T, U>::set_notifier(std::shared_ptr<matrix::fifo_notifier> n)
+    template <typename T, typename U, template <typename> class Q>
+    void DataSink<T, U, Q>::set_notifier(std::shared_ptr<matrix::fifo_notifier> n)
     {
         _ringbuf.set_notifier(n);
     }
 
+/**
+ * Returns a file descriptor that becomes readable when data arrives,
+ * so that the DataSink may be waited on with epoll (see `poller`),
+ * poll or select. It is driven by the `event_notifier` the
+ * constructor installs on the receive queue, unless that has been
+ * replaced with `set_notifier()`.
+ *
+ * Once the descriptor is readable, call `clear_event()` before
+ * reading the data, and read until the sink is empty before waiting
+ * on the descriptor again.
+ *
+ * @return The eventfd descriptor, owned by the DataSink.
+ *
+ */
+
+    template <typename T, typename U, template <typename> class Q>
+    int DataSink<T, U, Q>::event_fd()
+    {
+        return _event->fd();
+    }
+
+/**
+ * Clears the descriptor returned by `event_fd()` and re-arms it for
+ * the next arrival.
+ *
+ */
+
+    template <typename T, typename U, template <typename> class Q>
+    void DataSink<T, U, Q>::clear_event()
+    {
+        _event->rearm();
+    }
+
 /**
   * Reconnects a sink to its source. Given a KeymasterHeartbeatCB, it
   * can verify that the Keymaster is still alive. If so, it checks to
@@ -49,7 +49,7 @@ namespace matrix
      * will be used by the DataSource class in its 'publish' member
      * function. Other overloads may be added here.
      *
-     * @param key: The publication key
+     * @param topic: The publication key's topic ID
      * @param v: The value to publish (and the value that overloads
      * these functions)
      * @param t: the TransportServer pointer.
@@ -62,37 +62,46 @@ namespace matrix
     {
 
         template <typename V>
-        bool publish(std::string key, V &v, std::shared_ptr<TransportServer> t)
+        bool publish(topic_id_t topic, V &v, std::shared_ptr<TransportServer> t)
         {
-            return t->publish(key, &v, sizeof v);
+            return t->publish(topic, &v, sizeof v);
         }
 
 
         template <typename V>
-        bool publish(std::string key, std::vector<V> &v, std::shared_ptr<TransportServer> t)
+        bool publish(topic_id_t topic, std::vector<V> &v, std::shared_ptr<TransportServer> t)
         {
-            return t->publish(key, (void *)v.data(), v.size() * sizeof(V));
+            return t->publish(topic, (void *)v.data(), v.size() * sizeof(V));
         }
 
 
-        inline bool publish(std::string key, std::string &v,
+        inline bool publish(topic_id_t topic, std::string &v,
                             std::shared_ptr<TransportServer> t)
         {
-            return t->publish(key, (void *)v.data(), v.size());
+            return t->publish(topic, (void *)v.data(), v.size());
         }
 
 
-        inline bool publish(std::string key, matrix::GenericBuffer &v,
+        inline bool publish(topic_id_t topic, matrix::GenericBuffer &v,
                             std::shared_ptr<TransportServer> t)
         {
-            return t->publish(key, (void *)v.data(), v.size());
+            return t->publish(topic, (void *)v.data(), v.size());
         }
 
 
-        inline bool publish(std::string key, msgpack::sbuffer &v,
+        inline bool publish(topic_id_t topic, msgpack::sbuffer &v,
                             std::shared_ptr<TransportServer> t)
         {
-            return t->publish(key, (void *)v.data(), v.size());
+            return t->publish(topic, (void *)v.data(), v.size());
+        }
+
+
+        // The buffer itself goes to the transport, which may pass it
+        // on by reference rather than copying its contents.
+        inline bool publish(topic_id_t topic, matrix::SharedBuffer &v,
+                            std::shared_ptr<TransportServer> t)
+        {
+            return t->publish(topic, v);
         }
     }
 
@@ -133,7 +142,9 @@ namespace matrix
  * "A". Using this information it can create and/or obtain a reference
  * to the correct transport. From this point on, 'log->put(data)' will
  * then translate to a 't->put("log", data)', where 't' is the correct
- * transport specified in the configuration.
+ * transport specified in the configuration. The key is interned as a
+ * topic ID (see TopicRegistry) here, and it is the ID, not the key,
+ * that accompanies every publication.
  *
  */
 
@@ -146,7 +157,8 @@ namespace matrix
             _km_urn(km_urn),
             _component_name(component_name),
             _data_name(data_name),
-            _key(component_name + "." + data_name)
+            _key(component_name + "." + data_name),
+            _topic(TopicRegistry::intern(_key))
         {
             matrix::Keymaster km(km_urn);
             // obtain the transport name associated with this data source and
@@ -167,7 +179,53 @@ namespace matrix
 
         bool publish(T &val)
         {
-            return dspub::publish(_key, val, _ts);
+            return dspub::publish(_topic, val, _ts);
+        }
+
+        /**
+         * Publishes 'n' values of a simple, contiguous type T as a
+         * single message, rather than one message per value. A
+         * DataSink<T> receiving the message queues each value
+         * separately, so the sink sees the same stream of T as if
+         * each had been published with `publish()`.
+         *
+         * @param vals: The values to publish.
+         *
+         * @param n: The number of values in 'vals'. If 0, nothing is
+         * sent: a sink would take an empty message for a malformed one.
+         *
+         * @return true if publish succeeded, false otherwise.
+         *
+         */
+
+        bool publish_batch(T const *vals, size_t n)
+        {
+            if (n == 0)
+            {
+                return true;
+            }
+
+            return _ts->publish(_topic, (void const *)vals, n * sizeof(T));
+        }
+
+        /**
+         * Publishes 'size' bytes as a single message, the same message
+         * `publish()` would send for a T holding those bytes (a
+         * GenericBuffer or string, say). This lets a source publish
+         * data it does not own, such as a region of a memory mapped
+         * file, without first copying it into a T.
+         *
+         * @param data: The message.
+         *
+         * @param size: The size of the message, in bytes.
+         *
+         * @return true if publish succeeded, false otherwise.
+         *
+         */
+
+        bool publish_bytes(void const *data, size_t size)
+        {
+            return _ts->publish(_topic, data, size);
         }
 
     private:
@@ -177,6 +235,7 @@ namespace matrix
         std::string _transport_name;
         std::string _data_name;
         std::string _key;
+        topic_id_t _topic;
         std::shared_ptr<matrix::TransportServer> _ts;
     };
 
@@ -30,6 +30,10 @@
 #if !defined(_GENERIC_BUFFER_H_)
 #define _GENERIC_BUFFER_H_
 
+#include "matrix/recyclable.h"
+
+#include <list>
+#include <map>
 #include <string>
 #include <vector>
 #include <string.h>
@@ -104,6 +108,11 @@ namespace matrix
             _copy(gb);
         }
 
+        GenericBuffer(GenericBuffer &&gb) noexcept
+            : _buffer(std::move(gb._buffer))
+        {
+        }
+
         void resize(size_t size)
         {
             _buffer.resize(size);
@@ -119,12 +128,28 @@ namespace matrix
             return _buffer.data();
         }
 
+        const unsigned char *data() const
+        {
+            return _buffer.data();
+        }
+
         const GenericBuffer &operator=(const GenericBuffer &rhs)
         {
             _copy(rhs);
             return *this;
         }
 
+        GenericBuffer &operator=(GenericBuffer &&rhs) noexcept
+        {
+            _buffer = std::move(rhs._buffer);
+            return *this;
+        }
+
+        void swap(GenericBuffer &gb) noexcept
+        {
+            _buffer.swap(gb._buffer);
+        }
+
     private:
         void _copy(const GenericBuffer &gb)
         {
@@ -139,6 +164,18 @@ namespace matrix
         std::vector<unsigned char> _buffer;
     };
 
+    inline void swap(GenericBuffer &a, GenericBuffer &b) noexcept
+    {
+        a.swap(b);
+    }
+
+    // Queues swap GenericBuffers in and out of their slots, so that the
+    // storage circulates between producer and consumer.
+    template <>
+    struct recyclable<GenericBuffer> : std::true_type
+    {
+    };
+
     struct data_description
     {
         enum types
@@ -163,7 +200,8 @@ namespace matrix
             FLOAT,
             DOUBLE,
             LONG_DOUBLE,
-            TIME_T
+            TIME_T,
+            N_TYPES
         };
 
         struct data_field
@@ -199,28 +237,245 @@ namespace matrix
         *((T *)(buf + offset)) = val;
     }
 
+    /**
+     * \class compiled_description
+     *
+     * A data_description laid out for use on the data path. The fields
+     * are held in a vector, in order, with their offsets and element
+     * widths computed once, so a field is addressed by its index (its
+     * "field ID") in constant time. The indices of the fields of each
+     * type are also kept together, so that a consumer may handle all
+     * the columns of one type in a single pass rather than switching on
+     * the type of every field of every sample:
+     *
+     *      compiled_description cd(data_description(fields));
+     *      size_t az = cd.field_id("az");
+     *      buffer_view v(cd, buf);
+     *      double a = v.get<double>(az);
+     *
+     *      for (auto i : cd.columns(data_description::DOUBLE))
+     *      {
+     *          cd.extract(i, bufs, n, column);  // column i of n samples
+     *          ...
+     *      }
+     *
+     * The accessors do not check that T matches the field's type; it is
+     * up to the caller to use the type given by `field::type`.
+     *
+     */
+
+    class compiled_description
+    {
+    public:
+
+        struct field
+        {
+            std::string name;
+            data_description::types type;
+            size_t offset;            // offset into buffer
+            size_t elements;          // 1 or more of these
+            size_t width;             // size of one element
+            bool skip;                // flag to ignore field when logging
+        };
+
+        compiled_description();
+        compiled_description(data_description dd);
+        compiled_description(YAML::Node dd);
+
+        size_t size() const
+        {
+            return _size;
+        }
+
+        size_t num_fields() const
+        {
+            return _fields.size();
+        }
+
+        field const &operator[](size_t id) const
+        {
+            return _fields[id];
+        }
+
+        std::vector<field> const &fields() const
+        {
+            return _fields;
+        }
+
+        std::vector<size_t> const &columns(data_description::types t) const
+        {
+            return _by_type[t];
+        }
+
+        size_t field_id(std::string const &name) const;
+
+        template <typename T>
+        T get(unsigned char const *buf, size_t id, size_t elem = 0) const;
+
+        template <typename T>
+        void set(unsigned char *buf, size_t id, T val, size_t elem = 0) const;
+
+        template <typename T>
+        void extract(size_t id, GenericBuffer const *bufs, size_t n, T *out) const;
+
+        template <typename T>
+        void extract(size_t id, unsigned char const *rows, size_t n, T *out) const;
+
+    private:
+
+        void _compile(data_description &dd);
+
+        std::vector<field> _fields;
+        std::map<std::string, size_t> _ids;
+        std::vector<size_t> _by_type[data_description::N_TYPES];
+        size_t _size;
+    };
+
+/**
+ * Reads element 'elem' of field 'id' from a buffer laid out according
+ * to this description. The buffer need not be aligned.
+ *
+ * @param buf: The buffer.
+ * @param id: The field ID.
+ * @param elem: The element of the field, for fields with more than one.
+ *
+ * @return The value.
+ *
+ */
+
+    template <typename T>
+    inline T compiled_description::get(unsigned char const *buf, size_t id,
+                                       size_t elem) const
+    {
+        T val;
+        memcpy(&val, buf + _fields[id].offset + elem * sizeof(T), sizeof(T));
+        return val;
+    }
+
+/**
+ * Writes element 'elem' of field 'id' to a buffer laid out according
+ * to this description.
+ *
+ * @param buf: The buffer.
+ * @param id: The field ID.
+ * @param val: The value to write.
+ * @param elem: The element of the field, for fields with more than one.
+ *
+ */
+
+    template <typename T>
+    inline void compiled_description::set(unsigned char *buf, size_t id, T val,
+                                          size_t elem) const
+    {
+        memcpy(buf + _fields[id].offset + elem * sizeof(T), &val, sizeof(T));
+    }
+
+/**
+ * Extracts one column: the (first element of the) field 'id' from each
+ * of 'n' buffers, into a contiguous array.
+ *
+ * @param id: The field ID.
+ * @param bufs: The 'n' buffers.
+ * @param n: The number of buffers.
+ * @param out: Receives the 'n' values.
+ *
+ */
+
+    template <typename T>
+    void compiled_description::extract(size_t id, GenericBuffer const *bufs,
+                                       size_t n, T *out) const
+    {
+        size_t offset = _fields[id].offset;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            memcpy(out + i, bufs[i].data() + offset, sizeof(T));
+        }
+    }
+
+/**
+ * Extracts one column from 'n' samples stored back to back, as in a
+ * capture file or a batch published with `publish_batch()`. The loads
+ * are at a constant stride, which the compiler may vectorize.
+ *
+ * @param id: The field ID.
+ * @param rows: The samples, each `size()` bytes.
+ * @param n: The number of samples.
+ * @param out: Receives the 'n' values.
+ *
+ */
+
+    template <typename T>
+    void compiled_description::extract(size_t id, unsigned char const *rows,
+                                       size_t n, T *out) const
+    {
+        unsigned char const *p = rows + _fields[id].offset;
+
+        for (size_t i = 0; i < n; ++i, p += _size)
+        {
+            memcpy(out + i, p, sizeof(T));
+        }
+    }
+
+    /**
+     * \class buffer_view
+     *
+     * Binds a GenericBuffer to the compiled_description of its layout,
+     * giving typed access to its fields by field ID.
+     *
+     */
+
+    class buffer_view
+    {
+    public:
+
+        buffer_view(compiled_description const &cd, GenericBuffer &buf)
+            : _cd(cd),
+              _buf(buf.data())
+        {
+        }
+
+        template <typename T>
+        T get(size_t id, size_t elem = 0) const
+        {
+            return _cd.get<T>(_buf, id, elem);
+        }
+
+        template <typename T>
+        void set(size_t id, T val, size_t elem = 0)
+        {
+            _cd.set<T>(_buf, id, val, elem);
+        }
+
+    private:
+
+        compiled_description const &_cd;
+        unsigned char *_buf;
+    };
+
     /**
      * \class GenericBufferHandler
      *
      * Base class to a callback functor enables actions to be defined by a
      * user of the GenericDataConsumer component, or other application.
+     * The handler is given the buffer's layout already compiled.
      *
      */
 
     struct GenericBufferHandler
     {
-        void operator()(YAML::Node dd, matrix::GenericBuffer &buf)
+        void operator()(compiled_description const &dd, matrix::GenericBuffer &buf)
         {
             _call(dd, buf);
         }
 
-        void exec(YAML::Node dd, matrix::GenericBuffer &buf)
+        void exec(compiled_description const &dd, matrix::GenericBuffer &buf)
         {
             _call(dd, buf);
         }
 
     private:
-        virtual void _call(YAML::Node, matrix::GenericBuffer &)
+        virtual void _call(compiled_description const &, matrix::GenericBuffer &)
         {
         }
     };
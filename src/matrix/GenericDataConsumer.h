@@ -52,6 +52,9 @@ namespace matrix
         }
 
     protected:
+        // The most buffers taken from the sink at once.
+        enum { BATCH_SIZE = 64 };
+
         GenericDataConsumer(std::string name, std::string km_url);
 
         void _task();
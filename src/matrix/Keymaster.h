@@ -51,6 +51,8 @@
 #define __classmethod__  __func__
 #endif
 
+class KeymasterTest;
+
 namespace matrix
 {
     class KeymasterServer
@@ -241,7 +243,8 @@ namespace matrix
     {
     public:
 
-        Keymaster(std::string keymaster_url, bool shared = false);
+        Keymaster(std::string keymaster_url, bool shared = false,
+                  bool msgpack = false);
         ~Keymaster();
 
         YAML::Node get(std::string key);
@@ -249,7 +252,8 @@ namespace matrix
         bool put(std::string key, YAML::Node n, bool create = false);
         void put_nb(std::string key, std::string val, bool create = true);
         bool del(std::string key);
-        bool subscribe(std::string key, matrix::KeymasterCallbackBase *f);
+        bool subscribe(std::string key, matrix::KeymasterCallbackBase *f,
+                       bool delta = false);
         bool unsubscribe(std::string key);
 
         /// 'rpc' assumes a key 'key' which has subkeys 'request' and
@@ -266,7 +270,27 @@ namespace matrix
 
     private:
 
+        friend class ::KeymasterTest;
+
+        // The cached subtree of a delta subscription, and the
+        // sequence number of the last delta merged into it.
+        struct delta_cache
+        {
+            delta_cache()
+                : seq(0),
+                  synced(false)
+            {
+            }
+
+            YAML::Node tree;
+            uint64_t seq;
+            bool synced;
+        };
+
         void _subscriber_task();
+        bool _sync(std::string const &keychain, delta_cache &dc);
+        bool _merge_delta(std::string const &keychain, delta_cache &dc,
+                          YAML::Node delta);
         void _put_task();
         void _run();
         void _run_put();
@@ -274,7 +298,7 @@ namespace matrix
 
         ::mxutils::yaml_result
         _call_keymaster(std::string cmd, std::string key,
-                        std::string val = "", std::string flag = "");
+                        YAML::Node const *val = NULL, std::string flag = "");
 
         std::shared_ptr<zmq::socket_t> _keymaster_socket();
         std::shared_ptr<zmq::socket_t> _km_;
@@ -282,8 +306,11 @@ namespace matrix
         std::string _km_url;
         std::string _pipe_url;
         std::vector<std::string> _km_pub_urls;
+        bool _use_msgpack;  // msgpack wanted
+        bool _msgpack;      // msgpack negotiated, for the current socket
 
         std::map<std::string, matrix::KeymasterCallbackBase *> _callbacks;
+        std::map<std::string, delta_cache> _deltas;
         matrix::Thread<Keymaster> _subscriber_thread;
         matrix::TCondition<bool> _subscriber_thread_ready;
         matrix::Thread<Keymaster> _put_thread;
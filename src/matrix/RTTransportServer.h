@@ -66,6 +66,8 @@ namespace matrix
 
         bool _publish(std::string key, const void *data, size_t size_of_data);
         bool _publish(std::string key, std::string data);
+        bool _publish(topic_id_t topic, const void *data, size_t size_of_data);
+        bool _publish(topic_id_t topic, SharedBuffer const &buf);
 
         struct Impl;
         std::shared_ptr<Impl> _impl;
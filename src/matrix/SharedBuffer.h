@@ -0,0 +1,311 @@
+/*******************************************************************
+ *  SharedBuffer.h - An immutable, reference counted data buffer.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#if !defined(_SHARED_BUFFER_H_)
+#define _SHARED_BUFFER_H_
+
+#include "matrix/Mutex.h"
+#include "matrix/ThreadLock.h"
+
+#include <memory>
+#include <vector>
+#include <cstring>
+
+namespace matrix
+{
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcomment"
+    /**
+     * \class SharedBuffer
+     *
+     * A read-only block of bytes that is shared, not copied. Copying a
+     * SharedBuffer copies a reference to the block, which is freed (or
+     * returned to its owner) when the last SharedBuffer referring to it
+     * goes away.
+     *
+     * A DataSource<SharedBuffer> and DataSink<SharedBuffer> are the
+     * zero-copy counterparts of the GenericBuffer ones. Over the
+     * rtinproc transport the published SharedBuffer itself is handed to
+     * every subscribed sink, so a block is allocated once by the
+     * publisher no matter how many sinks receive it:
+     *
+     *      DataSource<SharedBuffer> src(km_urn, "spectrometer", "blocks");
+     *      std::vector<unsigned char> block(BLOCK_SIZE);
+     *      fill(block);
+     *      SharedBuffer buf(std::move(block)); // no copy
+     *      src.publish(buf);
+     *
+     *      // in any number of consumers:
+     *      DataSink<SharedBuffer> sink(km_urn);
+     *      sink.connect("spectrometer", "blocks");
+     *      SharedBuffer b;
+     *      sink.get(b);
+     *      process(b.data(), b.size());
+     *
+     * The contents must not be modified once the buffer is published,
+     * as every receiver sees the same bytes. ZMQ transports send the
+     * buffer without copying it, and a receiving DataSink<SharedBuffer>
+     * gets a view of the received ZMQ message. Other transports publish
+     * and receive the contents as they do for any other buffer.
+     *
+     * The block may be owned by anything kept alive by a shared_ptr,
+     * such as a pooled buffer or a received transport message. See the
+     * owning constructor.
+     *
+     */
+#pragma GCC diagnostic pop
+
+    class SharedBuffer
+    {
+    public:
+        SharedBuffer()
+            : _size(0)
+        {
+        }
+
+        /**
+         * Allocates a block and copies 'size' bytes from 'data' into it.
+         *
+         */
+
+        SharedBuffer(const void *data, size_t size)
+            : _size(size)
+        {
+            std::shared_ptr<std::vector<unsigned char> > v(
+                new std::vector<unsigned char>(size));
+            memcpy(v->data(), data, size);
+            _data = std::shared_ptr<const unsigned char>(v, v->data());
+        }
+
+        /**
+         * Takes over the contents of 'v' without copying them.
+         *
+         */
+
+        explicit SharedBuffer(std::vector<unsigned char> &&v)
+            : _size(v.size())
+        {
+            std::shared_ptr<std::vector<unsigned char> > owned(
+                new std::vector<unsigned char>(std::move(v)));
+            _data = std::shared_ptr<const unsigned char>(owned, owned->data());
+        }
+
+        /**
+         * Shares the contents of 'v', which must not be modified
+         * afterwards. Used with buffers obtained from a BufferPool.
+         *
+         */
+
+        explicit SharedBuffer(std::shared_ptr<std::vector<unsigned char> > v)
+            : _data(v, v->data()),
+              _size(v->size())
+        {
+        }
+
+        /**
+         * Refers to 'size' bytes at 'data', which belong to 'owner'. The
+         * owner is kept alive for as long as any SharedBuffer refers to
+         * the block.
+         *
+         */
+
+        SharedBuffer(std::shared_ptr<const void> owner, const void *data, size_t size)
+            : _data(owner, (const unsigned char *)data),
+              _size(size)
+        {
+        }
+
+        const unsigned char *data() const
+        {
+            return _data.get();
+        }
+
+        size_t size() const
+        {
+            return _size;
+        }
+
+        bool empty() const
+        {
+            return _size == 0;
+        }
+
+        long use_count() const
+        {
+            return _data.use_count();
+        }
+
+        void reset()
+        {
+            _data.reset();
+            _size = 0;
+        }
+
+    private:
+
+        std::shared_ptr<const unsigned char> _data;
+        size_t _size;
+    };
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcomment"
+    /**
+     * \class BufferPool
+     *
+     * Recycles the storage of published SharedBuffers. `get()` returns a
+     * writable buffer; once it has been wrapped in a SharedBuffer and
+     * published, and the last reference to it is dropped (which may be
+     * in a transport's I/O thread, long after `publish()` returns), the
+     * storage goes back to the pool instead of being freed. Steady-state
+     * publishing of same-sized blocks then never allocates or frees the
+     * blocks themselves. What remains per block is small and of fixed
+     * size: the shared_ptr control block made by `get()` and, over the
+     * ZMQ transports, the SharedBuffer reference each message holds and
+     * ZMQ's own record of the message.
+     *
+     *      std::shared_ptr<BufferPool> pool = BufferPool::create();
+     *      ...
+     *      std::shared_ptr<std::vector<unsigned char> > v = pool->get(BLOCK_SIZE);
+     *      fill(v->data());
+     *      src.publish(SharedBuffer(v)); // a DataSource<SharedBuffer>
+     *
+     * Buffers still in use when the pool is destroyed are simply freed
+     * when released.
+     *
+     */
+#pragma GCC diagnostic pop
+
+    class BufferPool : public std::enable_shared_from_this<BufferPool>
+    {
+    public:
+
+        typedef std::vector<unsigned char> buffer_t;
+
+        /**
+         * Creates a pool. Pools are always held by shared_ptr, as the
+         * buffers they hand out refer back to them.
+         *
+         * @param max_free: The most released buffers the pool will hold
+         * on to. Any more are freed.
+         *
+         */
+
+        static std::shared_ptr<BufferPool> create(size_t max_free = 16)
+        {
+            return std::shared_ptr<BufferPool>(new BufferPool(max_free));
+        }
+
+        /**
+         * Returns a buffer of 'size' bytes, reusing a released one if
+         * there is one. The contents are undefined.
+         *
+         */
+
+        std::shared_ptr<buffer_t> get(size_t size)
+        {
+            matrix::ThreadLock<matrix::Mutex> l(_mutex);
+            buffer_t *b;
+
+            l.lock();
+
+            if (_free.empty())
+            {
+                l.unlock();
+                b = new buffer_t(size);
+            }
+            else
+            {
+                // the most recently released, likeliest to be in cache.
+                b = _free.back();
+                _free.pop_back();
+                l.unlock();
+                b->resize(size);
+            }
+
+            std::weak_ptr<BufferPool> pool(shared_from_this());
+            return std::shared_ptr<buffer_t>(b, [pool](buffer_t *p)
+                                             {
+                                                 std::shared_ptr<BufferPool> sp = pool.lock();
+
+                                                 if (sp)
+                                                 {
+                                                     sp->_release(p);
+                                                 }
+                                                 else
+                                                 {
+                                                     delete p;
+                                                 }
+                                             });
+        }
+
+        size_t free_buffers()
+        {
+            matrix::ThreadLock<matrix::Mutex> l(_mutex);
+            l.lock();
+            return _free.size();
+        }
+
+        ~BufferPool()
+        {
+            for (std::vector<buffer_t *>::iterator i = _free.begin(); i != _free.end(); ++i)
+            {
+                delete *i;
+            }
+        }
+
+    private:
+
+        BufferPool(size_t max_free)
+            : _max_free(max_free)
+        {
+            // so that releasing a buffer never allocates.
+            _free.reserve(max_free);
+        }
+
+        void _release(buffer_t *b)
+        {
+            matrix::ThreadLock<matrix::Mutex> l(_mutex);
+            l.lock();
+
+            if (_free.size() < _max_free)
+            {
+                _free.push_back(b);
+            }
+            else
+            {
+                l.unlock();
+                delete b;
+            }
+        }
+
+        size_t _max_free;
+        std::vector<buffer_t *> _free;
+        matrix::Mutex _mutex;
+    };
+}
+
+#endif
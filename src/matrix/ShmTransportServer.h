@@ -0,0 +1,94 @@
+/*******************************************************************
+ *  ShmTransportServer.h - Shared memory transport server
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#if !defined(_SHMTRANSPORT_SERVER_H_)
+#define _SHMTRANSPORT_SERVER_H_
+
+#include "matrix/TransportServer.h"
+#include <string>
+#include <memory>
+
+namespace matrix
+{
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcomment"
+    /**
+     * \class ShmTransportServer
+     *
+     * Publishes data to ShmTransportClients in this or any other process
+     * on the same host through a POSIX shared memory ring (see
+     * shm_ring.h). A publication is a single copy into the ring; clients
+     * read the data where it lies.
+     *
+     * The transport is specified as 'shm', and is announced in the
+     * 'AsConfigured' key as 'shm:///matrix.<random string>', the name of
+     * the shared memory object. The size of the ring defaults to 16 MB
+     * and may be set with the optional 'BufferSize' key, in bytes. It
+     * should comfortably hold several of the largest messages:
+     *
+     *     spectrometer:
+     *       Transports:
+     *         B:
+     *           Specified: [shm]
+     *           BufferSize: 268435456
+     *           Mode: "0660"
+     *
+     * The shared memory object is created with the permissions in the
+     * optional 'Mode' key, an octal string as for chmod. The default,
+     * "0600", admits only clients run by the same user.
+     *
+     * A client whose backlog leaves no room for a new message is
+     * evicted, so that one slow client does not stall the others: its
+     * backlog is skipped, and it reports the number of messages lost
+     * and resumes with the new message. The message its callbacks may
+     * be using at the time is left in place until they return. A
+     * message too large for the ring is dropped, and `publish()`
+     * returns false.
+     *
+     */
+#pragma GCC diagnostic pop
+
+    class ShmTransportServer : public matrix::TransportServer
+    {
+    public:
+        ShmTransportServer(std::string keymaster_url, std::string key);
+        virtual ~ShmTransportServer();
+
+    private:
+        bool _publish(std::string key, const void *data, size_t size_of_data);
+        bool _publish(std::string key, std::string data);
+        bool _publish(topic_id_t topic, const void *data, size_t size_of_data);
+
+        struct Impl;
+        std::shared_ptr<Impl> _impl;
+
+        friend class matrix::TransportServer;
+        static matrix::TransportServer *factory(std::string, std::string);
+    };
+}
+
+#endif
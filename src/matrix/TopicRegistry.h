@@ -0,0 +1,102 @@
+/*******************************************************************
+ *  TopicRegistry.h - Maps "component.data" keys to compact integer
+ *  topic IDs for use on the data path.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#if !defined(_TOPIC_REGISTRY_H_)
+#define _TOPIC_REGISTRY_H_
+
+#include <string>
+#include <stdint.h>
+
+namespace matrix
+{
+    typedef uint64_t topic_id_t;
+
+    /**
+     * \class TopicRegistry
+     *
+     * Interns data keys ("component.data") as integer topic IDs. A
+     * DataSource interns its key once when it is constructed, and a
+     * DataSink when it connects; from then on every message is
+     * published, routed and matched by its topic ID, so no string is
+     * built, hashed or compared per message.
+     *
+     * The ID is a 64-bit FNV-1a hash of the key. It therefore depends
+     * only on the key, and two processes that have never communicated
+     * will compute the same ID for the same key. This is what allows the
+     * ID to be used on the wire (see `wire_header`). The registry keeps
+     * the reverse mapping, so that the key may be recovered from the ID
+     * where it is still needed, and throws if two different keys hash to
+     * the same ID.
+     *
+     */
+
+    class TopicRegistry
+    {
+    public:
+
+        static topic_id_t intern(std::string const &key);
+        static bool lookup(topic_id_t topic, std::string &key);
+        static std::string key(topic_id_t topic);
+        static topic_id_t hash(std::string const &key);
+    };
+
+    /**
+     * \struct wire_header
+     *
+     * The fixed size header that is sent as the first frame of every
+     * message by network transports, in place of the string key. The
+     * topic ID comes first so that a subscriber may filter on it by
+     * subscribing to the first `sizeof(topic_id_t)` bytes of the
+     * header. All fields are in host byte order.
+     *
+     * Normally the data follows in a second frame. If `flags` has
+     * `INLINE` set, the data instead follows the header in the same
+     * frame. Publishers do this when the transport is configured with
+     * CONFLATE, which ZMQ does not support for multi-part messages.
+     *
+     */
+
+    struct wire_header
+    {
+        enum
+        {
+            VERSION = 1
+        };
+
+        enum
+        {
+            INLINE = 1
+        };
+
+        topic_id_t topic;
+        uint32_t version;
+        uint32_t flags;
+    };
+}
+
+#endif
@@ -36,6 +36,7 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <yaml-cpp/yaml.h>
 
 namespace matrix
 {
@@ -68,6 +69,13 @@ namespace matrix
  * keys. That function checks to see if the stored shared_ptr is
  * unique, and if so, it resets it, terminating the TransportClient.
  *
+ * Before connecting, a DataSink passes the client the transport's
+ * options from the configuration (the 'SocketOptions' map of the
+ * transport, if any) via `set_options()`. Since the client is shared,
+ * the options in effect when it first connects are the ones used.
+ * Transports that have no use for options need not override
+ * `_set_options()`.
+ *
  */
     class DataCallbackBase;
 
@@ -82,6 +90,7 @@ namespace matrix
         bool disconnect();
         bool subscribe(std::string key, DataCallbackBase *cb);
         bool unsubscribe(std::string key);
+        void set_options(YAML::Node options);
 
         // exception type for this class.
         class CreationError : public std::exception
@@ -118,6 +127,7 @@ namespace matrix
         virtual bool _disconnect();
         virtual bool _subscribe(std::string key, DataCallbackBase *cb);
         virtual bool _unsubscribe(std::string key);
+        virtual void _set_options(YAML::Node options);
 
         std::string _urn;
 
@@ -171,6 +181,13 @@ namespace matrix
         return _unsubscribe(key);
     }
 
+    inline void TransportClient::set_options(YAML::Node options)
+    {
+        matrix::ThreadLock<matrix::Mutex> l(_shared_lock);
+        l.lock();
+        _set_options(options);
+    }
+
 }
 
 #endif
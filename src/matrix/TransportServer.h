@@ -31,6 +31,8 @@
 #define _TRANSPORT_SERVER_H_
 
 #include "matrix/Mutex.h"
+#include "matrix/TopicRegistry.h"
+#include "matrix/SharedBuffer.h"
 #include <string>
 #include <vector>
 #include <map>
@@ -120,6 +122,15 @@ namespace matrix
   *         static TransportServer *factory(std::string, std::string);
   *     };
   *
+  *     DataSources publish by topic ID (see TopicRegistry). A derived
+  *     class that does not override the `topic_id_t` overload of
+  *     `_publish()` will receive those publications through its
+  *     std::string overload, with the key looked up from the ID. The
+  *     SharedBuffer overload likewise defaults to publishing the
+  *     buffer's contents. A class that queues publications for
+  *     sending later may report on the queue by overriding
+  *     `_queue_depth()` and `_dropped()`.
+  *
   *     // 2) implement the new class
   *            ...
   *
@@ -138,6 +149,10 @@ namespace matrix
         bool bind(std::vector<std::string> urns);
         bool publish(std::string key, const void *data, size_t size_of_data);
         bool publish(std::string key, std::string data);
+        bool publish(topic_id_t topic, const void *data, size_t size_of_data);
+        bool publish(topic_id_t topic, SharedBuffer const &buf);
+        size_t queue_depth();
+        size_t dropped();
 
         // exception type for this class.
         class CreationError : public std::exception
@@ -177,6 +192,10 @@ namespace matrix
         virtual bool _bind(std::vector<std::string> urns);
         virtual bool _publish(std::string key, const void *data, size_t size_of_data);
         virtual bool _publish(std::string key, std::string data);
+        virtual bool _publish(topic_id_t topic, const void *data, size_t size_of_data);
+        virtual bool _publish(topic_id_t topic, SharedBuffer const &buf);
+        virtual size_t _queue_depth();
+        virtual size_t _dropped();
 
         bool _register_urn(std::vector<std::string> urns);
         bool _unregister_urn();
@@ -213,6 +232,27 @@ namespace matrix
     {
         return _publish(key, data);
     }
+
+    inline bool TransportServer::publish(topic_id_t topic, const void *data,
+            size_t size_of_data)
+    {
+        return _publish(topic, data, size_of_data);
+    }
+
+    inline bool TransportServer::publish(topic_id_t topic, SharedBuffer const &buf)
+    {
+        return _publish(topic, buf);
+    }
+
+    inline size_t TransportServer::queue_depth()
+    {
+        return _queue_depth();
+    }
+
+    inline size_t TransportServer::dropped()
+    {
+        return _dropped();
+    }
 }
 
 #endif
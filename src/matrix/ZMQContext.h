@@ -34,6 +34,8 @@
 #include "matrix/Mutex.h"
 
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace matrix
 {
@@ -43,8 +45,10 @@ namespace matrix
         ~ZMQContext();
 
         zmq::context_t &get_context();
+        bool configure(int io_threads, std::vector<int> const &cpus);
 
         static std::shared_ptr<ZMQContext> Instance();
+        static std::shared_ptr<ZMQContext> TransportInstance(std::string keymaster_url = "");
 
         static void RemoveInstance();
 
@@ -56,6 +60,8 @@ namespace matrix
 
         static std::shared_ptr<ZMQContext> _instance;
         static matrix::Mutex _instance_lock;
+        static std::shared_ptr<ZMQContext> _transport_instance;
+        static matrix::Mutex _transport_lock;
     };
 };
 
@@ -45,6 +45,7 @@ namespace matrix
         bool _disconnect();
         bool _subscribe(std::string key, matrix::DataCallbackBase *cb);
         bool _unsubscribe(std::string key);
+        void _set_options(YAML::Node options);
 
         struct Impl;
         std::shared_ptr<Impl> _impl;
@@ -44,6 +44,10 @@ namespace matrix
     private:
         bool _publish(std::string key, const void *data, size_t size_of_data);
         bool _publish(std::string key, std::string data);
+        bool _publish(topic_id_t topic, const void *data, size_t size_of_data);
+        bool _publish(topic_id_t topic, SharedBuffer const &buf);
+        size_t _queue_depth();
+        size_t _dropped();
 
         struct PubImpl;
         std::shared_ptr<PubImpl> _impl;
@@ -0,0 +1,140 @@
+/*******************************************************************
+ *  event_notifier.h - A fifo_notifier that signals an eventfd.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#if !defined(_MATRIX_EVENT_NOTIFIER_H_)
+#define _MATRIX_EVENT_NOTIFIER_H_
+
+#include "matrix/tsemfifo.h"
+#include "matrix/matrix_util.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+namespace matrix
+{
+/**
+ * \class event_notifier
+ *
+ * A fifo_notifier that makes a queue readable as a file descriptor,
+ * so that it may be waited on with epoll, poll or select alongside
+ * sockets and other queues (see `poller`).
+ *
+ * The descriptor is an eventfd. To keep the cost per entry down, the
+ * notifier only writes to it on the first put after the waiting
+ * thread has called `rearm()`; later puts only find the notifier
+ * disarmed. After the descriptor becomes readable, the waiting thread
+ * must `rearm()` and then look at the queue before waiting again:
+ *
+ *     std::shared_ptr<event_notifier> en(new event_notifier());
+ *     fifo.set_notifier(en);
+ *
+ *     // wait for en->fd() to become readable, then:
+ *     en->rearm();
+ *
+ *     while (fifo.try_get(v))
+ *     {
+ *         ...
+ *     }
+ *
+ */
+
+    class event_notifier : public fifo_notifier
+    {
+    public:
+
+        event_notifier()
+            : _fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+              _armed(true)
+        {
+            if (_fd == -1)
+            {
+                throw MatrixException("event_notifier", strerror(errno));
+            }
+        }
+
+        ~event_notifier()
+        {
+            close(_fd);
+        }
+
+        /**
+         * The file descriptor, which becomes readable when an entry is
+         * put into an empty (or, since the last `rearm()`, drained)
+         * queue.
+         *
+         */
+
+        int fd() const
+        {
+            return _fd;
+        }
+
+        /**
+         * Clears the descriptor, and arms the notifier so that the next
+         * put makes the descriptor readable again. The exchange
+         * synchronizes with the put that disarmed it, so anything that
+         * put queued is visible to the caller afterwards.
+         *
+         */
+
+        void rearm()
+        {
+            uint64_t count;
+
+            if (read(_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+            {
+                throw MatrixException("event_notifier::rearm()", strerror(errno));
+            }
+
+            _armed.exchange(true);
+        }
+
+    private:
+
+        event_notifier(event_notifier const &);
+        event_notifier &operator=(event_notifier const &);
+
+        virtual void _call(int)
+        {
+            if (_armed.exchange(false))
+            {
+                uint64_t one = 1;
+                ssize_t r = write(_fd, &one, sizeof(one));
+                (void)r;  // can only fail if the counter overflows
+            }
+        }
+
+        int _fd;
+        std::atomic<bool> _armed;
+    };
+}
+
+#endif  // _MATRIX_EVENT_NOTIFIER_H_
@@ -119,5 +119,24 @@ it will be considered to be inactive for that mode. For example:
                     - [Comp3] # Component Comp3 is active but has no connections in this mode
             ...
 
+A connection may have a fifth element, naming the transport to use, or giving
+a map of options for the sink's end of the connection:
+
+            connections:
+                default:
+                    - [Comp1, outputA, Comp2, inputB, rtinproc]
+                    - [Comp1, status, Comp3, display, {overflow: conflate}]
+                    - [Comp1, outputA, Comp4, logger,
+                       {transport: tcp, overflow: block_timeout, timeout_ms: 100}]
+
+'overflow' selects what the sink does when data arrives faster than the
+Component consumes it: 'drop_oldest', 'drop_newest', 'conflate' (keep only the
+latest value), 'block', or 'block_timeout', which blocks for at most
+'timeout_ms' milliseconds before dropping the incoming data. Without it the sink
+uses the policy it was constructed with: 'block' for a blocking DataSink,
+otherwise 'drop_oldest'. The options are applied by Component::connect_sink(),
+on every connection, so a policy given for one mode does not carry over into
+another.
+
 
 */
@@ -0,0 +1,266 @@
+/*******************************************************************
+ *  mpsc_ring.h - A bounded lock-free multiple producer, single consumer
+ *  queue.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#if !defined(_MATRIX_MPSC_RING_H_)
+#define _MATRIX_MPSC_RING_H_
+
+#include "matrix/recyclable.h"
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace matrix
+{
+/**
+ * \class mpsc_ring
+ *
+ * A bounded, lock-free, multiple producer single consumer queue. Any
+ * number of threads may call `try_put()` at once; only one thread may
+ * call `try_get()`. Neither ever blocks: `try_put()` returns false if
+ * the ring is full and `try_get()` returns false if it is empty. A
+ * caller that wants to sleep while the ring is empty must arrange its
+ * own wake-up, for example with a semaphore posted after each put.
+ *
+ * Each slot carries a sequence number that tells producers and the
+ * consumer whose turn it is to use the slot (after D. Vyukov's bounded
+ * MPMC queue). Producers claim slots by advancing the tail with a
+ * compare-and-swap. The head and tail live on separate cache lines,
+ * so that producers and the consumer do not contend for one line.
+ *
+ * Note that a producer that has claimed a slot but not yet filled it
+ * holds up the consumer at that slot, even if later slots are already
+ * filled.
+ *
+ *     mpsc_ring<int> ring(1024);
+ *
+ *     // in any producer thread:
+ *     if (!ring.try_put(42))
+ *     {
+ *         ... // full, the value was not queued
+ *     }
+ *
+ *     // in the one consumer thread:
+ *     int v;
+ *     while (ring.try_get(v))
+ *     {
+ *         ...
+ *     }
+ *
+ */
+
+    template<typename T>
+    class mpsc_ring
+    {
+    public:
+
+        mpsc_ring(size_t size);
+
+        bool try_put(T const &obj);
+        bool try_put(T &&obj);
+        bool try_get(T &obj);
+        size_t size() const;
+        size_t capacity() const;
+
+    private:
+
+        enum
+        {
+            CACHE_LINE = 64
+        };
+
+        struct cell
+        {
+            std::atomic<size_t> seq;
+            T data;
+        };
+
+        mpsc_ring(mpsc_ring const &);
+        mpsc_ring &operator=(mpsc_ring const &);
+
+        static size_t _round_up(size_t n);
+
+        size_t _mask;
+        std::unique_ptr<cell[]> _cells;
+        char _pad0[CACHE_LINE];
+        std::atomic<size_t> _tail;
+        char _pad1[CACHE_LINE - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> _head;
+        char _pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    };
+
+/**
+ * Constructs an mpsc_ring.
+ *
+ * @param size: The capacity of the ring. This is rounded up to the
+ * next power of 2.
+ *
+ */
+
+    template<typename T>
+    mpsc_ring<T>::mpsc_ring(size_t size)
+        : _mask(_round_up(size) - 1),
+          _cells(new cell[_mask + 1]),
+          _tail(0),
+          _head(0)
+    {
+        for (size_t i = 0; i <= _mask; ++i)
+        {
+            _cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    template<typename T>
+    size_t mpsc_ring<T>::_round_up(size_t n)
+    {
+        size_t p = 1;
+
+        while (p < n)
+        {
+            p <<= 1;
+        }
+
+        return p;
+    }
+
+/**
+ * Puts a value at the tail of the ring, if there is room. Safe to
+ * call from any number of threads at once.
+ *
+ * @param obj: The value to put (copy or move) into the ring.
+ *
+ * @return true if the value was queued, false if the ring was full.
+ *
+ */
+
+    template<typename T>
+    bool mpsc_ring<T>::try_put(T const &obj)
+    {
+        return try_put(T(obj));
+    }
+
+    template<typename T>
+    bool mpsc_ring<T>::try_put(T &&obj)
+    {
+        size_t pos = _tail.load(std::memory_order_relaxed);
+        cell *c;
+
+        for (;;)
+        {
+            c = &_cells[pos & _mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+            if (dif == 0)
+            {
+                // the slot is free for position 'pos'; claim it.
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (dif < 0)
+            {
+                // the consumer has not yet emptied this slot: full.
+                return false;
+            }
+            else
+            {
+                // another producer got here first.
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        recycle(c->data, obj);
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+/**
+ * Gets the value at the head of the ring, if there is one. Only one
+ * thread may call this.
+ *
+ * @param obj: The value is moved here.
+ *
+ * @return true if a value was taken, false if the ring was empty (or
+ * the producer of the value at the head has not yet finished putting
+ * it).
+ *
+ */
+
+    template<typename T>
+    bool mpsc_ring<T>::try_get(T &obj)
+    {
+        size_t pos = _head.load(std::memory_order_relaxed);
+        cell *c = &_cells[pos & _mask];
+        size_t seq = c->seq.load(std::memory_order_acquire);
+
+        if ((intptr_t)seq - (intptr_t)(pos + 1) < 0)
+        {
+            return false;
+        }
+
+        recycle(obj, c->data);
+        c->seq.store(pos + _mask + 1, std::memory_order_release);
+        _head.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+/**
+ * Returns the number of values in the ring. As producers and the
+ * consumer may be active, this is only a snapshot.
+ *
+ * @return The number of claimed slots not yet consumed.
+ *
+ */
+
+    template<typename T>
+    size_t mpsc_ring<T>::size() const
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        size_t tail = _tail.load(std::memory_order_relaxed);
+
+        return tail > head ? tail - head : 0;
+    }
+
+/**
+ * Returns the capacity of the ring.
+ *
+ * @return The most values the ring can hold.
+ *
+ */
+
+    template<typename T>
+    size_t mpsc_ring<T>::capacity() const
+    {
+        return _mask + 1;
+    }
+}
+
+#endif  // _MATRIX_MPSC_RING_H_
@@ -0,0 +1,118 @@
+/*******************************************************************
+ *  recyclable.h - Marks the types whose buffers queues should
+ *  recycle rather than move.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#if !defined(_MATRIX_RECYCLABLE_H_)
+#define _MATRIX_RECYCLABLE_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+namespace matrix
+{
+/**
+ * \struct recyclable
+ *
+ * True for types that own a heap buffer which is worth keeping for
+ * reuse, rather than freeing and allocating afresh, as entries pass
+ * through a queue: std::string, std::vector and GenericBuffer (see
+ * GenericBuffer.h). Specialize it for other such types.
+ *
+ * The queues (`tsemfifo`, `spsc_ring`, `mpsc_ring`) transfer entries
+ * of a recyclable type in and out of their slots with `recycle()`,
+ * which swaps rather than moves. A putter is left holding the slot's
+ * previous buffer and a getter's old buffer is left in the slot, so
+ * once a stream has reached its steady state no buffer is allocated
+ * or freed on the way through.
+ *
+ * Other types, in particular reference counted ones such as
+ * SharedBuffer, are moved, so that a queue slot never keeps a
+ * reference alive.
+ *
+ */
+
+    template<typename T>
+    struct recyclable : std::false_type
+    {
+    };
+
+    template<typename C, typename Tr, typename A>
+    struct recyclable<std::basic_string<C, Tr, A> > : std::true_type
+    {
+    };
+
+    template<typename U, typename A>
+    struct recyclable<std::vector<U, A> > : std::true_type
+    {
+    };
+
+    template<typename T>
+    inline void _recycle(T &dst, T &src, std::true_type)
+    {
+        using std::swap;
+        swap(dst, src);
+    }
+
+    template<typename T>
+    inline void _recycle(T &dst, T &src, std::false_type)
+    {
+        dst = std::move(src);
+    }
+
+/**
+ * Transfers 'src' to 'dst': by swapping if T is `recyclable`,
+ * otherwise by moving.
+ *
+ * @param dst: Receives the value of 'src'.
+ *
+ * @param src: For a recyclable T, receives the old value of 'dst';
+ * otherwise left moved-from.
+ *
+ */
+
+    template<typename T>
+    inline void recycle(T &dst, T &src)
+    {
+        _recycle(dst, src, recyclable<T>());
+    }
+
+/**
+ * Overload for a destination that is not a T, such as the proxy of a
+ * std::back_insert_iterator, which is simply assigned.
+ *
+ */
+
+    template<typename D, typename T>
+    inline void recycle(D &&dst, T &src)
+    {
+        dst = std::move(src);
+    }
+}
+
+#endif  // _MATRIX_RECYCLABLE_H_
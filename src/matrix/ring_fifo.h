@@ -0,0 +1,784 @@
+/*******************************************************************
+ *  ring_fifo.h - tsemfifo compatible queues built on the lock-free
+ *  rings.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#if !defined(_MATRIX_RING_FIFO_H_)
+#define _MATRIX_RING_FIFO_H_
+
+#include "matrix/tsemfifo.h"
+#include "matrix/spsc_ring.h"
+#include "matrix/mpsc_ring.h"
+#include "matrix/Time.h"
+
+#include <atomic>
+#include <memory>
+#include <climits>
+#include <cstdlib>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace matrix
+{
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcomment"
+/**
+ * \class ring_fifo
+ *
+ * Gives a lock-free ring (`spsc_ring` or `mpsc_ring`) the interface of
+ * a `tsemfifo`, so that it may be used as the queue of a DataSink
+ * (see `DataSink`'s third template parameter). Use it through
+ * `spsc_fifo<T>`, when exactly one thread puts, as is the case for a
+ * DataSink fed by one transport thread, or `mpsc_fifo<T>` when several
+ * may.
+ *
+ * Where a tsemfifo takes a mutex and posts and waits on two
+ * semaphores for every entry, a ring_fifo only makes a system call
+ * when a thread actually has to sleep: the getter on an empty queue,
+ * or a blocking putter on a full one. Sleepers wait on a futex word,
+ * and the other side only bumps the word and wakes it if the count of
+ * sleepers says someone is there.
+ *
+ * Only one thread may get from a ring_fifo, and only that thread may
+ * flush it. It follows that a putter cannot discard the oldest entry
+ * to make room, as `tsemfifo::put_no_block()` does. When the queue is
+ * full `put_no_block()`, `put_n_no_block()` and `put_latest()`
+ * instead discard the incoming entry, so that the DROP_OLDEST and
+ * CONFLATE overflow policies behave as DROP_NEWEST.
+ *
+ *     DataSink<double, select_only, spsc_fifo> sink(km_urn, 1024);
+ *
+ */
+#pragma GCC diagnostic pop
+
+    template<typename T, typename Ring>
+    class ring_fifo
+    {
+    public:
+
+        ring_fifo(size_t size = tsemfifo<T>::FIFO_SIZE);
+
+        void release();
+        void flush();
+        unsigned int flush(int items);
+
+        bool put(T const &obj);
+        bool put(T &&obj);
+        bool try_put(T const &obj);
+        bool try_put(T &&obj);
+        bool timed_put(T const &obj, Time::Time_t time_out);
+        bool timed_put(T &&obj, Time::Time_t time_out);
+        unsigned int put_no_block(T const &obj);
+        unsigned int put_no_block(T &&obj);
+        unsigned int put_latest(T const &obj);
+        unsigned int put_latest(T &&obj);
+        size_t put_n(T const *objs, size_t n);
+        template<typename ForwardIt>
+        size_t put_n(ForwardIt first, ForwardIt last);
+        size_t try_put_n(T const *objs, size_t n);
+        size_t timed_put_n(T const *objs, size_t n, Time::Time_t time_out);
+        unsigned int put_n_no_block(T const *objs, size_t n);
+
+        bool get(T &obj);
+        bool try_get(T &obj);
+        bool timed_get(T &obj, Time::Time_t time_out);
+        template<typename OutputIt>
+        size_t get_n(OutputIt out, size_t max, Time::Time_t time_out);
+        unsigned int size();
+        unsigned int capacity();
+        void set_notifier(std::shared_ptr<fifo_notifier>);
+
+    private:
+
+        enum
+        {
+            CACHE_LINE = 64
+        };
+
+        // a futex word, and the number of threads sleeping on it.
+        struct waitq
+        {
+            waitq()
+                : seq(0),
+                  waiters(0)
+            {
+            }
+
+            std::atomic<uint32_t> seq;
+            std::atomic<uint32_t> waiters;
+            char _pad[CACHE_LINE - 2 * sizeof(std::atomic<uint32_t>)];
+        };
+
+        ring_fifo(ring_fifo const &);
+        ring_fifo &operator=(ring_fifo const &);
+
+        template<typename Ready>
+        bool _wait(waitq &q, Ready ready, Time::Time_t deadline);
+        void _wake(waitq &q);
+        void _put_done();
+        void _get_done();
+
+        Ring _ring;
+        waitq _items;
+        waitq _space;
+        std::atomic<bool> _release;
+        std::shared_ptr<fifo_notifier> _notifier;
+    };
+
+/**
+ * \class spsc_fifo
+ *
+ * A ring_fifo for exactly one putting and one getting thread.
+ *
+ */
+
+    template<typename T>
+    class spsc_fifo : public ring_fifo<T, spsc_ring<T> >
+    {
+    public:
+
+        spsc_fifo(size_t size = tsemfifo<T>::FIFO_SIZE)
+            : ring_fifo<T, spsc_ring<T> >(size)
+        {
+        }
+    };
+
+/**
+ * \class mpsc_fifo
+ *
+ * A ring_fifo for any number of putting threads and one getting
+ * thread.
+ *
+ */
+
+    template<typename T>
+    class mpsc_fifo : public ring_fifo<T, mpsc_ring<T> >
+    {
+    public:
+
+        mpsc_fifo(size_t size = tsemfifo<T>::FIFO_SIZE)
+            : ring_fifo<T, mpsc_ring<T> >(size)
+        {
+        }
+    };
+
+/**
+ * Constructs a ring_fifo.
+ *
+ * @param size: The capacity of the queue, rounded up to the next
+ * power of 2.
+ *
+ */
+
+    template<typename T, typename Ring>
+    ring_fifo<T, Ring>::ring_fifo(size_t size)
+        : _ring(size),
+          _release(false),
+          _notifier(new fifo_notifier)
+    {
+    }
+
+/**
+ * Sleeps on a wait queue until 'ready()' is true, the fifo is
+ * released, or 'deadline' passes. The count of waiters is raised
+ * before 'ready()' is checked, and the waker bumps the futex word
+ * after making the change that makes 'ready()' true, so a wake-up can
+ * not be missed between the check and the sleep.
+ *
+ * @param q: The wait queue, `_items` or `_space`.
+ *
+ * @param ready: The condition waited for.
+ *
+ * @param deadline: The absolute time at which to give up, or 0 to
+ * wait indefinitely.
+ *
+ * @return false if 'deadline' has passed or the fifo was released,
+ * true otherwise. The caller must check 'ready()' again either way.
+ *
+ */
+
+    template<typename T, typename Ring>
+    template<typename Ready>
+    bool ring_fifo<T, Ring>::_wait(waitq &q, Ready ready, Time::Time_t deadline)
+    {
+        timespec ts, *tsp = NULL;
+
+        if (deadline)
+        {
+            Time::Time_t now = Time::getUTC();
+
+            if (now >= deadline)
+            {
+                return false;
+            }
+
+            ts.tv_sec = (deadline - now) / 1000000000L;
+            ts.tv_nsec = (deadline - now) % 1000000000L;
+            tsp = &ts;
+        }
+
+        q.waiters.fetch_add(1);
+        uint32_t seq = q.seq.load();
+
+        if (!ready() && !_release.load())
+        {
+            syscall(SYS_futex, (uint32_t *)&q.seq, FUTEX_WAIT_PRIVATE, seq, tsp, NULL, 0);
+        }
+
+        q.waiters.fetch_sub(1);
+        return !_release.load();
+    }
+
+/**
+ * Wakes the threads sleeping on a wait queue, if there are any. The
+ * fence orders the caller's change to the ring before the check of
+ * the waiter count.
+ *
+ */
+
+    template<typename T, typename Ring>
+    void ring_fifo<T, Ring>::_wake(waitq &q)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (q.waiters.load(std::memory_order_relaxed))
+        {
+            q.seq.fetch_add(1);
+            syscall(SYS_futex, (uint32_t *)&q.seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+        }
+    }
+
+    template<typename T, typename Ring>
+    void ring_fifo<T, Ring>::_put_done()
+    {
+        _wake(_items);
+        _notifier->exec(_ring.size());
+    }
+
+    template<typename T, typename Ring>
+    void ring_fifo<T, Ring>::_get_done()
+    {
+        _wake(_space);
+    }
+
+/**
+ * Wakes up every thread blocked in the fifo. They return false.
+ *
+ */
+
+    template<typename T, typename Ring>
+    void ring_fifo<T, Ring>::release()
+    {
+        _release.store(true);
+        _items.waiters.fetch_add(1);
+        _wake(_items);
+        _items.waiters.fetch_sub(1);
+        _space.waiters.fetch_add(1);
+        _wake(_space);
+        _space.waiters.fetch_sub(1);
+    }
+
+/**
+ * Empties the queue. Only the getting thread may call this.
+ *
+ */
+
+    template<typename T, typename Ring>
+    void ring_fifo<T, Ring>::flush()
+    {
+        T obj;
+
+        while (_ring.try_get(obj));
+
+        _release.store(false);
+        _get_done();
+    }
+
+/**
+ * Flushes 'items' items out of the queue. Only the getting thread may
+ * call this.
+ *
+ * @param items: The number of items to drop, oldest first. If 'items'
+ * equals or exceeds the number of elements in the queue, all will be
+ * dropped. If 'items' is negative, all but abs(items) will be dropped.
+ *
+ * @return The number of items remaining in the queue.
+ *
+ */
+
+    template<typename T, typename Ring>
+    unsigned int ring_fifo<T, Ring>::flush(int items)
+    {
+        size_t objects = _ring.size();
+        size_t nitems = static_cast<size_t>(abs(items));
+        T obj;
+
+        if (items < 0)
+        {
+            nitems = nitems < objects ? objects - nitems : 0;
+        }
+
+        for (size_t i = 0; i < nitems && _ring.try_get(obj); ++i);
+
+        _get_done();
+        return _ring.size();
+    }
+
+/**
+ * Puts a value at the tail of the queue, blocking while it is full.
+ *
+ * @param obj: The object to put into the queue.
+ *
+ * @return true if the object was queued, false if the fifo was
+ * released.
+ *
+ */
+
+    template<typename T, typename Ring>
+    bool ring_fifo<T, Ring>::put(T const &obj)
+    {
+        return put(T(obj));
+    }
+
+    template<typename T, typename Ring>
+    bool ring_fifo<T, Ring>::put(T &&obj)
+    {
+        // The ring only moves from 'obj' if it succeeds.
+        while (!_ring.try_put(std::move(obj)))
+        {
+            if (!_wait(_space, [this]() {return _ring.size() < _ring.capacity();}, 0))
+            {
+                return false;
+            }
+        }
+
+        _put_done();
+        return true;
+    }
+
+/**
+ * Puts a value at the tail of the queue if there is room. Never
+ * blocks.
+ *
+ * @param obj: The object to put into the queue.
+ *
+ * @return true if the object was queued, false if the queue was full.
+ *
+ */
+
+    template<typename T, typename Ring>
+    bool ring_fifo<T, Ring>::try_put(T const &obj)
+    {
+        return try_put(T(obj));
+    }
+
+    template<typename T, typename Ring>
+    bool ring_fifo<T, Ring>::try_put(T &&obj)
+    {
+        if (_ring.try_put(std::move(obj)))
+        {
+            _put_done();
+            return true;
+        }
+
+        return false;
+    }
+
+/**
+ * Puts a value at the tail of the queue, waiting for up to 'time_out'
+ * nano seconds while it is full.
+ *
+ * @param obj: The object to put into the queue.
+ *
+ * @param time_out: The most time to wait, in nano seconds.
+ *
+ * @return true if the object was queued, false if it timed out or the
+ * fifo was released.
+ *
+ */
+
+    template<typename T, typename Ring>
+    bool ring_fifo<T, Ring>::timed_put(T const &obj, Time::Time_t time_out)
+    {
+        return timed_put(T(obj), time_out);
+    }
+
+    template<typename T, typename Ring>
+    bool ring_fifo<T, Ring>::timed_put(T &&obj, Time::Time_t time_out)
+    {
+        Time::Time_t deadline = Time::getUTC() + time_out;
+
+        while (!_ring.try_put(std::move(obj)))
+        {
+            if (!_wait(_space, [this]() {return _ring.size() < _ring.capacity();}, deadline))
+            {
+                return false;
+            }
+        }
+
+        _put_done();
+        return true;
+    }
+
+/**
+ * Puts a value at the tail of the queue without blocking. Unlike
+ * `tsemfifo::put_no_block()`, if the queue is full it is 'obj' that is
+ * discarded.
+ *
+ * @param obj: The object to put into the queue.
+ *
+ * @return The number of objects discarded, 0 or 1.
+ *
+ */
+
+    template<typename T, typename Ring>
+    unsigned int ring_fifo<T, Ring>::put_no_block(T const &obj)
+    {
+        return try_put(obj) ? 0 : 1;
+    }
+
+    template<typename T, typename Ring>
+    unsigned int ring_fifo<T, Ring>::put_no_block(T &&obj)
+    {
+        return try_put(std::move(obj)) ? 0 : 1;
+    }
+
+/**
+ * As `put_no_block()`: a putter may not take entries out of the queue,
+ * so it cannot discard the older ones.
+ *
+ */
+
+    template<typename T, typename Ring>
+    unsigned int ring_fifo<T, Ring>::put_latest(T const &obj)
+    {
+        return put_no_block(obj);
+    }
+
+    template<typename T, typename Ring>
+    unsigned int ring_fifo<T, Ring>::put_latest(T &&obj)
+    {
+        return put_no_block(std::move(obj));
+    }
+
+/**
+ * Puts 'n' values at the tail of the queue, blocking while it is full.
+ *
+ * @param objs: The objects to put (copy) into the queue.
+ *
+ * @param n: The number of objects in 'objs'.
+ *
+ * @return The number of objects put, less than 'n' only if the fifo
+ * was released.
+ *
+ */
+
+    template<typename T, typename Ring>
+    size_t ring_fifo<T, Ring>::put_n(T const *objs, size_t n)
+    {
+        return put_n(objs, objs + n);
+    }
+
+/**
+ * Puts the values in the range [first, last), blocking while the
+ * queue is full. See `tsemfifo::put_n()`.
+ *
+ * @param first: The first value to put.
+ *
+ * @param last: Past the last value to put.
+ *
+ * @return The number of objects put, less than the size of the range
+ * only if the fifo was released.
+ *
+ */
+
+    template<typename T, typename Ring>
+    template<typename ForwardIt>
+    size_t ring_fifo<T, Ring>::put_n(ForwardIt first, ForwardIt last)
+    {
+        size_t done = 0;
+
+        for (; first != last; ++first, ++done)
+        {
+            T obj(*first);
+
+            if (!put(std::move(obj)))
+            {
+                break;
+            }
+        }
+
+        return done;
+    }
+
+/**
+ * Puts as many of 'n' values as there is room for, without blocking.
+ *
+ * @param objs: The objects to put (copy) into the queue.
+ *
+ * @param n: The number of objects in 'objs'.
+ *
+ * @return The number of objects put, the first that many of 'objs'.
+ *
+ */
+
+    template<typename T, typename Ring>
+    size_t ring_fifo<T, Ring>::try_put_n(T const *objs, size_t n)
+    {
+        size_t done = 0;
+
+        while (done < n && _ring.try_put(objs[done]))
+        {
+            ++done;
+        }
+
+        if (done)
+        {
+            _put_done();
+        }
+
+        return done;
+    }
+
+/**
+ * Puts 'n' values, waiting up to 'time_out' nano seconds in all for
+ * room.
+ *
+ * @param objs: The objects to put (copy) into the queue.
+ *
+ * @param n: The number of objects in 'objs'.
+ *
+ * @param time_out: The most time to wait, in nano seconds.
+ *
+ * @return The number of objects put, the first that many of 'objs'.
+ *
+ */
+
+    template<typename T, typename Ring>
+    size_t ring_fifo<T, Ring>::timed_put_n(T const *objs, size_t n, Time::Time_t time_out)
+    {
+        Time::Time_t deadline = Time::getUTC() + time_out;
+        size_t done = 0;
+
+        while (done < n)
+        {
+            if (_ring.try_put(objs[done]))
+            {
+                ++done;
+            }
+            else
+            {
+                if (done)
+                {
+                    _put_done();
+                }
+
+                if (!_wait(_space, [this]() {return _ring.size() < _ring.capacity();}, deadline))
+                {
+                    return done;
+                }
+            }
+        }
+
+        _put_done();
+        return done;
+    }
+
+/**
+ * Puts 'n' values without blocking, discarding those there is no room
+ * for.
+ *
+ * @param objs: The objects to put (copy) into the queue.
+ *
+ * @param n: The number of objects in 'objs'.
+ *
+ * @return The number of objects discarded, the last that many of
+ * 'objs'.
+ *
+ */
+
+    template<typename T, typename Ring>
+    unsigned int ring_fifo<T, Ring>::put_n_no_block(T const *objs, size_t n)
+    {
+        return n - try_put_n(objs, n);
+    }
+
+/**
+ * Gets the value at the head of the queue, blocking while it is empty.
+ *
+ * @param obj: The value is moved here.
+ *
+ * @return true if a value was taken, false if the fifo was released.
+ *
+ */
+
+    template<typename T, typename Ring>
+    bool ring_fifo<T, Ring>::get(T &obj)
+    {
+        while (!_ring.try_get(obj))
+        {
+            if (!_wait(_items, [this]() {return _ring.size() > 0;}, 0))
+            {
+                return false;
+            }
+        }
+
+        _get_done();
+        return true;
+    }
+
+/**
+ * Gets the value at the head of the queue, if there is one. Never
+ * blocks.
+ *
+ * @param obj: The value is moved here.
+ *
+ * @return true if a value was taken, false if the queue was empty.
+ *
+ */
+
+    template<typename T, typename Ring>
+    bool ring_fifo<T, Ring>::try_get(T &obj)
+    {
+        if (_ring.try_get(obj))
+        {
+            _get_done();
+            return true;
+        }
+
+        return false;
+    }
+
+/**
+ * Gets the value at the head of the queue, waiting for up to
+ * 'time_out' nano seconds while it is empty.
+ *
+ * @param obj: The value is moved here.
+ *
+ * @param time_out: The most time to wait, in nano seconds.
+ *
+ * @return true if a value was taken, false if it timed out or the
+ * fifo was released.
+ *
+ */
+
+    template<typename T, typename Ring>
+    bool ring_fifo<T, Ring>::timed_get(T &obj, Time::Time_t time_out)
+    {
+        Time::Time_t deadline = Time::getUTC() + time_out;
+
+        while (!_ring.try_get(obj))
+        {
+            if (!_wait(_items, [this]() {return _ring.size() > 0;}, deadline))
+            {
+                return false;
+            }
+        }
+
+        _get_done();
+        return true;
+    }
+
+/**
+ * Gets up to 'max' values, waiting up to 'time_out' nano seconds for
+ * the first, and taking the rest only if they are already there.
+ *
+ * @param out: An output iterator to which the values are moved.
+ *
+ * @param max: The most values to take.
+ *
+ * @param time_out: The most time to wait for the first, in nano
+ * seconds.
+ *
+ * @return The number of values taken.
+ *
+ */
+
+    template<typename T, typename Ring>
+    template<typename OutputIt>
+    size_t ring_fifo<T, Ring>::get_n(OutputIt out, size_t max, Time::Time_t time_out)
+    {
+        size_t done = 0;
+        T obj;
+
+        if (max == 0 || !timed_get(obj, time_out))
+        {
+            return 0;
+        }
+
+        do
+        {
+            recycle(*out, obj);
+            ++out;
+        }
+        while (++done < max && _ring.try_get(obj));
+
+        _get_done();
+        return done;
+    }
+
+/**
+ * Returns the number of values in the queue.
+ *
+ */
+
+    template<typename T, typename Ring>
+    unsigned int ring_fifo<T, Ring>::size()
+    {
+        return _ring.size();
+    }
+
+/**
+ * Returns the capacity of the queue.
+ *
+ */
+
+    template<typename T, typename Ring>
+    unsigned int ring_fifo<T, Ring>::capacity()
+    {
+        return _ring.capacity();
+    }
+
+/**
+ * Sets the notifier, which is called with the number of entries in
+ * the queue after every put. Must be set before any thread puts.
+ *
+ * @param n: A `std::shared_ptr` pointing to a `fifo_notifier` derived
+ * functor.
+ *
+ */
+
+    template<typename T, typename Ring>
+    void ring_fifo<T, Ring>::set_notifier(std::shared_ptr<fifo_notifier> n)
+    {
+        _notifier = n;
+    }
+}
+
+#endif  // _MATRIX_RING_FIFO_H_
@@ -0,0 +1,176 @@
+/*******************************************************************
+ *  shm_ring.h - The shared memory ring used by the 'shm' transport.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#if !defined(_SHM_RING_H_)
+#define _SHM_RING_H_
+
+#include "matrix/TopicRegistry.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace matrix
+{
+    /**
+     * The layout of the shared memory segment used by
+     * ShmTransportServer and ShmTransportClient. The segment is a
+     * `ring_header` followed by `capacity` bytes of data ring.
+     *
+     * There is one writer, the ShmTransportServer, and any number (up to
+     * `MAX_READERS`) of ShmTransportClients, in any process on the
+     * host. Positions in the ring are byte counts that only ever
+     * increase; the offset into the data area is the position modulo
+     * `capacity`. The writer owns `head`, the position past the last
+     * complete record. Each reader owns a `reader_slot`, whose `tail` is
+     * the position of the next record it will read.
+     *
+     * The writer never overwrites data a registered reader has not yet
+     * read, so readers may use the payloads in place, without copying
+     * them out of the ring. A reader whose backlog leaves no room for
+     * the next message is evicted rather than allowed to stall the
+     * other readers: the writer moves its `tail` up to the `head`, and
+     * adds the records it skipped to the slot's `lost` count. A reader
+     * announces the record it is handing to its callbacks in `busy` and
+     * `busy_end`; if it is evicted in the middle of one, the writer pads
+     * around that record on its next pass through the ring instead of
+     * waiting for it. A message that still does not fit is dropped, as a
+     * ZMQ publisher does at its high water mark.
+     *
+     * Every record is a `record_header` followed by the payload, padded
+     * out to a multiple of `ALIGN` bytes. Records never wrap: if a
+     * record does not fit in the space remaining before the end of the
+     * data area, that space is filled with a `PAD` record and the record
+     * starts at offset 0.
+     *
+     * Readers sleep on the `futex` word, which the writer increments
+     * after every record. The writer only makes the wake-up system call
+     * if `waiters` says someone is sleeping.
+     *
+     */
+
+    namespace shm
+    {
+        enum
+        {
+            MAGIC = 0x4853584d, // "MXSH"
+            VERSION = 2,
+            MAX_READERS = 32,
+            ALIGN = 64
+        };
+
+        // 'busy' when the reader is not inside a record.
+        const uint64_t IDLE = ~(uint64_t)0;
+
+        enum record_flags
+        {
+            DATA = 0,
+            PAD = 1
+        };
+
+        struct reader_slot
+        {
+            // 0 if the slot is free, otherwise the pid of the reader's
+            // process. Used to reclaim the slots of readers that died
+            // without releasing them.
+            std::atomic<pid_t> pid;
+            std::atomic<uint64_t> tail;
+            // The position of the record the reader is using, or IDLE,
+            // and the position past it.
+            std::atomic<uint64_t> busy;
+            std::atomic<uint64_t> busy_end;
+            // Records skipped when the writer evicted this reader.
+            std::atomic<uint64_t> lost;
+            // 'pid' is padded out to the alignment of 'tail'.
+            char _pad[ALIGN - 5 * sizeof(std::atomic<uint64_t>)];
+        };
+
+        struct ring_header
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t capacity;
+            char _pad0[ALIGN - 2 * sizeof(uint32_t) - sizeof(uint64_t)];
+
+            std::atomic<uint64_t> head;
+            char _pad1[ALIGN - sizeof(std::atomic<uint64_t>)];
+
+            std::atomic<uint32_t> futex;
+            std::atomic<uint32_t> waiters;
+            char _pad2[ALIGN - 2 * sizeof(std::atomic<uint32_t>)];
+
+            reader_slot readers[MAX_READERS];
+        };
+
+        struct record_header
+        {
+            uint64_t length;   // whole record, header and padding included
+            uint64_t size;     // the payload
+            topic_id_t topic;
+            uint64_t flags;
+        };
+
+        inline uint64_t aligned(uint64_t n)
+        {
+            return (n + ALIGN - 1) & ~((uint64_t)ALIGN - 1);
+        }
+
+        inline unsigned char *data_area(ring_header *hdr)
+        {
+            return (unsigned char *)hdr + aligned(sizeof(ring_header));
+        }
+
+        inline size_t segment_size(uint64_t capacity)
+        {
+            return aligned(sizeof(ring_header)) + capacity;
+        }
+
+        /**
+         * Sleeps on a futex word until it no longer holds 'val', or
+         * 'usecs' microseconds elapse. The futex is not process private,
+         * as the word lives in a segment shared between processes.
+         *
+         */
+
+        inline void futex_wait(std::atomic<uint32_t> *f, uint32_t val, long usecs)
+        {
+            timespec ts = {usecs / 1000000, (usecs % 1000000) * 1000};
+            syscall(SYS_futex, (uint32_t *)f, FUTEX_WAIT, val, &ts, NULL, 0);
+        }
+
+        inline void futex_wake_all(std::atomic<uint32_t> *f)
+        {
+            syscall(SYS_futex, (uint32_t *)f, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,244 @@
+/*******************************************************************
+ *  spsc_ring.h - A bounded lock-free single producer single
+ *  consumer queue.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#if !defined(_MATRIX_SPSC_RING_H_)
+#define _MATRIX_SPSC_RING_H_
+
+#include "matrix/recyclable.h"
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+
+namespace matrix
+{
+/**
+ * \class spsc_ring
+ *
+ * A bounded, lock-free, single producer single consumer queue. One
+ * thread may call `try_put()` and one other thread `try_get()`,
+ * concurrently. Neither ever blocks: `try_put()` returns false if the
+ * ring is full and `try_get()` returns false if it is empty.
+ *
+ * The producer owns the tail and the consumer the head, each on its
+ * own cache line. Each side also keeps a private copy of the other
+ * side's index, and only reloads the shared one when the copy says
+ * the ring is full (or empty). In the steady state a put or a get
+ * therefore touches no cache line the other thread is writing, apart
+ * from the slot itself.
+ *
+ * Where several threads must put into the same queue, use an
+ * `mpsc_ring` instead.
+ *
+ *     spsc_ring<int> ring(1024);
+ *
+ *     // in the producer thread:
+ *     if (!ring.try_put(42))
+ *     {
+ *         ... // full, the value was not queued
+ *     }
+ *
+ *     // in the consumer thread:
+ *     int v;
+ *     while (ring.try_get(v))
+ *     {
+ *         ...
+ *     }
+ *
+ */
+
+    template<typename T>
+    class spsc_ring
+    {
+    public:
+
+        spsc_ring(size_t size);
+
+        bool try_put(T const &obj);
+        bool try_put(T &&obj);
+        bool try_get(T &obj);
+        size_t size() const;
+        size_t capacity() const;
+
+    private:
+
+        enum
+        {
+            CACHE_LINE = 64
+        };
+
+        spsc_ring(spsc_ring const &);
+        spsc_ring &operator=(spsc_ring const &);
+
+        static size_t _round_up(size_t n);
+
+        size_t _mask;
+        std::unique_ptr<T[]> _cells;
+        char _pad0[CACHE_LINE];
+        // the producer's cache line
+        std::atomic<size_t> _tail;
+        size_t _head_cache;
+        char _pad1[CACHE_LINE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+        // the consumer's cache line
+        std::atomic<size_t> _head;
+        size_t _tail_cache;
+        char _pad2[CACHE_LINE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    };
+
+/**
+ * Constructs an spsc_ring.
+ *
+ * @param size: The capacity of the ring. This is rounded up to the
+ * next power of 2.
+ *
+ */
+
+    template<typename T>
+    spsc_ring<T>::spsc_ring(size_t size)
+        : _mask(_round_up(size) - 1),
+          _cells(new T[_mask + 1]),
+          _tail(0),
+          _head_cache(0),
+          _head(0),
+          _tail_cache(0)
+    {
+    }
+
+    template<typename T>
+    size_t spsc_ring<T>::_round_up(size_t n)
+    {
+        size_t p = 1;
+
+        while (p < n)
+        {
+            p <<= 1;
+        }
+
+        return p;
+    }
+
+/**
+ * Puts a value at the tail of the ring, if there is room. Only one
+ * thread may call this.
+ *
+ * @param obj: The value to put (copy or move) into the ring. See
+ * `recyclable` for what is left in 'obj'.
+ *
+ * @return true if the value was queued, false if the ring was full.
+ *
+ */
+
+    template<typename T>
+    bool spsc_ring<T>::try_put(T const &obj)
+    {
+        return try_put(T(obj));
+    }
+
+    template<typename T>
+    bool spsc_ring<T>::try_put(T &&obj)
+    {
+        size_t pos = _tail.load(std::memory_order_relaxed);
+
+        if (pos - _head_cache > _mask)
+        {
+            _head_cache = _head.load(std::memory_order_acquire);
+
+            if (pos - _head_cache > _mask)
+            {
+                return false;
+            }
+        }
+
+        recycle(_cells[pos & _mask], obj);
+        _tail.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+/**
+ * Gets the value at the head of the ring, if there is one. Only one
+ * thread may call this.
+ *
+ * @param obj: The value is moved here.
+ *
+ * @return true if a value was taken, false if the ring was empty.
+ *
+ */
+
+    template<typename T>
+    bool spsc_ring<T>::try_get(T &obj)
+    {
+        size_t pos = _head.load(std::memory_order_relaxed);
+
+        if (pos == _tail_cache)
+        {
+            _tail_cache = _tail.load(std::memory_order_acquire);
+
+            if (pos == _tail_cache)
+            {
+                return false;
+            }
+        }
+
+        recycle(obj, _cells[pos & _mask]);
+        _head.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+/**
+ * Returns the number of values in the ring. As the producer and the
+ * consumer may be active, this is only a snapshot.
+ *
+ * @return The number of values put but not yet taken.
+ *
+ */
+
+    template<typename T>
+    size_t spsc_ring<T>::size() const
+    {
+        // the head first: the tail can only be further along.
+        size_t head = _head.load(std::memory_order_acquire);
+        size_t tail = _tail.load(std::memory_order_acquire);
+
+        return tail - head;
+    }
+
+/**
+ * Returns the capacity of the ring.
+ *
+ * @return The most values the ring can hold.
+ *
+ */
+
+    template<typename T>
+    size_t spsc_ring<T>::capacity() const
+    {
+        return _mask + 1;
+    }
+}
+
+#endif  // _MATRIX_SPSC_RING_H_
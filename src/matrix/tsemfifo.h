@@ -33,6 +33,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <iterator>
 #include <vector>
 #include <memory>
 
@@ -40,6 +41,7 @@
 #include "matrix/Mutex.h"
 #include "matrix/ThreadLock.h"
 #include "matrix/Time.h"
+#include "matrix/recyclable.h"
 
 using namespace std;
 
@@ -154,10 +156,20 @@ namespace matrix
         bool timed_put(T &&obj, Time::Time_t time_out);
         unsigned int put_no_block(T const &obj);
         unsigned int put_no_block(T &&obj);
+        unsigned int put_latest(T const &obj);
+        unsigned int put_latest(T &&obj);
+        size_t put_n(T const *objs, size_t n);
+        template<typename ForwardIt>
+        size_t put_n(ForwardIt first, ForwardIt last);
+        size_t try_put_n(T const *objs, size_t n);
+        size_t timed_put_n(T const *objs, size_t n, Time::Time_t time_out);
+        unsigned int put_n_no_block(T const *objs, size_t n);
 
         bool get(T &obj);
         bool try_get(T &obj);
         bool timed_get(T &obj, Time::Time_t time_out);
+        template<typename OutputIt>
+        size_t get_n(OutputIt out, size_t max, Time::Time_t time_out);
         bool wait_for_empty(int milliseconds = -1);
         unsigned int size();
         unsigned int capacity();
@@ -173,9 +185,15 @@ namespace matrix
         void _close_sem();
 
         void _get(T &obj);
+        template<typename OutputIt>
+        void _get_n(OutputIt out, size_t n);
 
         void _put(T const &obj);
         void _put(T &&obj);
+        template<typename InputIt>
+        InputIt _put_n(InputIt first, size_t n);
+
+        size_t _try_wait_n(sem_t *sem, size_t n);
 
         std::vector<T> _buffer;
         unsigned int _head;
@@ -415,7 +433,9 @@ namespace matrix
  * with a new value, once the public put() or try_put() functions have
  * determined there is enough room for the value.
  *
- * @param obj: Object to put (copy) into the buffer.
+ * @param obj: Object to put (move) into the buffer. If T is
+ * `recyclable` it is swapped in instead, and 'obj' gets the slot's
+ * previous buffer for the caller to reuse.
  *
  */
 
@@ -425,7 +445,7 @@ namespace matrix
         matrix::ThreadLock<matrix::Mutex> l(_critical_section);
 
         l.lock();
-        _buffer[_tail] = std::move(obj);
+        recycle(_buffer[_tail], obj);
 
         if (_tail < (_buf_len - 1))
         {
@@ -453,6 +473,97 @@ namespace matrix
         }
     }
 
+/**
+ * The batch counterpart of `_put()`: copies 'n' objects into the FIFO
+ * under a single lock, and calls the notifier once. The caller must
+ * already hold 'n' slots of `_empty_sem`.
+ *
+ * @param first: The first of the objects to put (copy) into the
+ * buffer. A std::move_iterator moves them instead.
+ *
+ * @param n: The number of objects to put.
+ *
+ * @return The iterator past the last object put.
+ *
+ */
+
+    template<class T>
+    template<typename InputIt>
+    InputIt matrix::tsemfifo<T>::_put_n(InputIt first, size_t n)
+    {
+        matrix::ThreadLock<matrix::Mutex> l(_critical_section);
+
+        l.lock();
+
+        for (size_t i = 0; i < n; ++i, ++first)
+        {
+            _buffer[_tail] = *first;
+            _tail = (_tail + 1) % _buf_len;
+        }
+
+        if (!_objects && n)              // Was empty, now has something.
+        {
+            _empty.set_value(false);
+        }
+
+        _objects += n;
+        _notifier->exec(_objects);
+        l.unlock();
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (sem_post(&_full_sem) == -1)
+            {
+                Exception e;
+                e.what(errno, "tsemfifo<T>::_put_n()");
+                throw e;
+            }
+        }
+
+        return first;
+    }
+
+/**
+ * Takes up to 'n' counts of a semaphore without blocking.
+ *
+ * @param sem: The semaphore, `_full_sem` or `_empty_sem`.
+ *
+ * @param n: The most counts to take.
+ *
+ * @return The number of counts taken, which may be 0.
+ *
+ */
+
+    template<class T>
+    size_t matrix::tsemfifo<T>::_try_wait_n(sem_t *sem, size_t n)
+    {
+        size_t taken = 0;
+
+        while (taken < n)
+        {
+            if (sem_trywait(sem) == -1)
+            {
+                if (errno == EAGAIN)
+                {
+                    break;
+                }
+
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                Exception e;
+                e.what(errno, "tsemfifo<T>::_try_wait_n()");
+                throw e;
+            }
+
+            ++taken;
+        }
+
+        return taken;
+    }
+
 /**
  * Puts a new value at the tail of the FIFO.  put() will block if the
  * buffer is full. Throws an exception if there is a sem_wait() problem.
@@ -584,6 +695,237 @@ namespace matrix
         return true;
     }
 
+/**
+ * Puts 'n' values at the tail of the FIFO. Each time there is room the
+ * values that fit are copied in under one lock, so a batch costs one
+ * lock per wait rather than one per value. put_n() blocks while the
+ * FIFO is full, like put().
+ *
+ * @param objs: The objects to put (copy) into the buffer.
+ *
+ * @param n: The number of objects in 'objs'.
+ *
+ * @return The number of objects put. This is less than 'n' only if
+ * the FIFO was released while put_n() was waiting.
+ *
+ */
+
+    template<class T>
+    size_t matrix::tsemfifo<T>::put_n(T const *objs, size_t n)
+    {
+        return put_n(objs, objs + n);
+    }
+
+/**
+ * Puts the values in the range [first, last) at the tail of the FIFO,
+ * as `put_n(objs, n)` does. The range may be any forward iterator
+ * range, for example a whole std::vector, or a std::move_iterator
+ * range to move the values rather than copy them:
+ *
+ *     fifo.put_n(std::make_move_iterator(v.begin()),
+ *                std::make_move_iterator(v.end()));
+ *
+ * @param first: The first value to put.
+ *
+ * @param last: Past the last value to put.
+ *
+ * @return The number of objects put, the first that many of the
+ * range. This is less than the size of the range only if the FIFO was
+ * released while put_n() was waiting.
+ *
+ */
+
+    template<class T>
+    template<typename ForwardIt>
+    size_t matrix::tsemfifo<T>::put_n(ForwardIt first, ForwardIt last)
+    {
+        size_t n = std::distance(first, last);
+        size_t done = 0;
+
+        while (done < n)
+        {
+            int r;
+
+            do
+            {
+                r = sem_wait(&_empty_sem);
+
+                if (r == -1 && errno != EINTR)
+                {
+                    Exception e;
+                    e.what(errno, "tsemfifo<T>::put_n()");
+                    throw e;
+                }
+            }
+            while (r == -1 && errno != EDEADLK);
+
+            if (_release.wait(true, 0))
+            {
+                break;
+            }
+
+            size_t k = 1 + _try_wait_n(&_empty_sem, n - done - 1);
+            first = _put_n(first, k);
+            done += k;
+        }
+
+        return done;
+    }
+
+/**
+ * Puts as many of 'n' values at the tail of the FIFO as there is room
+ * for, without blocking. The batch counterpart of `try_put()`.
+ *
+ * @param objs: The objects to put (copy) into the buffer.
+ *
+ * @param n: The number of objects in 'objs'.
+ *
+ * @return The number of objects put, the first that many of 'objs'.
+ *
+ */
+
+    template<class T>
+    size_t matrix::tsemfifo<T>::try_put_n(T const *objs, size_t n)
+    {
+        size_t k = _try_wait_n(&_empty_sem, n);
+
+        if (k)
+        {
+            _put_n(objs, k);
+        }
+
+        return k;
+    }
+
+/**
+ * Puts 'n' values at the tail of the FIFO, waiting up to 'time_out'
+ * nano seconds in all for room. The batch counterpart of
+ * `timed_put()`.
+ *
+ * @param objs: The objects to put (copy) into the buffer.
+ *
+ * @param n: The number of objects in 'objs'.
+ *
+ * @param time_out: Time to wait for the FIFO to become not full, in
+ * nano seconds.
+ *
+ * @return The number of objects put, the first that many of
+ * 'objs'. Less than 'n' if 'time_out' expired first.
+ *
+ */
+
+    template<class T>
+    size_t matrix::tsemfifo<T>::timed_put_n(T const *objs, size_t n, Time::Time_t time_out)
+    {
+        size_t done = 0;
+        timespec ts;
+
+        Time::time2timespec(Time::getUTC(CLOCK_REALTIME) + time_out, ts);
+
+        while (done < n)
+        {
+            if (sem_timedwait(&_empty_sem, &ts) == -1)
+            {
+                if (errno == ETIMEDOUT)
+                {
+                    break;
+                }
+
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                Exception e;
+                e.what(errno, "tsemfifo<T>::timed_put_n()");
+                throw e;
+            }
+
+            size_t k = 1 + _try_wait_n(&_empty_sem, n - done - 1);
+            _put_n(objs + done, k);
+            done += k;
+        }
+
+        return done;
+    }
+
+/**
+ * The batch counterpart of `put_no_block()`. Puts 'n' values at the
+ * tail of the FIFO without blocking, bumping off as many of the oldest
+ * entries as needed to make room. If 'n' exceeds the capacity of the
+ * FIFO only the newest values are kept.
+ *
+ * @param objs: The objects to put (copy) into the buffer.
+ *
+ * @param n: The number of objects in 'objs'.
+ *
+ * @return The number of objects dropped, old entries and any of 'objs'
+ * that did not fit.
+ *
+ */
+
+    template<class T>
+    unsigned int matrix::tsemfifo<T>::put_n_no_block(T const *objs, size_t n)
+    {
+        unsigned int flushed(0);
+        size_t taken;
+
+        if (n > _buf_len)
+        {
+            flushed = n - _buf_len;
+            objs += flushed;
+            n = _buf_len;
+        }
+
+        // As in put_no_block(), flush the oldest object each time there
+        // is not yet room for all of 'objs'.
+        while ((taken = _try_wait_n(&_empty_sem, n)) < n)
+        {
+            if (taken)
+            {
+                _put_n(objs, taken);
+                objs += taken;
+                n -= taken;
+            }
+
+            flush(1);
+            ++flushed;
+        }
+
+        _put_n(objs, n);
+        return flushed;
+    }
+
+/**
+ * Replaces whatever is in the FIFO with 'obj', so that a consumer
+ * that falls behind only ever sees the latest value. Does not block.
+ *
+ * @param obj: object to place into the FIFO
+ *
+ * @return The number of older entries discarded.
+ *
+ */
+
+    template<class T>
+    unsigned int matrix::tsemfifo<T>::put_latest(T const &obj)
+    {
+        return put_latest(T(obj));
+    }
+
+    template<class T>
+    unsigned int matrix::tsemfifo<T>::put_latest(T &&obj)
+    {
+        unsigned int dropped(0);
+        T old;
+
+        while (try_get(old))
+        {
+            ++dropped;
+        }
+
+        return dropped + put_no_block(std::move(obj));
+    }
+
 /**
  * This put does not block, and bumps off the oldest entry if the fifo
  * is full.
@@ -619,7 +961,9 @@ namespace matrix
  * FIFO to retrieve an object for get() and try_get() once these have
  * determined that there is an object to get.
  *
- *  @param obj: object to which FIFO object will be copied to.
+ *  @param obj: object to which FIFO object will be moved. If T is
+ *  `recyclable` the two are swapped, so that the buffer 'obj' held
+ *  is reused for a later put.
  *
  */
 
@@ -629,7 +973,7 @@ namespace matrix
         matrix::ThreadLock<matrix::Mutex> l(_critical_section);
 
         l.lock();
-        obj = std::move(_buffer[_head]);
+        recycle(obj, _buffer[_head]);
 
         if (_head < (_buf_len - 1))
         {
@@ -657,6 +1001,50 @@ namespace matrix
         }
     }
 
+/**
+ * The batch counterpart of `_get()`: moves 'n' objects out of the FIFO
+ * under a single lock. The caller must already hold 'n' counts of
+ * `_full_sem`.
+ *
+ * @param out: Where to move the objects; room for at least 'n'.
+ *
+ * @param n: The number of objects to get.
+ *
+ */
+
+    template<class T>
+    template<typename OutputIt>
+    void matrix::tsemfifo<T>::_get_n(OutputIt out, size_t n)
+    {
+        matrix::ThreadLock<matrix::Mutex> l(_critical_section);
+
+        l.lock();
+
+        for (size_t i = 0; i < n; ++i, ++out)
+        {
+            recycle(*out, _buffer[_head]);
+            _head = (_head + 1) % _buf_len;
+        }
+
+        _objects -= n;
+        l.unlock();
+
+        if (!_objects)               // Was not empty, now empty.  Set empty event.
+        {
+            _empty.broadcast(true);
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (sem_post(&_empty_sem) == -1)
+            {
+                Exception e;
+                e.what(errno, "tsemfifo<T>::_get_n()");
+                throw e;
+            }
+        }
+    }
+
 /**
  * Gets a value out of the head of the FIFO.  get() will block,
  * suspending the calling thread, until something gets placed into the
@@ -766,6 +1154,55 @@ namespace matrix
     }
 
 
+/**
+ * Gets up to 'max' values out of the head of the FIFO at once. get_n()
+ * waits up to 'time_out' nano seconds for the first value, then takes
+ * whatever else is already in the FIFO, up to 'max', under one lock.
+ *
+ * @param out: An output iterator to which the FIFO objects will be
+ * moved: a pointer into an array with room for at least 'max'
+ * objects, a std::vector's begin(), a std::back_inserter(), etc.
+ *
+ * @param max: The most objects to get.
+ *
+ * @param time_out: The time, in nano seconds, to wait for the FIFO to
+ * become not empty.
+ *
+ * @return The number of objects written to 'out', 0 if the FIFO was
+ * still empty at the expiration of 'time_out'.
+ *
+ */
+
+    template<class T>
+    template<typename OutputIt>
+    size_t matrix::tsemfifo<T>::get_n(OutputIt out, size_t max, Time::Time_t time_out)
+    {
+        timespec ts;
+
+        if (max == 0)
+        {
+            return 0;
+        }
+
+        Time::time2timespec(Time::getUTC(CLOCK_REALTIME) + time_out, ts);
+
+        if (sem_timedwait(&_full_sem, &ts) == -1)
+        {
+            if (errno == ETIMEDOUT)
+            {
+                return 0;
+            }
+            Exception e;
+            e.what(errno, "tsemfifo<T>::get_n()");
+
+            throw e;
+        }
+
+        size_t n = 1 + _try_wait_n(&_full_sem, max - 1);
+        _get_n(out, n);
+        return n;
+    }
+
 /**
  * If any thread is waiting on get() or put(), this will release them.
  * The queue should not be used after this call unless the next call is
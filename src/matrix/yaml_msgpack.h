@@ -0,0 +1,63 @@
+/*******************************************************************
+ *  yaml_msgpack.h - msgpack encoding of YAML nodes and yaml_results,
+ *  for the Keymaster's binary wire protocol.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#if !defined(_YAML_MSGPACK_H_)
+#define _YAML_MSGPACK_H_
+
+#include "matrix/yaml_util.h"
+
+#include <string>
+#include <msgpack.hpp>
+#include <yaml-cpp/yaml.h>
+
+namespace mxutils
+{
+    /**
+     * These convert YAML nodes, and `yaml_result`s, to and from
+     * msgpack. A YAML mapping becomes a msgpack map, a sequence an
+     * array, a null nil, and a scalar a string: YAML scalars are
+     * untyped, and are left for the receiver to interpret with
+     * `as<T>()` exactly as it would after parsing YAML text. Decoding
+     * also accepts the other msgpack types, converting booleans and
+     * numbers to their YAML scalar text, so that other msgpack
+     * clients may send them.
+     *
+     * Encoding and decoding a large tree this way is much cheaper
+     * than emitting and parsing YAML text.
+     *
+     */
+
+    void pack_yaml(msgpack::packer<msgpack::sbuffer> &pk, YAML::Node const &n);
+    std::string yaml_to_msgpack(YAML::Node const &n);
+    YAML::Node msgpack_to_yaml(msgpack::object const &o);
+    YAML::Node msgpack_to_yaml(char const *data, size_t size);
+    std::string yaml_result_to_msgpack(yaml_result const &yr);
+    void msgpack_to_yaml_result(char const *data, size_t size, yaml_result &yr);
+}
+
+#endif
@@ -28,7 +28,9 @@
 #if !defined(_YAML_UTILS_H_)
 #define _YAML_UTILS_H_
 
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <yaml-cpp/yaml.h>
 
 namespace mxutils
@@ -124,6 +126,58 @@ namespace mxutils
     {
         return put_yaml_node(node, keychain, YAML::Node(val), create);
     }
+
+/**
+ * \class yaml_index
+ *
+ * A YAML tree with a flat hash index from full keychains
+ * ("components.foo.status") to the tree's nodes. `get()`, `put()` and
+ * `del()` behave as `get_yaml_node()`, `put_yaml_node()` and
+ * `delete_yaml_node()` on the root, but a keychain that has been
+ * looked up before is found with one hash lookup rather than by
+ * splitting it and walking the tree a key at a time. A keychain not
+ * yet indexed is walked from its longest indexed prefix, and every
+ * node passed on the way is indexed.
+ *
+ * Replacing or deleting a map or sequence drops the index entries of
+ * everything beneath it, as those nodes are no longer in the
+ * tree. The indexed keychains are also kept in order, so that finding
+ * those beneath a node costs only as many steps as there are. Replacing
+ * a scalar, the common case of a status value being updated, touches
+ * only its own entry.
+ *
+ * Unlike the free functions, a successful `get()` or `put()` returns
+ * the tree's own node rather than a deep copy of it.
+ *
+ * Anything that changes the tree other than through the index must
+ * be followed by `reset()`.
+ *
+ */
+
+    class yaml_index
+    {
+    public:
+
+        yaml_index(YAML::Node root = YAML::Node());
+
+        void reset(YAML::Node root);
+        YAML::Node root() const {return _root;}
+        size_t size() const {return _nodes.size();}
+
+        yaml_result get(std::string const &keychain);
+        yaml_result lookup(std::string const &keychain) const;
+        yaml_result put(std::string const &keychain, YAML::Node val, bool create = false);
+        yaml_result del(std::string const &keychain);
+
+    private:
+
+        YAML::Node *_find(std::string const &keychain, bool create);
+        void _forget_below(std::string const &keychain);
+
+        YAML::Node _root;
+        std::unordered_map<std::string, YAML::Node> _nodes;
+        std::set<std::string> _keychains; // the keys of _nodes, in order
+    };
 }
 
 #endif
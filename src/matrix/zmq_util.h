@@ -32,6 +32,7 @@
 
 #include <string>
 #include <vector>
+#include <yaml-cpp/yaml.h>
 
 namespace mxutils
 {
@@ -96,6 +97,10 @@ namespace mxutils
     // process urns for zmq services
     std::string process_zmq_urn(const std::string input);
 
+    // apply socket options given in a transport's YAML configuration
+    void set_socket_options(zmq::socket_t &sock, YAML::Node const &opts, bool sender);
+    bool socket_option_set(YAML::Node const &opts, std::string name);
+
 }
 
 #endif // _MATRIX_ZMQ_UTIL_H_
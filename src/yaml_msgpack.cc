@@ -0,0 +1,270 @@
+/*******************************************************************
+ *  yaml_msgpack.cc - msgpack encoding of YAML nodes and yaml_results.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#include "matrix/yaml_msgpack.h"
+
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+// msgpack::object_handle, and the FLOAT32/FLOAT64 object types, are
+// msgpack-c 2.0's. (src/CMakeLists.txt checks this too, when it can
+// find the headers.)
+#if MSGPACK_VERSION_MAJOR < 2
+#error "msgpack-c 2.0 or later is required"
+#endif
+
+using namespace std;
+
+namespace mxutils
+{
+
+/**
+ * Packs a YAML node, and everything beneath it.
+ *
+ * @param pk: The packer to pack the node with.
+ *
+ * @param n: The node.
+ *
+ */
+
+    void pack_yaml(msgpack::packer<msgpack::sbuffer> &pk, YAML::Node const &n)
+    {
+        switch (n.Type())
+        {
+        case YAML::NodeType::Scalar:
+            {
+                string const &s = n.Scalar();
+                pk.pack_str(s.size());
+                pk.pack_str_body(s.data(), s.size());
+            }
+            break;
+
+        case YAML::NodeType::Sequence:
+            pk.pack_array(n.size());
+
+            for (YAML::const_iterator i = n.begin(); i != n.end(); ++i)
+            {
+                pack_yaml(pk, *i);
+            }
+
+            break;
+
+        case YAML::NodeType::Map:
+            pk.pack_map(n.size());
+
+            for (YAML::const_iterator i = n.begin(); i != n.end(); ++i)
+            {
+                pack_yaml(pk, i->first);
+                pack_yaml(pk, i->second);
+            }
+
+            break;
+
+        default:
+            pk.pack_nil();
+        }
+    }
+
+/**
+ * Encodes a YAML node as msgpack.
+ *
+ * @param n: The node.
+ *
+ * @return The msgpack encoding of 'n'.
+ *
+ */
+
+    string yaml_to_msgpack(YAML::Node const &n)
+    {
+        msgpack::sbuffer buf;
+        msgpack::packer<msgpack::sbuffer> pk(&buf);
+
+        pack_yaml(pk, n);
+        return string(buf.data(), buf.size());
+    }
+
+/**
+ * Converts an unpacked msgpack object to a YAML node.
+ *
+ * @param o: The msgpack object.
+ *
+ * @return A new YAML node. It does not refer to 'o', which may be
+ * released.
+ *
+ */
+
+    YAML::Node msgpack_to_yaml(msgpack::object const &o)
+    {
+        switch (o.type)
+        {
+        case msgpack::type::STR:
+            return YAML::Node(string(o.via.str.ptr, o.via.str.size));
+
+        case msgpack::type::BIN:
+            return YAML::Node(string(o.via.bin.ptr, o.via.bin.size));
+
+        case msgpack::type::BOOLEAN:
+            return YAML::Node(o.via.boolean ? "true" : "false");
+
+        case msgpack::type::POSITIVE_INTEGER:
+            return YAML::Node(to_string(o.via.u64));
+
+        case msgpack::type::NEGATIVE_INTEGER:
+            return YAML::Node(to_string(o.via.i64));
+
+        case msgpack::type::FLOAT32:
+        case msgpack::type::FLOAT64:
+            {
+                ostringstream s;
+                s << setprecision(numeric_limits<double>::max_digits10) << o.via.f64;
+                return YAML::Node(s.str());
+            }
+
+        case msgpack::type::ARRAY:
+            {
+                YAML::Node n(YAML::NodeType::Sequence);
+
+                for (uint32_t i = 0; i < o.via.array.size; ++i)
+                {
+                    n.push_back(msgpack_to_yaml(o.via.array.ptr[i]));
+                }
+
+                return n;
+            }
+
+        case msgpack::type::MAP:
+            {
+                YAML::Node n(YAML::NodeType::Map);
+
+                for (uint32_t i = 0; i < o.via.map.size; ++i)
+                {
+                    n.force_insert(msgpack_to_yaml(o.via.map.ptr[i].key),
+                                   msgpack_to_yaml(o.via.map.ptr[i].val));
+                }
+
+                return n;
+            }
+
+        default:
+            return YAML::Node(YAML::NodeType::Null);
+        }
+    }
+
+/**
+ * Decodes msgpack to a YAML node.
+ *
+ * @param data: The msgpack encoding.
+ *
+ * @param size: The size of 'data', in bytes.
+ *
+ * @return A new YAML node.
+ *
+ */
+
+    YAML::Node msgpack_to_yaml(char const *data, size_t size)
+    {
+        msgpack::object_handle oh = msgpack::unpack(data, size);
+        return msgpack_to_yaml(oh.get());
+    }
+
+/**
+ * Encodes a `yaml_result` as a msgpack map of the same four fields
+ * its YAML representation has (see `yaml_result::to_yaml_node()`).
+ * Unlike that, the result's node is packed as it is, not cloned.
+ *
+ * @param yr: The `yaml_result`.
+ *
+ * @return The msgpack encoding of 'yr'.
+ *
+ */
+
+    string yaml_result_to_msgpack(yaml_result const &yr)
+    {
+        msgpack::sbuffer buf;
+        msgpack::packer<msgpack::sbuffer> pk(&buf);
+
+        pk.pack_map(4);
+        pk.pack(string("result"));
+        pk.pack(yr.result);
+        pk.pack(string("key"));
+        pk.pack(yr.key);
+        pk.pack(string("err"));
+        pk.pack(yr.err);
+        pk.pack(string("node"));
+        pack_yaml(pk, yr.node);
+        return string(buf.data(), buf.size());
+    }
+
+/**
+ * Decodes a `yaml_result` encoded by `yaml_result_to_msgpack()`.
+ *
+ * @param data: The msgpack encoding.
+ *
+ * @param size: The size of 'data', in bytes.
+ *
+ * @param yr: The `yaml_result` to update.
+ *
+ * Throws a msgpack exception if 'data' is not a msgpack map, or its
+ * fields are of the wrong types.
+ *
+ */
+
+    void msgpack_to_yaml_result(char const *data, size_t size, yaml_result &yr)
+    {
+        msgpack::object_handle oh = msgpack::unpack(data, size);
+        msgpack::object const &o = oh.get();
+
+        if (o.type != msgpack::type::MAP)
+        {
+            throw msgpack::type_error();
+        }
+
+        for (uint32_t i = 0; i < o.via.map.size; ++i)
+        {
+            string field = o.via.map.ptr[i].key.as<string>();
+            msgpack::object const &val = o.via.map.ptr[i].val;
+
+            if (field == "result")
+            {
+                yr.result = val.as<bool>();
+            }
+            else if (field == "key")
+            {
+                yr.key = val.as<string>();
+            }
+            else if (field == "err")
+            {
+                yr.err = val.as<string>();
+            }
+            else if (field == "node")
+            {
+                yr.node.reset(msgpack_to_yaml(val));
+            }
+        }
+    }
+}
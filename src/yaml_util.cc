@@ -394,4 +394,284 @@ namespace mxutils
         }
     }
 
+/**
+ * Constructor.
+ *
+ * @param root: The root of the tree to index. The index shares the
+ * tree; it does not copy it.
+ *
+ */
+
+    yaml_index::yaml_index(YAML::Node root)
+        : _root(root)
+    {
+    }
+
+/**
+ * Makes `root` the indexed tree, and empties the index.
+ *
+ * @param root: The new root node.
+ *
+ */
+
+    void yaml_index::reset(YAML::Node root)
+    {
+        _nodes.clear();
+        _keychains.clear();
+        _root.reset(root);
+    }
+
+/**
+ * Finds the node for a keychain, indexing it and every node on the
+ * way to it if it was not already indexed.
+ *
+ * @param keychain: The period-separated keys of the node.
+ *
+ * @param create: If true, missing nodes are created, as
+ * `put_yaml_node()` does.
+ *
+ * @return The node's index entry, or null if there is no such node.
+ *
+ */
+
+    YAML::Node *yaml_index::_find(string const &keychain, bool create)
+    {
+        unordered_map<string, YAML::Node>::iterator i = _nodes.find(keychain);
+
+        if (i != _nodes.end())
+        {
+            return &i->second;
+        }
+
+        // Start from the longest prefix that is already indexed.
+        YAML::Node *base = &_root;
+        size_t start = 0;
+
+        for (size_t dot = keychain.rfind('.'); dot != string::npos && dot > 0;
+             dot = keychain.rfind('.', dot - 1))
+        {
+            if ((i = _nodes.find(keychain.substr(0, dot))) != _nodes.end())
+            {
+                base = &i->second;
+                start = dot + 1;
+                break;
+            }
+        }
+
+        // As in walk_the_nodes(), each node is a new handle, never one
+        // assigned to.
+        vector<YAML::Node> nodes(1, *base);
+        YAML::Node *n = nullptr;
+
+        while (start <= keychain.size())
+        {
+            size_t end = keychain.find('.', start);
+
+            if (end == string::npos)
+            {
+                end = keychain.size();
+            }
+
+            string key = keychain.substr(start, end - start);
+
+            if (!nodes.back()[key])
+            {
+                if (!create)
+                {
+                    return nullptr;
+                }
+
+                nodes.back()[key] = YAML::Node();
+            }
+
+            nodes.push_back(nodes.back()[key]);
+
+            pair<unordered_map<string, YAML::Node>::iterator, bool> e =
+                _nodes.emplace(keychain.substr(0, end), nodes.back());
+
+            if (e.second)
+            {
+                _keychains.insert(e.first->first);
+            }
+
+            n = &e.first->second;
+            start = end + 1;
+        }
+
+        return n;
+    }
+
+/**
+ * Drops the index entries of every node beneath `keychain`. These are
+ * the keychains that begin with `keychain + "."`, which sort together,
+ * before `keychain + "/"`.
+ *
+ */
+
+    void yaml_index::_forget_below(string const &keychain)
+    {
+        set<string>::iterator first = _keychains.lower_bound(keychain + ".");
+        set<string>::iterator last = _keychains.lower_bound(keychain + "/");
+
+        for (set<string>::iterator i = first; i != last; ++i)
+        {
+            _nodes.erase(*i);
+        }
+
+        _keychains.erase(first, last);
+    }
+
+/**
+ * Returns the node for a keychain, as `get_yaml_node()` does.
+ *
+ * @param keychain: The period-separated keys of the node.
+ *
+ * @return A `yaml_result`. On success its node is the tree's own node.
+ *
+ */
+
+    yaml_result yaml_index::get(string const &keychain)
+    {
+        YAML::Node *n = nullptr;
+
+        if (keychain.empty())
+        {
+            return yaml_result(true, _root, "");
+        }
+
+        try
+        {
+            n = _find(keychain, false);
+        }
+        catch (YAML::Exception &e)
+        {
+        }
+
+        if (n)
+        {
+            return yaml_result(true, *n, keychain);
+        }
+
+        // Let get_yaml_node() describe the failure.
+        return get_yaml_node(_root, keychain);
+    }
+
+/**
+ * Returns the node for a keychain without adding to the index, for
+ * callers holding only a const index. Like every other member, it is
+ * not thread-safe: it must not run while anything modifies the index
+ * or the tree.
+ *
+ * @param keychain: The period-separated keys of the node.
+ *
+ * @return A `yaml_result`, as returned by `get_yaml_node()`.
+ *
+ */
+
+    yaml_result yaml_index::lookup(string const &keychain) const
+    {
+        unordered_map<string, YAML::Node>::const_iterator i = _nodes.find(keychain);
+
+        if (i != _nodes.end())
+        {
+            return yaml_result(true, i->second, keychain);
+        }
+
+        return get_yaml_node(_root, keychain);
+    }
+
+/**
+ * Sets the value of a node, as `put_yaml_node()` does.
+ *
+ * @param keychain: The period-separated keys of the node.
+ *
+ * @param val: The new value.
+ *
+ * @param create: If true, the node, and any nodes above it, are
+ * created if they do not exist.
+ *
+ * @return A `yaml_result`. On success its node is the tree's own node.
+ *
+ */
+
+    yaml_result yaml_index::put(string const &keychain, YAML::Node val, bool create)
+    {
+        YAML::Node *n = nullptr;
+
+        if (keychain.empty())
+        {
+            yaml_result r = put_yaml_node(_root, keychain, val, create);
+            _nodes.clear();
+            _keychains.clear();
+            return r;
+        }
+
+        try
+        {
+            n = _find(keychain, create);
+        }
+        catch (YAML::Exception &e)
+        {
+        }
+
+        if (!n)
+        {
+            // Let put_yaml_node() describe the failure.
+            return put_yaml_node(_root, keychain, val, create);
+        }
+
+        if (n->IsMap() || n->IsSequence())
+        {
+            _forget_below(keychain);
+        }
+
+        // Assign through a copy of the handle: YAML::Node's operator=()
+        // rebinds the handle it is applied to, and the index entry must
+        // keep referring to the node in the tree.
+        YAML::Node h(*n);
+        h = val;
+        return yaml_result(true, *n, keychain);
+    }
+
+/**
+ * Deletes a node, as `delete_yaml_node()` does.
+ *
+ * @param keychain: The period-separated keys of the node.
+ *
+ * @return A `yaml_result`, as returned by `delete_yaml_node()`.
+ *
+ */
+
+    yaml_result yaml_index::del(string const &keychain)
+    {
+        size_t dot = keychain.rfind('.');
+        string parent = dot == string::npos ? string() : keychain.substr(0, dot);
+        YAML::Node *p = &_root;
+
+        try
+        {
+            if (_find(keychain, false) == nullptr
+                || (!parent.empty() && (p = _find(parent, false)) == nullptr))
+            {
+                p = nullptr;
+            }
+        }
+        catch (YAML::Exception &e)
+        {
+            p = nullptr;
+        }
+
+        if (!p)
+        {
+            // Let delete_yaml_node() describe the failure.
+            return delete_yaml_node(_root, keychain);
+        }
+
+        p->remove(keychain.substr(dot + 1));
+        _nodes.erase(keychain);
+        _keychains.erase(keychain);
+        _forget_below(keychain);
+        return yaml_result(true, YAML::Clone(*p), parent);
+    }
+
 }
@@ -565,4 +565,172 @@ std::string process_zmq_urn(const std::string input)
                                   "send timed out.");
         }
     }
+
+    namespace
+    {
+        enum sockopt_dir
+        {
+            SENDER,
+            RECEIVER,
+            BOTH
+        };
+
+        enum sockopt_type
+        {
+            INT,
+            UINT64
+        };
+
+        struct sockopt
+        {
+            char const *name;
+            int option;
+            sockopt_type type;
+            sockopt_dir dir;
+        };
+
+        sockopt const sockopts[] =
+        {
+            {"SNDHWM",             ZMQ_SNDHWM,             INT,    SENDER},
+            {"RCVHWM",             ZMQ_RCVHWM,             INT,    RECEIVER},
+            {"SNDBUF",             ZMQ_SNDBUF,             INT,    SENDER},
+            {"RCVBUF",             ZMQ_RCVBUF,             INT,    RECEIVER},
+            {"CONFLATE",           ZMQ_CONFLATE,           INT,    BOTH},
+            {"AFFINITY",           ZMQ_AFFINITY,           UINT64, BOTH},
+            {"TCP_KEEPALIVE",      ZMQ_TCP_KEEPALIVE,      INT,    BOTH},
+            {"TCP_KEEPALIVE_IDLE", ZMQ_TCP_KEEPALIVE_IDLE, INT,    BOTH},
+            {"TCP_KEEPALIVE_CNT",  ZMQ_TCP_KEEPALIVE_CNT,  INT,    BOTH},
+            {"TCP_KEEPALIVE_INTVL", ZMQ_TCP_KEEPALIVE_INTVL, INT,  BOTH}
+        };
+
+        // Option values may be integers or YAML booleans ('CONFLATE: true').
+        int64_t sockopt_value(YAML::Node const &n)
+        {
+            try
+            {
+                return n.as<int64_t>();
+            }
+            catch (YAML::Exception &e)
+            {
+                return n.as<bool>() ? 1 : 0;
+            }
+        }
+    }
+
+/**
+ * Sets the socket options given in the 'SocketOptions' map of a
+ * transport's configuration:
+ *
+ *     Transports:
+ *       A:
+ *         Specified: [tcp]
+ *         SocketOptions:
+ *           SNDHWM: 100000
+ *           RCVHWM: 100000
+ *           RCVBUF: 4194304
+ *           TCP_KEEPALIVE: 1
+ *
+ * The same map serves both ends of the transport: the send options
+ * (SNDHWM, SNDBUF) are only applied to the publishing socket, the
+ * receive options (RCVHWM, RCVBUF) only to the subscribing sockets,
+ * and the rest (CONFLATE, AFFINITY and the TCP_KEEPALIVE options) to
+ * both. Options must be set before the socket is bound or connected
+ * for most of them to have any effect.
+ *
+ * Unknown option names, and options ZMQ rejects, are reported on
+ * stderr and otherwise ignored.
+ *
+ * @param sock: The socket.
+ *
+ * @param opts: The 'SocketOptions' map. May be a null node, in which
+ * case nothing is done.
+ *
+ * @param sender: true if 'sock' is the publishing socket.
+ *
+ */
+
+    void set_socket_options(zmq::socket_t &sock, YAML::Node const &opts, bool sender)
+    {
+        if (!opts.IsMap())
+        {
+            return;
+        }
+
+        for (YAML::const_iterator i = opts.begin(); i != opts.end(); ++i)
+        {
+            std::string name = i->first.as<std::string>();
+            sockopt const *o = NULL;
+
+            for (size_t j = 0; j < sizeof(sockopts) / sizeof(sockopt); ++j)
+            {
+                if (name == sockopts[j].name)
+                {
+                    o = &sockopts[j];
+                    break;
+                }
+            }
+
+            if (o == NULL)
+            {
+                std::cerr << "set_socket_options(): unknown socket option "
+                          << name << std::endl;
+                continue;
+            }
+
+            if ((o->dir == SENDER && !sender) || (o->dir == RECEIVER && sender))
+            {
+                continue;
+            }
+
+            try
+            {
+                int64_t v = sockopt_value(i->second);
+
+                if (o->type == UINT64)
+                {
+                    uint64_t u = (uint64_t)v;
+                    sock.setsockopt(o->option, &u, sizeof u);
+                }
+                else
+                {
+                    int n = (int)v;
+                    sock.setsockopt(o->option, &n, sizeof n);
+                }
+            }
+            catch (std::exception &e)
+            {
+                std::cerr << "set_socket_options(): cannot set " << name
+                          << ": " << e.what() << std::endl;
+            }
+        }
+    }
+
+/**
+ * Tells whether a true/non-zero option is present in a
+ * 'SocketOptions' map. See `set_socket_options()`.
+ *
+ * @param opts: The 'SocketOptions' map, or a null node.
+ *
+ * @param name: The option name, e.g. "CONFLATE".
+ *
+ * @return true if the option is given and is non-zero.
+ *
+ */
+
+    bool socket_option_set(YAML::Node const &opts, std::string name)
+    {
+        if (!opts.IsMap() || !opts[name])
+        {
+            return false;
+        }
+
+        try
+        {
+            return sockopt_value(opts[name]) != 0;
+        }
+        catch (YAML::Exception &e)
+        {
+            return false;
+        }
+    }
 }
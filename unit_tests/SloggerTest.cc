@@ -0,0 +1,450 @@
+/*******************************************************************
+ *  SloggerTest.cc - Tests for the slogger's writers and loggers.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#include "SloggerTest.h"
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+#include <ftw.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <fitsio.h>
+#include <yaml-cpp/yaml.h>
+#include "matrix/DataSource.h"
+#include "matrix/Keymaster.h"
+#include "matrix/Time.h"
+#include "AsyncLogWriter.h"
+#include "FITSLogger.h"
+#include "MultiStreamLogger.h"
+
+using namespace std;
+using namespace matrix;
+
+static string km_urn("inproc://slogger_tests.keymaster");
+static string test_dir("/tmp/slogger_test");
+
+static string yaml_configuration =
+    "Keymaster:\n"
+    "  URLS:\n"
+    "    Initial:\n"
+    "      - inproc://slogger_tests.keymaster\n"
+    "  clone_interval: 1000\n"
+    "\n"
+    "components:\n"
+    "  moby_dick:\n"
+    "    Transports:\n"
+    "      A:\n"
+    "        Specified: [inproc]\n"
+    "    Sources:\n"
+    "      lines: A\n"
+    "\n"
+    "stream_descriptions:\n"
+    "  counts:\n"
+    "    fields:\n"
+    "      0: [count, int64_t, 1]\n"
+    "      1: [value, double, 1]\n";
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+/// Removes 'dir' and all in it, and makes it again, empty.
+static void clean(string dir)
+{
+    nftw(dir.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    mkdir(dir.c_str(), 0755);
+}
+
+/// The log files in 'dir', not counting a prepared next file, sorted
+/// by name and so by time.
+static vector<string> log_files(string dir, bool temporary = false)
+{
+    vector<string> files;
+    DIR *d = opendir(dir.c_str());
+
+    if (d == nullptr)
+    {
+        return files;
+    }
+
+    for (struct dirent *e = readdir(d); e != nullptr; e = readdir(d))
+    {
+        string name(e->d_name);
+
+        if ((name[0] == '.') == temporary && name.size() > 5
+            && name.compare(name.size() - 5, 5, ".fits") == 0)
+        {
+            files.push_back(name);
+        }
+    }
+
+    closedir(d);
+    sort(files.begin(), files.end());
+    return files;
+}
+
+/// Reads column 'column' of the table of FITS file 'path', as
+/// 'fits_type', appending it to 'values'. Returns false if the file
+/// cannot be read.
+template <typename T>
+static bool read_column(string path, string column, int fits_type, vector<T> &values)
+{
+    fitsfile *f = nullptr;
+    int status = 0, col = 0, anynul = 0;
+    long rows = 0;
+
+    fits_open_file(&f, path.c_str(), READONLY, &status);
+
+    if (status != 0)
+    {
+        return false;
+    }
+
+    fits_movabs_hdu(f, 2, nullptr, &status);
+    fits_get_num_rows(f, &rows, &status);
+    fits_get_colnum(f, CASEINSEN, (char *)column.c_str(), &col, &status);
+
+    if (status == 0 && rows > 0)
+    {
+        size_t n = values.size();
+
+        values.resize(n + rows);
+        fits_read_col(f, fits_type, col, 1LL, 1LL, (LONGLONG)rows, nullptr,
+                      values.data() + n, &anynul, &status);
+    }
+
+    fits_close_file(f, &status);
+    return status == 0;
+}
+
+/// Waits up to two seconds for 'done' to be true.
+static bool wait_for(function<bool()> done)
+{
+    for (int i = 0; i < 200; ++i)
+    {
+        if (done())
+        {
+            return true;
+        }
+
+        Time::thread_delay(10000000);
+    }
+
+    return done();
+}
+
+/**
+ * Tests that a LogWorker opens the first file of a writer itself, only
+ * once it is given the writer, and that a writer whose file cannot be
+ * opened is dropped and reported by `failed()`.
+ *
+ */
+
+void SloggerTest::test_log_worker()
+{
+    string dir = test_dir + "/worker";
+    YAML::Node dd = YAML::Load(yaml_configuration)["stream_descriptions"]["counts"]["fields"];
+
+    clean(test_dir);
+    mkdir(dir.c_str(), 0755);
+    // a file where the 'bad' writer's directory should be.
+    fclose(fopen((dir + "/bad").c_str(), "w"));
+
+    shared_ptr<AsyncLogWriter> good(new AsyncLogWriter(dd, "good", dir + "/good/", 1000));
+    shared_ptr<AsyncLogWriter> bad(new AsyncLogWriter(dd, "bad", dir + "/bad/", 1000));
+    LogWorker worker;
+
+    CPPUNIT_ASSERT(log_files(dir + "/good").empty());
+    worker.add(good);
+    worker.add(bad);
+    CPPUNIT_ASSERT_EQUAL((size_t)2, worker.size());
+    CPPUNIT_ASSERT(!worker.failed(bad));
+
+    worker.start("test_worker");
+    CPPUNIT_ASSERT(wait_for([&]() { return worker.failed(bad); }));
+    CPPUNIT_ASSERT(!worker.failed(good));
+    CPPUNIT_ASSERT_EQUAL((size_t)1, worker.size());
+    CPPUNIT_ASSERT_EQUAL((size_t)1, log_files(dir + "/good").size());
+
+    // the rows of the writer still served are written.
+    vector<GenericBuffer> rows(10);
+
+    for (size_t i = 0; i < rows.size(); ++i)
+    {
+        rows[i].resize(good->log_datasize());
+    }
+
+    CPPUNIT_ASSERT_EQUAL((size_t)0, good->put(rows.data(), rows.size()));
+    worker.wake();
+    CPPUNIT_ASSERT(wait_for([&]() { return good->get_metrics().rows_written == 10; }));
+
+    // removing a failed writer forgets the failure.
+    worker.remove(bad);
+    CPPUNIT_ASSERT(!worker.failed(bad));
+    worker.remove(good);
+    CPPUNIT_ASSERT_EQUAL((size_t)0, worker.size());
+    worker.stop();
+}
+
+/**
+ * Tests MultiStreamLogger::reconcile(): only matching streams are
+ * added; a stream whose sink cannot be connected is not, and leaves
+ * no file behind; a stream whose entry changes is replaced, one whose
+ * file cannot be opened is tried again, and one no longer in the
+ * 'streams' table is removed.
+ *
+ */
+
+void SloggerTest::test_reconcile()
+{
+    YAML::Node config = YAML::Load(yaml_configuration);
+    shared_ptr<KeymasterServer> kms(new KeymasterServer(config));
+
+    kms->run();
+    clean(test_dir);
+
+    {
+        DataSource<GenericBuffer> source(km_urn, "moby_dick", "lines");
+        MultiStreamLogger msl(km_urn, "fine,absent,blocked", test_dir, 1000, 2);
+        YAML::Node streams = YAML::Load(
+            "fine: [moby_dick, lines, counts]\n"
+            "absent: [moby_dick, no_such_source, counts]\n"
+            "ignored: [moby_dick, lines, counts]\n");
+
+        msl.streams_changed("streams", streams);
+        CPPUNIT_ASSERT(msl.reconcile());
+        CPPUNIT_ASSERT_EQUAL((size_t)1, msl.streams.size());
+        CPPUNIT_ASSERT(msl.streams.find("fine") != msl.streams.end());
+        CPPUNIT_ASSERT(wait_for([&]() { return log_files(test_dir + "/fine").size() == 1; }));
+        CPPUNIT_ASSERT(log_files(test_dir + "/absent").empty());
+        CPPUNIT_ASSERT(log_files(test_dir + "/ignored").empty());
+
+        // nothing changed, nothing to do.
+        shared_ptr<AsyncLogWriter> writer = msl.streams["fine"]->writer;
+        CPPUNIT_ASSERT(!msl.reconcile());
+        CPPUNIT_ASSERT(msl.streams["fine"]->writer == writer);
+
+        // a changed entry is replaced.
+        streams["fine"] = YAML::Load("[moby_dick, lines, counts, changed]");
+        msl.streams_changed("streams", streams);
+        CPPUNIT_ASSERT(msl.reconcile());
+        CPPUNIT_ASSERT_EQUAL((size_t)1, msl.streams.size());
+        CPPUNIT_ASSERT(msl.streams["fine"]->writer != writer);
+        writer = msl.streams["fine"]->writer;
+
+        // a stream whose directory cannot be made is dropped by its
+        // worker, then removed and added again by reconcile().
+        fclose(fopen((test_dir + "/blocked").c_str(), "w"));
+        streams["blocked"] = YAML::Load("[moby_dick, lines, counts]");
+        msl.streams_changed("streams", streams);
+        CPPUNIT_ASSERT(msl.reconcile());
+        CPPUNIT_ASSERT_EQUAL((size_t)2, msl.streams.size());
+        shared_ptr<MultiStreamLogger::stream> blocked = msl.streams["blocked"];
+        CPPUNIT_ASSERT(wait_for([&]() { return msl.workers[blocked->worker]->failed(blocked->writer); }));
+        CPPUNIT_ASSERT(msl.reconcile());
+        CPPUNIT_ASSERT_EQUAL((size_t)2, msl.streams.size());
+        CPPUNIT_ASSERT(msl.streams["blocked"] != blocked);
+        CPPUNIT_ASSERT(msl.streams["fine"]->writer == writer);
+        CPPUNIT_ASSERT(!msl.workers[blocked->worker]->failed(blocked->writer));
+
+        // streams no longer in the table are removed.
+        msl.streams_changed("streams", YAML::Load("ignored: [moby_dick, lines, counts]"));
+        CPPUNIT_ASSERT(msl.reconcile());
+        CPPUNIT_ASSERT(msl.streams.empty());
+    }
+
+    kms.reset();
+}
+
+/**
+ * Tests that an AsyncLogWriter starts a new file every
+ * 'max_rows_per_file' rows, that every row queued is in one of them,
+ * in order, and that stop() leaves no prepared next file behind.
+ *
+ */
+
+void SloggerTest::test_rotate()
+{
+    string dir = test_dir + "/rotate";
+    YAML::Node dd = YAML::Load(yaml_configuration)["stream_descriptions"]["counts"]["fields"];
+    compiled_description cd(dd);
+    size_t count_id = cd.field_id("count");
+    const size_t rows_per_file = 100, total = 350;
+    vector<GenericBuffer> rows(50);
+
+    clean(test_dir);
+    AsyncLogWriter writer(dd, "rotate", dir + "/", rows_per_file);
+
+    CPPUNIT_ASSERT(writer.start());
+
+    for (size_t sent = 0; sent < total; sent += rows.size())
+    {
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            rows[i].resize(writer.log_datasize());
+            cd.set(rows[i].data(), count_id, (int64_t)(sent + i));
+        }
+
+        CPPUNIT_ASSERT_EQUAL((size_t)0, writer.put(rows.data(), rows.size()));
+    }
+
+    writer.stop();
+
+    AsyncLogWriter::metrics m = writer.get_metrics();
+    CPPUNIT_ASSERT_EQUAL(total, m.rows_written);
+    CPPUNIT_ASSERT_EQUAL((size_t)0, m.rows_dropped);
+    CPPUNIT_ASSERT_EQUAL((size_t)4, m.files);
+    CPPUNIT_ASSERT(log_files(dir, true).empty());
+
+    // the files are named by time, so in name order the rows are in
+    // the order queued.
+    vector<string> files = log_files(dir);
+    vector<long long> counts;
+
+    CPPUNIT_ASSERT_EQUAL((size_t)4, files.size());
+
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        size_t before = counts.size();
+
+        CPPUNIT_ASSERT(read_column(dir + "/" + files[i], "count", TLONGLONG, counts));
+        CPPUNIT_ASSERT_EQUAL(i < 3 ? rows_per_file : total % rows_per_file,
+                             counts.size() - before);
+    }
+
+    CPPUNIT_ASSERT_EQUAL(total, counts.size());
+
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        CPPUNIT_ASSERT_EQUAL((long long)i, counts[i]);
+    }
+}
+
+/**
+ * Tests that FITSLogger writes its buffered rows once there are
+ * 'flush_rows' of them, and the rest on close(), and that each type
+ * gets the FITS column it should: Time_t as a DMJD, long and uint64_t
+ * as 64 bit integers, uint8_t as bytes. 'nolog' fields are left out.
+ *
+ */
+
+void SloggerTest::test_fits_logger()
+{
+    string dir = test_dir + "/fits";
+    YAML::Node dd = YAML::Load(
+        "0: [time, Time_t, 1]\n"
+        "1: [big, long, 1]\n"
+        "2: [ubig, uint64_t, 1]\n"
+        "3: [byte, uint8_t, 1]\n"
+        "4: [value, double, 1]\n"
+        "5: [hidden, int, 1, nolog]\n");
+    compiled_description cd(dd);
+    const size_t flush_rows = 16, total = 40;
+    Time::Time_t t0 = Time::getUTC();
+    GenericBuffer row;
+
+    clean(test_dir);
+    FITSLogger log(dd, "fits", 0, flush_rows, 3600 * Time::TM_ONE_SEC);
+
+    CPPUNIT_ASSERT(log.set_directory(dir));
+    CPPUNIT_ASSERT(log.open_log());
+    row.resize(log.log_datasize());
+
+    for (size_t i = 0; i < total; ++i)
+    {
+        cd.set(row.data(), cd.field_id("time"), t0 + (Time::Time_t)i * Time::TM_ONE_SEC);
+        cd.set(row.data(), cd.field_id("big"), (long)i * -10000000000L);
+        cd.set(row.data(), cd.field_id("ubig"), (uint64_t)i * 10000000000000000ULL);
+        cd.set(row.data(), cd.field_id("byte"), (uint8_t)(200 + i));
+        cd.set(row.data(), cd.field_id("value"), i * 0.5);
+        cd.set(row.data(), cd.field_id("hidden"), (int)i);
+        CPPUNIT_ASSERT(log.log_data(row));
+    }
+
+    vector<string> files = log_files(dir);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, files.size());
+    string path = dir + "/" + files[0];
+
+    // two full batches are in the file; the rest are still buffered.
+    vector<long long> big;
+    CPPUNIT_ASSERT(read_column(path, "big", TLONGLONG, big));
+    CPPUNIT_ASSERT_EQUAL(2 * flush_rows, big.size());
+
+    log.close();
+
+    vector<double> time, value;
+    vector<unsigned long long> ubig;
+    vector<unsigned char> byte;
+
+    big.clear();
+    CPPUNIT_ASSERT(read_column(path, "time", TDOUBLE, time));
+    CPPUNIT_ASSERT(read_column(path, "big", TLONGLONG, big));
+    CPPUNIT_ASSERT(read_column(path, "ubig", TULONGLONG, ubig));
+    CPPUNIT_ASSERT(read_column(path, "byte", TBYTE, byte));
+    CPPUNIT_ASSERT(read_column(path, "value", TDOUBLE, value));
+    CPPUNIT_ASSERT_EQUAL(total, time.size());
+    CPPUNIT_ASSERT_EQUAL(total, byte.size());
+
+    for (size_t i = 0; i < total; ++i)
+    {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(Time::DMJD(t0 + (Time::Time_t)i * Time::TM_ONE_SEC),
+                                     time[i], 1e-9);
+        CPPUNIT_ASSERT_EQUAL((long long)i * -10000000000LL, big[i]);
+        CPPUNIT_ASSERT_EQUAL((unsigned long long)i * 10000000000000000ULL, ubig[i]);
+        CPPUNIT_ASSERT_EQUAL((unsigned char)(200 + i), byte[i]);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(i * 0.5, value[i], 1e-12);
+    }
+
+    // the column types, and the 'nolog' field left out.
+    fitsfile *f = nullptr;
+    int status = 0, ncols = 0, col = 0, type = 0;
+    long repeat = 0, width = 0;
+    const char *names[] = {"time", "big", "ubig", "byte"};
+    const int types[] = {TDOUBLE, TLONGLONG, TLONGLONG, TBYTE};
+
+    fits_open_file(&f, path.c_str(), READONLY, &status);
+    fits_movabs_hdu(f, 2, nullptr, &status);
+    fits_get_num_cols(f, &ncols, &status);
+    CPPUNIT_ASSERT_EQUAL(0, status);
+    CPPUNIT_ASSERT_EQUAL(5, ncols);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        fits_get_colnum(f, CASEINSEN, (char *)names[i], &col, &status);
+        fits_get_coltype(f, col, &type, &repeat, &width, &status);
+        CPPUNIT_ASSERT_EQUAL(0, status);
+        CPPUNIT_ASSERT_EQUAL(types[i], type);
+    }
+
+    fits_get_colnum(f, CASEINSEN, (char *)"hidden", &col, &status);
+    CPPUNIT_ASSERT(status != 0);
+    status = 0;
+    fits_close_file(f, &status);
+}
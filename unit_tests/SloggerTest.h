@@ -0,0 +1,49 @@
+/*******************************************************************
+ *  SloggerTest.h - Tests for the slogger's writers and loggers.
+ *
+ *  Copyright (C) 2019 Associated Universities, Inc. Washington DC, USA.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ *  Correspondence concerning GBT software should be addressed as follows:
+ *  GBT Operations
+ *  National Radio Astronomy Observatory
+ *  P. O. Box 2
+ *  Green Bank, WV 24944-0002 USA
+ *
+ *******************************************************************/
+
+#if !defined(_SLOGGERTEST_H_)
+#define _SLOGGERTEST_H_
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class SloggerTest : public CppUnit::TestCase
+{
+    CPPUNIT_TEST_SUITE(SloggerTest);
+    CPPUNIT_TEST(test_log_worker);
+    CPPUNIT_TEST(test_reconcile);
+    CPPUNIT_TEST(test_rotate);
+    CPPUNIT_TEST(test_fits_logger);
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void test_log_worker();
+    void test_reconcile();
+    void test_rotate();
+    void test_fits_logger();
+};
+
+#endif
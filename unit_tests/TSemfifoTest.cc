@@ -27,11 +27,44 @@
 
 #include "TSemfifoTest.h"
 #include "matrix/tsemfifo.h"
+#include "matrix/ring_fifo.h"
+#include "matrix/DataSink.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <thread>
 
 using namespace std;
 using namespace Time;
 using namespace matrix;
 
+// Counts heap allocations while 'count_allocations' is set, for
+// test_recycling().
+static std::atomic<bool> count_allocations(false);
+static std::atomic<size_t> allocations(0);
+
+void *operator new(size_t sze)
+{
+    if (count_allocations)
+    {
+        ++allocations;
+    }
+
+    void *p = malloc(sze ? sze : 1);
+
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
 
 /**
  * Tests for size count. 'size' refers to the number of items placed
@@ -156,3 +189,156 @@ void TSemfifoTest::test_flush()
     fifo.flush(100);
     CPPUNIT_ASSERT(fifo.size() == 0);
 }
+
+void TSemfifoTest::test_batch()
+{
+    int in[20], out[20];
+    tsemfifo<int> fifo(15);
+
+    for (int i = 0; i < 20; ++i)
+    {
+        in[i] = i;
+    }
+
+    // put 10, get them back in two batches; the second asks for more
+    // than there are.
+    CPPUNIT_ASSERT(fifo.put_n(in, 10) == 10);
+    CPPUNIT_ASSERT(fifo.size() == 10);
+    CPPUNIT_ASSERT(fifo.get_n(out, 4, 0) == 4);
+    CPPUNIT_ASSERT(out[0] == 0 && out[3] == 3);
+    CPPUNIT_ASSERT(fifo.get_n(out, 20, 0) == 6);
+    CPPUNIT_ASSERT(out[0] == 4 && out[5] == 9);
+    CPPUNIT_ASSERT(fifo.size() == 0);
+    // empty: times out with nothing.
+    CPPUNIT_ASSERT(fifo.get_n(out, 20, 1000000) == 0);
+
+    // 10 in a fifo of 15, then 10 more without blocking: the 5 oldest
+    // are bumped off, and the batch wraps around the end of the buffer.
+    fifo.put_n(in, 10);
+    CPPUNIT_ASSERT(fifo.put_n_no_block(in + 10, 10) == 5);
+    CPPUNIT_ASSERT(fifo.size() == 15);
+    CPPUNIT_ASSERT(fifo.get_n(out, 20, 0) == 15);
+
+    for (int i = 0; i < 15; ++i)
+    {
+        CPPUNIT_ASSERT(out[i] == i + 5);
+    }
+
+    // more than the fifo holds: only the newest 15 are kept.
+    CPPUNIT_ASSERT(fifo.put_n_no_block(in, 20) == 5);
+    CPPUNIT_ASSERT(fifo.get_n(out, 20, 0) == 15);
+    CPPUNIT_ASSERT(out[0] == 5 && out[14] == 19);
+
+    // the semaphores still agree with the contents.
+    CPPUNIT_ASSERT(fifo.try_put(1));
+    CPPUNIT_ASSERT(fifo.try_get(out[0]) && out[0] == 1);
+    CPPUNIT_ASSERT(!fifo.try_get(out[0]));
+
+    // any forward range in, any output iterator out.
+    vector<int> v(in, in + 10), w;
+    CPPUNIT_ASSERT(fifo.put_n(v.begin(), v.end()) == 10);
+    CPPUNIT_ASSERT(fifo.get_n(back_inserter(w), 20, 0) == 10);
+    CPPUNIT_ASSERT(w == v);
+}
+
+void TSemfifoTest::test_overflow()
+{
+    int in[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9}, out[10];
+    tsemfifo<int> fifo(5);
+
+    // only as many as there is room for, oldest first.
+    CPPUNIT_ASSERT(fifo.try_put_n(in, 3) == 3);
+    CPPUNIT_ASSERT(fifo.try_put_n(in + 3, 7) == 2);
+    CPPUNIT_ASSERT(fifo.try_put_n(in, 1) == 0);
+    CPPUNIT_ASSERT(fifo.get_n(out, 10, 0) == 5);
+    CPPUNIT_ASSERT(out[0] == 0 && out[4] == 4);
+
+    // times out part way through.
+    Time::Time_t t0 = Time::getUTC();
+    CPPUNIT_ASSERT(fifo.timed_put_n(in, 7, 10000000) == 5);
+    CPPUNIT_ASSERT(Time::getUTC() - t0 >= 10000000);
+    CPPUNIT_ASSERT(fifo.size() == 5);
+
+    // conflation leaves only the latest value.
+    CPPUNIT_ASSERT(fifo.put_latest(42) == 5);
+    CPPUNIT_ASSERT(fifo.put_latest(43) == 1);
+    CPPUNIT_ASSERT(fifo.size() == 1);
+    CPPUNIT_ASSERT(fifo.try_get(out[0]) && out[0] == 43);
+    CPPUNIT_ASSERT(!fifo.try_get(out[0]));
+}
+
+void TSemfifoTest::test_ring_fifo()
+{
+    int in[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9}, out[10];
+    spsc_fifo<int> fifo(6);    // rounded up to 8
+
+    CPPUNIT_ASSERT(fifo.capacity() == 8);
+    CPPUNIT_ASSERT(fifo.put_n(in, 5) == 5);
+    CPPUNIT_ASSERT(fifo.size() == 5);
+    CPPUNIT_ASSERT(fifo.try_get(out[0]) && out[0] == 0);
+    CPPUNIT_ASSERT(fifo.get_n(out, 10, 0) == 4);
+    CPPUNIT_ASSERT(out[0] == 1 && out[3] == 4);
+    CPPUNIT_ASSERT(!fifo.timed_get(out[0], 1000000));
+
+    // full: the incoming entries are the ones dropped.
+    CPPUNIT_ASSERT(fifo.put_n_no_block(in, 10) == 2);
+    CPPUNIT_ASSERT(!fifo.try_put(10));
+    CPPUNIT_ASSERT(!fifo.timed_put(10, 1000000));
+    CPPUNIT_ASSERT(fifo.flush(-3) == 3);
+    CPPUNIT_ASSERT(fifo.get_n(out, 10, 0) == 3);
+    CPPUNIT_ASSERT(out[0] == 5 && out[2] == 7);
+
+    // a blocked get is woken by a put from another thread.
+    mpsc_fifo<int> mfifo(4);
+    std::thread t([&mfifo]() {mfifo.put(42);});
+    CPPUNIT_ASSERT(mfifo.get(out[0]) && out[0] == 42);
+    t.join();
+}
+
+/**
+ * Tests that once the buffers in a sink's queue have grown to the
+ * message size, moving GenericBuffers and strings from the transport
+ * through the queue to the consumer allocates no memory.
+ *
+ */
+
+void TSemfifoTest::test_recycling()
+{
+    unsigned char msg[1024];
+    overflow_policy policy(overflow_policy::BLOCK);
+    tsemfifo<GenericBuffer> fifo(8);
+    GenericBuffer spare, out;
+    tsemfifo<string> sfifo(8);
+    string sspare, sout;
+
+    for (size_t i = 0; i < sizeof(msg); ++i)
+    {
+        msg[i] = (unsigned char)i;
+    }
+
+    // warm up: every slot, and the spares, get a buffer.
+    for (int i = 0; i < 20; ++i)
+    {
+        dspub::_data_handler(msg, sizeof(msg), fifo, spare, policy);
+        fifo.get(out);
+        dspub::_data_handler(msg, sizeof(msg), sfifo, sspare, policy);
+        sfifo.get(sout);
+    }
+
+    allocations = 0;
+    count_allocations = true;
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        msg[0] = (unsigned char)i;
+        dspub::_data_handler(msg, sizeof(msg), fifo, spare, policy);
+        fifo.get(out);
+        dspub::_data_handler(msg, sizeof(msg), sfifo, sspare, policy);
+        sfifo.get(sout);
+    }
+
+    count_allocations = false;
+    CPPUNIT_ASSERT(allocations == 0);
+    CPPUNIT_ASSERT(out.size() == sizeof(msg) && out.data()[0] == (unsigned char)999);
+    CPPUNIT_ASSERT(sout.size() == sizeof(msg) && (unsigned char)sout[1023] == msg[1023]);
+}
@@ -36,12 +36,20 @@ class TSemfifoTest : public CppUnit::TestCase
     CPPUNIT_TEST(test_size);
     CPPUNIT_TEST(test_get);
     CPPUNIT_TEST(test_flush);
+    CPPUNIT_TEST(test_batch);
+    CPPUNIT_TEST(test_overflow);
+    CPPUNIT_TEST(test_ring_fifo);
+    CPPUNIT_TEST(test_recycling);
     CPPUNIT_TEST_SUITE_END();
     
     public:
     void test_size();
     void test_get();
     void test_flush();
+    void test_batch();
+    void test_overflow();
+    void test_ring_fifo();
+    void test_recycling();
 
 };
 
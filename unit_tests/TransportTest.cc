@@ -28,6 +28,9 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <cstring>
 #include <yaml-cpp/yaml.h>
 #include <boost/shared_ptr.hpp>
 
@@ -37,6 +40,8 @@
 #include "TransportTest.h"
 #include "matrix/TCondition.h"
 #include "matrix/DataInterface.h"
+#include "matrix/ShmTransportClient.h"
+#include "matrix/RTTransportClient.h"
 
 using namespace std;
 using namespace mxutils;
@@ -49,6 +54,7 @@ static std::string yaml_configuration =
     "  URLS:\n"\
     "    Initial:\n"\
     "      - inproc://interface_tests.keymaster\n"\
+    "  clone_interval: 1000\n"\
     "\n"\
     "components:\n"\
     "  moby_dick:\n"\
@@ -206,3 +212,367 @@ void TransportTest::test_rtinproc_publish()
 {
     do_the_transaction("rtinproc");
 }
+
+void TransportTest::test_shm_publish()
+{
+    do_the_transaction("shm");
+}
+
+// Counts the messages it gets, and checks that each is still intact
+// after taking 'delay' microseconds over it.
+struct ShmCounter : public DataCallbackBase
+{
+    ShmCounter(int delay) : received(0), corrupted(0), _delay(delay) {}
+
+    std::atomic<int> received;
+    std::atomic<int> corrupted;
+
+private:
+    void _call(string, void *val, size_t sze)
+    {
+        unsigned char *p = (unsigned char *)val;
+        ++received;
+        do_nanosleep(0, _delay * 1000);
+
+        for (size_t i = 0; i < sze; ++i)
+        {
+            if (p[i] != p[0])
+            {
+                ++corrupted;
+                break;
+            }
+        }
+    }
+
+    int _delay;
+};
+
+void TransportTest::test_shm_slow_client()
+{
+    const int messages = 2000;
+    vector<string> tr = {"shm"};
+    _km->put("components.moby_dick.Transports.A.Specified", tr);
+    _km->put("components.moby_dick.Transports.A.BufferSize", 16384, true);
+
+    shared_ptr<TransportServer> server =
+        TransportServer::get_transport(km_urn, "moby_dick", "A");
+    string urn = _km->get_as<vector<string> >("components.moby_dick.Transports.A.AsConfigured")[0];
+
+    // the slow client falls a ring behind almost at once. It must be
+    // evicted rather than hold up the server and the fast client, and
+    // the message it is reading must not be overwritten under it.
+    ShmTransportClient fast(urn), slow(urn);
+    ShmCounter fast_cb(0), slow_cb(10000);
+    CPPUNIT_ASSERT(fast.connect());
+    CPPUNIT_ASSERT(slow.connect());
+    fast.subscribe("lines", &fast_cb);
+    slow.subscribe("lines", &slow_cb);
+
+    vector<unsigned char> buf(1000);
+    int published = 0;
+
+    for (int i = 0; i < messages; ++i)
+    {
+        size_t size = 1 + (i * 37) % buf.size();
+        memset(buf.data(), i & 0xff, size);
+        published += server->publish("lines", buf.data(), size);
+        do_nanosleep(0, 20000);
+    }
+
+    for (int i = 0; fast_cb.received < published && i < 100; ++i)
+    {
+        do_nanosleep(0, 10000000);
+    }
+
+    CPPUNIT_ASSERT_EQUAL(messages, published);
+    CPPUNIT_ASSERT_EQUAL(published, fast_cb.received.load());
+    CPPUNIT_ASSERT(slow_cb.received < published);
+    CPPUNIT_ASSERT_EQUAL(0, fast_cb.corrupted.load());
+    CPPUNIT_ASSERT_EQUAL(0, slow_cb.corrupted.load());
+
+    fast.disconnect();
+    slow.disconnect();
+    server.reset();
+    TransportServer::release_transport("moby_dick", "A");
+}
+
+void TransportTest::test_rtinproc_shared_buffer()
+{
+    vector<string> tr = {"rtinproc"};
+    _km->put("components.moby_dick.Transports.A.Specified", tr);
+
+    shared_ptr<DataSource<SharedBuffer> > source(
+        new DataSource<SharedBuffer>(km_urn, "moby_dick", "lines"));
+    shared_ptr<DataSink<SharedBuffer, select_only> > sink1(
+        new DataSink<SharedBuffer, select_only>(km_urn));
+    shared_ptr<DataSink<SharedBuffer, select_only> > sink2(
+        new DataSink<SharedBuffer, select_only>(km_urn));
+    sink1->connect("moby_dick", "lines");
+    sink2->connect("moby_dick", "lines");
+
+    string text = "Call me Ishmael.";
+    SharedBuffer sent(vector<unsigned char>(text.begin(), text.end()));
+    SharedBuffer recv1, recv2;
+    source->publish(sent);
+
+    CPPUNIT_ASSERT(sink1->timed_get(recv1, 100000000));
+    CPPUNIT_ASSERT(sink2->timed_get(recv2, 100000000));
+
+    // both sinks hold the very block that was published.
+    CPPUNIT_ASSERT(recv1.data() == sent.data());
+    CPPUNIT_ASSERT(recv2.data() == sent.data());
+    CPPUNIT_ASSERT_EQUAL(sent.size(), recv1.size());
+    CPPUNIT_ASSERT_EQUAL(3L, sent.use_count());
+
+    sink1->disconnect();
+    sink2->disconnect();
+}
+
+// Counts the messages it gets, and disconnects its client on the
+// first one if it has been given a client.
+struct RTDisconnecter : public DataCallbackBase
+{
+    RTDisconnecter(TransportClient *c) : received(0), _client(c) {}
+
+    int received;
+
+private:
+    void _call(string, void *, size_t)
+    {
+        if (++received == 1 && _client)
+        {
+            _client->disconnect();
+        }
+    }
+
+    TransportClient *_client;
+};
+
+void TransportTest::test_rtinproc_unsubscribe_in_callback()
+{
+    vector<string> tr = {"rtinproc"};
+    _km->put("components.moby_dick.Transports.A.Specified", tr);
+
+    shared_ptr<TransportServer> server =
+        TransportServer::get_transport(km_urn, "moby_dick", "A");
+    string urn = _km->get_as<vector<string> >("components.moby_dick.Transports.A.AsConfigured")[0];
+
+    // the first callback removes the topic, second one included, from
+    // inside the publish. The publish must neither wait for itself nor
+    // call the second callback.
+    RTTransportClient c1(urn), c2(urn);
+    RTDisconnecter cb1(&c1), cb2(NULL);
+    c1.subscribe("moby_dick.lines", &cb1);
+    c2.subscribe("moby_dick.lines", &cb2);
+
+    std::atomic<bool> done(false);
+    std::thread publisher([&]()
+    {
+        server->publish("moby_dick.lines", "Call me Ishmael.");
+        done = true;
+    });
+
+    for (int i = 0; !done && i < 100; ++i)
+    {
+        do_nanosleep(0, 10000000);
+    }
+
+    if (!done)
+    {
+        publisher.detach();
+        CPPUNIT_FAIL("publish() did not return");
+    }
+
+    publisher.join();
+    CPPUNIT_ASSERT_EQUAL(1, cb1.received);
+    CPPUNIT_ASSERT_EQUAL(0, cb2.received);
+    CPPUNIT_ASSERT(!server->publish("moby_dick.lines", "Call me Ishmael."));
+
+    server.reset();
+    TransportServer::release_transport("moby_dick", "A");
+}
+
+void TransportTest::test_inproc_shared_buffer()
+{
+    const int batches = 3, per_batch = 8;
+    vector<string> tr = {"inproc"};
+    _km->put("components.moby_dick.Transports.A.Specified", tr);
+
+    shared_ptr<DataSource<SharedBuffer> > source(
+        new DataSource<SharedBuffer>(km_urn, "moby_dick", "lines"));
+    shared_ptr<DataSink<SharedBuffer, select_only> > sink(
+        new DataSink<SharedBuffer, select_only>(km_urn, per_batch, true));
+    sink->connect("moby_dick", "lines");
+    do_nanosleep(0, 1000000);
+
+    // the sink's buffers are the ZMQ messages themselves. Those still
+    // held must not be reused for, or overwritten by, later ones.
+    vector<string> sent;
+    vector<SharedBuffer> held;
+
+    for (int b = 0; b < batches; ++b)
+    {
+        for (int i = 0; i < per_batch; ++i)
+        {
+            string text = "message " + to_string(b * per_batch + i)
+                + string(i * 10, 'a' + b);
+            SharedBuffer buf(vector<unsigned char>(text.begin(), text.end()));
+
+            sent.push_back(text);
+            source->publish(buf);
+        }
+
+        // the whole batch is queued before any of it is taken.
+        for (int i = 0; i < 100 && sink->items() < (size_t)per_batch; ++i)
+        {
+            do_nanosleep(0, 1000000);
+        }
+
+        CPPUNIT_ASSERT_EQUAL((size_t)per_batch, sink->items());
+
+        for (int i = 0; i < per_batch; ++i)
+        {
+            SharedBuffer recv;
+
+            CPPUNIT_ASSERT(sink->timed_get(recv, 100000000));
+            held.push_back(recv);
+        }
+    }
+
+    CPPUNIT_ASSERT_EQUAL(sent.size(), held.size());
+
+    for (size_t i = 0; i < held.size(); ++i)
+    {
+        CPPUNIT_ASSERT_EQUAL(sent[i], string((char const *)held[i].data(), held[i].size()));
+
+        for (size_t j = 0; j < i; ++j)
+        {
+            CPPUNIT_ASSERT(held[i].data() != held[j].data());
+        }
+    }
+
+    sink->disconnect();
+}
+
+void TransportTest::test_send_queue()
+{
+    const int producers = 4, messages = 200;
+    vector<string> tr = {"inproc"};
+    _km->put("components.moby_dick.Transports.A.Specified", tr);
+    _km->put("components.moby_dick.Transports.A.SendQueue", 64, true);
+
+    // every DataSource of 'lines' shares the one transport, and so its
+    // socket; the send queue is what makes publishing from several
+    // threads at once safe.
+    vector<shared_ptr<DataSource<double> > > sources;
+
+    for (int i = 0; i < producers; ++i)
+    {
+        sources.push_back(shared_ptr<DataSource<double> >(
+                              new DataSource<double>(km_urn, "moby_dick", "lines")));
+    }
+
+    shared_ptr<DataSink<double, select_only> > sink(
+        new DataSink<double, select_only>(km_urn, producers * messages, true));
+    sink->connect("moby_dick", "lines");
+    do_nanosleep(0, 1000000);
+
+    vector<thread> threads;
+
+    for (int i = 0; i < producers; ++i)
+    {
+        threads.push_back(thread([&sources, i, messages]()
+                                 {
+                                     for (int j = 0; j < messages; ++j)
+                                     {
+                                         double d = j;
+                                         sources[i]->publish(d);
+                                     }
+                                 }));
+    }
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+
+    shared_ptr<TransportServer> ts =
+        TransportServer::get_transport(km_urn, "moby_dick", "A");
+    size_t expected = producers * messages - ts->dropped();
+    size_t received = 0;
+    double d;
+
+    while (received < expected && sink->timed_get(d, 100000000))
+    {
+        ++received;
+    }
+
+    CPPUNIT_ASSERT_EQUAL(expected, received);
+    CPPUNIT_ASSERT_EQUAL((size_t)0, ts->queue_depth());
+
+    ts.reset();
+    TransportServer::release_transport("moby_dick", "A");
+    sink->disconnect();
+}
+
+void TransportTest::test_socket_options()
+{
+    vector<string> tr = {"inproc"};
+    _km->put("components.moby_dick.Transports.A.Specified", tr);
+    YAML::Node opts = YAML::Load("{SNDHWM: 10000, RCVHWM: 10000, CONFLATE: true}");
+    _km->put("components.moby_dick.Transports.A.SocketOptions", opts, true);
+
+    // with CONFLATE the message goes out as one frame, header and
+    // data together, and the sink keeps only the latest.
+    shared_ptr<DataSource<double> > source(new DataSource<double>(km_urn, "moby_dick", "lines"));
+    shared_ptr<DataSink<double, select_only> > sink(new DataSink<double, select_only>(km_urn));
+    sink->connect("moby_dick", "lines");
+    do_nanosleep(0, 1000000);
+
+    double sent = 2.71828, recv = 0.0;
+    source->publish(sent);
+    CPPUNIT_ASSERT(sink->timed_get(recv, 100000000));
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(sent, recv, 0.000001);
+
+    sink->disconnect();
+}
+
+void TransportTest::test_poller()
+{
+    vector<string> tr = {"rtinproc"};
+    _km->put("components.moby_dick.Transports.A.Specified", tr);
+
+    shared_ptr<DataSource<double> > source(new DataSource<double>(km_urn, "moby_dick", "lines"));
+    DataSink<double, select_only> sink1(km_urn), sink2(km_urn);
+    sink1.connect("moby_dick", "lines");
+    sink2.connect("moby_dick", "lines");
+
+    poller p;
+    vector<size_t> ready;
+    double d;
+    CPPUNIT_ASSERT_EQUAL((size_t)0, p.push_back(&sink1));
+    CPPUNIT_ASSERT_EQUAL((size_t)1, p.push_back(&sink2));
+    CPPUNIT_ASSERT_EQUAL((size_t)0, p.wait(ready, 1000));
+
+    // rtinproc delivers synchronously, so both are ready at once.
+    d = 1.0;
+    source->publish(d);
+    CPPUNIT_ASSERT_EQUAL((size_t)2, p.wait(ready, 100000));
+    CPPUNIT_ASSERT(ready[0] == 0 && ready[1] == 1);
+    CPPUNIT_ASSERT(p.all_of(1000));
+
+    // a sink with data left over stays ready without a new signal.
+    CPPUNIT_ASSERT(sink1.try_get(d));
+    CPPUNIT_ASSERT_EQUAL((size_t)1, p.wait(ready, 100000));
+    CPPUNIT_ASSERT_EQUAL((size_t)1, ready[0]);
+    CPPUNIT_ASSERT(sink2.try_get(d));
+    CPPUNIT_ASSERT(!p.any_of(1000));
+
+    // and a drained sink is signalled again by the next arrival.
+    source->publish(d);
+    CPPUNIT_ASSERT(p.any_of(100000));
+    CPPUNIT_ASSERT_EQUAL((size_t)2, p.wait(ready, 0));
+
+    sink1.disconnect();
+    sink2.disconnect();
+}
@@ -44,6 +44,14 @@ class TransportTest : public CppUnit::TestCase
     CPPUNIT_TEST(test_ipc_publish);
     CPPUNIT_TEST(test_tcp_publish);
     CPPUNIT_TEST(test_rtinproc_publish);
+    CPPUNIT_TEST(test_shm_publish);
+    CPPUNIT_TEST(test_shm_slow_client);
+    CPPUNIT_TEST(test_rtinproc_shared_buffer);
+    CPPUNIT_TEST(test_rtinproc_unsubscribe_in_callback);
+    CPPUNIT_TEST(test_inproc_shared_buffer);
+    CPPUNIT_TEST(test_send_queue);
+    CPPUNIT_TEST(test_socket_options);
+    CPPUNIT_TEST(test_poller);
     CPPUNIT_TEST_SUITE_END();
 
     std::shared_ptr<matrix::KeymasterServer> _kms;
@@ -61,6 +69,14 @@ public:
     void test_ipc_publish();
     void test_tcp_publish();
     void test_rtinproc_publish();
+    void test_shm_publish();
+    void test_shm_slow_client();
+    void test_rtinproc_shared_buffer();
+    void test_rtinproc_unsubscribe_in_callback();
+    void test_inproc_shared_buffer();
+    void test_send_queue();
+    void test_socket_options();
+    void test_poller();
 };
 
 #endif
@@ -36,6 +36,7 @@
 #include "matrix/zmq_util.h"
 #include "keymaster_test.h"
 #include "matrix/TCondition.h"
+#include "matrix/ThreadLock.h"
 #include "matrix/Time.h"
 
 using namespace std;
@@ -45,7 +46,10 @@ using namespace matrix;
 std::string keymaster_url = "inproc://matrix.keymaster";
 std::string tcp_keymaster_url = "tcp://ajax:42000";
 
-void KeymasterTest::test_keymaster()
+// The Keymaster tests are run once with the client speaking YAML to
+// the server, and once with it speaking msgpack.
+
+static void keymaster_test(bool msgpack)
 {
     yaml_result r;
     boost::shared_ptr<KeymasterServer> km_server;
@@ -55,7 +59,7 @@ void KeymasterTest::test_keymaster()
         km_server->run();
         );
 
-    Keymaster km(keymaster_url);
+    Keymaster km(keymaster_url, false, msgpack);
     // get a value as a YAML::Node
     YAML::Node n;
     CPPUNIT_ASSERT_NO_THROW(n = km.get("components.nettask.source.URLs"));
@@ -110,6 +114,16 @@ void KeymasterTest::test_keymaster()
     CPPUNIT_ASSERT(r.err.empty());
 }
 
+void KeymasterTest::test_keymaster()
+{
+    keymaster_test(false);
+}
+
+void KeymasterTest::test_keymaster_msgpack()
+{
+    keymaster_test(true);
+}
+
 template <typename T>
 struct MyCallback : public KeymasterCallbackBase
 {
@@ -129,7 +143,8 @@ private:
 class Foo
 {
 public:
-    Foo(string url) : data(0), my_cb(this, &Foo::bar), km(url)
+    Foo(string url, bool msgpack = false)
+        : data(0), my_cb(this, &Foo::bar), km(url, false, msgpack)
     {
         km.subscribe("foo.bar", &my_cb);
         Time::thread_delay(1000000); // 1mS; allow things to sync
@@ -158,7 +173,7 @@ private:
 
 };
 
-void KeymasterTest::test_keymaster_publisher()
+static void keymaster_publisher_test(bool msgpack)
 {
     yaml_result r;
     boost::shared_ptr<KeymasterServer> km_server;
@@ -168,7 +183,7 @@ void KeymasterTest::test_keymaster_publisher()
         km_server->run();
         );
 
-    Keymaster km(keymaster_url);
+    Keymaster km(keymaster_url, false, msgpack);
 
     // first kind of callback: a custom callback based on
     // KeymasterCallbackBase.
@@ -177,10 +192,12 @@ void KeymasterTest::test_keymaster_publisher()
 
     km.subscribe("components.nettask.source.ID", &cb);
 
-    // Put a new value into the keymaster
+    // Put a new value into the keymaster. The server holds back its
+    // publications for its first 2 seconds, so that clients may
+    // reconnect after a restart; this one must not be lost.
     km.put("components.nettask.source.ID", 1234, true);
 
-    CPPUNIT_ASSERT(cb.data.wait(1234, 100000));
+    CPPUNIT_ASSERT(cb.data.wait(1234, 3000000));
 
     // Replace an existing value in the keymaster
     km.put("components.nettask.source.ID", 9999);
@@ -191,8 +208,293 @@ void KeymasterTest::test_keymaster_publisher()
     // a callback, using the KeymasterMemberCB<T> class to enclose
     // it. Foo creates its own keymaster client, given a keymaster URL,
     // just as a component would do.
-    Foo foo(keymaster_url);
+    Foo foo(keymaster_url, msgpack);
     foo.put(5);
     cout << "Testing publisher" << endl;
     CPPUNIT_ASSERT(foo.get_data(5) == 5);
 }
+
+void KeymasterTest::test_keymaster_publisher()
+{
+    keymaster_publisher_test(false);
+}
+
+void KeymasterTest::test_keymaster_publisher_msgpack()
+{
+    keymaster_publisher_test(true);
+}
+
+// Signals the 'ID' found in the published subtree, or -1 if there is
+// none.
+struct IDCallback : public KeymasterCallbackBase
+{
+    IDCallback()
+    : id(0)
+    {}
+
+    TCondition<int> id;
+
+private:
+    void _call(string key, YAML::Node val)
+    {
+        id.signal(val["ID"] ? val["ID"].as<int>() : -1);
+    }
+};
+
+static void keymaster_subscriptions_test(bool msgpack)
+{
+    boost::shared_ptr<KeymasterServer> km_server;
+
+    CPPUNIT_ASSERT_NO_THROW(
+        km_server.reset(new KeymasterServer("test.yaml"));
+        km_server->run();
+        );
+
+    // Wait out the server's startup delay, after which it only
+    // publishes to the prefixes that have subscribers.
+    Time::thread_delay(2500000000);
+
+    Keymaster km(keymaster_url, false, msgpack);
+    IDCallback source, gputask;
+
+    km.subscribe("components.nettask.source", &source);
+    km.subscribe("components.gputask", &gputask);
+    Time::thread_delay(100000000);
+
+    // Changes beneath the subscribed prefix publish its whole
+    // subtree. Each must be serialized afresh, not taken from the
+    // cache of the previous one.
+    km.put("components.nettask.source.ID", 1234, true);
+    CPPUNIT_ASSERT(source.id.wait(1234, 1000000));
+
+    km.put("components.nettask.source.ID", 9999);
+    CPPUNIT_ASSERT(source.id.wait(9999, 1000000));
+
+    km.del("components.nettask.source.ID");
+    CPPUNIT_ASSERT(source.id.wait(-1, 1000000));
+
+    // No change was made beneath the other one.
+    CPPUNIT_ASSERT(gputask.id.value() == 0);
+}
+
+void KeymasterTest::test_keymaster_subscriptions()
+{
+    keymaster_subscriptions_test(false);
+}
+
+void KeymasterTest::test_keymaster_subscriptions_msgpack()
+{
+    keymaster_subscriptions_test(true);
+}
+
+// Compares two YAML trees by content, ignoring node style and the
+// order of map keys.
+static bool same_yaml(YAML::Node const &a, YAML::Node const &b)
+{
+    if (a.Type() != b.Type())
+    {
+        return false;
+    }
+
+    if (a.IsScalar())
+    {
+        return a.Scalar() == b.Scalar();
+    }
+
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+
+    if (a.IsSequence())
+    {
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            if (!same_yaml(a[i], b[i]))
+            {
+                return false;
+            }
+        }
+    }
+    else if (a.IsMap())
+    {
+        for (YAML::const_iterator i = a.begin(); i != a.end(); ++i)
+        {
+            string k = i->first.as<string>();
+
+            if (!b[k] || !same_yaml(i->second, b[k]))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// A delta as the keymaster publishes it.
+static YAML::Node delta(uint64_t seq, string key, string op,
+                        YAML::Node value = YAML::Node())
+{
+    YAML::Node d;
+
+    d["seq"] = seq;
+    d["key"] = key;
+    d["op"] = op;
+
+    if (op == "put")
+    {
+        d["value"] = value;
+    }
+
+    return d;
+}
+
+void KeymasterTest::test_keymaster_merge_delta()
+{
+    boost::shared_ptr<KeymasterServer> km_server;
+
+    CPPUNIT_ASSERT_NO_THROW(
+        km_server.reset(new KeymasterServer("test.yaml"));
+        km_server->run();
+        );
+
+    Keymaster km(keymaster_url);
+    Keymaster::delta_cache dc;
+    string keychain("components.nettask");
+    string id("components.nettask.source.ID");
+    YAML::Node value;
+
+    // The first delta finds the cache out of sync, and syncs it with
+    // the keymaster instead of being merged.
+    CPPUNIT_ASSERT(km._merge_delta(keychain, dc, delta(1, id, "put", YAML::Node(1))));
+    CPPUNIT_ASSERT(dc.synced);
+    CPPUNIT_ASSERT(same_yaml(dc.tree, km.get(keychain)));
+    CPPUNIT_ASSERT(!get_yaml_node(dc.tree, "source.ID").result);
+    uint64_t seq = dc.seq;
+
+    // in order: put beneath the subscription's keychain
+    CPPUNIT_ASSERT(km._merge_delta(keychain, dc, delta(seq + 1, id, "put", YAML::Node(1234))));
+    CPPUNIT_ASSERT(dc.seq == seq + 1);
+    CPPUNIT_ASSERT(get_yaml_node(dc.tree, "source.ID").node.as<int>() == 1234);
+
+    // a duplicate, and an older delta, are ignored
+    CPPUNIT_ASSERT(!km._merge_delta(keychain, dc, delta(seq + 1, id, "put", YAML::Node(5678))));
+    CPPUNIT_ASSERT(!km._merge_delta(keychain, dc, delta(seq, id, "del")));
+    CPPUNIT_ASSERT(dc.seq == seq + 1);
+    CPPUNIT_ASSERT(get_yaml_node(dc.tree, "source.ID").node.as<int>() == 1234);
+
+    // del beneath
+    CPPUNIT_ASSERT(km._merge_delta(keychain, dc, delta(seq + 2, id, "del")));
+    CPPUNIT_ASSERT(!get_yaml_node(dc.tree, "source.ID").result);
+    CPPUNIT_ASSERT(get_yaml_node(dc.tree, "source.URLs").result);
+
+    // put at the keychain itself replaces the whole tree
+    value["ID"] = 42;
+    CPPUNIT_ASSERT(km._merge_delta(keychain, dc, delta(seq + 3, keychain, "put", value)));
+    CPPUNIT_ASSERT(same_yaml(dc.tree, value));
+
+    // del at the keychain itself empties it; a later put beneath
+    // starts a new tree.
+    CPPUNIT_ASSERT(km._merge_delta(keychain, dc, delta(seq + 4, keychain, "del")));
+    CPPUNIT_ASSERT(dc.tree.IsNull());
+    CPPUNIT_ASSERT(km._merge_delta(keychain, dc, delta(seq + 5, id, "put", YAML::Node(7))));
+    CPPUNIT_ASSERT(get_yaml_node(dc.tree, "source.ID").node.as<int>() == 7);
+
+    // a gap: seq + 6 was missed. The cache is synced again, and now
+    // agrees with the keymaster, not with the deltas above.
+    CPPUNIT_ASSERT(km._merge_delta(keychain, dc, delta(seq + 7, id, "put", YAML::Node(8))));
+    CPPUNIT_ASSERT(dc.synced);
+    CPPUNIT_ASSERT(same_yaml(dc.tree, km.get(keychain)));
+    CPPUNIT_ASSERT(!get_yaml_node(dc.tree, "source.ID").result);
+}
+
+// Keeps the last tree given to it by a delta subscription.
+struct TreeCallback : public KeymasterCallbackBase
+{
+    YAML::Node tree()
+    {
+        ThreadLock<Mutex> l(_lock);
+        l.lock();
+        return YAML::Clone(_tree);
+    }
+
+    // Waits up to a second for the tree to agree with 'expected'.
+    bool wait_for(YAML::Node expected)
+    {
+        for (int i = 0; i < 100; ++i)
+        {
+            if (same_yaml(tree(), expected))
+            {
+                return true;
+            }
+
+            Time::thread_delay(10000000);
+        }
+
+        return false;
+    }
+
+private:
+    void _call(string key, YAML::Node val)
+    {
+        ThreadLock<Mutex> l(_lock);
+        l.lock();
+        _tree.reset(val);
+    }
+
+    Mutex _lock;
+    YAML::Node _tree;
+};
+
+static void keymaster_delta_test(bool msgpack)
+{
+    boost::shared_ptr<KeymasterServer> km_server;
+
+    CPPUNIT_ASSERT_NO_THROW(
+        km_server.reset(new KeymasterServer("test.yaml"));
+        km_server->run();
+        );
+
+    // Wait out the server's startup delay.
+    Time::thread_delay(2500000000);
+
+    Keymaster km(keymaster_url, false, msgpack);
+    TreeCallback cb;
+    string key("components.nettask");
+
+    km.subscribe(key, &cb, true);
+    Time::thread_delay(100000000);
+
+    // Each change beneath the key is merged into the client's tree,
+    // which the callback receives whole.
+    km.put("components.nettask.source.ID", 1234, true);
+    CPPUNIT_ASSERT(cb.wait_for(km.get(key)));
+    CPPUNIT_ASSERT(cb.tree()["source"]["ID"].as<int>() == 1234);
+
+    km.put("components.nettask.source.ID", 9999);
+    CPPUNIT_ASSERT(cb.wait_for(km.get(key)));
+    CPPUNIT_ASSERT(cb.tree()["source"]["ID"].as<int>() == 9999);
+
+    km.put("components.nettask.sink.B", "inproc", true);
+    CPPUNIT_ASSERT(cb.wait_for(km.get(key)));
+    CPPUNIT_ASSERT(cb.tree()["sink"]["B"].as<string>() == "inproc");
+
+    km.del("components.nettask.source.ID");
+    CPPUNIT_ASSERT(cb.wait_for(km.get(key)));
+    CPPUNIT_ASSERT(!cb.tree()["source"]["ID"]);
+
+    km.del("components.nettask.sink");
+    CPPUNIT_ASSERT(cb.wait_for(km.get(key)));
+    CPPUNIT_ASSERT(!cb.tree()["sink"]);
+}
+
+void KeymasterTest::test_keymaster_delta()
+{
+    keymaster_delta_test(false);
+}
+
+void KeymasterTest::test_keymaster_delta_msgpack()
+{
+    keymaster_delta_test(true);
+}
@@ -34,13 +34,27 @@ class KeymasterTest : public CppUnit::TestCase
 {
     CPPUNIT_TEST_SUITE(KeymasterTest);
     CPPUNIT_TEST(test_keymaster);
+    CPPUNIT_TEST(test_keymaster_msgpack);
     CPPUNIT_TEST(test_keymaster_publisher);
+    CPPUNIT_TEST(test_keymaster_publisher_msgpack);
+    CPPUNIT_TEST(test_keymaster_subscriptions);
+    CPPUNIT_TEST(test_keymaster_subscriptions_msgpack);
+    CPPUNIT_TEST(test_keymaster_merge_delta);
+    CPPUNIT_TEST(test_keymaster_delta);
+    CPPUNIT_TEST(test_keymaster_delta_msgpack);
 
     CPPUNIT_TEST_SUITE_END();
 
 public:
     void test_keymaster();
+    void test_keymaster_msgpack();
     void test_keymaster_publisher();
+    void test_keymaster_publisher_msgpack();
+    void test_keymaster_subscriptions();
+    void test_keymaster_subscriptions_msgpack();
+    void test_keymaster_merge_delta();
+    void test_keymaster_delta();
+    void test_keymaster_delta_msgpack();
 };
 
 #endif
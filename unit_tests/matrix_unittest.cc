@@ -36,6 +36,7 @@
 #include "matrix/ZMQContext.h"
 #include "ResourceLockTest.h"
 #include "log_t_test.h"
+#include "SloggerTest.h"
 
 using namespace std;
 using namespace matrix;
@@ -54,6 +55,7 @@ int main(int argc, char **argv)
 //    runner.addTest(TransportTest::suite());
     runner.addTest(TSemfifoTest::suite());
     runner.addTest(log_tTest::suite());
+    runner.addTest(SloggerTest::suite());
     runner.run();
 
     return 0;
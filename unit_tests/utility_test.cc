@@ -27,8 +27,22 @@
 
 #include "utility_test.h"
 #include "matrix/yaml_util.h"
-
+#include "matrix/yaml_msgpack.h"
+#include "matrix/TopicRegistry.h"
+#include "matrix/SharedBuffer.h"
+#include "matrix/GenericBuffer.h"
+#include "matrix/matrix_util.h"
+#include "CaptureFile.h"
+#include "FileDataSource.h"
+#include "matrix/Keymaster.h"
+#include "matrix/DataSink.h"
+
+#include <cstddef>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 using namespace std;
@@ -162,3 +176,556 @@ void UtilityTest::test_delete_yaml_node()
     // this node should be gone now
     CPPUNIT_ASSERT(!node["components"]["foocomponent"]["sources"]);
 }
+
+void UtilityTest::test_yaml_index()
+{
+    YAML::Node node = create_sample_yaml_node();
+    yaml_index idx(node);
+    yaml_result r;
+
+    r = idx.get("components.foocomponent.ID");
+    CPPUNIT_ASSERT(r.result);
+    CPPUNIT_ASSERT(r.key == "components.foocomponent.ID");
+    CPPUNIT_ASSERT(r.node.as<int>() == 0x1234);
+
+    // failures are reported as get_yaml_node() reports them
+    r = idx.get("components.foocomponent.IB");
+    CPPUNIT_ASSERT(!r.result);
+    CPPUNIT_ASSERT(r.key == "components.foocomponent");
+
+    // repeated puts through the indexed node all reach the tree
+    for (int i = 0; i < 3; ++i)
+    {
+        r = idx.put("components.foocomponent.ID", YAML::Node(i));
+        CPPUNIT_ASSERT(r.result);
+        CPPUNIT_ASSERT(node["components"]["foocomponent"]["ID"].as<int>() == i);
+        CPPUNIT_ASSERT(idx.get("components.foocomponent.ID").node.as<int>() == i);
+    }
+
+    // replacing a map drops what was indexed beneath it, and only that
+    CPPUNIT_ASSERT(idx.get("components.foocomponent.sources.A").result);
+    CPPUNIT_ASSERT(idx.put("components.foocomponent-b.ID", YAML::Node(1), true).result);
+    size_t indexed = idx.size();
+    r = idx.put("components.foocomponent", YAML::Load("{ID: 7}"));
+    CPPUNIT_ASSERT(r.result);
+    // ID, sources and sources.A
+    CPPUNIT_ASSERT_EQUAL(indexed - 3, idx.size());
+    CPPUNIT_ASSERT(!idx.get("components.foocomponent.sources.A").result);
+    CPPUNIT_ASSERT(idx.get("components.foocomponent.ID").node.as<int>() == 7);
+
+    // create, then delete
+    r = idx.put("components.barcomponent.status", YAML::Node("running"), true);
+    CPPUNIT_ASSERT(r.result);
+    CPPUNIT_ASSERT(node["components"]["barcomponent"]["status"].as<string>() == "running");
+
+    r = idx.del("components.barcomponent");
+    CPPUNIT_ASSERT(r.result);
+    CPPUNIT_ASSERT(r.key == "components");
+    CPPUNIT_ASSERT(!node["components"]["barcomponent"]);
+    CPPUNIT_ASSERT(!idx.get("components.barcomponent.status").result);
+    CPPUNIT_ASSERT(!idx.del("components.barcomponent").result);
+}
+
+void UtilityTest::test_yaml_msgpack()
+{
+    YAML::Node node = create_sample_yaml_node();
+    node["components"]["foocomponent"]["nothing"] = YAML::Node(YAML::NodeType::Null);
+    string packed = yaml_to_msgpack(node);
+    YAML::Node n = msgpack_to_yaml(packed.data(), packed.size());
+
+    // the round trip preserves the tree, and the scalars' text (but
+    // not YAML's flow or block style)
+    CPPUNIT_ASSERT(yaml_to_msgpack(n) == packed);
+    CPPUNIT_ASSERT(n["components"]["foocomponent"]["sources"]["B"][2].as<string>() == "inproc");
+    CPPUNIT_ASSERT(n["components"]["foocomponent"]["ID"].as<int>() == 0x1234);
+    CPPUNIT_ASSERT(n["components"]["foocomponent"]["nothing"].IsNull());
+
+    yaml_result yr(false, node["components"], "components", "oops"), r;
+    packed = yaml_result_to_msgpack(yr);
+    msgpack_to_yaml_result(packed.data(), packed.size(), r);
+    CPPUNIT_ASSERT(!r.result);
+    CPPUNIT_ASSERT(r.key == "components");
+    CPPUNIT_ASSERT(r.err == "oops");
+    CPPUNIT_ASSERT(r.node["foocomponent"]["ID"].as<int>() == 0x1234);
+
+    // other msgpack types are taken as their YAML scalar text
+    msgpack::sbuffer buf;
+    msgpack::packer<msgpack::sbuffer> pk(&buf);
+    pk.pack_map(3);
+    pk.pack(string("count"));
+    pk.pack(-42);
+    pk.pack(string("ratio"));
+    pk.pack(0.5);
+    pk.pack(string("on"));
+    pk.pack(true);
+    n = msgpack_to_yaml(buf.data(), buf.size());
+    CPPUNIT_ASSERT(n["count"].as<int>() == -42);
+    CPPUNIT_ASSERT(n["ratio"].as<double>() == 0.5);
+    CPPUNIT_ASSERT(n["on"].as<bool>());
+}
+
+void UtilityTest::test_topic_registry()
+{
+    using namespace matrix;
+    string key;
+
+    // IDs depend only on the key, so are stable across calls and
+    // processes.
+    topic_id_t meow = TopicRegistry::intern("cat.meow");
+    CPPUNIT_ASSERT(meow == TopicRegistry::intern("cat.meow"));
+    CPPUNIT_ASSERT(meow == TopicRegistry::hash("cat.meow"));
+    CPPUNIT_ASSERT(meow != TopicRegistry::intern("cat.meowmix"));
+
+    CPPUNIT_ASSERT(TopicRegistry::lookup(meow, key));
+    CPPUNIT_ASSERT(key == "cat.meow");
+    CPPUNIT_ASSERT(TopicRegistry::key(meow) == "cat.meow");
+
+    // never interned
+    CPPUNIT_ASSERT(!TopicRegistry::lookup(TopicRegistry::hash("dog.woof"), key));
+    CPPUNIT_ASSERT(TopicRegistry::key(TopicRegistry::hash("dog.woof")).empty());
+}
+
+void UtilityTest::test_buffer_pool()
+{
+    using namespace matrix;
+    shared_ptr<BufferPool> pool = BufferPool::create(2);
+    const unsigned char *first;
+
+    {
+        shared_ptr<vector<unsigned char> > v = pool->get(1024);
+        first = v->data();
+        SharedBuffer buf(v);
+        v.reset();
+        CPPUNIT_ASSERT_EQUAL((size_t)1024, buf.size());
+        CPPUNIT_ASSERT_EQUAL((size_t)0, pool->free_buffers());
+    }
+
+    // the last reference is gone, so the storage is back in the pool,
+    // and is handed out again.
+    CPPUNIT_ASSERT_EQUAL((size_t)1, pool->free_buffers());
+    shared_ptr<vector<unsigned char> > v = pool->get(1024);
+    CPPUNIT_ASSERT(v->data() == first);
+    CPPUNIT_ASSERT_EQUAL((size_t)0, pool->free_buffers());
+
+    // outliving the pool is harmless.
+    pool.reset();
+    v.reset();
+}
+
+void UtilityTest::test_compiled_description()
+{
+    using namespace matrix;
+    struct sample
+    {
+        int32_t a;
+        double b;
+        int16_t c;
+    };
+
+    compiled_description cd(YAML::Load("fields: [[a, int32_t, 1], [b, double, 1], "
+                                       "[c, int16_t, 1, nolog]]"));
+
+    // same layout as the compiler's.
+    CPPUNIT_ASSERT_EQUAL(sizeof(sample), cd.size());
+    CPPUNIT_ASSERT_EQUAL((size_t)3, cd.num_fields());
+    CPPUNIT_ASSERT_EQUAL(offsetof(sample, b), cd[cd.field_id("b")].offset);
+    CPPUNIT_ASSERT_EQUAL(offsetof(sample, c), cd[cd.field_id("c")].offset);
+    CPPUNIT_ASSERT(cd[2].skip && !cd[0].skip);
+    CPPUNIT_ASSERT_THROW(cd.field_id("d"), MatrixException);
+    CPPUNIT_ASSERT_EQUAL((size_t)1, cd.columns(data_description::DOUBLE).size());
+    CPPUNIT_ASSERT(cd.columns(data_description::FLOAT).empty());
+
+    vector<GenericBuffer> bufs(4);
+    sample rows[4];
+
+    for (int i = 0; i < 4; ++i)
+    {
+        bufs[i].resize(cd.size());
+        buffer_view v(cd, bufs[i]);
+        v.set<int32_t>(0, i);
+        v.set<double>(1, i * 1.5);
+        v.set<int16_t>(2, -i);
+        memcpy(&rows[i], bufs[i].data(), sizeof(sample));
+        CPPUNIT_ASSERT(rows[i].a == i && rows[i].b == i * 1.5 && rows[i].c == -i);
+        CPPUNIT_ASSERT(v.get<double>(1) == i * 1.5);
+    }
+
+    double col[4];
+    int16_t scol[4];
+    cd.extract(1, bufs.data(), 4, col);
+    cd.extract(2, (unsigned char const *)rows, 4, scol);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        CPPUNIT_ASSERT(col[i] == i * 1.5);
+        CPPUNIT_ASSERT(scol[i] == -i);
+    }
+}
+
+void UtilityTest::test_capture_file()
+{
+    using namespace matrix;
+    string fname("/tmp/utility_test_capture.mxc");
+    vector<string> payload;
+
+    // odd sizes, so that the records need padding.
+    for (int i = 0; i < 10; ++i)
+    {
+        payload.push_back(string(i + 1, 'a' + i));
+    }
+
+    {
+        CaptureWriter w(fname, FileRecorder::options(), 4);
+        CPPUNIT_ASSERT(w.open("fields: [[a, int32_t, 1]]"));
+
+        for (int i = 0; i < 10; ++i)
+        {
+            w.add(1000 + i * 100, i % 2 ? "b.data" : "a.data",
+                  payload[i].data(), payload[i].size());
+
+            if (i == 4)
+            {
+                CPPUNIT_ASSERT(w.flush());
+            }
+        }
+
+        CPPUNIT_ASSERT(w.close());
+    }
+
+    CaptureReader r(fname);
+    CaptureReader::message m;
+
+    CPPUNIT_ASSERT(r.open());
+    CPPUNIT_ASSERT(r.indexed());
+    CPPUNIT_ASSERT_EQUAL((size_t)10, r.num_messages());
+    CPPUNIT_ASSERT(r.first_time() == 1000 && r.last_time() == 1900);
+    CPPUNIT_ASSERT(r.description() == "fields: [[a, int32_t, 1]]");
+
+    for (int i = 0; i < 10; ++i)
+    {
+        CPPUNIT_ASSERT(r.next(m));
+        CPPUNIT_ASSERT(m.time == (Time::Time_t)(1000 + i * 100));
+        CPPUNIT_ASSERT(r.key(m.topic) == (i % 2 ? "b.data" : "a.data"));
+        CPPUNIT_ASSERT(string((char const *)m.data, m.size) == payload[i]);
+    }
+
+    CPPUNIT_ASSERT(!r.next(m));
+
+    // seek to the first message at or after the time, whether or not
+    // it is in the index.
+    r.seek(1450);
+    CPPUNIT_ASSERT(r.next(m) && m.time == 1500);
+    r.seek(1800);
+    CPPUNIT_ASSERT(r.next(m) && m.time == 1800);
+    r.seek(0);
+    CPPUNIT_ASSERT(r.next(m) && m.time == 1000);
+    r.seek(2000);
+    CPPUNIT_ASSERT(!r.next(m));
+    r.close();
+
+    // A damaged file must not be read past its end.
+    capture::trailer t, good;
+    capture::index_entry ix;
+    capture::record_header h;
+    fstream f(fname.c_str(), ios::in | ios::out | ios::binary);
+
+    f.seekg(-(streamoff)sizeof(t), ios::end);
+    f.read((char *)&good, sizeof(good));
+    CPPUNIT_ASSERT(f && good.num_index == 3);
+
+    // keys after the index: the trailer is ignored and the records
+    // scanned instead.
+    t = good;
+    t.num_keys = 0;
+    t.keys_offset = t.index_offset + sizeof(ix);
+    f.seekp(-(streamoff)sizeof(t), ios::end);
+    f.write((char const *)&t, sizeof(t));
+    f.flush();
+    CPPUNIT_ASSERT(r.open());
+    CPPUNIT_ASSERT(!r.indexed());
+    CPPUNIT_ASSERT(r.next(m) && m.time == 1000);
+    r.close();
+
+    // the size of the 9th message reaching past the keys.
+    f.seekp(-(streamoff)sizeof(t), ios::end);
+    f.write((char const *)&good, sizeof(good));
+    f.seekg(good.index_offset + 2 * sizeof(ix));
+    f.read((char *)&ix, sizeof(ix));
+    f.seekg(ix.offset);
+    f.read((char *)&h, sizeof(h));
+    CPPUNIT_ASSERT(f && h.time == 1800);
+    h.size = good.keys_offset - ix.offset;
+    f.seekp(ix.offset);
+    f.write((char const *)&h, sizeof(h));
+    f.close();
+
+    CPPUNIT_ASSERT(r.open());
+    CPPUNIT_ASSERT(r.indexed());
+
+    for (int i = 0; i < 8; ++i)
+    {
+        CPPUNIT_ASSERT(r.next(m));
+    }
+
+    CPPUNIT_ASSERT(r.error().empty());
+    CPPUNIT_ASSERT(!r.next(m));
+    CPPUNIT_ASSERT(!r.error().empty());
+    r.seek(1850);
+    CPPUNIT_ASSERT(!r.next(m));
+
+    r.close();
+    unlink(fname.c_str());
+}
+
+void UtilityTest::test_capture_rebuild()
+{
+    using namespace matrix;
+    string fname("/tmp/utility_test_rebuild.mxc");
+    vector<int32_t> vals(600);
+    struct stat st;
+
+    // A capture whose recorder stopped before closing it: it has no
+    // keys, seek index or trailer.
+    {
+        CaptureWriter w(fname);
+        CPPUNIT_ASSERT(w.open());
+
+        for (int i = 0; i < 600; ++i)
+        {
+            vals[i] = i;
+            w.add(i * 1000, "a.data", &vals[i], sizeof(int32_t));
+        }
+
+        CPPUNIT_ASSERT(w.flush());
+    }
+
+    CPPUNIT_ASSERT(stat(fname.c_str(), &st) == 0);
+
+    // zeros after the last record, as of space reserved but never
+    // written, are not records.
+    CPPUNIT_ASSERT(truncate(fname.c_str(), st.st_size + 4096) == 0);
+
+    CaptureReader r(fname);
+    CaptureReader::message m;
+
+    CPPUNIT_ASSERT(r.open());
+    CPPUNIT_ASSERT(!r.indexed());
+    CPPUNIT_ASSERT_EQUAL((size_t)600, r.num_messages());
+    CPPUNIT_ASSERT(r.last_time() == 599000);
+
+    r.seek(300500);
+    CPPUNIT_ASSERT(r.next(m));
+    CPPUNIT_ASSERT(m.time == 301000 && *(int32_t const *)m.data == 301);
+    CPPUNIT_ASSERT(r.key(m.topic) == "a.data");
+    r.close();
+
+    // an incomplete last record is dropped.
+    CPPUNIT_ASSERT(truncate(fname.c_str(), st.st_size - 6) == 0);
+    CPPUNIT_ASSERT(r.open());
+    CPPUNIT_ASSERT_EQUAL((size_t)599, r.num_messages());
+    CPPUNIT_ASSERT(r.last_time() == 598000);
+
+    r.seek(598000);
+    CPPUNIT_ASSERT(r.next(m) && *(int32_t const *)m.data == 598);
+    CPPUNIT_ASSERT(!r.next(m));
+
+    r.close();
+    unlink(fname.c_str());
+}
+
+static string read_file(string fname)
+{
+    ifstream f(fname.c_str(), ios::binary);
+    return string(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+}
+
+void UtilityTest::test_file_recorder()
+{
+    // In the working directory: /tmp may be a tmpfs, which refuses
+    // O_DIRECT.
+    string fname("utility_test_recorder.dat");
+    vector<string> blocks;
+    vector<struct iovec> iov;
+    string expected;
+
+    for (int i = 0; i < 50; ++i)
+    {
+        blocks.push_back(string(1000 + i * 37, 'a' + i % 26));
+        expected += blocks.back();
+    }
+
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        struct iovec v = {(void *)blocks[i].data(), blocks[i].size()};
+        iov.push_back(v);
+    }
+
+    expected += "tail";
+
+    // buffered, then direct through a staging buffer that fills
+    // several times and leaves an unaligned remainder.
+    for (int direct = 0; direct < 2; ++direct)
+    {
+        FileRecorder::options opts;
+        struct stat st;
+
+        opts.direct = direct;
+        opts.staging_bytes = 16384;
+
+        FileRecorder r(fname, opts);
+        CPPUNIT_ASSERT(r.open());
+        CPPUNIT_ASSERT(r.current_file() == fname);
+        CPPUNIT_ASSERT(r.write(iov.data(), iov.size()));
+        CPPUNIT_ASSERT(r.write("tail", 4));
+
+        // a sync leaves all the data on disk, staged remainder
+        // included, and no more; writing carries on after it.
+        CPPUNIT_ASSERT(r.sync());
+        CPPUNIT_ASSERT(read_file(fname) == expected);
+        CPPUNIT_ASSERT(r.write(blocks[0].data(), blocks[0].size()));
+        CPPUNIT_ASSERT(r.close());
+        CPPUNIT_ASSERT_EQUAL(expected.size() + blocks[0].size(), r.bytes_written());
+        CPPUNIT_ASSERT(read_file(fname) == expected + blocks[0]);
+
+        // the space reserved by default, far more than was written,
+        // was released on closing.
+        CPPUNIT_ASSERT(stat(fname.c_str(), &st) == 0);
+        CPPUNIT_ASSERT((size_t)st.st_blocks * 512 < expected.size() + (1 << 20));
+    }
+
+    unlink(fname.c_str());
+}
+
+void UtilityTest::test_file_recorder_rotation()
+{
+    string fname("utility_test_rotation.dat");
+    FileRecorder::options opts;
+    string batch[6];
+
+    opts.rotate_bytes = 10000;
+    FileRecorder r(fname, opts);
+
+    CPPUNIT_ASSERT(r.open());
+    CPPUNIT_ASSERT(r.current_file() == fname + ".0");
+
+    // a file is rotated after the batch that takes it past
+    // rotate_bytes, never within one.
+    for (int i = 0; i < 6; ++i)
+    {
+        batch[i] = string(4000, 'a' + i);
+        CPPUNIT_ASSERT(r.write(batch[i].data(), batch[i].size()));
+    }
+
+    CPPUNIT_ASSERT(r.close());
+    CPPUNIT_ASSERT_EQUAL((size_t)24000, r.bytes_written());
+    CPPUNIT_ASSERT(read_file(fname + ".0") == batch[0] + batch[1] + batch[2]);
+    CPPUNIT_ASSERT(read_file(fname + ".1") == batch[3] + batch[4] + batch[5]);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        unlink((fname + "." + to_string(i)).c_str());
+    }
+}
+
+// Opens FileDataSource's start and stop to the test.
+class TestFileDataSource : public FileDataSource
+{
+public:
+    TestFileDataSource(string name, string km_url) : FileDataSource(name, km_url) {}
+
+    bool start() { return _do_start(); }
+    bool stop() { return _do_stop(); }
+    bool reading() { return _read_thread.running(); }
+};
+
+void UtilityTest::test_file_data_source()
+{
+    string km_urn("inproc://file_data_source_tests.keymaster");
+    string fname("utility_test_replay.dat");
+    const size_t message_size = 1000, messages = 37;
+    string contents;
+
+    for (size_t i = 0; i < messages; ++i)
+    {
+        contents += string(message_size, 'a' + i % 26);
+    }
+
+    // not a whole number of messages; the rest is skipped.
+    contents += "tail";
+    ofstream(fname.c_str(), ios::binary) << contents;
+
+    YAML::Node config = YAML::Load(
+        "Keymaster:\n"
+        "  URLS:\n"
+        "    Initial: [" + km_urn + "]\n"
+        "  clone_interval: 1000\n"
+        "connections:\n"
+        "  default: []\n"
+        "components:\n"
+        "  replay:\n"
+        "    filename: " + fname + "\n"
+        "    message_size: 1000\n"
+        "    loops: 2\n"
+        "    max_speed: true\n"
+        "    Transports:\n"
+        "      A:\n"
+        "        Specified: [rtinproc]\n"
+        "    Sources:\n"
+        "      block_data: A\n");
+    shared_ptr<matrix::KeymasterServer> kms(new matrix::KeymasterServer(config));
+    kms->run();
+    matrix::Keymaster km(km_urn);
+
+    // two passes over the file, at full speed. The sink blocks rather
+    // than drop anything.
+    {
+        TestFileDataSource source("replay", km_urn);
+        matrix::DataSink<matrix::GenericBuffer> sink(km_urn, 8, true);
+        matrix::GenericBuffer buf;
+        size_t received = 0, bytes = 0;
+
+        sink.connect("replay", "block_data");
+        CPPUNIT_ASSERT(source.start());
+
+        while (sink.timed_get(buf, 1000000000))
+        {
+            CPPUNIT_ASSERT(buf.size() == message_size);
+            CPPUNIT_ASSERT(buf.data()[0] == 'a' + received % messages % 26);
+            ++received;
+            bytes += buf.size();
+        }
+
+        CPPUNIT_ASSERT_EQUAL(2 * messages, received);
+        CPPUNIT_ASSERT_EQUAL(2 * messages * message_size, bytes);
+        CPPUNIT_ASSERT(source.stop());
+        sink.disconnect();
+    }
+
+    // endless, at full speed, with no one listening: a stop ends the
+    // replay promptly.
+    {
+        km.put("components.replay.loops", 0);
+        TestFileDataSource source("replay", km_urn);
+
+        CPPUNIT_ASSERT(source.start());
+        Time::thread_delay(50000000);
+        CPPUNIT_ASSERT(source.reading());
+
+        Time::Time_t t0 = Time::getUTC();
+        CPPUNIT_ASSERT(source.stop());
+        CPPUNIT_ASSERT(Time::getUTC() - t0 < Time::TM_ONE_SEC);
+        CPPUNIT_ASSERT(!source.reading());
+    }
+
+    // a file shorter than one message is refused.
+    {
+        ofstream(fname.c_str(), ios::binary | ios::trunc) << string(message_size - 1, 'x');
+        TestFileDataSource source("replay", km_urn);
+
+        CPPUNIT_ASSERT(!source.start());
+        CPPUNIT_ASSERT(!source.reading());
+    }
+
+    kms.reset();
+    unlink(fname.c_str());
+}
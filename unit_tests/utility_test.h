@@ -36,6 +36,16 @@ class UtilityTest : public CppUnit::TestCase
     CPPUNIT_TEST(test_get_yaml_node);
     CPPUNIT_TEST(test_put_yaml_node);
     CPPUNIT_TEST(test_delete_yaml_node);
+    CPPUNIT_TEST(test_yaml_index);
+    CPPUNIT_TEST(test_yaml_msgpack);
+    CPPUNIT_TEST(test_topic_registry);
+    CPPUNIT_TEST(test_buffer_pool);
+    CPPUNIT_TEST(test_compiled_description);
+    CPPUNIT_TEST(test_capture_file);
+    CPPUNIT_TEST(test_capture_rebuild);
+    CPPUNIT_TEST(test_file_recorder);
+    CPPUNIT_TEST(test_file_recorder_rotation);
+    CPPUNIT_TEST(test_file_data_source);
 
     CPPUNIT_TEST_SUITE_END();
 
@@ -43,6 +53,16 @@ public:
     void test_get_yaml_node();
     void test_put_yaml_node();
     void test_delete_yaml_node();
+    void test_yaml_index();
+    void test_yaml_msgpack();
+    void test_topic_registry();
+    void test_buffer_pool();
+    void test_compiled_description();
+    void test_capture_file();
+    void test_capture_rebuild();
+    void test_file_recorder();
+    void test_file_recorder_rotation();
+    void test_file_data_source();
 };
 
 #endif